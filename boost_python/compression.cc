@@ -105,54 +105,106 @@ std::vector<char> dxtbx::boost_python::cbf_compress(const int *values,
   return packed;
 }
 
-void dxtbx::boost_python::cbf_decompress(const char *packed,
-                                         std::size_t packed_sz,
-                                         int *values) {
-  int current = 0;
-  unsigned int j = 0;
-  short s;
-  char c;
-  int i;
-  bool le = little_endian();
+namespace {
+
+  /**
+   * Decode a CBF byte offset compressed buffer, passing each pixel value in
+   * turn to the sink
+   */
+  template <typename Sink>
+  void byte_offset_decode(const char *packed, std::size_t packed_sz, Sink &sink) {
+    int current = 0;
+    unsigned int j = 0;
+    short s;
+    char c;
+    int i;
+    bool le = little_endian();
+
+    while (j < packed_sz) {
+      c = packed[j];
+      j += 1;
+
+      if (c != -128) {
+        current += c;
+        sink(current);
+        continue;
+      }
 
-  while (j < packed_sz) {
-    c = packed[j];
-    j += 1;
+      ((union_short *)&s)[0].b[0] = packed[j];
+      ((union_short *)&s)[0].b[1] = packed[j + 1];
+      j += 2;
 
-    if (c != -128) {
-      current += c;
-      *values = current;
-      values++;
-      continue;
-    }
+      if (!le) {
+        byte_swap_short((char *)&s);
+      }
 
-    ((union_short *)&s)[0].b[0] = packed[j];
-    ((union_short *)&s)[0].b[1] = packed[j + 1];
-    j += 2;
+      if (s != -32768) {
+        current += s;
+        sink(current);
+        continue;
+      }
 
-    if (!le) {
-      byte_swap_short((char *)&s);
+      ((union_int *)&i)[0].b[0] = packed[j];
+      ((union_int *)&i)[0].b[1] = packed[j + 1];
+      ((union_int *)&i)[0].b[2] = packed[j + 2];
+      ((union_int *)&i)[0].b[3] = packed[j + 3];
+      j += 4;
+
+      if (!le) {
+        byte_swap_int((char *)&i);
+      }
+
+      current += i;
+      sink(current);
     }
+  }
+
+  /**
+   * Write every pixel to a dense array
+   */
+  struct DenseSink {
+    int *values;
 
-    if (s != -32768) {
-      current += s;
-      *values = current;
+    void operator()(int value) {
+      *values = value;
       values++;
-      continue;
     }
+  };
+
+  /**
+   * Keep the index and value of the non-zero pixels
+   */
+  struct SparseSink {
+    std::size_t index;
+    std::size_t n_pixels;
+    std::vector<std::size_t> *indices;
+    std::vector<int> *values;
+
+    void operator()(int value) {
+      if (value != 0 && index < n_pixels) {
+        indices->push_back(index);
+        values->push_back(value);
+      }
+      index++;
+    }
+  };
 
-    ((union_int *)&i)[0].b[0] = packed[j];
-    ((union_int *)&i)[0].b[1] = packed[j + 1];
-    ((union_int *)&i)[0].b[2] = packed[j + 2];
-    ((union_int *)&i)[0].b[3] = packed[j + 3];
-    j += 4;
+}  // namespace
 
-    if (!le) {
-      byte_swap_int((char *)&i);
-    }
+void dxtbx::boost_python::cbf_decompress(const char *packed,
+                                         std::size_t packed_sz,
+                                         int *values) {
+  DenseSink sink = {values};
+  byte_offset_decode(packed, packed_sz, sink);
+}
 
-    current += i;
-    *values = current;
-    values++;
-  }
+std::size_t dxtbx::boost_python::cbf_decompress_sparse(
+  const char *packed,
+  std::size_t packed_sz,
+  std::size_t n_pixels,
+  std::vector<std::size_t> &indices,
+  std::vector<int> &values) {
+  SparseSink sink = {0, n_pixels, &indices, &values};
+  byte_offset_decode(packed, packed_sz, sink);
+  return sink.index;
 }
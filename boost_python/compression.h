@@ -5,6 +5,11 @@
 
 namespace dxtbx { namespace boost_python {
   void cbf_decompress(const char*, std::size_t, int*);
+  std::size_t cbf_decompress_sparse(const char*,
+                                    std::size_t,
+                                    std::size_t,
+                                    std::vector<std::size_t>&,
+                                    std::vector<int>&);
   std::vector<char> cbf_compress(const int*, const std::size_t&);
 }}  // namespace dxtbx::boost_python
 
@@ -181,6 +181,23 @@ namespace dxtbx { namespace boost_python {
     return z;
   }
 
+  boost::python::tuple uncompress_sparse(const boost::python::object &packed,
+                                         const int &slow,
+                                         const int &fast) {
+    std::string strpacked = boost::python::extract<std::string>(packed);
+    std::size_t n_pixels = slow * fast;
+
+    std::vector<std::size_t> indices;
+    std::vector<int> values;
+    std::size_t n_decoded = dxtbx::boost_python::cbf_decompress_sparse(
+      strpacked.c_str(), strpacked.size(), n_pixels, indices, values);
+    DXTBX_ASSERT(n_decoded <= n_pixels);
+
+    return boost::python::make_tuple(
+      scitbx::af::shared<std::size_t>(indices.begin(), indices.end()),
+      scitbx::af::shared<int>(values.begin(), values.end()));
+  }
+
   PyObject *compress(const scitbx::af::flex_int z) {
     const int *begin = z.begin();
     std::size_t sz = z.size();
@@ -202,6 +219,9 @@ namespace dxtbx { namespace boost_python {
     def("read_float32", read_float32, (arg("file"), arg("count")));
     def("is_big_endian", is_big_endian);
     def("uncompress", &uncompress, (arg_("packed"), arg_("slow"), arg_("fast")));
+    def("uncompress_sparse",
+        &uncompress_sparse,
+        (arg_("packed"), arg_("slow"), arg_("fast")));
     def("compress", &compress);
   }
 
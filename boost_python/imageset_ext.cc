@@ -215,7 +215,10 @@ namespace dxtbx { namespace boost_python {
                                        obj.get_template(),
                                        obj.get_vendor(),
                                        detail::bytes_from_std_string(obj.get_params()),
-                                       detail::bytes_from_std_string(obj.get_format()));
+                                       detail::bytes_from_std_string(obj.get_format()),
+                                       boost::python::make_tuple(obj.model_provider(),
+                                                                 obj.model_batch_size(),
+                                                                 obj.models_loaded()));
     }
 
     template <typename Model, typename Func>
@@ -305,7 +308,7 @@ namespace dxtbx { namespace boost_python {
     }
 
     static void setstate(ImageSetData &obj, boost::python::tuple state) {
-      DXTBX_ASSERT(boost::python::len(state) == 6);
+      DXTBX_ASSERT(boost::python::len(state) == 6 || boost::python::len(state) == 7);
 
       // Set the models
       ImageSetDataPickleSuite::set_model_tuple(
@@ -320,6 +323,21 @@ namespace dxtbx { namespace boost_python {
       obj.set_vendor(boost::python::extract<std::string>(state[3])());
       obj.set_params(boost::python::extract<std::string>(state[4])());
       obj.set_format(boost::python::extract<std::string>(state[5])());
+
+      // Set the model provider and the images it has read the models of
+      if (boost::python::len(state) == 7) {
+        boost::python::tuple provider =
+          boost::python::extract<boost::python::tuple>(state[6])();
+        DXTBX_ASSERT(boost::python::len(provider) == 3);
+        boost::python::object model_provider = provider[0];
+        if (!model_provider.is_none()) {
+          obj.set_model_provider(model_provider,
+                                 boost::python::extract<std::size_t>(provider[1])());
+          obj.set_models_loaded(
+            boost::python::extract<scitbx::af::shared<bool> >(provider[2])()
+              .const_ref());
+        }
+      }
     }
   };
 
@@ -355,6 +373,15 @@ namespace dxtbx { namespace boost_python {
     }
   };
 
+  /**
+   * Implement pickling for SummedImageSequence class
+   */
+  struct SummedImageSequencePickleSuite : boost::python::pickle_suite {
+    static boost::python::tuple getinitargs(SummedImageSequence obj) {
+      return boost::python::make_tuple(obj.sequence(), obj.get_block_size());
+    }
+  };
+
   /**
    * Get the external lookup data as a tuple of images
    */
@@ -431,9 +458,74 @@ namespace dxtbx { namespace boost_python {
     return boost::python::tuple(result);
   }
 
+  /**
+   * Copy a buffer out of the reading thread's cache, so that the Python result
+   * shares no array with a cache changed later without the GIL. Only needed
+   * when the imageset reads without the GIL, that is with more than one thread.
+   */
+  ImageBuffer unshared_buffer(const ImageBuffer &buffer) {
+    if (buffer.is_int()) {
+      return ImageBuffer(dxtbx::detail::deep_copy(buffer.as_int()));
+    } else if (buffer.is_double()) {
+      return ImageBuffer(dxtbx::detail::deep_copy(buffer.as_double()));
+    } else if (buffer.is_float()) {
+      return ImageBuffer(dxtbx::detail::deep_copy(buffer.as_float()));
+    }
+    return buffer;
+  }
+
   boost::python::tuple ImageSet_get_raw_data(ImageSet &self, std::size_t index) {
     boost::python::tuple result;
-    ImageBuffer buffer = self.get_raw_data(index);
+    ImageBuffer buffer;
+    if (self.num_threads() > 1) {
+      ImageSet::thread_cache_ptr pin = self.pin_thread_cache();
+      dxtbx::detail::gil_release nogil;
+      buffer = unshared_buffer(self.get_raw_data(index).dense());
+    } else {
+      buffer = self.get_raw_data(index).dense();
+    }
+    if (buffer.is_int()) {
+      result = image_as_tuple<int>(buffer.as_int());
+    } else if (buffer.is_double()) {
+      result = image_as_tuple<double>(buffer.as_double());
+    } else if (buffer.is_float()) {
+      result = image_as_tuple<float>(buffer.as_float());
+    } else {
+      throw DXTBX_ERROR("Problem reading raw data");
+    }
+    return result;
+  }
+
+  boost::python::tuple ImageSet_get_raw_data_for_panels(
+    ImageSet &self,
+    std::size_t index,
+    const scitbx::af::const_ref<std::size_t> &panels) {
+    boost::python::tuple result;
+    ImageBuffer buffer;
+    if (self.num_threads() > 1) {
+      ImageSet::thread_cache_ptr pin = self.pin_thread_cache();
+      dxtbx::detail::gil_release nogil;
+      buffer = unshared_buffer(self.get_raw_data_for_panels(index, panels).dense());
+    } else {
+      buffer = self.get_raw_data_for_panels(index, panels).dense();
+    }
+    if (buffer.is_int()) {
+      result = image_as_tuple<int>(buffer.as_int());
+    } else if (buffer.is_double()) {
+      result = image_as_tuple<double>(buffer.as_double());
+    } else if (buffer.is_float()) {
+      result = image_as_tuple<float>(buffer.as_float());
+    } else {
+      throw DXTBX_ERROR("Problem reading raw data");
+    }
+    return result;
+  }
+
+  boost::python::tuple ImageSet_get_binned_raw_data(ImageSet &self,
+                                                    std::size_t index,
+                                                    std::size_t bin_size) {
+    boost::python::tuple result;
+    ImageBuffer buffer = self.get_binned_raw_data(index, bin_size);
     if (buffer.is_int()) {
       result = image_as_tuple<int>(buffer.as_int());
     } else if (buffer.is_double()) {
@@ -446,8 +538,115 @@ namespace dxtbx { namespace boost_python {
     return result;
   }
 
-  boost::python::tuple ImageSet_get_corrected_data(ImageSet &self, std::size_t index) {
-    return image_as_tuple<double>(self.get_corrected_data(index));
+  boost::python::tuple ImageSet_get_binned_mask(ImageSet &self,
+                                                std::size_t index,
+                                                std::size_t bin_size) {
+    return image_as_tuple<bool>(self.get_binned_mask(index, bin_size));
+  }
+
+  template <typename T>
+  Image<T> image_from_tuple(boost::python::tuple data) {
+    typedef typename scitbx::af::flex<T>::type flex_type;
+    Image<T> result;
+    for (std::size_t i = 0; i < boost::python::len(data); ++i) {
+      flex_type a = boost::python::extract<flex_type>(data[i])();
+      DXTBX_ASSERT(a.accessor().all().size() == 2);
+      result.push_back(ImageTile<T>(scitbx::af::versa<T, scitbx::af::c_grid<2> >(
+        a.handle(), scitbx::af::c_grid<2>(a.accessor()))));
+    }
+    return result;
+  }
+
+  Image<bool> mask_from_object(boost::python::object mask) {
+    if (mask == boost::python::object()) {
+      return Image<bool>();
+    }
+    return image_from_tuple<bool>(boost::python::tuple(mask));
+  }
+
+  boost::shared_ptr<ImageAssembler> make_image_assembler(
+    const Detector &detector,
+    double pixel_size,
+    const std::string &interpolation) {
+    DXTBX_ASSERT(interpolation == "nearest" || interpolation == "bilinear");
+    return boost::make_shared<ImageAssembler>(
+      detector, pixel_size, interpolation == "bilinear");
+  }
+
+  ImageAssembler::array_type ImageAssembler_assemble(const ImageAssembler &self,
+                                                     boost::python::object data,
+                                                     boost::python::object mask,
+                                                     double gap_value,
+                                                     int num_threads) {
+    boost::python::tuple tiles(data);
+    Image<bool> m = mask_from_object(mask);
+    DXTBX_ASSERT(boost::python::len(tiles) > 0);
+    boost::python::object first = tiles[0];
+    if (boost::python::extract<scitbx::af::flex<int>::type>(first).check()) {
+      return self.assemble(image_from_tuple<int>(tiles), m, gap_value, num_threads);
+    } else if (boost::python::extract<scitbx::af::flex<float>::type>(first).check()) {
+      return self.assemble(image_from_tuple<float>(tiles), m, gap_value, num_threads);
+    }
+    return self.assemble(image_from_tuple<double>(tiles), m, gap_value, num_threads);
+  }
+
+  scitbx::af::versa<bool, scitbx::af::c_grid<2> > ImageAssembler_assemble_mask(
+    const ImageAssembler &self,
+    boost::python::object mask) {
+    return self.assemble_mask(image_from_tuple<bool>(boost::python::tuple(mask)));
+  }
+
+  scitbx::vec2<double> ImageAssembler_panel_to_image(const ImageAssembler &self,
+                                                     std::size_t panel,
+                                                     scitbx::vec2<double> xy) {
+    return self.panel_to_image(panel, xy);
+  }
+
+  format::ImagePyramid ImageSet_get_pyramid(ImageSet &self,
+                                            std::size_t index,
+                                            std::size_t num_levels,
+                                            const std::string &pooling) {
+    DXTBX_ASSERT(pooling == "max" || pooling == "mean");
+    return self.get_pyramid(index, num_levels, pooling == "max");
+  }
+
+  boost::python::tuple ImageSet_get_corrected_data(ImageSet &self,
+                                                   std::size_t index,
+                                                   bool solid_angle,
+                                                   bool polarization,
+                                                   bool obliquity) {
+    if (self.num_threads() == 1) {
+      return image_as_tuple<double>(
+        self.get_corrected_data(index, solid_angle, polarization, obliquity));
+    }
+    Image<double> data;
+    {
+      ImageSet::thread_cache_ptr pin = self.pin_thread_cache();
+      dxtbx::detail::gil_release nogil;
+      data = dxtbx::detail::deep_copy(
+        self.get_corrected_data(index, solid_angle, polarization, obliquity));
+    }
+    return image_as_tuple<double>(data);
+  }
+
+  boost::python::object ImageSet_get_raw_sparse_data(ImageSet &self,
+                                                     std::size_t index) {
+    ImageBuffer buffer = self.get_raw_data(index);
+    if (buffer.is_empty()) {
+      throw DXTBX_ERROR("Problem reading raw data");
+    } else if (buffer.is_int() || buffer.is_sparse_int()) {
+      return boost::python::object(buffer.as_sparse_int());
+    }
+    return boost::python::object(buffer.as_sparse_double());
+  }
+
+  boost::python::tuple ImageSet_get_geometric_correction(ImageSet &self,
+                                                         std::size_t index,
+                                                         bool solid_angle,
+                                                         bool polarization,
+                                                         bool obliquity) {
+    return image_as_tuple<double>(
+      self.get_geometric_correction(index, solid_angle, polarization, obliquity));
   }
 
   boost::python::tuple ImageSet_get_gain(ImageSet &self, std::size_t index) {
@@ -459,7 +658,20 @@ namespace dxtbx { namespace boost_python {
   }
 
   boost::python::tuple ImageSet_get_mask(ImageSet &self, std::size_t index) {
-    return image_as_tuple<bool>(self.get_mask(index));
+    if (self.num_threads() == 1) {
+      return image_as_tuple<bool>(self.get_mask(index));
+    }
+    Image<bool> mask;
+    {
+      ImageSet::thread_cache_ptr pin = self.pin_thread_cache();
+      dxtbx::detail::gil_release nogil;
+      mask = dxtbx::detail::deep_copy(self.get_mask(index));
+    }
+    return image_as_tuple<bool>(mask);
+  }
+
+  boost::python::tuple ImageSet_get_static_mask(ImageSet &self) {
+    return image_as_tuple<bool>(self.get_static_mask());
   }
 
   /**
@@ -602,6 +814,14 @@ namespace dxtbx { namespace boost_python {
       .def("set_detector", &ImageSetData::set_detector)
       .def("set_goniometer", &ImageSetData::set_goniometer)
       .def("set_scan", &ImageSetData::set_scan)
+      .def("set_model_provider",
+           &ImageSetData::set_model_provider,
+           (arg("provider"), arg("batch_size") = 16))
+      .def("model_provider", &ImageSetData::model_provider)
+      .def("has_model_provider", &ImageSetData::has_model_provider)
+      .def("load_models", &ImageSetData::load_models)
+      .def("set_shared_cache", &ImageSetData::set_shared_cache)
+      .def("shared_cache", &ImageSetData::shared_cache)
       .def("get_template", &ImageSetData::get_template)
       .def("set_template", &ImageSetData::set_template)
       .def("get_vendor", &ImageSetData::get_vendor)
@@ -615,21 +835,96 @@ namespace dxtbx { namespace boost_python {
         make_function(&ImageSetData::external_lookup, return_internal_reference<>()))
       .def_pickle(ImageSetDataPickleSuite());
 
+    class_<ImageAssembler, boost::shared_ptr<ImageAssembler> >("ImageAssembler",
+                                                               no_init)
+      .def("__init__",
+           make_constructor(&make_image_assembler,
+                            default_call_policies(),
+                            (arg("detector"),
+                             arg("pixel_size") = 0,
+                             arg("interpolation") = "nearest")))
+      .def("get_image_size", &ImageAssembler::get_image_size)
+      .def("get_pixel_size", &ImageAssembler::get_pixel_size)
+      .def("is_bilinear", &ImageAssembler::is_bilinear)
+      .def("num_covered", &ImageAssembler::num_covered)
+      .def("coverage", &ImageAssembler::coverage)
+      .def("panel_to_image",
+           &ImageAssembler_panel_to_image,
+           (arg("panel"), arg("xy")))
+      .def("assemble",
+           &ImageAssembler_assemble,
+           (arg("data"),
+            arg("mask") = boost::python::object(),
+            arg("gap_value") = 0,
+            arg("num_threads") = 1))
+      .def("assemble_mask", &ImageAssembler_assemble_mask, (arg("mask")));
+
     class_<ImageSet>("ImageSet", no_init)
       .def("__init__",
            make_constructor(&make_imageset,
                             default_call_policies(),
                             (arg("data"), arg("indices") = boost::python::object())))
       .def("data", &ImageSet::data)
+      .def("set_shared_cache", &ImageSet::set_shared_cache)
+      .def("shared_cache", &ImageSet::shared_cache)
+      .def("set_num_threads", &ImageSet::set_num_threads)
+      .def("num_threads", &ImageSet::num_threads)
       .def("indices", &ImageSet::indices)
       .def("size", &ImageSet::size)
       .def("__len__", &ImageSet::size)
       .def("has_dynamic_mask", &ImageSet::has_dynamic_mask)
       .def("get_raw_data", &ImageSet_get_raw_data)
-      .def("get_corrected_data", &ImageSet_get_corrected_data)
+      .def("get_raw_data_for_panels",
+           &ImageSet_get_raw_data_for_panels,
+           (arg("index"), arg("panels")))
+      .def("get_corrected_data",
+           &ImageSet_get_corrected_data,
+           (arg("index"),
+            arg("solid_angle") = false,
+            arg("polarization") = false,
+            arg("obliquity") = false))
+      .def("get_geometric_correction",
+           &ImageSet_get_geometric_correction,
+           (arg("index"),
+            arg("solid_angle") = true,
+            arg("polarization") = true,
+            arg("obliquity") = true))
       .def("get_gain", &ImageSet_get_gain)
       .def("get_pedestal", &ImageSet_get_pedestal)
       .def("get_mask", &ImageSet_get_mask)
+      .def("get_static_mask", &ImageSet_get_static_mask)
+      .def("get_raw_sparse_data", &ImageSet_get_raw_sparse_data, (arg("index")))
+      .def("get_corrected_sparse_data",
+           &ImageSet::get_corrected_sparse_data,
+           (arg("index"),
+            arg("solid_angle") = false,
+            arg("polarization") = false,
+            arg("obliquity") = false))
+      .def("get_binned_raw_data",
+           &ImageSet_get_binned_raw_data,
+           (arg("index"), arg("bin_size")))
+      .def("get_binned_mask",
+           &ImageSet_get_binned_mask,
+           (arg("index"), arg("bin_size")))
+      .def("get_pyramid",
+           &ImageSet_get_pyramid,
+           (arg("index"), arg("num_levels") = 4, arg("pooling") = "max"))
+      .def("get_assembled_data",
+           &ImageSet::get_assembled_data,
+           (arg("index"),
+            arg("assembler"),
+            arg("gap_value") = 0,
+            arg("num_threads") = 1))
+      .def("accumulate_histogram",
+           &ImageSet::accumulate_histogram,
+           (arg("histogram"),
+            arg("first"),
+            arg("last"),
+            arg("use_mask") = true,
+            arg("num_threads") = 1))
+      .def("accumulate_bad_pixels",
+           &ImageSet::accumulate_bad_pixels,
+           (arg("finder"), arg("first"), arg("last")))
       .def("get_beam", &ImageSet::get_beam_for_image, (arg("index") = 0))
       .def("get_detector", &ImageSet::get_detector_for_image, (arg("index") = 0))
       .def("get_goniometer", &ImageSet::get_goniometer_for_image, (arg("index") = 0))
@@ -702,6 +997,21 @@ namespace dxtbx { namespace boost_python {
       .def("partial_set", &ImageSequence::partial_sequence)
       .def("update_detector_px_mm_data", &ImageSequence_update_detector_px_mm_data)
       .def_pickle(ImageSequencePickleSuite());
+
+    class_<SummedImageSequence, bases<ImageSequence> >("SummedImageSequence", no_init)
+      .def(init<const ImageSequence &, std::size_t>(
+        (arg("sequence"), arg("block_size"))))
+      .def("sequence", &SummedImageSequence::sequence)
+      .def("get_block_size", &SummedImageSequence::get_block_size)
+      .def("set_beam", &SummedImageSequence::set_beam)
+      .def("set_detector", &SummedImageSequence::set_detector)
+      .def("set_goniometer", &SummedImageSequence::set_goniometer)
+      .def("set_scan", &SummedImageSequence::set_scan)
+      .def("as_imageset", &SummedImageSequence::as_imageset)
+      .def("complete_set", &SummedImageSequence::complete_sequence)
+      .def("partial_set", &SummedImageSequence::partial_sequence)
+      .def("clear_cache", &SummedImageSequence::clear_cache)
+      .def_pickle(SummedImageSequencePickleSuite());
   }
 
   BOOST_PYTHON_MODULE(dxtbx_imageset_ext) {
@@ -10,6 +10,7 @@ goniometers etc. from the headers and hence a format specific factory.
 import bz2
 import functools
 import os
+import threading
 from typing import ClassVar, List
 
 from six.moves.urllib_parse import urlparse
@@ -33,6 +34,10 @@ except ImportError:
 
 _cache_controller = dxtbx.filecache_controller.simple_controller()
 
+# The (filename, kwargs, instance) last returned by get_instance for each
+# (thread, class)
+_instances = {}
+
 
 def abstract(cls):
     """
@@ -57,6 +62,12 @@ class Reader(object):
         )
         return format_instance.get_raw_data()
 
+    def read_panels(self, index, panels):
+        format_instance = self.format_class.get_instance(
+            self._filenames[index], **self._kwargs
+        )
+        return format_instance.get_raw_data_for_panels(panels)
+
     def paths(self):
         return self._filenames
 
@@ -229,6 +240,19 @@ class Format(object):
         raw_data = image.get_raw_data()
         return raw_data
 
+    def get_raw_data_for_panels(self, panels, index=None):
+        """Get the pixel intensities for a subset of the detector panels.
+
+        Formats which can read individual panels should override this; the
+        default reads the whole image and selects the requested panels."""
+        if index is None:
+            raw_data = self.get_raw_data()
+        else:
+            raw_data = self.get_raw_data(index)
+        if not isinstance(raw_data, tuple):
+            raw_data = (raw_data,)
+        return tuple(raw_data[panel] for panel in panels)
+
     def get_vendortype(self):
         return "no dxtbx Format vendortype"
 
@@ -264,15 +288,31 @@ class Format(object):
 
     @classmethod
     def get_instance(Class, filename, **kwargs):
-        if (
-            not hasattr(Class, "_current_instance_")
-            or Class._current_filename_ != filename
-            or Class._current_kwargs_ != kwargs
-        ):
-            Class._current_instance_ = Class(filename, **kwargs)
-            Class._current_filename_ = filename
-            Class._current_kwargs_ = kwargs
-        return Class._current_instance_
+        """
+        Get an instance of the class for a file, reusing the last instance
+        returned to the calling thread if the file and arguments are the same.
+        Each thread has its own instance so that threads reading the same
+        imageset do not share file handles. The instances of threads which
+        have finished are dropped when a new instance is made.
+        """
+        # Native threads calling in get a dummy thread which stays alive
+        key = (threading.current_thread().ident, Class)
+        current = _instances.get(key)
+        if current is None or current[0] != filename or current[1] != kwargs:
+            alive = {thread.ident for thread in threading.enumerate()}
+            for other in list(_instances):
+                if other[0] not in alive:
+                    _instances.pop(other, None)
+            current = (filename, kwargs, Class(filename, **kwargs))
+            _instances[key] = current
+        return current[2]
+
+    @classmethod
+    def reset_instance(Class):
+        """Forget the instances of the class returned by get_instance"""
+        for key in list(_instances):
+            if key[1] is Class:
+                _instances.pop(key, None)
 
     @classmethod
     def get_reader(cls):
@@ -167,23 +167,45 @@ class FormatCBFMultiTile(FormatCBFFull):
 
     def get_raw_data(self):
         if self._raw_data is None:
-            self._raw_data = []
+            raw_data = self._read_panels(range(len(self.get_detector())))
+            if raw_data is None:
+                return None
+            self._raw_data = list(raw_data)
 
-            cbf = self._get_cbf_handle()
+        return tuple(self._raw_data)
+
+    def get_raw_data_for_panels(self, panels, index=None):
+        if self._raw_data is not None:
+            return tuple(self._raw_data[panel] for panel in panels)
+        return self._read_panels(panels)
 
-            # find the data
-            cbf.select_category(0)
-            while cbf.category_name().lower() != "array_data":
-                try:
-                    cbf.next_category()
-                except Exception:
-                    return None
-            cbf.select_column(0)
-            cbf.select_row(0)
+    def _read_panels(self, panels):
+        """Decode the binary sections of the requested panels only."""
+        if not panels:
+            return ()
+        cbf = self._get_cbf_handle()
 
-            d = self.get_detector()
+        # find the data
+        cbf.select_category(0)
+        while cbf.category_name().lower() != "array_data":
+            try:
+                cbf.next_category()
+            except Exception:
+                return None
+        cbf.select_column(0)
+        cbf.select_row(0)
+
+        d = self.get_detector()
+        assert all(0 <= panel < len(d) for panel in panels)
+        wanted = set(panels)
+        last = max(wanted)
+
+        raw_data = {}
+        for i, panel in enumerate(d):
+            if i > last:
+                break
 
-            for panel in d:
+            if i in wanted:
                 name = panel.get_name()
                 cbf.find_column(b"array_id")
                 assert name == cbf.get_value()
@@ -199,15 +221,15 @@ class FormatCBFMultiTile(FormatCBFFull):
 
                 image.reshape(flex.grid(*image_size))
 
-                self._raw_data.append(image)
+                raw_data[i] = image
 
-                try:
-                    cbf.next_row()
-                except Exception:
-                    break
-            assert len(d) == len(self._raw_data)
+            try:
+                cbf.next_row()
+            except Exception:
+                break
+        assert len(raw_data) == len(wanted)
 
-        return tuple(self._raw_data)
+        return tuple(raw_data[panel] for panel in panels)
 
 
 class FormatCBFMultiTileStill(FormatStill, FormatCBFMultiTile):
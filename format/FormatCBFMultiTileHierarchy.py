@@ -5,18 +5,16 @@ automatically, and builds a hierarchy if present
 
 from __future__ import absolute_import, division, print_function
 
-import collections
-import struct
 import sys
 from builtins import range
 
 import pycbf
 
 from libtbx.utils import Sorry
-from scitbx.array_family import flex
 from scitbx.matrix import col, sqr
 
 from dxtbx.format.FormatCBFMultiTile import FormatCBFMultiTile, FormatCBFMultiTileStill
+from dxtbx.format.image import cbf_read_arrays
 from dxtbx.model import Detector
 
 
@@ -325,92 +323,24 @@ class FormatCBFMultiTileHierarchy(FormatCBFMultiTile):
 
     def get_raw_data(self):
         if self._raw_data is None:
-            self._raw_data = []
-            cbf = self._get_cbf_handle()
-            cbf.find_category(b"array_structure")
-            cbf.find_column(b"encoding_type")
-            cbf.select_row(0)
-            types = []
-            for i in range(cbf.count_rows()):
-                types.append(cbf.get_value())
-                cbf.next_row()
-            assert len(types) == cbf.count_rows()
-
-            # read the data
-            data = collections.OrderedDict()
-            cbf.find_category(b"array_data")
-            for i in range(cbf.count_rows()):
-                cbf.find_column(b"array_id")
-                name = cbf.get_value()
-
-                cbf.find_column(b"data")
-                assert cbf.get_typeofvalue().find(b"bnry") > -1
-
-                if types[i] == b"signed 32-bit integer":
-                    array_string = cbf.get_integerarray_as_string()
-                    nelem = int(len(array_string) / 4)
-                    array = flex.int(struct.unpack("%di" % nelem, array_string))
-                    parameters = cbf.get_integerarrayparameters_wdims_fs()
-                    array_size = (parameters[11], parameters[10], parameters[9])
-                elif types[i] == b"signed 64-bit real IEEE":
-                    array_string = cbf.get_realarray_as_string()
-                    nelem = int(len(array_string) / 8)
-                    array = flex.double(struct.unpack("%dd" % nelem, array_string))
-                    parameters = cbf.get_realarrayparameters_wdims_fs()
-                    array_size = (parameters[7], parameters[6], parameters[5])
-                else:
-                    return None  # type not supported
-
-                array.reshape(flex.grid(*array_size))
-                data[name] = array
-                cbf.next_row()
-
-            # extract the data for each panel
-            if cbf.has_sections():
-                section_shapes = collections.OrderedDict()
-                for i in range(cbf.count_rows()):
-                    cbf.find_column(b"id")
-                    section_name = cbf.get_value()
-                    if section_name not in section_shapes:
-                        section_shapes[section_name] = {}
-                    cbf.find_column(b"array_id")
-                    if "array_id" not in section_shapes[section_name]:
-                        section_shapes[section_name]["array_id"] = cbf.get_value()
-                    else:
-                        assert (
-                            section_shapes[section_name]["array_id"] == cbf.get_value()
-                        )
-                    cbf.find_column(b"index")
-                    axis_index = int(cbf.get_value()) - 1
-                    cbf.find_column(b"start")
-                    axis_start = int(cbf.get_value()) - 1
-                    cbf.find_column(b"end")
-                    axis_end = int(cbf.get_value())
-
-                    section_shapes[section_name][axis_index] = slice(
-                        axis_start, axis_end
-                    )
-                    cbf.next_row()
-
-                for section_name in section_shapes:
-                    section_shape = section_shapes[section_name]
-                    section = data[section_shape["array_id"]][
-                        section_shape[2], section_shape[1], section_shape[0]
-                    ]
-                    section.reshape(flex.grid(section.focus()[-2], section.focus()[-1]))
-                    self._raw_data.append(section)
-            else:
-                for key in data:
-                    data[key].reshape(
-                        flex.grid(data[key].focus()[-2], data[key].focus()[-1])
-                    )
-                    self._raw_data.append(data[key])
+            raw_data = cbf_read_arrays(self._get_cbf_handle())
+            if raw_data is None:
+                return None  # type not supported
+            self._raw_data = list(raw_data)
 
             d = self.get_detector()
             assert len(d) == len(self._raw_data)
 
         return tuple(self._raw_data)
 
+    def get_raw_data_for_panels(self, panels, index=None):
+        # Panels may be sections of arrays shared between panels, so the whole
+        # image is read and the panels are selected from it
+        raw_data = self.get_raw_data()
+        if raw_data is None:
+            return None
+        return tuple(raw_data[panel] for panel in panels)
+
 
 class FormatCBFMultiTileHierarchyStill(
     FormatCBFMultiTileStill, FormatCBFMultiTileHierarchy
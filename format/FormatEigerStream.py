@@ -1,6 +1,13 @@
 from __future__ import absolute_import, division, print_function
 
 import json
+import os
+import select
+import socket
+import stat
+import struct
+import threading
+from concurrent.futures import CancelledError, ThreadPoolExecutor
 
 import numpy as np
 
@@ -11,6 +18,7 @@ from dxtbx import IncorrectFormatError
 from dxtbx.format.Format import Format
 from dxtbx.format.FormatMultiImage import FormatMultiImage
 from dxtbx.format.FormatPilatusHelpers import get_vendortype_eiger
+from dxtbx.imageset import ImageSet, ImageSetData
 from dxtbx.model.beam import BeamFactory
 from dxtbx.model.detector import DetectorFactory
 from dxtbx.model.goniometer import GoniometerFactory
@@ -29,6 +37,309 @@ except (ImportError, ValueError):
 injected_data = {}
 
 
+def write_stream_message(stream, parts):
+    """
+    Write a multipart stream message as a part count followed by each part
+    prefixed by its length
+    """
+    stream.write(struct.pack("<I", len(parts)))
+    for part in parts:
+        if not isinstance(part, bytes):
+            part = part.encode()
+        stream.write(struct.pack("<Q", len(part)))
+        stream.write(part)
+
+
+def read_stream_message(stream):
+    """
+    Read a multipart stream message written by write_stream_message. Returns
+    None at the end of the stream.
+    """
+
+    def read_exactly(size):
+        data = b""
+        while len(data) < size:
+            chunk = stream.read(size - len(data))
+            if not chunk:
+                raise EOFError("Truncated stream message")
+            data += chunk
+        return data
+
+    count = stream.read(4)
+    if not count:
+        return None
+    if len(count) < 4:
+        count += read_exactly(4 - len(count))
+    parts = []
+    for i in range(struct.unpack("<I", count)[0]):
+        size = struct.unpack("<Q", read_exactly(8))[0]
+        parts.append(read_exactly(size))
+    return parts
+
+
+def decode_frame(data, info):
+    """
+    Decode an encoded frame given its streamfile_2 info
+    """
+    if info["encoding"] == "lz4<":
+        data = FormatEigerStream.readLZ4(
+            data, info["shape"], info["type"], info["size"]
+        )
+    elif info["encoding"] == "bs16-lz4<":
+        data = FormatEigerStream.readBS16LZ4(
+            data, info["shape"], info["type"], info["size"]
+        )
+    elif info["encoding"] == "bs32-lz4<":
+        data = FormatEigerStream.readBSLZ4(
+            data, info["shape"], info["type"], info["size"]
+        )
+    elif info["encoding"] == "<":
+        data = np.frombuffer(data, dtype=np.dtype(info["type"]))
+        data = data.reshape(info["shape"][::-1])
+    else:
+        raise IOError("encoding %s is not implemented" % info["encoding"])
+
+    data = np.array(data, ndmin=3)  # handle data, must be 3 dim
+    data = data.reshape(data.shape[1:3]).astype("int32")
+
+    if info["type"] == "uint16":
+        bad_sel = data == 2 ** 16 - 1
+        data[bad_sel] = -1
+
+    return flex.int(data)
+
+
+class _InterruptibleFile(object):
+    """
+    A file or named pipe opened for reading whose blocking reads can be
+    interrupted from another thread, after which they return end of file
+    """
+
+    def __init__(self, filename):
+        self._fd = os.open(filename, os.O_RDONLY)
+        self._wake_read, self._wake_write = os.pipe()
+
+    def read(self, size):
+        ready, _, _ = select.select([self._fd, self._wake_read], [], [])
+        if self._wake_read in ready:
+            return b""
+        return os.read(self._fd, size)
+
+    def interrupt(self):
+        os.write(self._wake_write, b"x")
+
+    def close(self):
+        for fd in (self._fd, self._wake_read, self._wake_write):
+            os.close(fd)
+
+
+class EigerStreamReceiver(object):
+    """
+    Receive the messages of an EIGER stream in a background thread. The
+    encoded frames are kept in a bounded ring buffer and decoded by a pool of
+    worker threads as they arrive, so frames can be read by index while the
+    stream is still being received. When the buffer is full the oldest frames
+    are dropped, and at most capacity frames wait to be decoded: beyond that
+    the receiver stops reading from the source until a decode finishes. The
+    source may be the path of a Unix socket, a named pipe or a file to replay,
+    or an open binary stream. A stream passed in is only closed after the
+    receiver stops, so the writer must end it for close() to return.
+    """
+
+    def __init__(self, source, capacity=100, nproc=4):
+        assert capacity > 0
+        self._socket = None
+        if not isinstance(source, str):
+            self._stream = source
+        elif stat.S_ISSOCK(os.stat(source).st_mode):
+            self._socket = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+            self._socket.connect(source)
+            self._stream = self._socket.makefile("rb")
+        else:
+            self._stream = _InterruptibleFile(source)
+        self._capacity = capacity
+        self._slots = [None] * capacity
+        self._pending = threading.Semaphore(capacity)
+        self._condition = threading.Condition()
+        self._executor = ThreadPoolExecutor(max_workers=nproc)
+        self._config = None
+        self._info = None
+        self._num_received = 0
+        self._finished = False
+        self._closing = False
+        self._error = None
+        self._thread = threading.Thread(target=self._receive)
+        self._thread.daemon = True
+        self._thread.start()
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *args):
+        self.close()
+
+    def close(self):
+        """
+        Stop receiving and release the stream
+        """
+        self._closing = True
+        if self._socket is not None:
+            self._socket.shutdown(socket.SHUT_RDWR)
+        elif isinstance(self._stream, _InterruptibleFile):
+            self._stream.interrupt()
+        self._thread.join()
+        self._stream.close()
+        if self._socket is not None:
+            self._socket.close()
+        for slot in self._slots:
+            if slot is not None:
+                slot[1].cancel()
+        self._executor.shutdown()
+
+    def _receive(self):
+        try:
+            while True:
+                parts = read_stream_message(self._stream)
+                if parts is None:
+                    break
+                htype = json.loads(parts[0])["htype"]
+                if htype.startswith("dheader"):
+                    with self._condition:
+                        self._config = json.loads(parts[1])
+                        self._condition.notify_all()
+                elif htype.startswith("dimage"):
+                    self._add_frame(parts)
+                elif htype.startswith("dseries_end"):
+                    break
+        except Exception as e:
+            if not self._closing:
+                self._error = e
+        finally:
+            with self._condition:
+                self._finished = True
+                self._condition.notify_all()
+
+    def _add_frame(self, parts):
+        index = json.loads(parts[0])["frame"]
+        info = json.loads(parts[1])
+
+        # Stop reading the source while too many frames wait to be decoded
+        while not self._pending.acquire(timeout=0.1):
+            if self._closing:
+                return
+        future = self._executor.submit(decode_frame, parts[2], info)
+        future.add_done_callback(lambda f: self._pending.release())
+        with self._condition:
+            if self._info is None:
+                self._info = info
+            slot = self._slots[index % self._capacity]
+            if slot is not None:
+                slot[1].cancel()
+            self._slots[index % self._capacity] = (index, future)
+            self._num_received += 1
+            self._condition.notify_all()
+
+    def _wait(self, predicate, timeout):
+        with self._condition:
+            self._condition.wait_for(
+                lambda: predicate() or self._finished, timeout=timeout
+            )
+            if self._error is not None:
+                raise self._error
+            return predicate()
+
+    def header(self, timeout=None):
+        """
+        Get the detector configuration and the info of the first frame,
+        waiting for them to arrive
+        """
+        if not self._wait(
+            lambda: self._config is not None and self._info is not None, timeout
+        ):
+            raise RuntimeError("No stream header received")
+        return {"configuration": self._config, "info": self._info}
+
+    def num_images(self, timeout=None):
+        """
+        Get the number of images in the series
+        """
+        config = self.header(timeout)["configuration"]
+        return config.get("nimages", 1) * config.get("ntrigger", 1)
+
+    def num_received(self):
+        """
+        Get the number of frames received so far
+        """
+        return self._num_received
+
+    def finished(self):
+        """
+        Has the end of the stream been reached
+        """
+        return self._finished
+
+    def read(self, index, timeout=None):
+        """
+        Get the decoded frame at index, waiting for it to arrive
+        """
+
+        def arrived():
+            slot = self._slots[index % self._capacity]
+            return slot is not None and slot[0] >= index
+
+        if not self._wait(arrived, timeout):
+            raise IndexError("Frame %d was not received" % index)
+        slot = self._slots[index % self._capacity]
+        if slot[0] != index:
+            raise IndexError("Frame %d is no longer in the buffer" % index)
+        try:
+            return slot[1].result()
+        except CancelledError:
+            # The frame was dropped from the buffer, or the receiver closed,
+            # after it was looked up
+            if self._closing:
+                raise RuntimeError("The stream receiver is closed")
+            raise IndexError("Frame %d is no longer in the buffer" % index)
+
+
+class EigerStreamReader(object):
+    """
+    An imageset reader for the frames of an EigerStreamReceiver
+    """
+
+    def __init__(self, receiver, models=None):
+        self._receiver = receiver
+        self._num_images = receiver.num_images()
+        self._models = models
+
+    def read(self, index):
+        return self._receiver.read(index)
+
+    def read_panels(self, index, panels):
+        data = self.read(index)
+        assert list(panels) == [0]
+        return data
+
+    def read_models(self, first, last):
+        """Read the (beam, detector, goniometer, scan) of each image in a range"""
+        return [self._models] * (last - first)
+
+    def paths(self):
+        return [""]
+
+    def identifiers(self):
+        return ["eiger-stream-%d" % index for index in range(len(self))]
+
+    def __len__(self):
+        return self._num_images
+
+    def is_single_file_reader(self):
+        return True
+
+    def master_path(self):
+        return ""
+
+
 class FormatEigerStream(FormatMultiImage, Format):
     """
     A format class to understand an EIGER stream
@@ -41,14 +352,16 @@ class FormatEigerStream(FormatMultiImage, Format):
     def get_num_images(*args):
         return 1
 
-    def __init__(self, image_file, **kwargs):
-        if not injected_data:
-            raise IncorrectFormatError(self, image_file)
+    def __init__(self, image_file, header=None, **kwargs):
+        if header is None:
+            if not injected_data:
+                raise IncorrectFormatError(self, image_file)
+            header = {
+                "configuration": json.loads(injected_data.get("header2", "")),
+                "info": json.loads(injected_data.get("streamfile_2", "")),
+            }
 
-        self.header = {
-            "configuration": json.loads(injected_data.get("header2", "")),
-            "info": json.loads(injected_data.get("streamfile_2", "")),
-        }
+        self.header = header
 
         self._goniometer_instance = None
         self._detector_instance = None
@@ -137,29 +450,30 @@ class FormatEigerStream(FormatMultiImage, Format):
         """
         Get the raw data from the image
         """
-        info = self.header["info"]
-        data = injected_data["streamfile_3"]
-        if info["encoding"] == "lz4<":
-            data = self.readLZ4(data, info["shape"], info["type"], info["size"])
-        elif info["encoding"] == "bs16-lz4<":
-            data = self.readBS16LZ4(data, info["shape"], info["type"], info["size"])
-        elif info["encoding"] == "bs32-lz4<":
-            data = self.readBSLZ4(data, info["shape"], info["type"], info["size"])
-        else:
-            raise IOError("encoding %s is not implemented" % info["encoding"])
-
-        data = np.array(data, ndmin=3)  # handle data, must be 3 dim
-        data = data.reshape(data.shape[1:3]).astype("int32")
+        return decode_frame(injected_data["streamfile_3"], self.header["info"])
 
-        print("Get raw data")
-
-        if info["type"] == "uint16":
-            bad_sel = data == 2 ** 16 - 1
-            data[bad_sel] = -1
-
-        return flex.int(data)
+    @classmethod
+    def get_stream_imageset(cls, receiver, timeout=None):
+        """
+        Get an imageset of the frames of an EigerStreamReceiver. The frames
+        are read from the receiver's buffer as they are accessed.
+        """
+        format_instance = cls("eiger-stream", header=receiver.header(timeout))
+        reader = EigerStreamReader(
+            receiver,
+            (
+                format_instance.get_beam(),
+                format_instance.get_detector(),
+                format_instance.get_goniometer(),
+                None,
+            ),
+        )
+        data = ImageSetData(reader, None)
+        data.set_model_provider(reader, batch_size=len(reader))
+        return ImageSet(data)
 
-    def readBSLZ4(self, data, shape, dtype, size):
+    @staticmethod
+    def readBSLZ4(data, shape, dtype, size):
         """
         Unpack bitshuffle-lz4 compressed frame and return np array image data
         """
@@ -172,7 +486,8 @@ class FormatEigerStream(FormatMultiImage, Format):
         )
         return imgData
 
-    def readBS16LZ4(self, data, shape, dtype, size):
+    @staticmethod
+    def readBS16LZ4(data, shape, dtype, size):
         """
         Unpack bitshuffle-lz4 compressed 16 bit frame and return np array image data
         """
@@ -180,7 +495,8 @@ class FormatEigerStream(FormatMultiImage, Format):
         blob = np.fromstring(data[12:], dtype=np.uint8)
         return bitshuffle.decompress_lz4(blob, shape[::-1], np.dtype(dtype))
 
-    def readLZ4(self, data, shape, dtype, size):
+    @staticmethod
+    def readLZ4(data, shape, dtype, size):
         """
         Unpack lz4 compressed frame and return np array image data
         """
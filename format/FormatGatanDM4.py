@@ -24,6 +24,7 @@ from dxtbx.ext import (
 )
 from dxtbx.format.Format import Format
 from dxtbx.format.FormatMultiImage import FormatMultiImage
+from dxtbx.format.image import FrameStackReader
 
 
 class FormatGatanDM4(FormatMultiImage, Format):
@@ -71,10 +72,24 @@ class FormatGatanDM4(FormatMultiImage, Format):
         23: ("rgba", 4),
     }
 
+    # Pixel types of the image data types read by the frame stack reader
+    _pixel_types = {
+        "h": "int16",
+        "f": "float32",
+        "B": "uint8",
+        "l": "int32",
+        "b": "int8",
+        "H": "uint16",
+        "I": "uint32",
+        "d": "float64",
+    }
+
     def __init__(self, image_file, **kwargs):
 
         if not self.understand(image_file):
             raise IncorrectFormatError(self, image_file)
+        self._frame_stack = None
+        self._frame_stack_checked = False
         FormatMultiImage.__init__(self, **kwargs)
         Format.__init__(self, image_file, **kwargs)
 
@@ -368,7 +383,33 @@ class FormatGatanDM4(FormatMultiImage, Format):
             image_range, exposure_times, oscillation, epochs, deg=True
         )
 
+    def get_frame_stack(self):
+        """Get a memory-mapped reader for all the frames. This is None if the
+        file is compressed, in which case the frames are read one at a time."""
+        if self._frame_stack_checked:
+            return self._frame_stack
+        self._frame_stack_checked = True
+        if self._image_file.endswith((".bz2", ".gz")):
+            return None
+
+        frame_bytes = self._image_num_elements * self._data_size
+        offsets = [self._data_offset + i * frame_bytes for i in range(self._num_images)]
+        try:
+            self._frame_stack = FrameStackReader(
+                self._image_file,
+                flex.size_t(offsets),
+                self._pixel_types[self._data_type],
+                (self._image_size[1], self._image_size[0]),
+                big_endian=self._byteord == ">",
+            )
+        except RuntimeError:
+            pass
+        return self._frame_stack
+
     def get_raw_data(self, index):
+        frame_stack = self.get_frame_stack()
+        if frame_stack is not None:
+            return frame_stack.read(index)
 
         # is this image a type we can read?
         assert self._data_type in ["h", "f", "B", "l", "b", "H", "I", "d"]
@@ -1,5 +1,6 @@
 from __future__ import absolute_import, division, print_function
 
+import functools
 import math
 import os
 import sys
@@ -13,8 +14,10 @@ from scitbx import matrix
 from scitbx.array_family import flex
 
 from dxtbx.format.FormatHDF5 import FormatHDF5
+from dxtbx.format.FormatMultiImage import Reader
 from dxtbx.format.FormatMultiImageLazy import FormatMultiImageLazy
 from dxtbx.format.FormatStill import FormatStill
+from dxtbx.format.image import ImageInt
 from dxtbx.model import ParallaxCorrectedPxMmStrategy
 from dxtbx.model.detector import Detector
 
@@ -28,6 +31,14 @@ from dxtbx.model.detector import Detector
 # 180724: update 'understand' to exclude Rayonix data
 
 
+class ImageReader(Reader):
+    """A reader returning the panels as views of the tiled frame"""
+
+    def read(self, index):
+        format_instance = self.format_class.get_instance(self._filename, **self.kwargs)
+        return format_instance.get_raw_image(index)
+
+
 class FormatHDF5SaclaMPCCD(FormatMultiImageLazy, FormatHDF5, FormatStill):
     """
     Class to handle multi-event HDF5 files from MPCCD
@@ -55,6 +66,7 @@ class FormatHDF5SaclaMPCCD(FormatMultiImageLazy, FormatHDF5, FormatStill):
 
     def __init__(self, image_file, index=0, reconst_mode=False, **kwargs):
         self._raw_data = None
+        self._raw_image = None
         self.index = index
         self.image_filename = image_file
         super(FormatHDF5SaclaMPCCD, self).__init__(image_file, **kwargs)
@@ -168,6 +180,7 @@ class FormatHDF5SaclaMPCCD(FormatMultiImageLazy, FormatHDF5, FormatStill):
         self.index = index
         self.tag = self._images[self.index]
         self._raw_data = None
+        self._raw_image = None
 
     def _detector(self, index=None):
         wavelength = self.get_beam(index).get_wavelength()
@@ -249,14 +262,20 @@ class FormatHDF5SaclaMPCCD(FormatMultiImageLazy, FormatHDF5, FormatStill):
 
         return tuple(tmp)
 
-    def get_raw_data(self, index=None):
+    @classmethod
+    def get_reader(cls):
+        return functools.partial(ImageReader, cls)
+
+    def get_raw_image(self, index=None):
+        """Get the raw data as an ImageInt. The panels are views of the tiled
+        frame so they are not copied out of it."""
         if index is not None and self.index != index:
             self.set_index(index)
 
-        if self._raw_data is None:
+        if self._raw_image is None:
 
             if self.RECONST_MODE:
-                self._raw_data = flex.int(self.reconst_image())
+                self._raw_image = ImageInt(flex.int(self.reconst_image()))
 
             else:
                 h5_handle = h5py.File(self.image_filename, "r")
@@ -266,7 +285,22 @@ class FormatHDF5SaclaMPCCD(FormatMultiImageLazy, FormatHDF5, FormatStill):
                 # this is 8192x512 (slow/fast) tiled image
                 h5_handle.close()
 
-                self._raw_data = self.split_panels(data)
+                frame = flex.int(np.ascontiguousarray(data, dtype=np.int32))
+                layout = [(i * 1024 * 512, 512, 1024, 512) for i in range(8)]
+                self._raw_image = ImageInt(frame, layout)
+
+        return self._raw_image
+
+    def get_raw_data(self, index=None):
+        if index is not None and self.index != index:
+            self.set_index(index)
+
+        if self._raw_data is None:
+            image = self.get_raw_image()
+            if self.RECONST_MODE:
+                self._raw_data = image.tile(0).data()
+            else:
+                self._raw_data = tuple(tile.data() for tile in image)
 
         return self._raw_data
 
@@ -41,13 +41,29 @@ class Reader(object):
             self._num_images = num_images
 
     def nullify_format_instance(self):
-        self.format_class._current_instance_ = None
-        self.format_class._current_filename_ = None
+        self.format_class.reset_instance()
 
     def read(self, index):
         format_instance = self.format_class.get_instance(self._filename, **self.kwargs)
         return format_instance.get_raw_data(index)
 
+    def read_panels(self, index, panels):
+        format_instance = self.format_class.get_instance(self._filename, **self.kwargs)
+        return format_instance.get_raw_data_for_panels(panels, index)
+
+    def read_models(self, first, last):
+        """Read the (beam, detector, goniometer, scan) of each image in a range"""
+        format_instance = self.format_class.get_instance(self._filename, **self.kwargs)
+        return [
+            (
+                format_instance.get_beam(index),
+                format_instance.get_detector(index),
+                format_instance.get_goniometer(index),
+                format_instance.get_scan(index),
+            )
+            for index in range(first, last)
+        ]
+
     def paths(self):
         return [self._filename]
 
@@ -55,7 +71,7 @@ class Reader(object):
         return self._num_images
 
     def copy(self, filenames, indices=None):
-        return Reader(self.format_class, filenames, indices)
+        return type(self)(self.format_class, filenames, indices, **self.kwargs)
 
     def identifiers(self):
         return ["%s-%d" % (self._filename, index) for index in range(len(self))]
@@ -224,16 +240,17 @@ class FormatMultiImage(Format):
             # Use imagesetlazy
             # Setup ImageSetLazy and just return it. No models are set.
             if lazy:
-                iset = ImageSetLazy(
-                    ImageSetData(
-                        reader=reader,
-                        masker=None,
-                        vendor=vendor,
-                        params=params,
-                        format=cls,
-                    ),
-                    indices=single_file_indices,
+                data = ImageSetData(
+                    reader=reader,
+                    masker=None,
+                    vendor=vendor,
+                    params=params,
+                    format=cls,
                 )
+                # Without a checked format instance the models are left unset
+                if format_instance is not None and hasattr(reader, "read_models"):
+                    data.set_model_provider(reader)
+                iset = ImageSetLazy(data, indices=single_file_indices)
                 _add_static_mask_to_iset(format_instance, iset)
                 return iset
             # Create the imageset
@@ -129,6 +129,11 @@ class FormatNexus(FormatHDF5):
     def get_raw_data(self, index):
         return self._raw_data[index]
 
+    def get_raw_data_for_panels(self, panels, index=None):
+        if hasattr(self._raw_data, "get_panels"):
+            return self._raw_data.get_panels(index, panels)
+        return super(FormatNexus, self).get_raw_data_for_panels(panels, index)
+
     def get_static_mask(self, index=None, goniometer=None):
         return MaskFactory(self.instrument.detectors, index).mask
 
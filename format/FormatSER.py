@@ -16,13 +16,29 @@ import dxtbx.ext
 from dxtbx import IncorrectFormatError
 from dxtbx.format.Format import Format
 from dxtbx.format.FormatMultiImage import FormatMultiImage
+from dxtbx.format.image import FrameStackReader
 
 
 class FormatSER(FormatMultiImage, Format):
+
+    # Pixel types of the SER DataType codes
+    _pixel_types = {
+        1: "uint8",
+        2: "uint16",
+        3: "uint32",
+        4: "int8",
+        5: "int16",
+        6: "int32",
+        7: "float32",
+        8: "float64",
+    }
+
     def __init__(self, image_file, **kwargs):
 
         if not self.understand(image_file):
             raise IncorrectFormatError(self, image_file)
+        self._frame_stack = None
+        self._frame_stack_checked = False
         FormatMultiImage.__init__(self, **kwargs)
         Format.__init__(self, image_file, **kwargs)
 
@@ -140,7 +156,50 @@ class FormatSER(FormatMultiImage, Format):
     def get_image_file(self, index=None):
         return Format.get_image_file(self)
 
+    def get_frame_stack(self):
+        """Get a memory-mapped reader for all the frames. This is None if the
+        file is compressed or the frames differ in type or size, in which case
+        the frames are read one at a time."""
+        if self._frame_stack_checked:
+            return self._frame_stack
+        self._frame_stack_checked = True
+        if self._image_file.endswith((".bz2", ".gz")):
+            return None
+
+        # Each frame has a 50 byte header with its calibration, type and size
+        offsets = []
+        frame_header = None
+        with FormatSER.open_file(self._image_file, "rb") as f:
+            for data_offset in self._header_dictionary["DataOffsetArray"][
+                : self.get_num_images()
+            ]:
+                f.seek(data_offset + 40)
+                header = struct.unpack("<HII", f.read(10))
+                if frame_header is None:
+                    frame_header = header
+                elif header != frame_header:
+                    return None
+                offsets.append(data_offset + 50)
+        if frame_header is None or frame_header[0] not in self._pixel_types:
+            return None
+
+        data_type, size_x, size_y = frame_header
+        try:
+            self._frame_stack = FrameStackReader(
+                self._image_file,
+                flex.size_t(offsets),
+                self._pixel_types[data_type],
+                (size_y, size_x),
+            )
+        except RuntimeError:
+            pass
+        return self._frame_stack
+
     def get_raw_data(self, index):
+        frame_stack = self.get_frame_stack()
+        if frame_stack is not None:
+            return frame_stack.read(index)
+
         data_offset = self._header_dictionary["DataOffsetArray"][index]
         with FormatSER.open_file(self._image_file, "rb") as f:
             f.seek(data_offset)
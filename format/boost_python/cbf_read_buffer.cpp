@@ -1,10 +1,14 @@
 
+#include <cstdlib>
 #include <memory>
+#include <string>
+#include <vector>
 
 #include <stdio.h>
 
 #include <boost/python.hpp>
 #include <boost/move/unique_ptr.hpp>
+#include <scitbx/array_family/flex_types.h>
 
 #include <cbf.h>
 
@@ -56,6 +60,258 @@ namespace dxtbx { namespace format { namespace boost_python {
     return data;
   }
 
+  /// Raise a python exception if a cbflib call failed
+  void check_cbf_error(int err, const char *call) {
+    if (err) {
+      PyErr_Format(PyExc_RuntimeError, "cbflib %s returned error %d", call, err);
+      py::throw_error_already_set();
+    }
+  }
+
+  /// Get the value of a column in the current row as a string
+  std::string get_cbf_value(cbf_handle_struct *cbf_handle, const char *column) {
+    const char *value = NULL;
+    check_cbf_error(cbf_find_column(cbf_handle, column), "find_column");
+    check_cbf_error(cbf_get_value(cbf_handle, &value), "get_value");
+    return value == NULL ? std::string() : std::string(value);
+  }
+
+  /// A decoded binary array with its (slow, mid, fast) dimensions
+  struct CBFArray {
+    std::string name;
+    bool is_real;
+    scitbx::af::flex_int int_data;
+    scitbx::af::flex_double real_data;
+    std::size_t dims[3];
+  };
+
+  /// A section of an array with the (start, end) of each of the
+  /// (fast, mid, slow) axes
+  struct CBFSection {
+    std::string name;
+    std::string array_id;
+    long start[3];
+    long end[3];
+  };
+
+  /// Copy a (mid, fast) section out of a (slow, mid, fast) array
+  template <typename FlexType>
+  py::object extract_cbf_section(const FlexType &data,
+                                 const std::size_t dims[3],
+                                 const CBFSection &section) {
+    for (std::size_t axis = 0; axis < 3; ++axis) {
+      std::size_t size = dims[2 - axis];
+      if (section.start[axis] < 0 || section.end[axis] < section.start[axis]
+          || section.end[axis] > (long)size) {
+        PyErr_Format(
+          PyExc_RuntimeError, "Section %s is out of range", section.name.c_str());
+        py::throw_error_already_set();
+      }
+    }
+    if (section.end[2] - section.start[2] != 1) {
+      PyErr_Format(
+        PyExc_RuntimeError, "Section %s is not two dimensional", section.name.c_str());
+      py::throw_error_already_set();
+    }
+    std::size_t ysize = section.end[1] - section.start[1];
+    std::size_t xsize = section.end[0] - section.start[0];
+    FlexType result(scitbx::af::flex_grid<>(ysize, xsize),
+                    scitbx::af::init_functor_null<typename FlexType::value_type>());
+    for (std::size_t j = 0; j < ysize; ++j) {
+      const typename FlexType::value_type *row =
+        &data[(section.start[2] * dims[1] + section.start[1] + j) * dims[2]
+              + section.start[0]];
+      std::copy(row, row + xsize, &result[j * xsize]);
+    }
+    return py::object(result);
+  }
+
+  /// Decode every binary array of a CBF and split them into the sections
+  /// given by array_structure_list_section if present. The arrays are decoded
+  /// straight into flex arrays with no intermediate python objects.
+  py::object cbf_read_arrays(py::object handle) {
+    cbf_handle_struct *cbf_handle =
+      reinterpret_cast<cbf_handle_struct *>(extract_swig_wrapped_pointer(handle.ptr()));
+    if (cbf_handle == NULL) {
+      PyErr_SetString(PyExc_ValueError, "handle must be a CBF handle object");
+      py::throw_error_already_set();
+    }
+
+    // Get the encoding type of each array
+    unsigned int num_rows = 0;
+    std::vector<std::string> types;
+    check_cbf_error(cbf_find_category(cbf_handle, "array_structure"), "find_category");
+    check_cbf_error(cbf_count_rows(cbf_handle, &num_rows), "count_rows");
+    for (unsigned int i = 0; i < num_rows; ++i) {
+      check_cbf_error(cbf_select_row(cbf_handle, i), "select_row");
+      types.push_back(get_cbf_value(cbf_handle, "encoding_type"));
+    }
+
+    // Decode the arrays
+    std::vector<CBFArray> arrays;
+    check_cbf_error(cbf_find_category(cbf_handle, "array_data"), "find_category");
+    check_cbf_error(cbf_count_rows(cbf_handle, &num_rows), "count_rows");
+    if (num_rows > types.size()) {
+      return py::object();
+    }
+    for (unsigned int i = 0; i < num_rows; ++i) {
+      CBFArray array;
+      unsigned int compression = 0;
+      int binary_id = 0;
+      std::size_t elsize = 0;
+      std::size_t elements = 0;
+      std::size_t elements_read = 0;
+      std::size_t padding = 0;
+      const char *byteorder = NULL;
+      check_cbf_error(cbf_select_row(cbf_handle, i), "select_row");
+      array.name = get_cbf_value(cbf_handle, "array_id");
+      check_cbf_error(cbf_find_column(cbf_handle, "data"), "find_column");
+      if (types[i] == "signed 32-bit integer") {
+        int elsigned = 0;
+        int elunsigned = 0;
+        int minelement = 0;
+        int maxelement = 0;
+        check_cbf_error(cbf_get_integerarrayparameters_wdims_fs(cbf_handle,
+                                                                &compression,
+                                                                &binary_id,
+                                                                &elsize,
+                                                                &elsigned,
+                                                                &elunsigned,
+                                                                &elements,
+                                                                &minelement,
+                                                                &maxelement,
+                                                                &byteorder,
+                                                                &array.dims[2],
+                                                                &array.dims[1],
+                                                                &array.dims[0],
+                                                                &padding),
+                        "get_integerarrayparameters_wdims_fs");
+        array.is_real = false;
+        array.int_data = scitbx::af::flex_int(
+          scitbx::af::flex_grid<>(elements), scitbx::af::init_functor_null<int>());
+        check_cbf_error(cbf_get_integerarray(cbf_handle,
+                                             &binary_id,
+                                             array.int_data.begin(),
+                                             sizeof(int),
+                                             1,
+                                             elements,
+                                             &elements_read),
+                        "get_integerarray");
+      } else if (types[i] == "signed 64-bit real IEEE") {
+        check_cbf_error(cbf_get_realarrayparameters_wdims_fs(cbf_handle,
+                                                             &compression,
+                                                             &binary_id,
+                                                             &elsize,
+                                                             &elements,
+                                                             &byteorder,
+                                                             &array.dims[2],
+                                                             &array.dims[1],
+                                                             &array.dims[0],
+                                                             &padding),
+                        "get_realarrayparameters_wdims_fs");
+        array.is_real = true;
+        array.real_data = scitbx::af::flex_double(
+          scitbx::af::flex_grid<>(elements), scitbx::af::init_functor_null<double>());
+        check_cbf_error(cbf_get_realarray(cbf_handle,
+                                          &binary_id,
+                                          array.real_data.begin(),
+                                          sizeof(double),
+                                          elements,
+                                          &elements_read),
+                        "get_realarray");
+      } else {
+        return py::object();  // type not supported
+      }
+      if (elements_read != elements
+          || elements != array.dims[0] * array.dims[1] * array.dims[2]) {
+        PyErr_Format(
+          PyExc_RuntimeError, "Array %s has the wrong size", array.name.c_str());
+        py::throw_error_already_set();
+      }
+      arrays.push_back(array);
+    }
+
+    // Read the sections in the order they first appear
+    std::vector<CBFSection> sections;
+    if (cbf_find_category(cbf_handle, "array_structure_list_section") == 0) {
+      check_cbf_error(cbf_count_rows(cbf_handle, &num_rows), "count_rows");
+      for (unsigned int i = 0; i < num_rows; ++i) {
+        check_cbf_error(cbf_select_row(cbf_handle, i), "select_row");
+        std::string name = get_cbf_value(cbf_handle, "id");
+        std::string array_id = get_cbf_value(cbf_handle, "array_id");
+        long index = std::atol(get_cbf_value(cbf_handle, "index").c_str()) - 1;
+        long start = std::atol(get_cbf_value(cbf_handle, "start").c_str()) - 1;
+        long end = std::atol(get_cbf_value(cbf_handle, "end").c_str());
+        if (index < 0 || index > 2) {
+          PyErr_Format(PyExc_RuntimeError, "Section %s has a bad index", name.c_str());
+          py::throw_error_already_set();
+        }
+        std::size_t j = 0;
+        while (j < sections.size() && sections[j].name != name) {
+          ++j;
+        }
+        if (j == sections.size()) {
+          CBFSection section;
+          section.name = name;
+          section.array_id = array_id;
+          for (std::size_t axis = 0; axis < 3; ++axis) {
+            section.start[axis] = -1;
+            section.end[axis] = -1;
+          }
+          sections.push_back(section);
+        } else if (sections[j].array_id != array_id) {
+          PyErr_Format(
+            PyExc_RuntimeError, "Section %s spans several arrays", name.c_str());
+          py::throw_error_already_set();
+        }
+        sections[j].start[index] = start;
+        sections[j].end[index] = end;
+      }
+    }
+
+    // Extract the data for each panel
+    py::list result;
+    if (sections.empty()) {
+      for (std::size_t i = 0; i < arrays.size(); ++i) {
+        CBFArray &array = arrays[i];
+        if (array.dims[0] != 1) {
+          PyErr_Format(
+            PyExc_RuntimeError, "Array %s is not two dimensional", array.name.c_str());
+          py::throw_error_already_set();
+        }
+        scitbx::af::flex_grid<> grid(array.dims[1], array.dims[2]);
+        if (array.is_real) {
+          array.real_data.resize(grid);
+          result.append(array.real_data);
+        } else {
+          array.int_data.resize(grid);
+          result.append(array.int_data);
+        }
+      }
+    } else {
+      for (std::size_t i = 0; i < sections.size(); ++i) {
+        std::size_t j = 0;
+        while (j < arrays.size() && arrays[j].name != sections[i].array_id) {
+          ++j;
+        }
+        if (j == arrays.size()) {
+          PyErr_Format(PyExc_RuntimeError,
+                       "Section %s refers to an unknown array",
+                       sections[i].name.c_str());
+          py::throw_error_already_set();
+        }
+        if (arrays[j].is_real) {
+          result.append(
+            extract_cbf_section(arrays[j].real_data, arrays[j].dims, sections[i]));
+        } else {
+          result.append(
+            extract_cbf_section(arrays[j].int_data, arrays[j].dims, sections[i]));
+        }
+      }
+    }
+    return py::tuple(result);
+  }
+
   /// Declare the cbf-reading classes
   void export_cbf_read_buffer() {
     using namespace boost::python;
@@ -68,5 +324,17 @@ namespace dxtbx { namespace format { namespace boost_python {
         "    handle (pycbf.cbf_handle_struct): The CBF handle object\n"
         "    data (bytes): The data buffer containing the CBF file\n"
         "    flags (int): The flags to pass to");
+
+    def("cbf_read_arrays",
+        cbf_read_arrays,
+        args("handle"),
+        "Decode all the binary arrays of a CBF file with CBFlib.\n\n"
+        "If the file has an array_structure_list_section category, the arrays\n"
+        "are split into its sections.\n\n"
+        "Args:\n"
+        "    handle (pycbf.cbf_handle_struct): The CBF handle object\n\n"
+        "Returns:\n"
+        "    A tuple of flex arrays, one for each array or section, or None if\n"
+        "    an array has an unsupported encoding type");
   }
 }}}  // namespace dxtbx::format::boost_python
@@ -17,6 +17,9 @@
 #include <scitbx/array_family/flex_types.h>
 #include <dxtbx/error.h>
 #include <dxtbx/format/image.h>
+#include <dxtbx/format/frame_stack.h>
+#include <dxtbx/format/pixel_histogram.h>
+#include <dxtbx/format/shared_frame_cache.h>
 #include <vector>
 #include <hdf5.h>
 
@@ -76,6 +79,24 @@ namespace dxtbx { namespace format { namespace boost_python {
         data.handle(), scitbx::af::c_grid<2>(data.accessor()))));
   }
 
+  template <typename T>
+  boost::shared_ptr<Image<T> > make_image_from_layout(
+    typename scitbx::af::flex<T>::type data,
+    boost::python::object layout) {
+    scitbx::af::shared<tile_layout_type> tile_layout;
+    for (std::size_t i = 0; i < boost::python::len(layout); ++i) {
+      boost::python::object item = layout[i];
+      DXTBX_ASSERT(boost::python::len(item) == 4);
+      tile_layout.push_back(
+        tile_layout_type(boost::python::extract<std::size_t>(item[0])(),
+                         boost::python::extract<std::size_t>(item[1])(),
+                         boost::python::extract<std::size_t>(item[2])(),
+                         boost::python::extract<std::size_t>(item[3])()));
+    }
+    return boost::make_shared<Image<T> >(scitbx::af::shared<T>(data.handle()),
+                                         tile_layout.const_ref());
+  }
+
   template <typename T>
   struct ImageTilePickleSuite : boost::python::pickle_suite {
     static boost::python::tuple getinitargs(ImageTile<T> obj) {
@@ -113,6 +134,8 @@ namespace dxtbx { namespace format { namespace boost_python {
       .def("name", &image_tile_type::name)
       .def("data", &image_tile_type::data)
       .def("empty", &image_tile_type::empty)
+      .def("is_view", &image_tile_type::is_view)
+      .def("is_contiguous", &image_tile_type::is_contiguous)
       .def_pickle(ImageTilePickleSuite<T>());
   }
 
@@ -125,6 +148,7 @@ namespace dxtbx { namespace format { namespace boost_python {
       .def(init<tile_type>())
       .def("__init__", make_constructor(&make_image_from_flex<T>))
       .def("__init__", make_constructor(&make_image_from_tuple<T>))
+      .def("__init__", make_constructor(&make_image_from_layout<T>))
       .def("__getitem__", &image_type::tile)
       .def("tile", &image_type::tile)
       .def("tile_names", &image_type::tile_names)
@@ -136,6 +160,331 @@ namespace dxtbx { namespace format { namespace boost_python {
       .def_pickle(ImagePickleSuite<T>());
   }
 
+  template <typename T>
+  boost::shared_ptr<SparseImageTile<T> > make_sparse_image_tile(
+    const scitbx::af::shared<std::size_t> &indices,
+    const scitbx::af::shared<T> &values,
+    boost::python::tuple shape,
+    const char *name) {
+    DXTBX_ASSERT(boost::python::len(shape) == 2);
+    return boost::make_shared<SparseImageTile<T> >(
+      scitbx::af::c_grid<2>(boost::python::extract<std::size_t>(shape[0])(),
+                            boost::python::extract<std::size_t>(shape[1])()),
+      indices,
+      values,
+      name);
+  }
+
+  template <typename T>
+  boost::shared_ptr<SparseImageTile<T> > make_sparse_image_tile_from_flex(
+    typename scitbx::af::flex<T>::type data) {
+    return boost::make_shared<SparseImageTile<T> >(*make_image_tile<T>(data));
+  }
+
+  template <typename T>
+  struct SparseImageTilePickleSuite : boost::python::pickle_suite {
+    static boost::python::tuple getinitargs(SparseImageTile<T> obj) {
+      return boost::python::make_tuple(
+        obj.indices(),
+        obj.values(),
+        boost::python::make_tuple(obj.accessor()[0], obj.accessor()[1]),
+        obj.name());
+    }
+  };
+
+  template <typename T>
+  struct SparseImagePickleSuite : boost::python::pickle_suite {
+    static boost::python::tuple getstate(const SparseImage<T> &obj) {
+      boost::python::list tile_list;
+      for (std::size_t i = 0; i < obj.n_tiles(); ++i) {
+        tile_list.append(obj.tile(i));
+      }
+      return boost::python::make_tuple(tile_list);
+    }
+
+    static void setstate(SparseImage<T> &obj, boost::python::tuple state) {
+      DXTBX_ASSERT(boost::python::len(state) == 1);
+      boost::python::list tile_list =
+        boost::python::extract<boost::python::list>(state[0])();
+      for (std::size_t i = 0; i < boost::python::len(tile_list); ++i) {
+        obj.push_back(boost::python::extract<SparseImageTile<T> >(tile_list[i])());
+      }
+    }
+  };
+
+  template <typename T>
+  void sparse_image_tile_wrapper(const char *name) {
+    typedef SparseImageTile<T> tile_type;
+
+    class_<tile_type, boost::shared_ptr<tile_type> >(name, no_init)
+      .def("__init__",
+           make_constructor(&make_sparse_image_tile<T>,
+                            default_call_policies(),
+                            (arg("indices"),
+                             arg("values"),
+                             arg("shape"),
+                             arg("name") = "")))
+      .def("__init__", make_constructor(&make_sparse_image_tile_from_flex<T>))
+      .def(init<ImageTile<T> >())
+      .def("name", &tile_type::name)
+      .def("data", &tile_type::data)
+      .def("indices", &tile_type::indices)
+      .def("values", &tile_type::values)
+      .def("num_pixels", &tile_type::num_pixels)
+      .def("empty", &tile_type::empty)
+      .def_pickle(SparseImageTilePickleSuite<T>());
+  }
+
+  template <typename T>
+  void sparse_image_wrapper(const char *name) {
+    typedef SparseImage<T> image_type;
+    typedef typename image_type::tile_type tile_type;
+
+    class_<image_type>(name)
+      .def(init<tile_type>())
+      .def(init<Image<T> >())
+      .def("__getitem__", &image_type::tile)
+      .def("tile", &image_type::tile)
+      .def("n_tiles", &image_type::n_tiles)
+      .def("num_pixels", &image_type::num_pixels)
+      .def("empty", &image_type::empty)
+      .def("dense", &image_type::dense)
+      .def("append", &image_type::push_back)
+      .def("__len__", &image_type::n_tiles)
+      .def("__iter__", range(&image_type::begin, &image_type::end))
+      .def_pickle(SparseImagePickleSuite<T>());
+  }
+
+  boost::shared_ptr<FrameStackReader> make_frame_stack_reader(
+    std::string filename,
+    const scitbx::af::const_ref<std::size_t> &offsets,
+    std::string dtype,
+    boost::python::tuple shape,
+    bool big_endian) {
+    DXTBX_ASSERT(boost::python::len(shape) == 2);
+    return boost::make_shared<FrameStackReader>(
+      filename,
+      offsets,
+      dtype,
+      big_endian,
+      boost::python::extract<std::size_t>(shape[0])(),
+      boost::python::extract<std::size_t>(shape[1])());
+  }
+
+  template <typename T>
+  boost::python::object frame_stack_as_flex(
+    const scitbx::af::versa<T, scitbx::af::c_grid<2> > &data) {
+    return boost::python::object(scitbx::af::versa<T, scitbx::af::flex_grid<> >(
+      data.handle(), scitbx::af::flex_grid<>(data.accessor()[0], data.accessor()[1])));
+  }
+
+  template <typename T>
+  boost::python::object frame_stack_as_flex(
+    const scitbx::af::versa<T, scitbx::af::c_grid<3> > &data) {
+    return boost::python::object(scitbx::af::versa<T, scitbx::af::flex_grid<> >(
+      data.handle(),
+      scitbx::af::flex_grid<>(
+        data.accessor()[0], data.accessor()[1], data.accessor()[2])));
+  }
+
+  /**
+   * Frames of float32 pixels are read as flex.float and of float64 pixels as
+   * flex.double, as the other readers of those types do
+   */
+  boost::python::object frame_stack_read(const FrameStackReader &self,
+                                         std::size_t index) {
+    if (self.is_double()) {
+      return frame_stack_as_flex(self.read<double>(index));
+    } else if (self.is_float()) {
+      return frame_stack_as_flex(self.read<float>(index));
+    }
+    return frame_stack_as_flex(self.read<int>(index));
+  }
+
+  boost::python::object frame_stack_read_range(const FrameStackReader &self,
+                                               std::size_t first,
+                                               std::size_t last,
+                                               std::size_t step,
+                                               int num_threads) {
+    if (self.is_double()) {
+      return frame_stack_as_flex(
+        self.read_range<double>(first, last, step, num_threads));
+    } else if (self.is_float()) {
+      return frame_stack_as_flex(
+        self.read_range<float>(first, last, step, num_threads));
+    }
+    return frame_stack_as_flex(self.read_range<int>(first, last, step, num_threads));
+  }
+
+  boost::python::object frame_stack_read_frames(
+    const FrameStackReader &self,
+    const scitbx::af::const_ref<std::size_t> &indices,
+    int num_threads) {
+    if (self.is_double()) {
+      return frame_stack_as_flex(self.read_frames<double>(indices, num_threads));
+    } else if (self.is_float()) {
+      return frame_stack_as_flex(self.read_frames<float>(indices, num_threads));
+    }
+    return frame_stack_as_flex(self.read_frames<int>(indices, num_threads));
+  }
+
+  void frame_stack_reader_wrapper() {
+    class_<FrameStackReader, boost::shared_ptr<FrameStackReader> >("FrameStackReader",
+                                                                   no_init)
+      .def("__init__",
+           make_constructor(&make_frame_stack_reader,
+                            default_call_policies(),
+                            (arg("filename"),
+                             arg("offsets"),
+                             arg("dtype"),
+                             arg("shape"),
+                             arg("big_endian") = false)))
+      .def("filename", &FrameStackReader::filename)
+      .def("frame_bytes", &FrameStackReader::frame_bytes)
+      .def("is_float", &FrameStackReader::is_float)
+      .def("is_double", &FrameStackReader::is_double)
+      .def("read", &frame_stack_read, (arg("index")))
+      .def("read_range",
+           &frame_stack_read_range,
+           (arg("first"), arg("last"), arg("step") = 1, arg("num_threads") = 1))
+      .def("read_frames",
+           &frame_stack_read_frames,
+           (arg("indices"), arg("num_threads") = 1))
+      .def("__len__", &FrameStackReader::size);
+  }
+
+  bool pyramid_use_max(const std::string &pooling) {
+    if (pooling == "max") return true;
+    if (pooling == "mean") return false;
+    throw DXTBX_ERROR("Unknown pooling: " + pooling);
+    return true;
+  }
+
+  template <typename T>
+  boost::shared_ptr<ImagePyramid> make_image_pyramid(const Image<T> &image,
+                                                     const Image<bool> &mask,
+                                                     std::size_t num_levels,
+                                                     const std::string &pooling) {
+    return boost::make_shared<ImagePyramid>(
+      image, mask, num_levels, pyramid_use_max(pooling));
+  }
+
+  template <typename T>
+  boost::python::tuple pyramid_as_tuple(const Image<T> &image) {
+    boost::python::list result;
+    for (std::size_t i = 0; i < image.n_tiles(); ++i) {
+      result.append(image.tile(i).data());
+    }
+    return boost::python::tuple(result);
+  }
+
+  boost::python::tuple image_pyramid_level(const ImagePyramid &self,
+                                           std::size_t level) {
+    return pyramid_as_tuple(self.level(level));
+  }
+
+  boost::python::tuple image_pyramid_mask(const ImagePyramid &self,
+                                          std::size_t level) {
+    return pyramid_as_tuple(self.mask(level));
+  }
+
+  boost::python::tuple image_pyramid_count(const ImagePyramid &self,
+                                           std::size_t level) {
+    return pyramid_as_tuple(self.count(level));
+  }
+
+  void image_pyramid_wrapper() {
+    class_<ImagePyramid, boost::shared_ptr<ImagePyramid> >("ImagePyramid", no_init)
+      .def("__init__",
+           make_constructor(&make_image_pyramid<int>,
+                            default_call_policies(),
+                            (arg("image"),
+                             arg("mask") = Image<bool>(),
+                             arg("num_levels") = 4,
+                             arg("pooling") = "max")))
+      .def("__init__",
+           make_constructor(&make_image_pyramid<double>,
+                            default_call_policies(),
+                            (arg("image"),
+                             arg("mask") = Image<bool>(),
+                             arg("num_levels") = 4,
+                             arg("pooling") = "max")))
+      .def("num_levels", &ImagePyramid::num_levels)
+      .def("use_max", &ImagePyramid::use_max)
+      .def("level", &image_pyramid_level, (arg("level")))
+      .def("mask", &image_pyramid_mask, (arg("level")))
+      .def("count", &image_pyramid_count, (arg("level")))
+      .def("__len__", &ImagePyramid::num_levels);
+  }
+
+  boost::python::object shared_frame_cache_get(SharedFrameCache &self,
+                                               const std::string &key) {
+    SharedFrame frame = self.find(key);
+    if (frame.empty()) {
+      return boost::python::object();
+    }
+    return boost::python::object(frame.image_buffer());
+  }
+
+  bool shared_frame_cache_put(SharedFrameCache &self,
+                              const std::string &key,
+                              const ImageBuffer &buffer) {
+    return !self.insert(key, buffer).empty();
+  }
+
+  void shared_frame_cache_wrapper() {
+    class_<SharedFrameCache, boost::shared_ptr<SharedFrameCache> >("SharedFrameCache",
+                                                                   no_init)
+      .def(init<const std::string &, std::size_t, std::size_t>(
+        (arg("name"), arg("max_bytes"), arg("max_frames") = 4096)))
+      .def("name", &SharedFrameCache::name)
+      .def("max_bytes", &SharedFrameCache::max_bytes)
+      .def("max_frames", &SharedFrameCache::max_frames)
+      .def("num_bytes", &SharedFrameCache::num_bytes)
+      .def("num_frames", &SharedFrameCache::num_frames)
+      .def("get", &shared_frame_cache_get, (arg("key")))
+      .def("put", &shared_frame_cache_put, (arg("key"), arg("buffer")))
+      .def("clear", &SharedFrameCache::clear)
+      .def("__contains__", &SharedFrameCache::contains)
+      .def("__len__", &SharedFrameCache::num_frames)
+      .def("remove", &SharedFrameCache::remove, (arg("name")))
+      .staticmethod("remove")
+      .def("frame_key", &SharedFrameCache::frame_key, (arg("path"), arg("index")))
+      .staticmethod("frame_key");
+  }
+
+  void pixel_histogram_wrapper() {
+    class_<PixelHistogram>("PixelHistogram", no_init)
+      .def(init<std::size_t, double, double, bool, bool>((arg("num_bins"),
+                                                          arg("min_value"),
+                                                          arg("max_value"),
+                                                          arg("logarithmic") = false,
+                                                          arg("per_pixel") = false)))
+      .def("add_image",
+           &PixelHistogram::add_image<int>,
+           (arg("image"), arg("mask") = Image<bool>(), arg("num_threads") = 1))
+      .def("add_image",
+           &PixelHistogram::add_image<double>,
+           (arg("image"), arg("mask") = Image<bool>(), arg("num_threads") = 1))
+      .def("merge", &PixelHistogram::merge, (arg("other")))
+      .def("num_bins", &PixelHistogram::num_bins)
+      .def("num_panels", &PixelHistogram::num_panels)
+      .def("num_images", &PixelHistogram::num_images)
+      .def("is_logarithmic", &PixelHistogram::is_logarithmic)
+      .def("is_per_pixel", &PixelHistogram::is_per_pixel)
+      .def("edges", &PixelHistogram::edges)
+      .def("counts", &PixelHistogram::counts, (arg("panel")))
+      .def("pixel_counts", &PixelHistogram::pixel_counts, (arg("panel")))
+      .def("underflow", &PixelHistogram::underflow, (arg("panel")))
+      .def("overflow", &PixelHistogram::overflow, (arg("panel")))
+      .def("num_masked", &PixelHistogram::num_masked, (arg("panel")))
+      .def("num_valid", &PixelHistogram::num_valid, (arg("panel")))
+      .def("mean", &PixelHistogram::mean, (arg("panel")))
+      .def("minimum", &PixelHistogram::minimum, (arg("panel")))
+      .def("maximum", &PixelHistogram::maximum, (arg("panel")))
+      .def("quantile", &PixelHistogram::quantile, (arg("panel"), arg("q")));
+  }
+
   BOOST_PYTHON_MODULE(dxtbx_format_image_ext) {
     image_tile_wrapper<bool>("ImageTileBool");
     image_tile_wrapper<int>("ImageTileInt");
@@ -143,17 +492,32 @@ namespace dxtbx { namespace format { namespace boost_python {
     image_wrapper<bool>("ImageBool");
     image_wrapper<int>("ImageInt");
     image_wrapper<double>("ImageDouble");
+    sparse_image_tile_wrapper<int>("SparseImageTileInt");
+    sparse_image_tile_wrapper<double>("SparseImageTileDouble");
+    sparse_image_wrapper<int>("SparseImageInt");
+    sparse_image_wrapper<double>("SparseImageDouble");
 
     class_<ImageBuffer>("ImageBuffer")
       .def(init<Image<int> >())
       .def(init<Image<double> >())
+      .def(init<SparseImage<int> >())
+      .def(init<SparseImage<double> >())
       .def("is_empty", &ImageBuffer::is_empty)
       .def("is_int", &ImageBuffer::is_int)
       .def("is_float", &ImageBuffer::is_float)
       .def("is_double", &ImageBuffer::is_double)
+      .def("is_sparse", &ImageBuffer::is_sparse)
+      .def("dense", &ImageBuffer::dense)
       .def("as_int", &ImageBuffer::as_int)
       .def("as_float", &ImageBuffer::as_float)
-      .def("as_double", &ImageBuffer::as_double);
+      .def("as_double", &ImageBuffer::as_double)
+      .def("as_sparse_int", &ImageBuffer::as_sparse_int)
+      .def("as_sparse_double", &ImageBuffer::as_sparse_double);
+
+    frame_stack_reader_wrapper();
+    image_pyramid_wrapper();
+    shared_frame_cache_wrapper();
+    pixel_histogram_wrapper();
 
     export_cbf_read_buffer();
   }
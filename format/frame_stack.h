@@ -0,0 +1,295 @@
+#ifndef DXTBX_FORMAT_FRAME_STACK_H
+#define DXTBX_FORMAT_FRAME_STACK_H
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <boost/shared_ptr.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#include <scitbx/array_family/versa.h>
+#include <scitbx/array_family/shared.h>
+#include <scitbx/array_family/ref.h>
+#include <scitbx/array_family/accessors/c_grid.h>
+#include <dxtbx/error.h>
+
+namespace dxtbx { namespace format {
+
+  namespace detail {
+
+    /**
+     * Read a value from an unaligned, possibly byte swapped, buffer
+     */
+    template <typename T>
+    T read_value(const char *src, bool swap) {
+      T value;
+      if (swap) {
+        char bytes[sizeof(T)];
+        std::reverse_copy(src, src + sizeof(T), bytes);
+        std::memcpy(&value, bytes, sizeof(T));
+      } else {
+        std::memcpy(&value, src, sizeof(T));
+      }
+      return value;
+    }
+
+    /**
+     * Convert a buffer of pixels to the output type. Unsigned 32 bit values
+     * above INT_MAX wrap to negative values when read as int, as they do in
+     * the other uint32 readers, so 0xFFFFFFFF reads as -1.
+     */
+    template <typename Source, typename T>
+    void convert_pixels(const char *src, std::size_t n, bool swap, T *dst) {
+      for (std::size_t i = 0; i < n; ++i) {
+        dst[i] = static_cast<T>(read_value<Source>(src + i * sizeof(Source), swap));
+      }
+    }
+
+  }  // namespace detail
+
+  /**
+   * A reader for a stack of uncompressed frames of the same type and shape at
+   * known offsets in a single file, as found in multi-image binary formats.
+   * The file is memory mapped once so reading a frame is a single conversion
+   * from the page cache into the output array with no file handling or header
+   * parsing. Reads of several frames can convert the frames in parallel
+   * when OpenMP is available.
+   */
+  class FrameStackReader {
+  public:
+    enum pixel_type {
+      UINT8,
+      INT8,
+      UINT16,
+      INT16,
+      UINT32,
+      INT32,
+      FLOAT32,
+      FLOAT64
+    };
+
+    /**
+     * @param filename The file name
+     * @param offsets The byte offset of each frame in the file
+     * @param dtype The pixel type (e.g. "uint16" or "float32")
+     * @param big_endian Are the pixels big endian
+     * @param ysize The number of rows in a frame
+     * @param xsize The number of columns in a frame
+     */
+    FrameStackReader(const std::string &filename,
+                     const scitbx::af::const_ref<std::size_t> &offsets,
+                     const std::string &dtype,
+                     bool big_endian,
+                     std::size_t ysize,
+                     std::size_t xsize)
+        : filename_(filename),
+          offsets_(offsets.begin(), offsets.end()),
+          type_(parse_dtype(dtype)),
+          swap_(big_endian != is_big_endian()),
+          grid_(ysize, xsize) {
+      using namespace boost::interprocess;
+      try {
+        file_ = boost::make_shared<file_mapping>(filename.c_str(), read_only);
+        region_ = boost::make_shared<mapped_region>(*file_, read_only);
+      } catch (const interprocess_exception &e) {
+        throw DXTBX_ERROR("Unable to map " + filename + ": " + e.what());
+      }
+      for (std::size_t i = 0; i < offsets_.size(); ++i) {
+        DXTBX_ASSERT(offsets_[i] + frame_bytes() <= region_->get_size());
+      }
+    }
+
+    /**
+     * @returns The file name
+     */
+    std::string filename() const {
+      return filename_;
+    }
+
+    /**
+     * @returns The number of frames
+     */
+    std::size_t size() const {
+      return offsets_.size();
+    }
+
+    /**
+     * @returns The frame shape
+     */
+    scitbx::af::c_grid<2> accessor() const {
+      return grid_;
+    }
+
+    /**
+     * @returns The size of a pixel in bytes
+     */
+    std::size_t pixel_bytes() const {
+      switch (type_) {
+      case UINT8:
+      case INT8:
+        return 1;
+      case UINT16:
+      case INT16:
+        return 2;
+      case UINT32:
+      case INT32:
+      case FLOAT32:
+        return 4;
+      default:
+        return 8;
+      }
+    }
+
+    /**
+     * @returns The size of a frame in bytes
+     */
+    std::size_t frame_bytes() const {
+      return grid_.size_1d() * pixel_bytes();
+    }
+
+    /**
+     * @returns Are the pixels floating point
+     */
+    bool is_float() const {
+      return type_ == FLOAT32 || type_ == FLOAT64;
+    }
+
+    /**
+     * @returns Are the pixels double precision floating point
+     */
+    bool is_double() const {
+      return type_ == FLOAT64;
+    }
+
+    /**
+     * Read a single frame
+     * @param index The frame index
+     * @returns The frame data
+     */
+    template <typename T>
+    scitbx::af::versa<T, scitbx::af::c_grid<2> > read(std::size_t index) const {
+      DXTBX_ASSERT(index < size());
+      scitbx::af::versa<T, scitbx::af::c_grid<2> > result(
+        grid_, scitbx::af::init_functor_null<T>());
+      read_into(index, result.begin());
+      return result;
+    }
+
+    /**
+     * Read a selection of frames into a single (n, ysize, xsize) array
+     * @param indices The frame indices
+     * @param num_threads The number of threads converting the frames
+     * @returns The frame data
+     */
+    template <typename T>
+    scitbx::af::versa<T, scitbx::af::c_grid<3> > read_frames(
+      const scitbx::af::const_ref<std::size_t> &indices,
+      int num_threads = 1) const {
+      DXTBX_ASSERT(num_threads > 0);
+      for (std::size_t i = 0; i < indices.size(); ++i) {
+        DXTBX_ASSERT(indices[i] < size());
+      }
+      scitbx::af::versa<T, scitbx::af::c_grid<3> > result(
+        scitbx::af::c_grid<3>(indices.size(), grid_[0], grid_[1]),
+        scitbx::af::init_functor_null<T>());
+      std::size_t frame_size = grid_.size_1d();
+      T *data = result.begin();
+      int num_frames = static_cast<int>(indices.size());
+#pragma omp parallel for num_threads(num_threads) schedule(dynamic) if (num_threads > 1)
+      for (int i = 0; i < num_frames; ++i) {
+        read_into(indices[i], data + i * frame_size);
+      }
+      return result;
+    }
+
+    /**
+     * Read a range of frames into a single (n, ysize, xsize) array
+     * @param first The first frame
+     * @param last One past the last frame
+     * @param step The step between frames
+     * @param num_threads The number of threads converting the frames
+     * @returns The frame data
+     */
+    template <typename T>
+    scitbx::af::versa<T, scitbx::af::c_grid<3> > read_range(std::size_t first,
+                                                            std::size_t last,
+                                                            std::size_t step,
+                                                            int num_threads = 1) const {
+      DXTBX_ASSERT(first <= last && last <= size());
+      DXTBX_ASSERT(step > 0);
+      scitbx::af::shared<std::size_t> indices;
+      for (std::size_t i = first; i < last; i += step) {
+        indices.push_back(i);
+      }
+      return read_frames<T>(indices.const_ref(), num_threads);
+    }
+
+  protected:
+    static bool is_big_endian() {
+      unsigned int value = 1;
+      return *reinterpret_cast<const char *>(&value) == 0;
+    }
+
+    static pixel_type parse_dtype(const std::string &dtype) {
+      if (dtype == "uint8") return UINT8;
+      if (dtype == "int8") return INT8;
+      if (dtype == "uint16") return UINT16;
+      if (dtype == "int16") return INT16;
+      if (dtype == "uint32") return UINT32;
+      if (dtype == "int32") return INT32;
+      if (dtype == "float32") return FLOAT32;
+      if (dtype == "float64") return FLOAT64;
+      throw DXTBX_ERROR("Unknown pixel type: " + dtype);
+      return UINT8;
+    }
+
+    /**
+     * Convert a frame into the output buffer. This does not throw so it can be
+     * called from a parallel region.
+     */
+    template <typename T>
+    void read_into(std::size_t index, T *dst) const {
+      const char *src =
+        static_cast<const char *>(region_->get_address()) + offsets_[index];
+      std::size_t n = grid_.size_1d();
+      switch (type_) {
+      case UINT8:
+        detail::convert_pixels<unsigned char>(src, n, swap_, dst);
+        break;
+      case INT8:
+        detail::convert_pixels<signed char>(src, n, swap_, dst);
+        break;
+      case UINT16:
+        detail::convert_pixels<unsigned short>(src, n, swap_, dst);
+        break;
+      case INT16:
+        detail::convert_pixels<short>(src, n, swap_, dst);
+        break;
+      case UINT32:
+        detail::convert_pixels<unsigned int>(src, n, swap_, dst);
+        break;
+      case INT32:
+        detail::convert_pixels<int>(src, n, swap_, dst);
+        break;
+      case FLOAT32:
+        detail::convert_pixels<float>(src, n, swap_, dst);
+        break;
+      default:
+        detail::convert_pixels<double>(src, n, swap_, dst);
+      }
+    }
+
+    std::string filename_;
+    std::vector<std::size_t> offsets_;
+    pixel_type type_;
+    bool swap_;
+    scitbx::af::c_grid<2> grid_;
+    boost::shared_ptr<boost::interprocess::file_mapping> file_;
+    boost::shared_ptr<boost::interprocess::mapped_region> region_;
+  };
+
+}}  // namespace dxtbx::format
+
+#endif  // DXTBX_FORMAT_FRAME_STACK_H
@@ -11,9 +11,15 @@
 #ifndef DXTBX_FORMAT_IMAGE_H
 #define DXTBX_FORMAT_IMAGE_H
 
+#include <algorithm>
+#include <cmath>
 #include <vector>
 
 #include <boost/variant.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/interprocess/sync/interprocess_mutex.hpp>
+#include <boost/interprocess/sync/scoped_lock.hpp>
 
 #include <dxtbx/error.h>
 #include <scitbx/array_family/tiny.h>
@@ -24,29 +30,92 @@
 namespace dxtbx { namespace format {
 
   /**
-   * An image tile containing data from a single detector panel
+   * The layout of a tile within a frame buffer as (offset, row stride, number
+   * of rows, number of columns), all in elements.
+   */
+  typedef scitbx::af::tiny<std::size_t, 4> tile_layout_type;
+
+  /**
+   * An image tile containing data from a single detector panel.
+   *
+   * The tile either owns a contiguous array or is a view of a region of a
+   * larger frame buffer which holds the data for several panels. A view only
+   * copies its data into a contiguous array the first time data() is called;
+   * the copy is shared between copies of the tile and is made under a lock so
+   * copies of the tile can be read from several threads. Views whose rows are
+   * contiguous in the buffer can be read through const_ref() without a copy.
    */
   template <typename T>
   class ImageTile {
   public:
     typedef scitbx::af::c_grid<2> accessor_type;
     typedef scitbx::af::versa<T, accessor_type> array_type;
+    typedef scitbx::af::const_ref<T, accessor_type> const_ref_type;
 
     /**
      * Initialize the class
      */
-    ImageTile(array_type data) : data_(data), name_("") {}
+    ImageTile(array_type data)
+        : data_(data), name_(""), offset_(0), stride_(0), is_view_(false) {}
 
     /**
      * Initialize the class
      */
-    ImageTile(array_type data, const char *name) : data_(data), name_(name) {}
+    ImageTile(array_type data, const char *name)
+        : data_(data), name_(name), offset_(0), stride_(0), is_view_(false) {}
+
+    /**
+     * Initialize the tile as a view of a frame buffer
+     * @param buffer The frame buffer
+     * @param layout The (offset, stride, ysize, xsize) of the tile
+     * @param name The tile name
+     */
+    ImageTile(const scitbx::af::shared<T> &buffer,
+              const tile_layout_type &layout,
+              const char *name = "")
+        : name_(name),
+          buffer_(buffer),
+          offset_(layout[0]),
+          stride_(layout[1]),
+          grid_(layout[2], layout[3]),
+          cache_(boost::make_shared<view_cache>()),
+          is_view_(true) {
+      DXTBX_ASSERT(stride_ >= grid_[1]);
+      DXTBX_ASSERT(grid_[0] == 0
+                   || offset_ + (grid_[0] - 1) * stride_ + grid_[1] <= buffer.size());
+    }
 
     /**
      * Get the image data
      */
     array_type data() const {
-      return data_;
+      if (!is_view_) {
+        return data_;
+      }
+      boost::interprocess::scoped_lock<boost::interprocess::interprocess_mutex> lock(
+        cache_->mutex);
+      if (!cache_->filled) {
+        array_type data(grid_, scitbx::af::init_functor_null<T>());
+        for (std::size_t j = 0; j < grid_[0]; ++j) {
+          const T *row = &buffer_[offset_ + j * stride_];
+          std::uninitialized_copy(row, row + grid_[1], &data[j * grid_[1]]);
+        }
+        cache_->data = data;
+        cache_->filled = true;
+      }
+      return cache_->data;
+    }
+
+    /**
+     * Get a reference to the image data. This does not copy the data if the
+     * tile owns its data or is a view with contiguous rows.
+     */
+    const_ref_type const_ref() const {
+      if (is_view_ && is_contiguous()) {
+        return const_ref_type(grid_.size_1d() > 0 ? &buffer_[offset_] : NULL,
+                              grid_);
+      }
+      return is_view_ ? data().const_ref() : data_.const_ref();
     }
 
     /**
@@ -60,19 +129,49 @@ namespace dxtbx { namespace format {
      * Is the array empty
      */
     bool empty() const {
-      return data_.empty();
+      return is_view_ ? grid_.size_1d() == 0 : data_.empty();
+    }
+
+    /**
+     * Is the tile a view of a frame buffer
+     */
+    bool is_view() const {
+      return is_view_;
+    }
+
+    /**
+     * Are the rows of the tile contiguous in memory
+     */
+    bool is_contiguous() const {
+      return !is_view_ || stride_ == grid_[1];
     }
 
     /**
      * Get the accessor
      */
     accessor_type accessor() const {
-      return data_.accessor();
+      return is_view_ ? grid_ : data_.accessor();
     }
 
   protected:
+    /**
+     * The contiguous copy of a view, shared between copies of the tile
+     */
+    struct view_cache {
+      view_cache() : filled(false) {}
+      boost::interprocess::interprocess_mutex mutex;
+      array_type data;
+      bool filled;
+    };
+
     array_type data_;
     std::string name_;
+    scitbx::af::shared<T> buffer_;
+    std::size_t offset_;
+    std::size_t stride_;
+    accessor_type grid_;
+    boost::shared_ptr<view_cache> cache_;
+    bool is_view_;
   };
 
   /**
@@ -99,6 +198,19 @@ namespace dxtbx { namespace format {
       tiles_.push_back(tile);
     }
 
+    /**
+     * Construct from a single frame buffer holding the data for all tiles.
+     * The tiles are views of the buffer so no data is copied.
+     * @param buffer The frame buffer
+     * @param layout The layout of each tile in the buffer
+     */
+    Image(const scitbx::af::shared<T> &buffer,
+          const scitbx::af::const_ref<tile_layout_type> &layout) {
+      for (std::size_t i = 0; i < layout.size(); ++i) {
+        tiles_.push_back(ImageTile<T>(buffer, layout[i]));
+      }
+    }
+
     /**
      * Add a tile
      */
@@ -157,6 +269,212 @@ namespace dxtbx { namespace format {
     scitbx::af::shared<ImageTile<T> > tiles_;
   };
 
+  /**
+   * An image tile holding only the non-zero pixels of a detector panel, as
+   * their sorted 1D pixel indices and their values. For frames where few
+   * pixels are lit this takes memory and time proportional to the number of
+   * lit pixels rather than the panel size.
+   */
+  template <typename T>
+  class SparseImageTile {
+  public:
+    typedef scitbx::af::c_grid<2> accessor_type;
+    typedef scitbx::af::versa<T, accessor_type> array_type;
+
+    /**
+     * Initialize the class
+     * @param accessor The panel shape
+     * @param indices The sorted 1D indices of the pixels
+     * @param values The pixel values
+     * @param name The tile name
+     */
+    SparseImageTile(const accessor_type &accessor,
+                    const scitbx::af::shared<std::size_t> &indices,
+                    const scitbx::af::shared<T> &values,
+                    const char *name = "")
+        : accessor_(accessor), indices_(indices), values_(values), name_(name) {
+      DXTBX_ASSERT(indices.size() == values.size());
+      for (std::size_t i = 0; i < indices.size(); ++i) {
+        DXTBX_ASSERT(indices[i] < accessor.size_1d());
+        DXTBX_ASSERT(i == 0 || indices[i - 1] < indices[i]);
+      }
+    }
+
+    /**
+     * Initialize from the non-zero pixels of a dense tile
+     */
+    explicit SparseImageTile(const ImageTile<T> &tile)
+        : accessor_(tile.accessor()), name_(tile.name()) {
+      typename ImageTile<T>::const_ref_type data = tile.const_ref();
+      for (std::size_t i = 0; i < data.size(); ++i) {
+        if (data[i] != 0) {
+          indices_.push_back(i);
+          values_.push_back(data[i]);
+        }
+      }
+    }
+
+    /**
+     * Get the image data as a dense array
+     */
+    array_type data() const {
+      array_type result(accessor_, T(0));
+      for (std::size_t i = 0; i < indices_.size(); ++i) {
+        result[indices_[i]] = values_[i];
+      }
+      return result;
+    }
+
+    /**
+     * Get the pixel indices
+     */
+    scitbx::af::shared<std::size_t> indices() const {
+      return indices_;
+    }
+
+    /**
+     * Get the pixel values
+     */
+    scitbx::af::shared<T> values() const {
+      return values_;
+    }
+
+    /**
+     * Get the number of stored pixels
+     */
+    std::size_t num_pixels() const {
+      return indices_.size();
+    }
+
+    /**
+     * Get the name
+     */
+    std::string name() const {
+      return name_;
+    }
+
+    /**
+     * Is the panel empty
+     */
+    bool empty() const {
+      return accessor_.size_1d() == 0;
+    }
+
+    /**
+     * Get the accessor
+     */
+    accessor_type accessor() const {
+      return accessor_;
+    }
+
+  protected:
+    accessor_type accessor_;
+    scitbx::af::shared<std::size_t> indices_;
+    scitbx::af::shared<T> values_;
+    std::string name_;
+  };
+
+  /**
+   * A class to hold a multi-tile image with sparse tiles
+   */
+  template <typename T>
+  class SparseImage {
+  public:
+    typedef T data_type;
+    typedef SparseImageTile<T> tile_type;
+    typedef typename scitbx::af::shared<tile_type> tile_array_type;
+    typedef typename tile_array_type::iterator iterator;
+
+    /**
+     * Construct empty
+     */
+    SparseImage() {}
+
+    /**
+     * Construct with a single tile
+     */
+    SparseImage(const SparseImageTile<T> &tile) {
+      tiles_.push_back(tile);
+    }
+
+    /**
+     * Construct from the non-zero pixels of a dense image
+     */
+    explicit SparseImage(const Image<T> &image) {
+      for (std::size_t i = 0; i < image.n_tiles(); ++i) {
+        tiles_.push_back(SparseImageTile<T>(image.tile(i)));
+      }
+    }
+
+    /**
+     * Add a tile
+     */
+    void push_back(const SparseImageTile<T> &tile) {
+      tiles_.push_back(tile);
+    }
+
+    /**
+     * Get an image tile
+     */
+    SparseImageTile<T> tile(std::size_t index) const {
+      DXTBX_ASSERT(index < n_tiles());
+      return tiles_[index];
+    }
+
+    /**
+     * Get the number of tiles
+     */
+    std::size_t n_tiles() const {
+      return tiles_.size();
+    }
+
+    /**
+     * Get the total number of stored pixels
+     */
+    std::size_t num_pixels() const {
+      std::size_t result = 0;
+      for (std::size_t i = 0; i < tiles_.size(); ++i) {
+        result += tiles_[i].num_pixels();
+      }
+      return result;
+    }
+
+    /**
+     * Is the image empty
+     */
+    bool empty() const {
+      return tiles_.empty();
+    }
+
+    /**
+     * Get the image as a dense image
+     */
+    Image<T> dense() const {
+      Image<T> result;
+      for (std::size_t i = 0; i < tiles_.size(); ++i) {
+        result.push_back(ImageTile<T>(tiles_[i].data(), tiles_[i].name().c_str()));
+      }
+      return result;
+    }
+
+    /**
+     * Get the begin iterator
+     */
+    iterator begin() {
+      return tiles_.begin();
+    }
+
+    /**
+     * Get the end iterator
+     */
+    iterator end() {
+      return tiles_.end();
+    }
+
+  protected:
+    scitbx::af::shared<SparseImageTile<T> > tiles_;
+  };
+
   /**
    * A class to hold image data which can be either int, float, or double
    */
@@ -166,11 +484,17 @@ namespace dxtbx { namespace format {
     typedef Image<int> int_image_type;
     typedef Image<float> float_image_type;
     typedef Image<double> double_image_type;
+    typedef SparseImage<int> sparse_int_image_type;
+    typedef SparseImage<double> sparse_double_image_type;
 
     // The variant type
-    typedef boost::
-      variant<empty_type, int_image_type, float_image_type, double_image_type>
-        variant_type;
+    typedef boost::variant<empty_type,
+                           int_image_type,
+                           float_image_type,
+                           double_image_type,
+                           sparse_int_image_type,
+                           sparse_double_image_type>
+      variant_type;
 
     /**
      * A visitor class to convert from/to different types.
@@ -194,15 +518,147 @@ namespace dxtbx { namespace format {
         for (std::size_t i = 0; i < v.n_tiles(); ++i) {
           typedef typename ImageType::tile_type ImageTileType;
           typedef typename ImageType::array_type ArrayType;
+          typedef typename OtherImageType::tile_type::const_ref_type ConstRefType;
+          ConstRefType source = v.tile(i).const_ref();
           ArrayType data(
-            v.tile(i).accessor(),
+            source.accessor(),
             scitbx::af::init_functor_null<typename ArrayType::value_type>());
-          std::uninitialized_copy(
-            v.tile(i).data().begin(), v.tile(i).data().end(), data.begin());
+          std::uninitialized_copy(source.begin(), source.end(), data.begin());
           result.push_back(ImageTileType(data));
         }
         return result;
       }
+
+      template <typename OtherType>
+      ImageType operator()(const SparseImage<OtherType> &v) const {
+        typedef typename ImageType::tile_type ImageTileType;
+        typedef typename ImageType::array_type ArrayType;
+        typedef typename ArrayType::value_type ValueType;
+        ImageType result;
+        for (std::size_t i = 0; i < v.n_tiles(); ++i) {
+          SparseImageTile<OtherType> tile = v.tile(i);
+          scitbx::af::shared<std::size_t> indices = tile.indices();
+          scitbx::af::shared<OtherType> values = tile.values();
+          ArrayType data(tile.accessor(), ValueType(0));
+          for (std::size_t j = 0; j < indices.size(); ++j) {
+            data[indices[j]] = static_cast<ValueType>(values[j]);
+          }
+          result.push_back(ImageTileType(data, tile.name().c_str()));
+        }
+        return result;
+      }
+    };
+
+    /**
+     * A visitor class to convert to a sparse image.
+     * Data is copied except when the to/from types are the same
+     */
+    template <typename T>
+    class SparseConverterVisitor : public boost::static_visitor<SparseImage<T> > {
+    public:
+      SparseImage<T> operator()(const empty_type &) const {
+        throw DXTBX_ERROR("ImageBuffer is empty");
+        return SparseImage<T>();
+      }
+
+      SparseImage<T> operator()(const SparseImage<T> &v) const {
+        return v;
+      }
+
+      template <typename OtherType>
+      SparseImage<T> operator()(const SparseImage<OtherType> &v) const {
+        SparseImage<T> result;
+        for (std::size_t i = 0; i < v.n_tiles(); ++i) {
+          SparseImageTile<OtherType> tile = v.tile(i);
+          scitbx::af::shared<OtherType> values = tile.values();
+          scitbx::af::shared<T> data(values.size(), scitbx::af::init_functor_null<T>());
+          std::uninitialized_copy(values.begin(), values.end(), data.begin());
+          result.push_back(SparseImageTile<T>(
+            tile.accessor(), tile.indices(), data, tile.name().c_str()));
+        }
+        return result;
+      }
+
+      template <typename OtherType>
+      SparseImage<T> operator()(const Image<OtherType> &v) const {
+        SparseImage<T> result;
+        for (std::size_t i = 0; i < v.n_tiles(); ++i) {
+          typename ImageTile<OtherType>::const_ref_type data = v.tile(i).const_ref();
+          scitbx::af::shared<std::size_t> indices;
+          scitbx::af::shared<T> values;
+          for (std::size_t j = 0; j < data.size(); ++j) {
+            if (data[j] != 0) {
+              indices.push_back(j);
+              values.push_back(static_cast<T>(data[j]));
+            }
+          }
+          result.push_back(SparseImageTile<T>(
+            data.accessor(), indices, values, v.tile(i).name().c_str()));
+        }
+        return result;
+      }
+    };
+
+    /**
+     * A visitor class to get a dense buffer with the same value type
+     */
+    class DenseVisitor : public boost::static_visitor<variant_type> {
+    public:
+      template <typename OtherType>
+      variant_type operator()(const SparseImage<OtherType> &v) const {
+        return v.dense();
+      }
+
+      template <typename OtherImageType>
+      variant_type operator()(const OtherImageType &v) const {
+        return v;
+      }
+    };
+
+    /**
+     * Is the data sparse
+     */
+    class IsSparseVisitor : public boost::static_visitor<bool> {
+    public:
+      template <typename OtherType>
+      bool operator()(const SparseImage<OtherType> &v) const {
+        return true;
+      }
+
+      template <typename OtherImageType>
+      bool operator()(const OtherImageType &v) const {
+        return false;
+      }
+    };
+
+    /**
+     * Is the data a sparse int type
+     */
+    class IsSparseIntVisitor : public boost::static_visitor<bool> {
+    public:
+      bool operator()(const sparse_int_image_type &v) const {
+        return true;
+      }
+
+      template <typename OtherImageType>
+      bool operator()(const OtherImageType &v) const {
+        return false;
+      }
+    };
+
+    /**
+     * Is the data a sparse double type
+     */
+    class IsSparseDoubleVisitor : public boost::static_visitor<bool> {
+    public:
+      bool operator()(const sparse_double_image_type &v) const {
+        return true;
+      }
+
+      template <typename OtherImageType>
+      bool operator()(const OtherImageType &v) const {
+        return false;
+      }
     };
 
     /**
@@ -303,6 +759,48 @@ namespace dxtbx { namespace format {
       return boost::apply_visitor(IsDoubleVisitor(), data_);
     }
 
+    /**
+     * @returns Is the buffer sparse
+     */
+    bool is_sparse() const {
+      return boost::apply_visitor(IsSparseVisitor(), data_);
+    }
+
+    /**
+     * @returns Is the buffer a sparse int image
+     */
+    bool is_sparse_int() const {
+      return boost::apply_visitor(IsSparseIntVisitor(), data_);
+    }
+
+    /**
+     * @returns Is the buffer a sparse double image
+     */
+    bool is_sparse_double() const {
+      return boost::apply_visitor(IsSparseDoubleVisitor(), data_);
+    }
+
+    /**
+     * @returns The buffer with sparse images converted to dense images
+     */
+    ImageBuffer dense() const {
+      return ImageBuffer(boost::apply_visitor(DenseVisitor(), data_));
+    }
+
+    /**
+     * @returns The buffer as a sparse int image
+     */
+    SparseImage<int> as_sparse_int() const {
+      return boost::apply_visitor(SparseConverterVisitor<int>(), data_);
+    }
+
+    /**
+     * @returns The buffer as a sparse double image
+     */
+    SparseImage<double> as_sparse_double() const {
+      return boost::apply_visitor(SparseConverterVisitor<double>(), data_);
+    }
+
     /**
      * @returns The buffer as an int image
      */
@@ -328,6 +826,329 @@ namespace dxtbx { namespace format {
     variant_type data_;
   };
 
+  namespace detail {
+
+    /**
+     * Convert a binned value to the image data type
+     */
+    template <typename T>
+    T binned_value(double value) {
+      return static_cast<T>(value);
+    }
+
+    template <>
+    inline int binned_value<int>(double value) {
+      return static_cast<int>(std::floor(value + 0.5));
+    }
+
+  }  // namespace detail
+
+  /**
+   * Bin an image tile into blocks of bin_size x bin_size pixels. Masked pixels
+   * are excluded from the sum and the sum is scaled by the fraction of valid
+   * pixels in the block so that partially masked blocks are comparable with
+   * unmasked blocks. Blocks with no valid pixels are set to empty_value.
+   * Incomplete blocks at the far edges of the tile are dropped.
+   * @param tile The image tile
+   * @param mask The mask tile (empty to use all pixels)
+   * @param bin_size The number of pixels along each side of a block
+   * @param empty_value The value for blocks with no valid pixels
+   * @returns The binned image tile
+   */
+  template <typename T>
+  ImageTile<T> bin_image_tile(const ImageTile<T> &tile,
+                              const ImageTile<bool> &mask,
+                              std::size_t bin_size,
+                              double empty_value) {
+    typedef typename ImageTile<T>::array_type array_type;
+    DXTBX_ASSERT(bin_size > 0);
+    scitbx::af::const_ref<T, scitbx::af::c_grid<2> > data = tile.data().const_ref();
+    scitbx::af::const_ref<bool, scitbx::af::c_grid<2> > m = mask.data().const_ref();
+    bool use_mask = !mask.empty();
+    DXTBX_ASSERT(!use_mask || data.accessor().all_eq(m.accessor()));
+    std::size_t width = data.accessor()[1];
+    std::size_t ysize = data.accessor()[0] / bin_size;
+    std::size_t xsize = width / bin_size;
+    double npix = (double)(bin_size * bin_size);
+
+    // Accumulate one row of blocks at a time
+    array_type result(scitbx::af::c_grid<2>(ysize, xsize),
+                      scitbx::af::init_functor_null<T>());
+    std::vector<double> sum(xsize);
+    std::vector<std::size_t> count(xsize);
+    for (std::size_t j = 0; j < ysize; ++j) {
+      std::fill(sum.begin(), sum.end(), 0.0);
+      std::fill(count.begin(), count.end(), 0);
+      for (std::size_t jj = j * bin_size; jj < (j + 1) * bin_size; ++jj) {
+        std::size_t k = jj * width;
+        for (std::size_t i = 0; i < xsize; ++i) {
+          for (std::size_t ii = 0; ii < bin_size; ++ii, ++k) {
+            if (!use_mask || m[k]) {
+              sum[i] += data[k];
+              count[i] += 1;
+            }
+          }
+        }
+      }
+      for (std::size_t i = 0; i < xsize; ++i) {
+        result(j, i) = count[i] > 0
+                         ? detail::binned_value<T>(sum[i] * npix / count[i])
+                         : detail::binned_value<T>(empty_value);
+      }
+    }
+    return ImageTile<T>(result, tile.name().c_str());
+  }
+
+  /**
+   * Bin a mask tile into blocks of bin_size x bin_size pixels. A block is
+   * valid if any of the pixels in the block are valid.
+   * @param mask The mask tile
+   * @param bin_size The number of pixels along each side of a block
+   * @returns The binned mask tile
+   */
+  inline ImageTile<bool> bin_mask_tile(const ImageTile<bool> &mask,
+                                       std::size_t bin_size) {
+    DXTBX_ASSERT(bin_size > 0);
+    scitbx::af::const_ref<bool, scitbx::af::c_grid<2> > m = mask.data().const_ref();
+    std::size_t width = m.accessor()[1];
+    std::size_t ysize = m.accessor()[0] / bin_size;
+    std::size_t xsize = width / bin_size;
+    scitbx::af::versa<bool, scitbx::af::c_grid<2> > result(
+      scitbx::af::c_grid<2>(ysize, xsize), false);
+    for (std::size_t j = 0; j < ysize; ++j) {
+      for (std::size_t jj = j * bin_size; jj < (j + 1) * bin_size; ++jj) {
+        std::size_t k = jj * width;
+        for (std::size_t i = 0; i < xsize; ++i) {
+          for (std::size_t ii = 0; ii < bin_size; ++ii, ++k) {
+            result(j, i) = result(j, i) || m[k];
+          }
+        }
+      }
+    }
+    return ImageTile<bool>(result, mask.name().c_str());
+  }
+
+  /**
+   * Bin all the tiles of an image
+   * @param image The image
+   * @param mask The mask (empty to use all pixels)
+   * @param bin_size The number of pixels along each side of a block
+   * @param empty_value The value for blocks with no valid pixels for each tile
+   * @returns The binned image
+   */
+  template <typename T>
+  Image<T> bin_image(const Image<T> &image,
+                     const Image<bool> &mask,
+                     std::size_t bin_size,
+                     const std::vector<double> &empty_value) {
+    DXTBX_ASSERT(mask.empty() || mask.n_tiles() == image.n_tiles());
+    DXTBX_ASSERT(empty_value.size() == image.n_tiles());
+    Image<T> result;
+    for (std::size_t i = 0; i < image.n_tiles(); ++i) {
+      ImageTile<bool> mask_tile =
+        mask.empty() ? ImageTile<bool>(ImageTile<bool>::array_type()) : mask.tile(i);
+      result.push_back(
+        bin_image_tile(image.tile(i), mask_tile, bin_size, empty_value[i]));
+    }
+    return result;
+  }
+
+  /**
+   * Bin all the tiles of a mask
+   * @param mask The mask
+   * @param bin_size The number of pixels along each side of a block
+   * @returns The binned mask
+   */
+  inline Image<bool> bin_mask(const Image<bool> &mask, std::size_t bin_size) {
+    Image<bool> result;
+    for (std::size_t i = 0; i < mask.n_tiles(); ++i) {
+      result.push_back(bin_mask_tile(mask.tile(i), bin_size));
+    }
+    return result;
+  }
+
+  namespace detail {
+
+    /**
+     * Pool blocks of 2x2 pixels of a tile. The blocks at the far edges may be
+     * incomplete and are pooled over the pixels available. Each pixel has a
+     * weight: the number of full resolution pixels it covers, which is zero
+     * for masked pixels. The weight of a block is the sum of the weights of
+     * its pixels and its value is either the weighted mean or the maximum of
+     * the pixels with a non-zero weight.
+     * @param data The pixel values
+     * @param weight The pixel weights (empty for a weight of one)
+     * @param use_max Take the maximum rather than the mean
+     * @param value The pooled values
+     * @param count The pooled weights
+     */
+    template <typename T, typename W>
+    void pool_tile(const scitbx::af::const_ref<T, scitbx::af::c_grid<2> > &data,
+                   const scitbx::af::const_ref<W, scitbx::af::c_grid<2> > &weight,
+                   bool use_max,
+                   scitbx::af::versa<double, scitbx::af::c_grid<2> > &value,
+                   scitbx::af::versa<double, scitbx::af::c_grid<2> > &count) {
+      bool use_weight = weight.size() > 0;
+      DXTBX_ASSERT(!use_weight || data.accessor().all_eq(weight.accessor()));
+      std::size_t height = data.accessor()[0];
+      std::size_t width = data.accessor()[1];
+      scitbx::af::c_grid<2> grid((height + 1) / 2, (width + 1) / 2);
+      value = scitbx::af::versa<double, scitbx::af::c_grid<2> >(grid, 0.0);
+      count = scitbx::af::versa<double, scitbx::af::c_grid<2> >(grid, 0.0);
+      for (std::size_t j = 0; j < height; ++j) {
+        for (std::size_t i = 0; i < width; ++i) {
+          double w = use_weight ? static_cast<double>(weight(j, i)) : 1.0;
+          if (w <= 0) {
+            continue;
+          }
+          double v = static_cast<double>(data(j, i));
+          double &block_value = value(j / 2, i / 2);
+          double &block_count = count(j / 2, i / 2);
+          if (!use_max) {
+            block_value += v * w;
+          } else if (block_count == 0 || v > block_value) {
+            block_value = v;
+          }
+          block_count += w;
+        }
+      }
+      if (!use_max) {
+        for (std::size_t k = 0; k < value.size(); ++k) {
+          if (count[k] > 0) {
+            value[k] /= count[k];
+          }
+        }
+      }
+    }
+
+  }  // namespace detail
+
+  /**
+   * A multi-resolution pyramid of an image for viewers. Level 0 is pooled from
+   * the full resolution image in blocks of 2x2 pixels and each further level
+   * halves the size of the one before, so level n is reduced by a factor of
+   * 2^(n+1). Each level is computed from the one before rather than from the
+   * full image, so the full resolution data is only read once. Masked pixels
+   * are left out of the pooling and blocks with no valid pixels are masked at
+   * the next level. Mean pooling is weighted by the number of valid pixels
+   * under each block, so every level is the mean of the valid full resolution
+   * pixels it covers.
+   */
+  class ImagePyramid {
+  public:
+    typedef scitbx::af::versa<double, scitbx::af::c_grid<2> > array_type;
+
+    ImagePyramid() : use_max_(true) {}
+
+    /**
+     * Construct the pyramid
+     * @param image The full resolution image
+     * @param mask The mask (true for valid pixels, empty to use all pixels)
+     * @param num_levels The number of levels
+     * @param use_max Pool with the maximum rather than the mean
+     */
+    template <typename T>
+    ImagePyramid(const Image<T> &image,
+                 const Image<bool> &mask,
+                 std::size_t num_levels,
+                 bool use_max)
+        : use_max_(use_max) {
+      typedef scitbx::af::const_ref<bool, scitbx::af::c_grid<2> > mask_ref_type;
+      DXTBX_ASSERT(num_levels > 0);
+      DXTBX_ASSERT(mask.empty() || mask.n_tiles() == image.n_tiles());
+      values_.resize(num_levels);
+      counts_.resize(num_levels);
+      for (std::size_t i = 0; i < image.n_tiles(); ++i) {
+        array_type value, count;
+        mask_ref_type m = mask.empty()
+                            ? mask_ref_type(NULL, scitbx::af::c_grid<2>(0, 0))
+                            : mask.tile(i).const_ref();
+        detail::pool_tile(image.tile(i).const_ref(), m, use_max, value, count);
+        values_[0].push_back(value);
+        counts_[0].push_back(count);
+        for (std::size_t level = 1; level < num_levels; ++level) {
+          array_type next_value, next_count;
+          detail::pool_tile(value.const_ref(),
+                            count.const_ref(),
+                            use_max,
+                            next_value,
+                            next_count);
+          value = next_value;
+          count = next_count;
+          values_[level].push_back(value);
+          counts_[level].push_back(count);
+        }
+      }
+    }
+
+    /**
+     * @returns The number of levels
+     */
+    std::size_t num_levels() const {
+      return values_.size();
+    }
+
+    /**
+     * @returns Are the levels pooled with the maximum
+     */
+    bool use_max() const {
+      return use_max_;
+    }
+
+    /**
+     * Get the pooled image at a level. Masked blocks are zero.
+     * @param level The level
+     * @returns The image
+     */
+    Image<double> level(std::size_t level) const {
+      DXTBX_ASSERT(level < num_levels());
+      Image<double> result;
+      for (std::size_t i = 0; i < values_[level].size(); ++i) {
+        result.push_back(ImageTile<double>(values_[level][i]));
+      }
+      return result;
+    }
+
+    /**
+     * Get the mask at a level. A block is valid if any of the full resolution
+     * pixels it covers is valid.
+     * @param level The level
+     * @returns The mask
+     */
+    Image<bool> mask(std::size_t level) const {
+      DXTBX_ASSERT(level < num_levels());
+      Image<bool> result;
+      for (std::size_t i = 0; i < counts_[level].size(); ++i) {
+        const array_type &count = counts_[level][i];
+        scitbx::af::versa<bool, scitbx::af::c_grid<2> > m(count.accessor());
+        for (std::size_t k = 0; k < count.size(); ++k) {
+          m[k] = count[k] > 0;
+        }
+        result.push_back(ImageTile<bool>(m));
+      }
+      return result;
+    }
+
+    /**
+     * Get the number of valid full resolution pixels under each block
+     * @param level The level
+     * @returns The counts
+     */
+    Image<double> count(std::size_t level) const {
+      DXTBX_ASSERT(level < num_levels());
+      Image<double> result;
+      for (std::size_t i = 0; i < counts_[level].size(); ++i) {
+        result.push_back(ImageTile<double>(counts_[level][i]));
+      }
+      return result;
+    }
+
+  protected:
+    bool use_max_;
+    std::vector<std::vector<array_type> > values_;
+    std::vector<std::vector<array_type> > counts_;
+  };
+
 }}  // namespace dxtbx::format
 
 #endif  // DXTBX_FORMAT_IMAGE_H
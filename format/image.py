@@ -10,7 +10,14 @@ __all__ = (  # noqa: F405
     "ImageBuffer",
     "ImageDouble",
     "ImageInt",
+    "ImagePyramid",
     "ImageTileBool",
     "ImageTileDouble",
     "ImageTileInt",
+    "PixelHistogram",
+    "SharedFrameCache",
+    "SparseImageDouble",
+    "SparseImageInt",
+    "SparseImageTileDouble",
+    "SparseImageTileInt",
 )
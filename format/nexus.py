@@ -1249,6 +1249,19 @@ class DetectorGroupDataList(object):
     def __getitem__(self, index):
         return tuple(itertools.chain.from_iterable(dl[index] for dl in self._datalists))
 
+    def num_panels(self):
+        return sum(datalist.num_panels() for datalist in self._datalists)
+
+    def get_panels(self, index, panels):
+        """Read only the requested panels, numbered across all the detectors"""
+        lookup = []
+        for i, datalist in enumerate(self._datalists):
+            lookup.extend((i, j) for j in range(datalist.num_panels()))
+        return tuple(
+            self._datalists[lookup[panel][0]].get_panels(index, [lookup[panel][1]])[0]
+            for panel in panels
+        )
+
 
 def get_detector_module_slices(detector):
     """
@@ -1298,14 +1311,21 @@ class MultiPanelDataList(object):
         return self._num_images
 
     def __getitem__(self, index):
+        return self.get_panels(index, range(len(self._all_slices)))
+
+    def num_panels(self):
+        return len(self._all_slices)
+
+    def get_panels(self, index, panels):
+        """Read only the hyperslabs of the requested detector modules"""
         d = self._lookup[index]
         i = index - self._offset[d]
 
         all_data = []
 
-        for module_slices in self._all_slices:
+        for panel in panels:
             slices = [slice(i, i + 1, 1)]
-            slices.extend(module_slices)
+            slices.extend(self._all_slices[panel])
             data_as_flex = dataset_as_flex(self._datasets[d], tuple(slices))
             data_as_flex.reshape(
                 flex.grid(data_as_flex.all()[-2:])
@@ -0,0 +1,448 @@
+#ifndef DXTBX_FORMAT_PIXEL_HISTOGRAM_H
+#define DXTBX_FORMAT_PIXEL_HISTOGRAM_H
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+#include <scitbx/array_family/shared.h>
+#include <scitbx/array_family/versa.h>
+#include <scitbx/array_family/accessors/c_grid.h>
+#include <dxtbx/format/image.h>
+#include <dxtbx/error.h>
+
+namespace dxtbx { namespace format {
+
+  /**
+   * A histogram of pixel values accumulated over a stream of images.
+   *
+   * The bins are of equal width in the value or, for logarithmic bins, in the
+   * log of the value. Each panel has its own histogram with counts of the
+   * values below and above the bins, and the number, sum, minimum and maximum
+   * of all its valid values. The values of each pixel can optionally be
+   * counted separately as well, which needs num_bins counts per pixel so is
+   * limited to a low number of bins. Masked pixels and NaN values are counted
+   * but not binned.
+   *
+   * Only the counts are stored, so the memory used does not depend on the
+   * number of images and quantiles can be estimated at any point in the
+   * stream. Each image is split into fixed blocks of pixels which are binned
+   * in parallel and merged in order, so the results do not depend on the
+   * number of threads.
+   */
+  class PixelHistogram {
+  public:
+    typedef scitbx::af::versa<int, scitbx::af::c_grid<2> > pixel_counts_type;
+
+    /** The largest number of bins for per-pixel histograms */
+    static const std::size_t max_pixel_bins = 256;
+
+    /**
+     * @param num_bins The number of bins
+     * @param min_value The lower edge of the first bin
+     * @param max_value The upper edge of the last bin
+     * @param logarithmic Use bins of equal width in the log of the value
+     * @param per_pixel Also count the values of each pixel
+     */
+    PixelHistogram(std::size_t num_bins,
+                   double min_value,
+                   double max_value,
+                   bool logarithmic = false,
+                   bool per_pixel = false)
+        : logarithmic_(logarithmic), per_pixel_(per_pixel), num_images_(0) {
+      DXTBX_ASSERT(num_bins > 0);
+      DXTBX_ASSERT(min_value < max_value);
+      DXTBX_ASSERT(!logarithmic || min_value > 0);
+      DXTBX_ASSERT(!per_pixel || num_bins <= max_pixel_bins);
+      origin_ = logarithmic ? std::log(min_value) : min_value;
+      double end = logarithmic ? std::log(max_value) : max_value;
+      double width = (end - origin_) / num_bins;
+      scale_ = 1.0 / width;
+      edges_.push_back(min_value);
+      for (std::size_t k = 1; k < num_bins; ++k) {
+        double x = origin_ + k * width;
+        edges_.push_back(logarithmic ? std::exp(x) : x);
+      }
+      edges_.push_back(max_value);
+    }
+
+    /**
+     * Accumulate the pixel values of an image
+     * @param image The image
+     * @param mask The mask (true for valid pixels, empty to use all pixels)
+     * @param num_threads The number of threads
+     */
+    template <typename T>
+    void add_image(const Image<T> &image, const Image<bool> &mask, int num_threads) {
+      DXTBX_ASSERT(num_threads > 0);
+      DXTBX_ASSERT(mask.empty() || mask.n_tiles() == image.n_tiles());
+      if (num_images_ == 0) {
+        initialize(image);
+      }
+      DXTBX_ASSERT(image.n_tiles() == num_panels());
+
+      // Split the tiles into blocks of pixels
+      std::vector<Block<T> > blocks;
+      for (std::size_t t = 0; t < image.n_tiles(); ++t) {
+        scitbx::af::const_ref<T, scitbx::af::c_grid<2> > data =
+          image.tile(t).const_ref();
+        DXTBX_ASSERT(data.accessor().all_eq(shapes_[t]));
+        const bool *m = NULL;
+        if (!mask.empty()) {
+          DXTBX_ASSERT(mask.tile(t).accessor().all_eq(shapes_[t]));
+          m = mask.tile(t).const_ref().begin();
+        }
+        int *pixel_counts = per_pixel_ ? pixel_counts_[t].begin() : NULL;
+        for (std::size_t first = 0; first < data.size(); first += block_size) {
+          Block<T> block;
+          block.panel = t;
+          block.data = data.begin();
+          block.mask = m;
+          block.pixel_counts = pixel_counts;
+          block.first = first;
+          block.last = std::min(first + block_size, data.size());
+          blocks.push_back(block);
+        }
+      }
+
+      // Bin the blocks in parallel
+      int num_blocks = static_cast<int>(blocks.size());
+#pragma omp parallel for num_threads(num_threads) schedule(dynamic) if (num_threads > 1)
+      for (int i = 0; i < num_blocks; ++i) {
+        bin_block(blocks[i]);
+      }
+
+      // Merge the blocks in order
+      for (std::size_t i = 0; i < blocks.size(); ++i) {
+        const Block<T> &block = blocks[i];
+        Totals &totals = totals_[block.panel];
+        for (std::size_t k = 0; k < num_bins(); ++k) {
+          counts_[block.panel][k] += block.counts[k];
+        }
+        totals.add(block.totals);
+      }
+      num_images_++;
+    }
+
+    /**
+     * Add the counts of another histogram with the same bins and panels
+     * @param other The other histogram
+     */
+    void merge(const PixelHistogram &other) {
+      DXTBX_ASSERT(other.logarithmic_ == logarithmic_);
+      DXTBX_ASSERT(other.per_pixel_ == per_pixel_);
+      DXTBX_ASSERT(other.edges_.size() == edges_.size());
+      DXTBX_ASSERT(std::equal(edges_.begin(), edges_.end(), other.edges_.begin()));
+      if (other.num_images_ == 0) {
+        return;
+      }
+      if (num_images_ == 0) {
+        shapes_ = other.shapes_;
+        counts_.assign(other.num_panels(), std::vector<std::size_t>(num_bins(), 0));
+        totals_.assign(other.num_panels(), Totals());
+        for (std::size_t t = 0; t < other.pixel_counts_.size(); ++t) {
+          pixel_counts_.push_back(
+            pixel_counts_type(other.pixel_counts_[t].accessor(), 0));
+        }
+      }
+      DXTBX_ASSERT(other.num_panels() == num_panels());
+      for (std::size_t t = 0; t < num_panels(); ++t) {
+        DXTBX_ASSERT(other.shapes_[t].all_eq(shapes_[t]));
+        for (std::size_t k = 0; k < num_bins(); ++k) {
+          counts_[t][k] += other.counts_[t][k];
+        }
+        totals_[t].add(other.totals_[t]);
+      }
+      for (std::size_t t = 0; t < pixel_counts_.size(); ++t) {
+        for (std::size_t k = 0; k < pixel_counts_[t].size(); ++k) {
+          pixel_counts_[t][k] += other.pixel_counts_[t][k];
+        }
+      }
+      num_images_ += other.num_images_;
+    }
+
+    /**
+     * @returns The number of bins
+     */
+    std::size_t num_bins() const {
+      return edges_.size() - 1;
+    }
+
+    /**
+     * @returns The number of panels, or zero before the first image
+     */
+    std::size_t num_panels() const {
+      return counts_.size();
+    }
+
+    /**
+     * @returns The number of images added
+     */
+    std::size_t num_images() const {
+      return num_images_;
+    }
+
+    /**
+     * @returns Are the bins of equal width in the log of the value
+     */
+    bool is_logarithmic() const {
+      return logarithmic_;
+    }
+
+    /**
+     * @returns Are the values of each pixel counted
+     */
+    bool is_per_pixel() const {
+      return per_pixel_;
+    }
+
+    /**
+     * @returns The num_bins + 1 bin edges
+     */
+    scitbx::af::shared<double> edges() const {
+      return scitbx::af::shared<double>(edges_.begin(), edges_.end());
+    }
+
+    /**
+     * @param panel The panel index
+     * @returns The number of values of the panel in each bin
+     */
+    scitbx::af::shared<std::size_t> counts(std::size_t panel) const {
+      DXTBX_ASSERT(panel < num_panels());
+      return scitbx::af::shared<std::size_t>(counts_[panel].begin(),
+                                             counts_[panel].end());
+    }
+
+    /**
+     * @param panel The panel index
+     * @returns The number of values of each pixel in each bin, with one row
+     *          per pixel in the order of the panel data
+     */
+    pixel_counts_type pixel_counts(std::size_t panel) const {
+      DXTBX_ASSERT(per_pixel_);
+      DXTBX_ASSERT(panel < num_panels());
+      return pixel_counts_[panel].deep_copy();
+    }
+
+    /**
+     * @param panel The panel index
+     * @returns The number of values of the panel below the first bin
+     */
+    std::size_t underflow(std::size_t panel) const {
+      DXTBX_ASSERT(panel < num_panels());
+      return totals_[panel].underflow;
+    }
+
+    /**
+     * @param panel The panel index
+     * @returns The number of values of the panel above the last bin
+     */
+    std::size_t overflow(std::size_t panel) const {
+      DXTBX_ASSERT(panel < num_panels());
+      return totals_[panel].overflow;
+    }
+
+    /**
+     * @param panel The panel index
+     * @returns The number of masked or NaN values of the panel
+     */
+    std::size_t num_masked(std::size_t panel) const {
+      DXTBX_ASSERT(panel < num_panels());
+      return totals_[panel].masked;
+    }
+
+    /**
+     * @param panel The panel index
+     * @returns The number of valid values of the panel
+     */
+    std::size_t num_valid(std::size_t panel) const {
+      DXTBX_ASSERT(panel < num_panels());
+      return totals_[panel].valid;
+    }
+
+    /**
+     * @param panel The panel index
+     * @returns The mean of the valid values of the panel
+     */
+    double mean(std::size_t panel) const {
+      DXTBX_ASSERT(num_valid(panel) > 0);
+      return totals_[panel].sum / totals_[panel].valid;
+    }
+
+    /**
+     * @param panel The panel index
+     * @returns The smallest valid value of the panel
+     */
+    double minimum(std::size_t panel) const {
+      DXTBX_ASSERT(num_valid(panel) > 0);
+      return totals_[panel].minimum;
+    }
+
+    /**
+     * @param panel The panel index
+     * @returns The largest valid value of the panel
+     */
+    double maximum(std::size_t panel) const {
+      DXTBX_ASSERT(num_valid(panel) > 0);
+      return totals_[panel].maximum;
+    }
+
+    /**
+     * Estimate a quantile of the valid values of a panel by interpolating
+     * within the bins, linearly in the value or in its log for logarithmic
+     * bins. Quantiles falling below or above the bins are clamped to the
+     * histogram range.
+     * @param panel The panel index
+     * @param q The quantile (between 0 and 1)
+     * @returns The estimated value
+     */
+    double quantile(std::size_t panel, double q) const {
+      DXTBX_ASSERT(num_valid(panel) > 0);
+      DXTBX_ASSERT(q >= 0 && q <= 1);
+      const std::vector<std::size_t> &counts = counts_[panel];
+      double target = q * totals_[panel].valid;
+      double cumulative = totals_[panel].underflow;
+      if (target <= cumulative) {
+        return edges_.front();
+      }
+      for (std::size_t k = 0; k < counts.size(); ++k) {
+        double count = counts[k];
+        if (count > 0 && target <= cumulative + count) {
+          double fraction = (target - cumulative) / count;
+          if (logarithmic_) {
+            return edges_[k] * std::pow(edges_[k + 1] / edges_[k], fraction);
+          }
+          return edges_[k] + fraction * (edges_[k + 1] - edges_[k]);
+        }
+        cumulative += count;
+      }
+      return edges_.back();
+    }
+
+  protected:
+    /** The number of pixels binned together by one thread */
+    static const std::size_t block_size = 65536;
+
+    struct Totals {
+      std::size_t underflow;
+      std::size_t overflow;
+      std::size_t masked;
+      std::size_t valid;
+      double sum;
+      double minimum;
+      double maximum;
+
+      Totals()
+          : underflow(0),
+            overflow(0),
+            masked(0),
+            valid(0),
+            sum(0),
+            minimum(std::numeric_limits<double>::infinity()),
+            maximum(-std::numeric_limits<double>::infinity()) {}
+
+      void add(const Totals &other) {
+        underflow += other.underflow;
+        overflow += other.overflow;
+        masked += other.masked;
+        valid += other.valid;
+        sum += other.sum;
+        minimum = std::min(minimum, other.minimum);
+        maximum = std::max(maximum, other.maximum);
+      }
+    };
+
+    template <typename T>
+    struct Block {
+      std::size_t panel;
+      const T *data;
+      const bool *mask;
+      int *pixel_counts;
+      std::size_t first;
+      std::size_t last;
+      std::vector<std::size_t> counts;
+      Totals totals;
+    };
+
+    template <typename T>
+    void initialize(const Image<T> &image) {
+      for (std::size_t t = 0; t < image.n_tiles(); ++t) {
+        scitbx::af::c_grid<2> grid = image.tile(t).accessor();
+        shapes_.push_back(grid);
+        counts_.push_back(std::vector<std::size_t>(num_bins(), 0));
+        totals_.push_back(Totals());
+        if (per_pixel_) {
+          pixel_counts_.push_back(pixel_counts_type(
+            scitbx::af::c_grid<2>(grid[0] * grid[1], num_bins()), 0));
+        }
+      }
+    }
+
+    /**
+     * Find the bin of a value. The estimate from the bin width is checked
+     * against the edges so values on an edge go in the bin above it.
+     * @returns The bin, or -1 below the bins and num_bins above them
+     */
+    int find_bin(double value) const {
+      int n = static_cast<int>(num_bins());
+      if (value < edges_.front()) {
+        return -1;
+      }
+      if (value >= edges_.back()) {
+        return n;
+      }
+      double x = logarithmic_ ? std::log(value) : value;
+      int k = std::max(0, std::min(n - 1, static_cast<int>((x - origin_) * scale_)));
+      while (k > 0 && value < edges_[k]) {
+        --k;
+      }
+      while (k < n - 1 && value >= edges_[k + 1]) {
+        ++k;
+      }
+      return k;
+    }
+
+    template <typename T>
+    void bin_block(Block<T> &block) const {
+      int n = static_cast<int>(num_bins());
+      block.counts.assign(num_bins(), 0);
+      Totals &totals = block.totals;
+      for (std::size_t i = block.first; i < block.last; ++i) {
+        double value = block.data[i];
+        if ((block.mask != NULL && !block.mask[i]) || value != value) {
+          totals.masked++;
+          continue;
+        }
+        totals.valid++;
+        totals.sum += value;
+        totals.minimum = std::min(totals.minimum, value);
+        totals.maximum = std::max(totals.maximum, value);
+        int k = find_bin(value);
+        if (k < 0) {
+          totals.underflow++;
+        } else if (k == n) {
+          totals.overflow++;
+        } else {
+          block.counts[k]++;
+          if (block.pixel_counts != NULL) {
+            block.pixel_counts[i * num_bins() + k]++;
+          }
+        }
+      }
+    }
+
+    bool logarithmic_;
+    bool per_pixel_;
+    std::size_t num_images_;
+    double origin_;
+    double scale_;
+    std::vector<double> edges_;
+    std::vector<scitbx::af::c_grid<2> > shapes_;
+    std::vector<std::vector<std::size_t> > counts_;
+    std::vector<Totals> totals_;
+    std::vector<pixel_counts_type> pixel_counts_;
+  };
+
+}}  // namespace dxtbx::format
+
+#endif  // DXTBX_FORMAT_PIXEL_HISTOGRAM_H
@@ -0,0 +1,557 @@
+#ifndef DXTBX_FORMAT_SHARED_FRAME_CACHE_H
+#define DXTBX_FORMAT_SHARED_FRAME_CACHE_H
+
+#include <algorithm>
+#include <cstring>
+#include <new>
+#include <sstream>
+#include <string>
+#include <sys/stat.h>
+#include <boost/cstdint.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/type_traits/is_same.hpp>
+#include <boost/interprocess/managed_shared_memory.hpp>
+#include <boost/interprocess/shared_memory_object.hpp>
+#include <boost/interprocess/sync/interprocess_mutex.hpp>
+#include <boost/interprocess/sync/scoped_lock.hpp>
+#include <scitbx/array_family/versa.h>
+#include <scitbx/array_family/ref.h>
+#include <scitbx/array_family/accessors/c_grid.h>
+#include <dxtbx/format/image.h>
+#include <dxtbx/error.h>
+
+namespace dxtbx { namespace format {
+
+  namespace detail {
+
+    /**
+     * The maximum length of a frame key, including the terminating null
+     */
+    const std::size_t shared_frame_key_size = 512;
+
+    /**
+     * The book keeping for the whole cache, stored in the shared segment
+     */
+    struct SharedFrameCacheHeader {
+      SharedFrameCacheHeader(std::size_t max_bytes_, std::size_t max_frames_)
+          : max_bytes(max_bytes_), max_frames(max_frames_), num_bytes(0), clock(0) {}
+
+      boost::interprocess::interprocess_mutex mutex;
+      std::size_t max_bytes;
+      std::size_t max_frames;
+      std::size_t num_bytes;
+      boost::uint64_t clock;
+    };
+
+    /**
+     * A slot for a single decoded frame, stored in the shared segment. The
+     * pixel data lives in a separate block referenced by a handle because
+     * the segment is mapped at a different address in each process.
+     */
+    struct SharedFrameEntry {
+      SharedFrameEntry()
+          : used(false),
+            ready(false),
+            is_int(false),
+            n_tiles(0),
+            bytes(0),
+            handle(0),
+            refcount(0),
+            last_used(0) {
+        key[0] = '\0';
+      }
+
+      char key[shared_frame_key_size];
+      bool used;
+      bool ready;
+      bool is_int;
+      std::size_t n_tiles;
+      std::size_t bytes;
+      boost::interprocess::managed_shared_memory::handle_t handle;
+      int refcount;
+      boost::uint64_t last_used;
+    };
+
+    typedef boost::interprocess::scoped_lock<boost::interprocess::interprocess_mutex>
+      shared_frame_lock;
+
+    /**
+     * The mapping of the shared segment in this process
+     */
+    struct SharedFrameSegment : boost::noncopyable {
+      boost::interprocess::managed_shared_memory memory;
+      SharedFrameCacheHeader *header;
+      SharedFrameEntry *entries;
+    };
+
+    /**
+     * Keeps a frame pinned in the cache while any view of it is alive
+     */
+    class SharedFramePin : boost::noncopyable {
+    public:
+      SharedFramePin(boost::shared_ptr<SharedFrameSegment> segment, std::size_t slot)
+          : segment_(segment), slot_(slot) {}
+
+      ~SharedFramePin() {
+        shared_frame_lock lock(segment_->header->mutex);
+        segment_->entries[slot_].refcount--;
+      }
+
+      const SharedFrameEntry &entry() const {
+        return segment_->entries[slot_];
+      }
+
+      const char *address() const {
+        return static_cast<const char *>(
+          segment_->memory.get_address_from_handle(entry().handle));
+      }
+
+    private:
+      boost::shared_ptr<SharedFrameSegment> segment_;
+      std::size_t slot_;
+    };
+
+  }  // namespace detail
+
+  /**
+   * A decoded frame held in a shared frame cache. The tiles are read in place
+   * from shared memory and the frame cannot be evicted while a copy of this
+   * object exists.
+   */
+  class SharedFrame {
+  public:
+    SharedFrame() {}
+
+    SharedFrame(boost::shared_ptr<detail::SharedFramePin> pin) : pin_(pin) {}
+
+    /**
+     * @returns Is there no frame
+     */
+    bool empty() const {
+      return !pin_;
+    }
+
+    /**
+     * @returns Is the frame int data (otherwise it is double data)
+     */
+    bool is_int() const {
+      DXTBX_ASSERT(!empty());
+      return pin_->entry().is_int;
+    }
+
+    /**
+     * @returns The number of tiles
+     */
+    std::size_t n_tiles() const {
+      DXTBX_ASSERT(!empty());
+      return pin_->entry().n_tiles;
+    }
+
+    /**
+     * @param index The tile index
+     * @returns The shape of the tile
+     */
+    scitbx::af::c_grid<2> tile_accessor(std::size_t index) const {
+      DXTBX_ASSERT(index < n_tiles());
+      const std::size_t *shape = shapes();
+      return scitbx::af::c_grid<2>(shape[2 * index], shape[2 * index + 1]);
+    }
+
+    /**
+     * Get a view of a tile in shared memory without copying
+     * @param index The tile index
+     * @returns A reference to the tile data
+     */
+    template <typename T>
+    scitbx::af::const_ref<T, scitbx::af::c_grid<2> > tile_ref(std::size_t index) const {
+      DXTBX_ASSERT(index < n_tiles());
+      DXTBX_ASSERT(is_int() == (boost::is_same<T, int>::value));
+      const T *data = reinterpret_cast<const T *>(shapes() + 2 * n_tiles());
+      for (std::size_t i = 0; i < index; ++i) {
+        data += tile_accessor(i).size_1d();
+      }
+      return scitbx::af::const_ref<T, scitbx::af::c_grid<2> >(data,
+                                                              tile_accessor(index));
+    }
+
+    /**
+     * @returns A private copy of the frame
+     */
+    ImageBuffer image_buffer() const {
+      if (is_int()) {
+        return ImageBuffer(copy_image<int>());
+      }
+      return ImageBuffer(copy_image<double>());
+    }
+
+  protected:
+    const std::size_t *shapes() const {
+      return reinterpret_cast<const std::size_t *>(pin_->address());
+    }
+
+    template <typename T>
+    Image<T> copy_image() const {
+      Image<T> result;
+      for (std::size_t i = 0; i < n_tiles(); ++i) {
+        scitbx::af::const_ref<T, scitbx::af::c_grid<2> > src = tile_ref<T>(i);
+        scitbx::af::versa<T, scitbx::af::c_grid<2> > data(
+          src.accessor(), scitbx::af::init_functor_null<T>());
+        std::copy(src.begin(), src.end(), data.begin());
+        result.push_back(ImageTile<T>(data));
+      }
+      return result;
+    }
+
+    boost::shared_ptr<detail::SharedFramePin> pin_;
+  };
+
+  /**
+   * A cache of decoded frames in a named shared memory segment, so that
+   * several processes on the same node reading the same images decode each
+   * frame only once. Frames are keyed by a string which should identify the
+   * file and the image within it (see frame_key). When adding a frame would
+   * take the cache over its byte budget, the least recently used frames which
+   * are not pinned by a SharedFrame in any process are evicted.
+   *
+   * Every process opening a cache with the same name shares the same frames;
+   * the size of the cache is fixed by the first process to create it. The
+   * segment persists until removed with SharedFrameCache::remove. Int frames
+   * are stored as int; all other frames are stored as double. A process which
+   * dies while holding a frame leaves it pinned until the segment is removed.
+   */
+  class SharedFrameCache {
+  public:
+    /**
+     * Create or open a cache
+     * @param name The name of the shared memory segment
+     * @param max_bytes The maximum number of bytes of frame data
+     * @param max_frames The maximum number of frames
+     */
+    SharedFrameCache(const std::string &name,
+                     std::size_t max_bytes,
+                     std::size_t max_frames = 4096)
+        : name_(name) {
+      using namespace boost::interprocess;
+      DXTBX_ASSERT(max_bytes > 0);
+      DXTBX_ASSERT(max_frames > 0);
+      std::size_t size = max_bytes + max_frames * sizeof(detail::SharedFrameEntry)
+                         + max_frames * 256 + (1 << 20);
+      segment_ = boost::make_shared<detail::SharedFrameSegment>();
+      try {
+        managed_shared_memory memory(open_or_create, name.c_str(), size);
+        segment_->memory.swap(memory);
+        segment_->header =
+          segment_->memory.find_or_construct<detail::SharedFrameCacheHeader>(
+            "header")(max_bytes, max_frames);
+        segment_->entries =
+          segment_->memory.find_or_construct<detail::SharedFrameEntry>("entries")
+            [segment_->header->max_frames]();
+      } catch (const interprocess_exception &e) {
+        throw DXTBX_ERROR("Unable to open shared frame cache " + name + ": "
+                          + e.what());
+      }
+    }
+
+    /**
+     * Remove a shared memory segment. Processes which have the cache open
+     * keep using it until they close it.
+     * @param name The name of the segment
+     * @returns True if the segment existed
+     */
+    static bool remove(const std::string &name) {
+      return boost::interprocess::shared_memory_object::remove(name.c_str());
+    }
+
+    /**
+     * Make a key for an image in a file. The key includes the size and the
+     * modification time of the file so a rewritten file is not confused with
+     * the frames cached from the old one.
+     * @param path The file path
+     * @param index The index of the image
+     * @returns The key
+     */
+    static std::string frame_key(const std::string &path, std::size_t index) {
+      std::ostringstream key;
+      key << index << ":";
+      struct stat info;
+      if (::stat(path.c_str(), &info) == 0) {
+        key << info.st_size << ":" << info.st_mtime << ":";
+      }
+      key << path;
+      return key.str();
+    }
+
+    /**
+     * @returns The name of the shared memory segment
+     */
+    std::string name() const {
+      return name_;
+    }
+
+    /**
+     * @returns The maximum number of bytes of frame data
+     */
+    std::size_t max_bytes() const {
+      return segment_->header->max_bytes;
+    }
+
+    /**
+     * @returns The maximum number of frames
+     */
+    std::size_t max_frames() const {
+      return segment_->header->max_frames;
+    }
+
+    /**
+     * @returns The number of bytes of frame data in the cache
+     */
+    std::size_t num_bytes() const {
+      detail::shared_frame_lock lock(segment_->header->mutex);
+      return segment_->header->num_bytes;
+    }
+
+    /**
+     * @returns The number of frames in the cache
+     */
+    std::size_t num_frames() const {
+      detail::shared_frame_lock lock(segment_->header->mutex);
+      std::size_t count = 0;
+      for (std::size_t i = 0; i < max_frames(); ++i) {
+        if (segment_->entries[i].used && segment_->entries[i].ready) {
+          count++;
+        }
+      }
+      return count;
+    }
+
+    /**
+     * @param key The frame key
+     * @returns Is the frame in the cache
+     */
+    bool contains(const std::string &key) const {
+      detail::shared_frame_lock lock(segment_->header->mutex);
+      std::size_t slot = find_slot(key);
+      return slot < max_frames() && segment_->entries[slot].ready;
+    }
+
+    /**
+     * Find a frame and pin it in the cache
+     * @param key The frame key
+     * @returns The frame, or an empty frame if it is not cached
+     */
+    SharedFrame find(const std::string &key) {
+      detail::shared_frame_lock lock(segment_->header->mutex);
+      std::size_t slot = find_slot(key);
+      if (slot == max_frames() || !segment_->entries[slot].ready) {
+        return SharedFrame();
+      }
+      return pin(slot);
+    }
+
+    /**
+     * Add a frame to the cache, evicting unpinned frames if needed. If the
+     * frame is already cached, or is being added by another process, the
+     * cached frame is left as it is.
+     * @param key The frame key
+     * @param buffer The decoded frame
+     * @returns The cached frame, or an empty frame if it could not be added
+     */
+    SharedFrame insert(const std::string &key, const ImageBuffer &buffer) {
+      if (key.size() >= detail::shared_frame_key_size || buffer.is_empty()) {
+        return SharedFrame();
+      }
+      bool is_int = buffer.is_int() || buffer.is_sparse_int();
+      if (is_int) {
+        return insert_image(key, buffer.dense().as_int(), true);
+      }
+      return insert_image(key, buffer.dense().as_double(), false);
+    }
+
+    /**
+     * Remove all the frames which are not pinned
+     */
+    void clear() {
+      detail::shared_frame_lock lock(segment_->header->mutex);
+      for (std::size_t i = 0; i < max_frames(); ++i) {
+        detail::SharedFrameEntry &entry = segment_->entries[i];
+        if (entry.used && entry.ready && entry.refcount == 0) {
+          release(i);
+        }
+      }
+    }
+
+  protected:
+    /**
+     * Find the slot holding a key. The lock must be held.
+     * @returns The slot or max_frames() if not found
+     */
+    std::size_t find_slot(const std::string &key) const {
+      if (key.size() >= detail::shared_frame_key_size) {
+        return max_frames();
+      }
+      for (std::size_t i = 0; i < max_frames(); ++i) {
+        const detail::SharedFrameEntry &entry = segment_->entries[i];
+        if (entry.used && std::strcmp(entry.key, key.c_str()) == 0) {
+          return i;
+        }
+      }
+      return max_frames();
+    }
+
+    /**
+     * Pin a frame and mark it as recently used. The lock must be held.
+     */
+    SharedFrame pin(std::size_t slot) {
+      detail::SharedFrameEntry &entry = segment_->entries[slot];
+      entry.refcount++;
+      entry.last_used = ++segment_->header->clock;
+      return SharedFrame(boost::make_shared<detail::SharedFramePin>(segment_, slot));
+    }
+
+    /**
+     * Free the data of a frame and its slot. The lock must be held.
+     */
+    void release(std::size_t slot) {
+      detail::SharedFrameEntry &entry = segment_->entries[slot];
+      segment_->memory.deallocate(
+        segment_->memory.get_address_from_handle(entry.handle));
+      segment_->header->num_bytes -= entry.bytes;
+      entry = detail::SharedFrameEntry();
+    }
+
+    /**
+     * Evict the least recently used unpinned frame. The lock must be held.
+     * @returns False if every frame is pinned
+     */
+    bool evict() {
+      std::size_t oldest = max_frames();
+      for (std::size_t i = 0; i < max_frames(); ++i) {
+        const detail::SharedFrameEntry &entry = segment_->entries[i];
+        if (entry.used && entry.ready && entry.refcount == 0
+            && (oldest == max_frames()
+                || entry.last_used < segment_->entries[oldest].last_used)) {
+          oldest = i;
+        }
+      }
+      if (oldest == max_frames()) {
+        return false;
+      }
+      release(oldest);
+      return true;
+    }
+
+    /**
+     * Find a free slot, evicting a frame if needed. The lock must be held.
+     * @returns The slot or max_frames() if there is none
+     */
+    std::size_t free_slot() {
+      for (;;) {
+        for (std::size_t i = 0; i < max_frames(); ++i) {
+          if (!segment_->entries[i].used) {
+            return i;
+          }
+        }
+        if (!evict()) {
+          return max_frames();
+        }
+      }
+    }
+
+    /**
+     * Reserve a slot and the memory for a frame. The lock must be held.
+     * @returns The slot or max_frames() if there is no room
+     */
+    std::size_t reserve(const std::string &key, std::size_t bytes) {
+      detail::SharedFrameCacheHeader *header = segment_->header;
+      if (bytes > header->max_bytes) {
+        return max_frames();
+      }
+      while (header->num_bytes + bytes > header->max_bytes) {
+        if (!evict()) {
+          return max_frames();
+        }
+      }
+      std::size_t slot = free_slot();
+      if (slot == max_frames()) {
+        return max_frames();
+      }
+      void *address = segment_->memory.allocate(bytes, std::nothrow);
+      while (address == NULL) {
+        // The segment is fragmented so make room by evicting more frames
+        if (!evict()) {
+          return max_frames();
+        }
+        address = segment_->memory.allocate(bytes, std::nothrow);
+      }
+      detail::SharedFrameEntry &entry = segment_->entries[slot];
+      std::strcpy(entry.key, key.c_str());
+      entry.used = true;
+      entry.ready = false;
+      entry.bytes = bytes;
+      entry.handle = segment_->memory.get_handle_from_address(address);
+      entry.refcount = 1;
+      header->num_bytes += bytes;
+      return slot;
+    }
+
+    template <typename T>
+    SharedFrame insert_image(const std::string &key,
+                             const Image<T> &image,
+                             bool is_int) {
+      std::size_t n_tiles = image.n_tiles();
+      if (n_tiles == 0) {
+        return SharedFrame();
+      }
+      std::size_t header_bytes = 2 * n_tiles * sizeof(std::size_t);
+      std::size_t bytes = header_bytes;
+      for (std::size_t i = 0; i < n_tiles; ++i) {
+        bytes += image.tile(i).data().size() * sizeof(T);
+      }
+
+      // Reserve the memory, unless another process already has the frame
+      std::size_t slot;
+      {
+        detail::shared_frame_lock lock(segment_->header->mutex);
+        slot = find_slot(key);
+        if (slot < max_frames()) {
+          return segment_->entries[slot].ready ? pin(slot) : SharedFrame();
+        }
+        slot = reserve(key, bytes);
+        if (slot == max_frames()) {
+          return SharedFrame();
+        }
+      }
+
+      // Copy the frame without holding the lock; the slot is not visible to
+      // other processes until it is marked as ready
+      detail::SharedFrameEntry &entry = segment_->entries[slot];
+      char *address =
+        static_cast<char *>(segment_->memory.get_address_from_handle(entry.handle));
+      std::size_t *shape = reinterpret_cast<std::size_t *>(address);
+      T *data = reinterpret_cast<T *>(address + header_bytes);
+      for (std::size_t i = 0; i < n_tiles; ++i) {
+        scitbx::af::versa<T, scitbx::af::c_grid<2> > tile = image.tile(i).data();
+        shape[2 * i] = tile.accessor()[0];
+        shape[2 * i + 1] = tile.accessor()[1];
+        std::copy(tile.begin(), tile.end(), data);
+        data += tile.size();
+      }
+
+      // Publish the frame, keeping the pin taken when it was reserved
+      detail::shared_frame_lock lock(segment_->header->mutex);
+      entry.is_int = is_int;
+      entry.n_tiles = n_tiles;
+      entry.ready = true;
+      entry.last_used = ++segment_->header->clock;
+      return SharedFrame(boost::make_shared<detail::SharedFramePin>(segment_, slot));
+    }
+
+    std::string name_;
+    boost::shared_ptr<detail::SharedFrameSegment> segment_;
+  };
+
+}}  // namespace dxtbx::format
+
+#endif  // DXTBX_FORMAT_SHARED_FRAME_CACHE_H
@@ -0,0 +1,417 @@
+/*
+ * image_assembly.h
+ *
+ *  This code is distributed under the BSD license, a copy of which is
+ *  included in the root directory of this package.
+ */
+#ifndef DXTBX_IMAGE_ASSEMBLY_H
+#define DXTBX_IMAGE_ASSEMBLY_H
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include <scitbx/vec2.h>
+#include <scitbx/vec3.h>
+#include <scitbx/array_family/versa.h>
+#include <scitbx/array_family/tiny_types.h>
+#include <scitbx/array_family/accessors/c_grid.h>
+#include <dxtbx/model/detector.h>
+#include <dxtbx/format/image.h>
+#include <dxtbx/error.h>
+
+namespace dxtbx {
+
+  /**
+   * Assemble the panels of a detector into a single 2D image for display.
+   *
+   * The panels are projected onto the plane which best fits the detector,
+   * with the x axis of the image closest to the laboratory x axis and the rows
+   * running against the laboratory y axis, so a single panel detector with
+   * the usual orientation assembles to the raw image. A lookup table from
+   * each image pixel to the panel pixels which cover it is built once for
+   * the detector geometry, so assembling a frame is a single gather over the
+   * table. Pixels in the gaps between panels take a fixed value. Where panels
+   * overlap in projection the first panel is used.
+   */
+  class ImageAssembler {
+  public:
+    typedef scitbx::af::versa<double, scitbx::af::c_grid<2> > array_type;
+
+    /**
+     * Build the lookup table for a detector
+     * @param detector The detector
+     * @param pixel_size The size of an assembled pixel (mm), or zero to use
+     *                   the smallest panel pixel size
+     * @param bilinear Interpolate bilinearly rather than take the nearest pixel
+     */
+    ImageAssembler(const model::Detector &detector,
+                   double pixel_size = 0,
+                   bool bilinear = false)
+        : pixel_size_(pixel_size), bilinear_(bilinear) {
+      DXTBX_ASSERT(detector.size() > 0);
+      DXTBX_ASSERT(pixel_size >= 0);
+      compute_plane(detector);
+      for (std::size_t i = 0; i < detector.size(); ++i) {
+        image_sizes_.push_back(detector[i].get_image_size());
+      }
+      if (pixel_size_ == 0) {
+        pixel_size_ = detector[0].get_pixel_size()[0];
+        for (std::size_t i = 0; i < detector.size(); ++i) {
+          scitbx::af::double2 size = detector[i].get_pixel_size();
+          pixel_size_ = std::min(pixel_size_, std::min(size[0], size[1]));
+        }
+      }
+      DXTBX_ASSERT(pixel_size_ > 0);
+
+      // Find the extent of the projected panels
+      double xmin = 0, xmax = 0, ymin = 0, ymax = 0;
+      for (std::size_t i = 0; i < detector.size(); ++i) {
+        for (std::size_t k = 0; k < 4; ++k) {
+          scitbx::vec2<double> p = project(panel_corner(detector[i], k));
+          if ((i == 0 && k == 0) || p[0] < xmin) xmin = p[0];
+          if ((i == 0 && k == 0) || p[0] > xmax) xmax = p[0];
+          if ((i == 0 && k == 0) || p[1] < ymin) ymin = p[1];
+          if ((i == 0 && k == 0) || p[1] > ymax) ymax = p[1];
+        }
+      }
+      xmin_ = xmin;
+      ymax_ = ymax;
+      std::size_t width =
+        std::max(1, static_cast<int>(std::ceil((xmax - xmin) / pixel_size_ - 1e-6)));
+      std::size_t height =
+        std::max(1, static_cast<int>(std::ceil((ymax - ymin) / pixel_size_ - 1e-6)));
+      grid_ = scitbx::af::c_grid<2>(height, width);
+      coverage_ = scitbx::af::versa<int, scitbx::af::c_grid<2> >(grid_, -1);
+
+      for (std::size_t i = 0; i < detector.size(); ++i) {
+        add_panel(detector[i], i);
+      }
+    }
+
+    /**
+     * @returns The assembled image size (width, height)
+     */
+    scitbx::af::tiny<std::size_t, 2> get_image_size() const {
+      return scitbx::af::tiny<std::size_t, 2>(grid_[1], grid_[0]);
+    }
+
+    /**
+     * @returns The size of an assembled pixel (mm)
+     */
+    double get_pixel_size() const {
+      return pixel_size_;
+    }
+
+    /**
+     * @returns Is the image interpolated bilinearly
+     */
+    bool is_bilinear() const {
+      return bilinear_;
+    }
+
+    /**
+     * @returns The number of assembled pixels covered by a panel
+     */
+    std::size_t num_covered() const {
+      return canvas_.size();
+    }
+
+    /**
+     * @returns The panel covering each assembled pixel, or -1 in the gaps
+     */
+    scitbx::af::versa<int, scitbx::af::c_grid<2> > coverage() const {
+      return coverage_;
+    }
+
+    /**
+     * Map a point on a panel to the assembled image
+     * @param panel The panel
+     * @param xy The panel pixel coordinate (fast, slow)
+     * @returns The assembled image coordinate (x, y)
+     */
+    scitbx::vec2<double> panel_to_image(std::size_t panel,
+                                        scitbx::vec2<double> xy) const {
+      DXTBX_ASSERT(panel < panels_.size());
+      const PanelFrame &frame = panels_[panel];
+      scitbx::vec2<double> p = frame.origin + xy[0] * frame.pixel_size[0] * frame.fast
+                               + xy[1] * frame.pixel_size[1] * frame.slow;
+      return scitbx::vec2<double>((p[0] - xmin_) / pixel_size_,
+                                  (ymax_ - p[1]) / pixel_size_);
+    }
+
+    /**
+     * Assemble an image
+     * @param image The image with one tile per panel
+     * @param mask The mask (true for valid pixels, empty to use all pixels)
+     * @param gap_value The value of pixels in the gaps or fully masked
+     * @param num_threads The number of threads
+     * @returns The assembled image
+     */
+    template <typename T>
+    array_type assemble(const format::Image<T> &image,
+                        const format::Image<bool> &mask,
+                        double gap_value,
+                        int num_threads = 1) const {
+      DXTBX_ASSERT(num_threads > 0);
+      std::vector<scitbx::af::versa<T, scitbx::af::c_grid<2> > > data =
+        tile_data(image);
+      std::vector<scitbx::af::versa<bool, scitbx::af::c_grid<2> > > valid;
+      if (!mask.empty()) {
+        valid = tile_data(mask);
+      }
+      array_type result(grid_, gap_value);
+      double *out = result.begin();
+      std::size_t n = bilinear_ ? 4 : 1;
+      int num_lookups = static_cast<int>(canvas_.size());
+#pragma omp parallel for num_threads(num_threads) schedule(static) if (num_threads > 1)
+      for (int k = 0; k < num_lookups; ++k) {
+        const T *d = data[panel_[k]].begin();
+        const bool *m = valid.empty() ? NULL : valid[panel_[k]].begin();
+        double sum = 0;
+        double sum_weight = 0;
+        for (std::size_t j = k * n; j < (k + 1) * n; ++j) {
+          if (weight_[j] > 0 && (m == NULL || m[pixel_[j]])) {
+            sum += weight_[j] * static_cast<double>(d[pixel_[j]]);
+            sum_weight += weight_[j];
+          }
+        }
+        if (sum_weight > 0) {
+          out[canvas_[k]] = sum / sum_weight;
+        }
+      }
+      return result;
+    }
+
+    /**
+     * Assemble an image buffer
+     * @param buffer The image buffer
+     * @param mask The mask (true for valid pixels, empty to use all pixels)
+     * @param gap_value The value of pixels in the gaps or fully masked
+     * @param num_threads The number of threads
+     * @returns The assembled image
+     */
+    array_type assemble(const format::ImageBuffer &buffer,
+                        const format::Image<bool> &mask,
+                        double gap_value,
+                        int num_threads = 1) const {
+      format::ImageBuffer dense = buffer.dense();
+      if (dense.is_int()) {
+        return assemble(dense.as_int(), mask, gap_value, num_threads);
+      } else if (dense.is_float()) {
+        return assemble(dense.as_float(), mask, gap_value, num_threads);
+      } else if (dense.is_double()) {
+        return assemble(dense.as_double(), mask, gap_value, num_threads);
+      }
+      throw DXTBX_ERROR("Problem reading image data");
+    }
+
+    /**
+     * Assemble a mask
+     * @param mask The mask (true for valid pixels)
+     * @returns True for assembled pixels covered by a valid panel pixel
+     */
+    scitbx::af::versa<bool, scitbx::af::c_grid<2> > assemble_mask(
+      const format::Image<bool> &mask) const {
+      std::vector<scitbx::af::versa<bool, scitbx::af::c_grid<2> > > valid =
+        tile_data(mask);
+      scitbx::af::versa<bool, scitbx::af::c_grid<2> > result(grid_, false);
+      std::size_t n = bilinear_ ? 4 : 1;
+      for (std::size_t k = 0; k < canvas_.size(); ++k) {
+        for (std::size_t j = k * n; j < (k + 1) * n; ++j) {
+          if (weight_[j] > 0 && valid[panel_[k]][pixel_[j]]) {
+            result[canvas_[k]] = true;
+            break;
+          }
+        }
+      }
+      return result;
+    }
+
+  protected:
+    struct PanelFrame {
+      scitbx::vec2<double> origin;
+      scitbx::vec2<double> fast;
+      scitbx::vec2<double> slow;
+      scitbx::af::double2 pixel_size;
+    };
+
+    static scitbx::vec3<double> panel_corner(const model::Panel &panel,
+                                             std::size_t corner) {
+      scitbx::af::double2 size = panel.get_image_size_mm();
+      scitbx::vec3<double> p = panel.get_origin();
+      if (corner & 1) p += size[0] * panel.get_fast_axis();
+      if (corner & 2) p += size[1] * panel.get_slow_axis();
+      return p;
+    }
+
+    /**
+     * Find the plane of the detector. The normal is the mean of the panel
+     * normals, each pointing back towards the sample.
+     */
+    void compute_plane(const model::Detector &detector) {
+      scitbx::vec3<double> normal(0, 0, 0);
+      centre_ = scitbx::vec3<double>(0, 0, 0);
+      for (std::size_t i = 0; i < detector.size(); ++i) {
+        scitbx::vec3<double> panel_centre(0, 0, 0);
+        for (std::size_t k = 0; k < 4; ++k) {
+          panel_centre += 0.25 * panel_corner(detector[i], k);
+        }
+        scitbx::vec3<double> n = detector[i].get_normal();
+        normal += n * panel_centre > 0 ? -n : n;
+        centre_ += panel_centre / static_cast<double>(detector.size());
+      }
+      DXTBX_ASSERT(normal.length() > 0);
+      normal = normal.normalize();
+
+      // Take x from the laboratory x axis, or the first fast axis if the
+      // plane is perpendicular to it
+      scitbx::vec3<double> x(1, 0, 0);
+      x -= (x * normal) * normal;
+      if (x.length() < 1e-3) {
+        x = detector[0].get_fast_axis();
+        x -= (x * normal) * normal;
+      }
+      x_axis_ = x.normalize();
+      y_axis_ = normal.cross(x_axis_).normalize();
+
+      for (std::size_t i = 0; i < detector.size(); ++i) {
+        PanelFrame frame;
+        frame.origin = project(detector[i].get_origin());
+        frame.fast = project_direction(detector[i].get_fast_axis());
+        frame.slow = project_direction(detector[i].get_slow_axis());
+        frame.pixel_size = detector[i].get_pixel_size();
+        panels_.push_back(frame);
+      }
+    }
+
+    scitbx::vec2<double> project_direction(const scitbx::vec3<double> &v) const {
+      return scitbx::vec2<double>(v * x_axis_, v * y_axis_);
+    }
+
+    scitbx::vec2<double> project(const scitbx::vec3<double> &p) const {
+      return project_direction(p - centre_);
+    }
+
+    /**
+     * Add the lookups for the assembled pixels covered by a panel
+     */
+    void add_panel(const model::Panel &panel, std::size_t index) {
+      const PanelFrame &frame = panels_[index];
+      double det = frame.fast[0] * frame.slow[1] - frame.fast[1] * frame.slow[0];
+      if (std::abs(det) < 1e-6) {
+        // The panel is edge on to the plane
+        return;
+      }
+      int nx = static_cast<int>(image_sizes_[index][0]);
+      int ny = static_cast<int>(image_sizes_[index][1]);
+
+      // Find the bounding box of the panel in the assembled image
+      int x0 = static_cast<int>(grid_[1]), x1 = 0;
+      int y0 = static_cast<int>(grid_[0]), y1 = 0;
+      for (std::size_t k = 0; k < 4; ++k) {
+        scitbx::vec2<double> p = project(panel_corner(panel, k));
+        double x = (p[0] - xmin_) / pixel_size_;
+        double y = (ymax_ - p[1]) / pixel_size_;
+        x0 = std::min(x0, static_cast<int>(std::floor(x)) - 1);
+        x1 = std::max(x1, static_cast<int>(std::ceil(x)) + 1);
+        y0 = std::min(y0, static_cast<int>(std::floor(y)) - 1);
+        y1 = std::max(y1, static_cast<int>(std::ceil(y)) + 1);
+      }
+      x0 = std::max(x0, 0);
+      y0 = std::max(y0, 0);
+      x1 = std::min(x1, static_cast<int>(grid_[1]));
+      y1 = std::min(y1, static_cast<int>(grid_[0]));
+
+      for (int j = y0; j < y1; ++j) {
+        for (int i = x0; i < x1; ++i) {
+          std::size_t canvas = j * grid_[1] + i;
+          if (coverage_[canvas] >= 0) {
+            continue;
+          }
+
+          // Solve for the panel coordinate of the pixel centre
+          scitbx::vec2<double> q(xmin_ + (i + 0.5) * pixel_size_,
+                                 ymax_ - (j + 0.5) * pixel_size_);
+          q -= frame.origin;
+          double u = (q[0] * frame.slow[1] - q[1] * frame.slow[0]) / det;
+          double v = (frame.fast[0] * q[1] - frame.fast[1] * q[0]) / det;
+          double px = u / frame.pixel_size[0];
+          double py = v / frame.pixel_size[1];
+          if (px < 0 || py < 0 || px >= nx || py >= ny) {
+            continue;
+          }
+          coverage_[canvas] = static_cast<int>(index);
+          canvas_.push_back(canvas);
+          panel_.push_back(index);
+          if (!bilinear_) {
+            pixel_.push_back(static_cast<std::size_t>(py) * nx
+                             + static_cast<std::size_t>(px));
+            weight_.push_back(1.0);
+            continue;
+          }
+
+          // Interpolate between the neighbouring pixel centres, dropping the
+          // neighbours which fall off the panel
+          double fx = px - 0.5;
+          double fy = py - 0.5;
+          int ix = static_cast<int>(std::floor(fx));
+          int iy = static_cast<int>(std::floor(fy));
+          double wx = fx - ix;
+          double wy = fy - iy;
+          for (int dy = 0; dy < 2; ++dy) {
+            for (int dx = 0; dx < 2; ++dx) {
+              int x = ix + dx;
+              int y = iy + dy;
+              double w = (dx ? wx : 1 - wx) * (dy ? wy : 1 - wy);
+              if (x < 0 || y < 0 || x >= nx || y >= ny) {
+                w = 0;
+                x = 0;
+                y = 0;
+              }
+              pixel_.push_back(static_cast<std::size_t>(y) * nx + x);
+              weight_.push_back(w);
+            }
+          }
+        }
+      }
+    }
+
+    /**
+     * Get the data of each tile, checking the tiles match the panels. This is
+     * done before any parallel region since reading the data of a view may
+     * copy it.
+     */
+    template <typename T>
+    std::vector<scitbx::af::versa<T, scitbx::af::c_grid<2> > > tile_data(
+      const format::Image<T> &image) const {
+      DXTBX_ASSERT(image.n_tiles() == image_sizes_.size());
+      std::vector<scitbx::af::versa<T, scitbx::af::c_grid<2> > > result;
+      for (std::size_t i = 0; i < image.n_tiles(); ++i) {
+        scitbx::af::versa<T, scitbx::af::c_grid<2> > data = image.tile(i).data();
+        DXTBX_ASSERT(data.accessor()[0] == image_sizes_[i][1]);
+        DXTBX_ASSERT(data.accessor()[1] == image_sizes_[i][0]);
+        result.push_back(data);
+      }
+      return result;
+    }
+
+    double pixel_size_;
+    bool bilinear_;
+    scitbx::vec3<double> centre_;
+    scitbx::vec3<double> x_axis_;
+    scitbx::vec3<double> y_axis_;
+    double xmin_;
+    double ymax_;
+    scitbx::af::c_grid<2> grid_;
+    std::vector<PanelFrame> panels_;
+    std::vector<scitbx::af::tiny<std::size_t, 2> > image_sizes_;
+    scitbx::af::versa<int, scitbx::af::c_grid<2> > coverage_;
+    std::vector<std::size_t> canvas_;
+    std::vector<std::size_t> panel_;
+    std::vector<std::size_t> pixel_;
+    std::vector<double> weight_;
+  };
+
+}  // namespace dxtbx
+
+#endif  // DXTBX_IMAGE_ASSEMBLY_H
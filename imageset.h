@@ -12,9 +12,18 @@
 #ifndef DXTBX_IMAGESET_H
 #define DXTBX_IMAGESET_H
 
+#include <algorithm>
 #include <map>
+#include <stdexcept>
+#include <string>
+#include <typeinfo>
+#include <vector>
 
 #include <boost/python.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/interprocess/sync/interprocess_mutex.hpp>
+#include <boost/interprocess/sync/scoped_lock.hpp>
 
 #include <scitbx/array_family/shared.h>
 #include <scitbx/array_family/versa.h>
@@ -25,7 +34,11 @@
 #include <dxtbx/model/goniometer.h>
 #include <dxtbx/model/scan.h>
 #include <dxtbx/format/image.h>
+#include <dxtbx/format/pixel_histogram.h>
+#include <dxtbx/format/shared_frame_cache.h>
+#include <dxtbx/image_assembly.h>
 #include <dxtbx/error.h>
+#include <dxtbx/masking/bad_pixel_finder.h>
 #include <dxtbx/masking/goniometer_shadow_masking.h>
 
 namespace dxtbx {
@@ -33,6 +46,10 @@ namespace dxtbx {
 using format::Image;
 using format::ImageBuffer;
 using format::ImageTile;
+using format::SharedFrame;
+using format::SharedFrameCache;
+using format::SparseImage;
+using format::SparseImageTile;
 using masking::GoniometerShadowMasker;
 using model::BeamBase;
 using model::Detector;
@@ -54,6 +71,430 @@ namespace detail {
     return *item;
   }
 
+  /**
+   * Raise exception if we can't dereference pointer. Unlike safe_dereference
+   * the object is not copied, so the pointer must outlive the reference.
+   */
+  template <typename T>
+  const T &safe_reference(const boost::shared_ptr<T> &ptr) {
+    DXTBX_ASSERT(ptr.get() != NULL);
+    return *ptr;
+  }
+
+  /**
+   * Hold the Python GIL while in scope, so that threads not started by
+   * Python can call the Python readers. This is cheap if the calling thread
+   * already holds the GIL.
+   */
+  class gil_guard : boost::noncopyable {
+  public:
+    gil_guard() : state_(PyGILState_Ensure()) {}
+
+    ~gil_guard() {
+      PyGILState_Release(state_);
+    }
+
+  protected:
+    PyGILState_STATE state_;
+  };
+
+  /**
+   * Release the Python GIL while in scope, so that other threads can read
+   * while the calling thread works in C++. The GIL is taken again before the
+   * scope is left, including by an exception.
+   */
+  class gil_release : boost::noncopyable {
+  public:
+    gil_release() : state_(PyEval_SaveThread()) {}
+
+    ~gil_release() {
+      PyEval_RestoreThread(state_);
+    }
+
+  protected:
+    PyThreadState *state_;
+  };
+
+  /**
+   * A mutex which can be a member of a copyable class. Copies have their own
+   * mutex.
+   */
+  class cache_mutex {
+  public:
+    cache_mutex() {}
+
+    cache_mutex(const cache_mutex &) {}
+
+    cache_mutex &operator=(const cache_mutex &) {
+      return *this;
+    }
+
+    void lock() {
+      mutex_.lock();
+    }
+
+    void unlock() {
+      mutex_.unlock();
+    }
+
+  protected:
+    boost::interprocess::interprocess_mutex mutex_;
+  };
+
+  typedef boost::interprocess::scoped_lock<cache_mutex> cache_lock;
+  typedef boost::interprocess::scoped_lock<boost::interprocess::interprocess_mutex>
+    mutex_lock;
+
+  /**
+   * @returns An identifier of the calling thread
+   */
+  inline unsigned long current_thread_id() {
+    return PyThread_get_thread_ident();
+  }
+
+  /**
+   * Copy the data of an image so that it shares no arrays with the original
+   */
+  template <typename T>
+  Image<T> deep_copy(const Image<T> &image) {
+    Image<T> result;
+    for (std::size_t i = 0; i < image.n_tiles(); ++i) {
+      ImageTile<T> tile = image.tile(i);
+      result.push_back(ImageTile<T>(tile.data().deep_copy(), tile.name().c_str()));
+    }
+    return result;
+  }
+
+  /**
+   * Select a subset of the image tiles
+   */
+  template <typename T>
+  Image<T> select_tiles(const Image<T> &image,
+                        const scitbx::af::const_ref<std::size_t> &panels) {
+    Image<T> result;
+    for (std::size_t i = 0; i < panels.size(); ++i) {
+      DXTBX_ASSERT(panels[i] < image.n_tiles());
+      result.push_back(image.tile(panels[i]));
+    }
+    return result;
+  }
+
+  template <typename T>
+  SparseImage<T> select_tiles(const SparseImage<T> &image,
+                              const scitbx::af::const_ref<std::size_t> &panels) {
+    SparseImage<T> result;
+    for (std::size_t i = 0; i < panels.size(); ++i) {
+      DXTBX_ASSERT(panels[i] < image.n_tiles());
+      result.push_back(image.tile(panels[i]));
+    }
+    return result;
+  }
+
+  inline ImageBuffer select_tiles(const ImageBuffer &buffer,
+                                  const scitbx::af::const_ref<std::size_t> &panels) {
+    if (buffer.is_sparse()) {
+      if (buffer.is_sparse_int()) {
+        return ImageBuffer(select_tiles(buffer.as_sparse_int(), panels));
+      }
+      return ImageBuffer(select_tiles(buffer.as_sparse_double(), panels));
+    } else if (buffer.is_int()) {
+      return ImageBuffer(select_tiles(buffer.as_int(), panels));
+    } else if (buffer.is_float()) {
+      return ImageBuffer(select_tiles(buffer.as_float(), panels));
+    } else if (buffer.is_double()) {
+      return ImageBuffer(select_tiles(buffer.as_double(), panels));
+    }
+    return ImageBuffer();
+  }
+
+  /**
+   * Apply the trusted range of a panel to a mask from a sparse image tile.
+   * Pixels which are not stored have a value of zero so, when zero is inside
+   * the trusted range, only the stored pixels need to be checked.
+   * @param panel The panel
+   * @param tile The sparse image tile
+   * @param mask The mask to write into
+   */
+  inline void apply_sparse_trusted_range_mask(
+    const Panel &panel,
+    const SparseImageTile<double> &tile,
+    scitbx::af::ref<bool, scitbx::af::c_grid<2> > mask) {
+    DXTBX_ASSERT(tile.accessor()[0] == panel.get_image_size()[1]);
+    DXTBX_ASSERT(tile.accessor()[1] == panel.get_image_size()[0]);
+    DXTBX_ASSERT(tile.accessor().all_eq(mask.accessor()));
+    scitbx::af::tiny<double, 2> trusted_range = panel.get_trusted_range();
+    scitbx::af::shared<std::size_t> indices = tile.indices();
+    scitbx::af::shared<double> values = tile.values();
+    if (trusted_range[0] < 0 && 0 < trusted_range[1]) {
+      for (std::size_t k = 0; k < indices.size(); ++k) {
+        double value = values[k];
+        mask[indices[k]] = mask[indices[k]]
+                           && (trusted_range[0] < value && value < trusted_range[1]);
+      }
+    } else {
+      std::size_t k = 0;
+      for (std::size_t j = 0; j < mask.size(); ++j) {
+        double value = 0;
+        if (k < indices.size() && indices[k] == j) {
+          value = values[k++];
+        }
+        mask[j] = mask[j] && (trusted_range[0] < value && value < trusted_range[1]);
+      }
+    }
+  }
+
+  /**
+   * Call a function for each tile of an image, sharing the tiles between
+   * num_threads OpenMP threads. The scitbx arrays are not thread safe so the
+   * function must only use references prepared before the call and must not
+   * copy arrays shared between tiles. An exception thrown for a tile is
+   * caught in the worker thread and rethrown once all the tiles are done.
+   * @param function The function, called with the tile index
+   * @param n_tiles The number of tiles
+   * @param num_threads The number of threads
+   */
+  template <typename Function>
+  void for_each_tile(const Function &function, std::size_t n_tiles, int num_threads) {
+    DXTBX_ASSERT(num_threads > 0);
+    std::vector<char> failed(n_tiles, 0);
+    std::vector<std::string> errors(n_tiles);
+    int n = static_cast<int>(n_tiles);
+#pragma omp parallel for num_threads(num_threads) schedule(dynamic) if (num_threads > 1)
+    for (int i = 0; i < n; ++i) {
+      try {
+        function(i);
+      } catch (const std::exception &e) {
+        failed[i] = 1;
+        errors[i] = e.what();
+      }
+    }
+    for (std::size_t i = 0; i < n_tiles; ++i) {
+      if (failed[i]) {
+        throw DXTBX_ERROR(errors[i]);
+      }
+    }
+  }
+
+  /**
+   * Convert tiles to double
+   */
+  template <typename T>
+  struct ConvertTiles {
+    std::vector<scitbx::af::const_ref<T, scitbx::af::c_grid<2> > > source;
+    std::vector<scitbx::af::ref<double, scitbx::af::c_grid<2> > > result;
+
+    void operator()(std::size_t i) const {
+      std::copy(source[i].begin(), source[i].end(), result[i].begin());
+    }
+  };
+
+  /**
+   * Subtract the pedestal from tiles and divide by the gain and the geometric
+   * correction. Empty pedestal, gain or correction references are skipped.
+   */
+  struct CorrectTiles {
+    typedef scitbx::af::const_ref<double, scitbx::af::c_grid<2> > const_ref_type;
+    std::vector<const_ref_type> data;
+    std::vector<const_ref_type> gain;
+    std::vector<const_ref_type> pedestal;
+    std::vector<const_ref_type> geometry;
+    std::vector<scitbx::af::ref<double, scitbx::af::c_grid<2> > > result;
+
+    void operator()(std::size_t i) const {
+      const const_ref_type &r = data[i];
+      const const_ref_type &g = gain[i];
+      const const_ref_type &p = pedestal[i];
+      const const_ref_type &q = geometry[i];
+      scitbx::af::ref<double, scitbx::af::c_grid<2> > c = result[i];
+      std::copy(r.begin(), r.end(), c.begin());
+      if (p.size() > 0) {
+        for (std::size_t j = 0; j < r.size(); ++j) {
+          c[j] = c[j] - p[j];
+        }
+      }
+      if (g.size() > 0) {
+        for (std::size_t j = 0; j < r.size(); ++j) {
+          DXTBX_ASSERT(g[j] > 0);
+          c[j] = c[j] / g[j];
+        }
+      }
+      if (q.size() > 0) {
+        for (std::size_t j = 0; j < r.size(); ++j) {
+          DXTBX_ASSERT(q[j] > 0);
+          c[j] = c[j] / q[j];
+        }
+      }
+    }
+  };
+
+  /**
+   * Apply the trusted range of each panel to its mask tile
+   */
+  struct TrustedRangeMaskTiles {
+    std::vector<const Panel *> panels;
+    std::vector<scitbx::af::const_ref<double, scitbx::af::c_grid<2> > > data;
+    std::vector<scitbx::af::ref<bool, scitbx::af::c_grid<2> > > mask;
+
+    void operator()(std::size_t i) const {
+      panels[i]->apply_trusted_range_mask(data[i], mask[i]);
+    }
+  };
+
+  /**
+   * Apply the trusted range of each panel to its mask tile for sparse data
+   */
+  struct SparseTrustedRangeMaskTiles {
+    std::vector<const Panel *> panels;
+    std::vector<SparseImageTile<double> > data;
+    std::vector<scitbx::af::ref<bool, scitbx::af::c_grid<2> > > mask;
+
+    void operator()(std::size_t i) const {
+      apply_sparse_trusted_range_mask(*panels[i], data[i], mask[i]);
+    }
+  };
+
+  /**
+   * Mask the untrusted rectangles of each panel. The rectangles are taken on
+   * the calling thread, so no array handle is copied in the workers.
+   */
+  struct UntrustedRectangleMaskTiles {
+    std::vector<const Panel *> panels;
+    std::vector<scitbx::af::const_ref<scitbx::af::int4> > rectangles;
+    std::vector<scitbx::af::ref<bool, scitbx::af::c_grid<2> > > mask;
+
+    void operator()(std::size_t i) const {
+      panels[i]->apply_untrusted_rectangle_mask(mask[i], rectangles[i]);
+    }
+  };
+
+  /**
+   * Combine mask tiles with an external mask
+   */
+  struct CombineMaskTiles {
+    std::vector<scitbx::af::ref<bool, scitbx::af::c_grid<2> > > mask;
+    std::vector<scitbx::af::const_ref<bool, scitbx::af::c_grid<2> > > other;
+
+    void operator()(std::size_t i) const {
+      for (std::size_t j = 0; j < mask[i].size(); ++j) {
+        mask[i][j] = mask[i][j] && other[i][j];
+      }
+    }
+  };
+
+  /**
+   * Get the key identifying the geometry used by a geometric correction.
+   * The correction only needs to be recomputed when this changes.
+   */
+  inline std::vector<double> geometric_correction_key(
+    const Detector &detector,
+    boost::shared_ptr<BeamBase> beam,
+    bool solid_angle,
+    bool polarization,
+    bool obliquity) {
+    std::vector<double> key;
+    key.push_back(solid_angle);
+    key.push_back(polarization);
+    key.push_back(obliquity);
+    for (std::size_t i = 0; i < detector.size(); ++i) {
+      const Panel &panel = detector[i];
+      scitbx::vec3<double> fast = panel.get_fast_axis();
+      scitbx::vec3<double> slow = panel.get_slow_axis();
+      scitbx::vec3<double> origin = panel.get_origin();
+      key.insert(key.end(), fast.begin(), fast.end());
+      key.insert(key.end(), slow.begin(), slow.end());
+      key.insert(key.end(), origin.begin(), origin.end());
+      key.push_back(panel.get_pixel_size()[0]);
+      key.push_back(panel.get_pixel_size()[1]);
+      key.push_back(panel.get_image_size()[0]);
+      key.push_back(panel.get_image_size()[1]);
+      key.push_back(panel.get_thickness());
+      key.push_back(panel.get_mu());
+    }
+    if (polarization) {
+      scitbx::vec3<double> s0 = beam->get_s0();
+      scitbx::vec3<double> pn = beam->get_polarization_normal();
+      key.insert(key.end(), s0.begin(), s0.end());
+      key.insert(key.end(), pn.begin(), pn.end());
+      key.push_back(beam->get_polarization_fraction());
+    }
+    return key;
+  }
+
+  /**
+   * Compute the product of the requested geometric correction factors for
+   * each panel. The solid angle is given relative to that of a pixel at
+   * normal incidence on the closest panel so that it is comparable between
+   * panels.
+   */
+  inline Image<double> geometric_correction(const Detector &detector,
+                                            boost::shared_ptr<BeamBase> beam,
+                                            bool solid_angle,
+                                            bool polarization,
+                                            bool obliquity) {
+    typedef scitbx::af::versa<double, scitbx::af::c_grid<2> > array_type;
+
+    // The solid angle of the reference pixel
+    double reference = 0;
+    if (solid_angle) {
+      for (std::size_t i = 0; i < detector.size(); ++i) {
+        double distance = detector[i].get_distance();
+        DXTBX_ASSERT(distance != 0);
+        double area = detector[i].get_pixel_size()[0] * detector[i].get_pixel_size()[1];
+        reference = std::max(reference, area / (distance * distance));
+      }
+    }
+    if (polarization) {
+      DXTBX_ASSERT(beam != NULL);
+    }
+
+    Image<double> result;
+    for (std::size_t i = 0; i < detector.size(); ++i) {
+      const Panel &panel = detector[i];
+      std::size_t xsize = panel.get_image_size()[0];
+      std::size_t ysize = panel.get_image_size()[1];
+      array_type correction(scitbx::af::c_grid<2>(ysize, xsize), 1.0);
+      if (solid_angle) {
+        array_type factor = panel.get_solid_angle_array();
+        for (std::size_t j = 0; j < correction.size(); ++j) {
+          correction[j] *= factor[j] / reference;
+        }
+      }
+      if (polarization) {
+        array_type factor = panel.get_polarization_array(
+          beam->get_s0(),
+          beam->get_polarization_normal(),
+          beam->get_polarization_fraction());
+        for (std::size_t j = 0; j < correction.size(); ++j) {
+          correction[j] *= factor[j];
+        }
+      }
+      if (obliquity) {
+        array_type factor = panel.get_obliquity_array();
+        for (std::size_t j = 0; j < correction.size(); ++j) {
+          correction[j] *= factor[j];
+        }
+      }
+      result.push_back(ImageTile<double>(correction));
+    }
+    return result;
+  }
+
+  /**
+   * Share a model with the previous image if they are identical
+   * @param model The new model
+   * @param previous The model of the previous image
+   * @returns The model to use
+   */
+  template <typename Model>
+  boost::shared_ptr<Model> shared_model(const boost::shared_ptr<Model> &model,
+                                        const boost::shared_ptr<Model> &previous) {
+    if (model != NULL && previous != NULL && typeid(*model) == typeid(*previous)
+        && *model == *previous) {
+      return previous;
+    }
+    return model;
+  }
+
 }  // namespace detail
 
 /**
@@ -63,7 +504,7 @@ template <typename T>
 class ExternalLookupItem {
 public:
   /** Construct the external lookup item */
-  ExternalLookupItem() {}
+  ExternalLookupItem() : version_(0) {}
 
   /**
    * Get the filename
@@ -93,11 +534,20 @@ public:
    */
   void set_data(const Image<T> &data) {
     data_ = data;
+    version_++;
+  }
+
+  /**
+   * Get the number of times the data has been set
+   */
+  std::size_t version() const {
+    return version_;
   }
 
 protected:
   std::string filename_;
   Image<T> data_;
+  std::size_t version_;
 };
 
 /**
@@ -149,7 +599,11 @@ protected:
 };
 
 /**
- * A class to hold data about the imageset
+ * A class to hold data about the imageset. The methods which read images or
+ * models may be called from several threads at once, including threads not
+ * started by Python: the GIL is taken for each call into the Python reader
+ * and the models read from the model provider are stored under a lock shared
+ * by all copies of the object.
  */
 class ImageSetData {
 public:
@@ -159,7 +613,9 @@ public:
   typedef boost::shared_ptr<Scan> scan_ptr;
   typedef boost::shared_ptr<GoniometerShadowMasker> masker_ptr;
 
-  ImageSetData() {}
+  ImageSetData()
+      : model_batch_size_(1),
+        models_mutex_(boost::make_shared<boost::interprocess::interprocess_mutex>()) {}
 
   /**
    * Construct the imageset data object
@@ -173,7 +629,10 @@ public:
         detectors_(boost::python::len(reader)),
         goniometers_(boost::python::len(reader)),
         scans_(boost::python::len(reader)),
-        reject_(boost::python::len(reader)) {}
+        reject_(boost::python::len(reader)),
+        models_loaded_(boost::python::len(reader), false),
+        model_batch_size_(1),
+        models_mutex_(boost::make_shared<boost::interprocess::interprocess_mutex>()) {}
 
   /**
    * @returns The reader object
@@ -202,30 +661,72 @@ public:
    * @returns The image data
    */
   ImageBuffer get_data(std::size_t index) {
-    // Create the return buffer
-    ImageBuffer buffer;
-
-    // Get the image data object
-    boost::python::object data = reader_.attr("read")(index);
+    if (shared_cache_) {
+      std::string key = frame_key(index);
+      SharedFrame frame = shared_cache_->find(key);
+      if (!frame.empty()) {
+        return frame.image_buffer();
+      }
+      ImageBuffer buffer = read_data(index);
+      shared_cache_->insert(key, buffer);
+      return buffer;
+    }
+    return read_data(index);
+  }
 
-    // Get the class name
-    std::string name =
-      boost::python::extract<std::string>(data.attr("__class__").attr("__name__"))();
+  /**
+   * Read the image data for a subset of the detector panels. If the reader
+   * has no read_panels method the whole image is read and the requested
+   * tiles selected from it.
+   * @param index The image index
+   * @param panels The panel indices
+   * @returns The image data with one tile per requested panel
+   */
+  ImageBuffer get_data_for_panels(std::size_t index,
+                                  const scitbx::af::const_ref<std::size_t> &panels) {
+    if (shared_cache_) {
+      SharedFrame frame = shared_cache_->find(frame_key(index));
+      if (!frame.empty()) {
+        return detail::select_tiles(frame.image_buffer(), panels);
+      }
+    }
+    detail::gil_guard gil;
+    if (!PyObject_HasAttrString(reader_.ptr(), "read_panels")) {
+      return detail::select_tiles(get_data(index), panels);
+    }
+    boost::python::list panel_list;
+    for (std::size_t i = 0; i < panels.size(); ++i) {
+      panel_list.append(panels[i]);
+    }
+    return get_image_buffer(reader_.attr("read_panels")(index, panel_list));
+  }
 
-    // Extract the image buffer
-    if (name == "tuple") {
-      buffer = get_image_buffer_from_tuple(
-        boost::python::extract<boost::python::tuple>(data)());
-    } else {
-      buffer = get_image_buffer_from_object(data);
+  /**
+   * Share the decoded images with other processes on the node. Images are
+   * looked up in the cache before they are read and added to it afterwards.
+   * The images are keyed on their file, so a reader without paths, such as
+   * an in-memory or stream reader, can not use a cache.
+   * @param cache The shared frame cache, or a null pointer for no cache
+   */
+  void set_shared_cache(boost::shared_ptr<SharedFrameCache> cache) {
+    if (cache && size() > 0) {
+      frame_key(0);
     }
-    return buffer;
+    shared_cache_ = cache;
+  }
+
+  /**
+   * @returns The shared frame cache
+   */
+  boost::shared_ptr<SharedFrameCache> shared_cache() const {
+    return shared_cache_;
   }
 
   /**
    * @returns Is the reader a single file reader
    */
   bool has_single_file_reader() const {
+    detail::gil_guard gil;
     return boost::python::extract<bool>(reader_.attr("is_single_file_reader")())();
   }
 
@@ -233,6 +734,7 @@ public:
    * @returns The image path
    */
   std::string get_path(std::size_t index) const {
+    detail::gil_guard gil;
     return boost::python::extract<std::string>(reader_.attr("paths")()[index])();
   }
 
@@ -240,6 +742,7 @@ public:
    * @returns The master image path
    */
   std::string get_master_path() const {
+    detail::gil_guard gil;
     return boost::python::extract<std::string>(reader_.attr("master_path")())();
   }
 
@@ -247,6 +750,7 @@ public:
    * @returns The image identifier
    */
   std::string get_image_identifier(std::size_t index) const {
+    detail::gil_guard gil;
     return boost::python::extract<std::string>(reader_.attr("identifiers")()[index])();
   }
 
@@ -364,10 +868,124 @@ public:
     scans_[index] = scan;
   }
 
+  /**
+   * Set an object to provide the models of images which have none set. Its
+   * read_models(first, last) method returns a list of (beam, detector,
+   * goniometer, scan) tuples for the images in the range. It is only called
+   * the first time the models of an image are needed, for a batch of images
+   * at a time. Identical models of consecutive images are shared as they are
+   * in a sequence: setting a model replaces it for one image only, but a
+   * shared model changed in place changes for every image using it.
+   * @param provider The model provider
+   * @param batch_size The number of images to read the models of at once
+   */
+  void set_model_provider(boost::python::object provider, std::size_t batch_size) {
+    DXTBX_ASSERT(batch_size > 0);
+    model_provider_ = provider;
+    model_batch_size_ = batch_size;
+  }
+
+  /**
+   * @returns The model provider
+   */
+  boost::python::object model_provider() const {
+    return model_provider_;
+  }
+
+  /**
+   * @returns The number of images to read the models of at once
+   */
+  std::size_t model_batch_size() const {
+    return model_batch_size_;
+  }
+
+  /**
+   * @returns Which images have had their models read from the provider
+   */
+  scitbx::af::shared<bool> models_loaded() const {
+    detail::mutex_lock lock(*models_mutex_);
+    return scitbx::af::shared<bool>(models_loaded_.begin(), models_loaded_.end());
+  }
+
+  /**
+   * Mark which images have had their models read from the provider
+   * @param loaded The flag for each image
+   */
+  void set_models_loaded(const scitbx::af::const_ref<bool> &loaded) {
+    DXTBX_ASSERT(loaded.size() == models_loaded_.size());
+    detail::mutex_lock lock(*models_mutex_);
+    std::copy(loaded.begin(), loaded.end(), models_loaded_.begin());
+  }
+
+  /**
+   * @returns Is there a model provider
+   */
+  bool has_model_provider() const {
+    return !model_provider_.is_none();
+  }
+
+  /**
+   * Read the models of an image from the model provider if not yet done
+   * @param index The image index
+   */
+  void load_models(std::size_t index) const {
+    if (model_provider_.is_none()) {
+      return;
+    }
+    DXTBX_ASSERT(index < models_loaded_.size());
+    {
+      detail::mutex_lock lock(*models_mutex_);
+      if (models_loaded_[index]) {
+        return;
+      }
+    }
+
+    // Models from Python hold Python references so are only handled with the
+    // GIL. The lock is taken with the GIL held but never waits for the GIL.
+    detail::gil_guard gil;
+    std::size_t last = std::min(index + model_batch_size_, models_loaded_.size());
+    boost::python::object models = model_provider_.attr("read_models")(index, last);
+    DXTBX_ASSERT(boost::python::len(models) == last - index);
+    detail::mutex_lock lock(*models_mutex_);
+
+    // The arrays are shared handles so the models can be cached from here
+    scitbx::af::shared<beam_ptr> beams = beams_;
+    scitbx::af::shared<detector_ptr> detectors = detectors_;
+    scitbx::af::shared<goniometer_ptr> goniometers = goniometers_;
+    scitbx::af::shared<scan_ptr> scans = scans_;
+    scitbx::af::shared<bool> loaded = models_loaded_;
+    for (std::size_t i = index; i < last; ++i) {
+      if (loaded[i]) {
+        continue;
+      }
+      boost::python::object item = models[i - index];
+      DXTBX_ASSERT(boost::python::len(item) == 4);
+      std::size_t prev = i > 0 ? i - 1 : i;
+      if (beams[i] == NULL) {
+        beams[i] = detail::shared_model(
+          boost::python::extract<beam_ptr>(item[0])(), beams[prev]);
+      }
+      if (detectors[i] == NULL) {
+        detectors[i] = detail::shared_model(
+          boost::python::extract<detector_ptr>(item[1])(), detectors[prev]);
+      }
+      if (goniometers[i] == NULL) {
+        goniometers[i] = detail::shared_model(
+          boost::python::extract<goniometer_ptr>(item[2])(), goniometers[prev]);
+      }
+      if (scans[i] == NULL) {
+        scans[i] = detail::shared_model(
+          boost::python::extract<scan_ptr>(item[3])(), scans[prev]);
+      }
+      loaded[i] = true;
+    }
+  }
+
   /**
    * @returns the number of images
    */
   std::size_t size() const {
+    detail::gil_guard gil;
     return boost::python::len(reader_);
   }
 
@@ -435,6 +1053,41 @@ public:
   }
 
 protected:
+  /**
+   * The key of an image in the shared frame cache. The images of a single
+   * file reader are keyed on the master file and the image index.
+   * @param index The image index
+   * @returns The key
+   */
+  std::string frame_key(std::size_t index) const {
+    std::string path = has_single_file_reader() ? get_master_path() : get_path(index);
+    if (path.empty()) {
+      throw DXTBX_ERROR("Images without a path can not be shared in a frame cache");
+    }
+    return SharedFrameCache::frame_key(path, index);
+  }
+
+  ImageBuffer get_image_buffer(boost::python::object data) {
+    // Get the class name
+    std::string name =
+      boost::python::extract<std::string>(data.attr("__class__").attr("__name__"))();
+
+    // Extract the image buffer
+    if (name == "tuple") {
+      return get_image_buffer_from_tuple(
+        boost::python::extract<boost::python::tuple>(data)());
+    } else if (name == "ImageInt") {
+      return ImageBuffer(boost::python::extract<Image<int> >(data)());
+    } else if (name == "ImageDouble") {
+      return ImageBuffer(boost::python::extract<Image<double> >(data)());
+    } else if (name == "SparseImageInt") {
+      return ImageBuffer(boost::python::extract<SparseImage<int> >(data)());
+    } else if (name == "SparseImageDouble") {
+      return ImageBuffer(boost::python::extract<SparseImage<double> >(data)());
+    }
+    return get_image_buffer_from_object(data);
+  }
+
   ImageBuffer get_image_buffer_from_tuple(boost::python::tuple obj) {
     // Get the class name
     std::string name =
@@ -473,6 +1126,11 @@ protected:
     return buffer;
   }
 
+  ImageBuffer read_data(std::size_t index) {
+    detail::gil_guard gil;
+    return get_image_buffer(reader_.attr("read")(index));
+  }
+
   template <typename T>
   Image<T> get_image_from_tuple(boost::python::tuple obj) {
     Image<T> image;
@@ -501,7 +1159,12 @@ protected:
   scitbx::af::shared<goniometer_ptr> goniometers_;
   scitbx::af::shared<scan_ptr> scans_;
   scitbx::af::shared<bool> reject_;
+  scitbx::af::shared<bool> models_loaded_;
+  boost::python::object model_provider_;
+  std::size_t model_batch_size_;
+  boost::shared_ptr<boost::interprocess::interprocess_mutex> models_mutex_;
   ExternalLookup external_lookup_;
+  boost::shared_ptr<SharedFrameCache> shared_cache_;
 
   std::string template_;
   std::string vendor_;
@@ -510,7 +1173,16 @@ protected:
 };
 
 /**
- * A class to represent an imageset
+ * A class to represent an imageset.
+ *
+ * The methods which read image data, masks and corrections may be called
+ * from several threads at once on the same imageset, including native threads
+ * not started by Python. Each thread has its own caches, and its own copies
+ * of the external lookup maps, so that no arrays are shared between threads.
+ * Calls into the Python reader take the GIL, so a thread which holds the GIL
+ * must release it before waiting for other threads reading the imageset. The
+ * models, the external lookup and the caches must not be set or cleared while
+ * other threads are reading.
  */
 class ImageSet {
 public:
@@ -531,6 +1203,69 @@ public:
     DataCache() : index(-1) {}
   };
 
+  /**
+   * A class to cache the geometric correction
+   */
+  class GeometricCorrectionCache {
+  public:
+    std::vector<double> key;
+    Image<double> image;
+  };
+
+  /**
+   * A class to hold a private copy of an external lookup map
+   */
+  template <class T>
+  class LookupCache {
+  public:
+    Image<T> image;
+    std::size_t version;
+    bool valid;
+
+    LookupCache() : version(0), valid(false) {}
+  };
+
+  /**
+   * The caches of a single thread
+   */
+  class ThreadCache {
+  public:
+    DataCache<ImageBuffer> data;
+    DataCache<Image<double> > double_raw_data;
+    DataCache<Image<bool> > trusted_mask;
+    GeometricCorrectionCache geometric_correction;
+    LookupCache<bool> mask;
+    LookupCache<double> gain;
+    LookupCache<double> pedestal;
+    std::size_t last_used;
+
+    ThreadCache() : last_used(0) {}
+  };
+
+  typedef boost::shared_ptr<ThreadCache> thread_cache_ptr;
+
+  /**
+   * The caches of each thread by thread id. A copy of an imageset starts with
+   * no caches, so the caches are never shared between imagesets.
+   */
+  class ThreadCacheMap : public std::map<unsigned long, thread_cache_ptr> {
+  public:
+    ThreadCacheMap() {}
+
+    ThreadCacheMap(const ThreadCacheMap &) {}
+
+    ThreadCacheMap &operator=(const ThreadCacheMap &) {
+      clear();
+      return *this;
+    }
+  };
+
+  /**
+   * The number of threads which keep caches. When another thread reads, the
+   * caches of the thread which read least recently are dropped.
+   */
+  static const std::size_t max_thread_caches = 8;
+
   /**
    * Default constructor throws an exception.
    * This only here so overloaded functions that
@@ -549,7 +1284,8 @@ public:
    * Construct the imageset
    * @param data The imageset data
    */
-  ImageSet(const ImageSetData &data) : data_(data), indices_(data.size()) {
+  ImageSet(const ImageSetData &data)
+      : data_(data), indices_(data.size()), thread_cache_clock_(0), num_threads_(1) {
     // Check number of images
     if (data.size() == 0) {
       throw DXTBX_ERROR("No images specified in ImageSetData");
@@ -567,7 +1303,10 @@ public:
    * @param indices The image indices
    */
   ImageSet(const ImageSetData &data, const scitbx::af::const_ref<std::size_t> &indices)
-      : data_(data), indices_(indices.begin(), indices.end()) {
+      : data_(data),
+        indices_(indices.begin(), indices.end()),
+        thread_cache_clock_(0),
+        num_threads_(1) {
     // Check number of images
     if (data.size() == 0) {
       throw DXTBX_ERROR("No images specified in ImageSetData");
@@ -594,6 +1333,50 @@ public:
     return data_;
   }
 
+  /**
+   * Share the decoded images with other processes on the node
+   * @param cache The shared frame cache, or a null pointer for no cache
+   */
+  void set_shared_cache(boost::shared_ptr<SharedFrameCache> cache) {
+    data_.set_shared_cache(cache);
+  }
+
+  /**
+   * @returns The shared frame cache
+   */
+  boost::shared_ptr<SharedFrameCache> shared_cache() const {
+    return data_.shared_cache();
+  }
+
+  /**
+   * Set the number of threads used to correct and mask the panels of a
+   * frame. The panels of a frame are processed in parallel when this is more
+   * than one and dxtbx is built with OpenMP. The Python bindings then also
+   * release the GIL while reading, and return copies of the cached data.
+   * @param num_threads The number of threads
+   */
+  void set_num_threads(int num_threads) {
+    DXTBX_ASSERT(num_threads > 0);
+    num_threads_ = num_threads;
+  }
+
+  /**
+   * @returns The number of threads used to correct and mask a frame
+   */
+  int num_threads() const {
+    return num_threads_;
+  }
+
+  /**
+   * Keep the caches of the calling thread while the returned pointer is
+   * held. Data returned from the caches is only safe to use without the GIL
+   * while they are kept.
+   * @returns The caches of the calling thread
+   */
+  thread_cache_ptr pin_thread_cache() {
+    return thread_cache();
+  }
+
   /**
    * @returns The image indices
    */
@@ -620,23 +1403,51 @@ public:
    * @param index The image index
    * @returns The raw image data
    */
-  ImageBuffer get_raw_data(std::size_t index) {
+  virtual ImageBuffer get_raw_data(std::size_t index) {
     DXTBX_ASSERT(index < indices_.size());
-    if (data_cache_.index == index) {
-      return data_cache_.image;
+    thread_cache_ptr cache_pointer = thread_cache();
+    ThreadCache &cache = *cache_pointer;
+    if (cache.data.index == index) {
+      return cache.data.image;
     }
     ImageBuffer image = data_.get_data(indices_[index]);
-    data_cache_.index = index;
-    data_cache_.image = image;
+    cache.data.index = index;
+    cache.data.image = image;
     return image;
   }
 
   /**
-   * Get the corrected data array (raw - pedestal) / gain
+   * Get the raw image data for a subset of the detector panels. Only the
+   * requested panels are read if the format supports it.
    * @param index The image index
+   * @param panels The panel indices
+   * @returns The raw image data with one tile per requested panel
+   */
+  virtual ImageBuffer get_raw_data_for_panels(
+    std::size_t index,
+    const scitbx::af::const_ref<std::size_t> &panels) {
+    DXTBX_ASSERT(index < indices_.size());
+    thread_cache_ptr cache_pointer = thread_cache();
+    ThreadCache &cache = *cache_pointer;
+    if (cache.data.index == index) {
+      return detail::select_tiles(cache.data.image, panels);
+    }
+    return data_.get_data_for_panels(indices_[index], panels);
+  }
+
+  /**
+   * Get the corrected data array (raw - pedestal) / gain, optionally also
+   * divided by the geometric correction (see get_geometric_correction).
+   * @param index The image index
+   * @param solid_angle Apply the relative solid angle correction
+   * @param polarization Apply the polarization correction
+   * @param obliquity Apply the sensor obliquity correction
    * @returns The corrected data array
    */
-  Image<double> get_corrected_data(std::size_t index) {
+  Image<double> get_corrected_data(std::size_t index,
+                                   bool solid_angle = false,
+                                   bool polarization = false,
+                                   bool obliquity = false) {
     typedef scitbx::af::versa<double, scitbx::af::c_grid<2> > array_type;
     typedef scitbx::af::const_ref<double, scitbx::af::c_grid<2> > const_ref_type;
 
@@ -645,14 +1456,20 @@ public:
     Image<double> data = get_raw_data_as_double(index);
     Image<double> gain = get_gain(index);
     Image<double> dark = get_pedestal(index);
+    Image<double> geom;
+    if (solid_angle || polarization || obliquity) {
+      geom = get_geometric_correction(index, solid_angle, polarization, obliquity);
+    }
     DXTBX_ASSERT(gain.n_tiles() == 0 || data.n_tiles() == gain.n_tiles());
     DXTBX_ASSERT(dark.n_tiles() == 0 || data.n_tiles() == dark.n_tiles());
+    DXTBX_ASSERT(geom.n_tiles() == 0 || data.n_tiles() == geom.n_tiles());
 
-    // Loop through tiles
+    // Prepare the tiles; the corrections are then applied in parallel
     Image<double> result;
+    detail::CorrectTiles correct;
     for (std::size_t i = 0; i < data.n_tiles(); ++i) {
       // Get the data
-      const_ref_type r = data.tile(i).data().const_ref();
+      const_ref_type r = data.tile(i).const_ref();
 
       // Get the gain and dark
       const_ref_type g = gain.n_tiles() > 0
@@ -661,44 +1478,148 @@ public:
       const_ref_type p = dark.n_tiles() > 0
                            ? dark.tile(i).data().const_ref()
                            : const_ref_type(NULL, scitbx::af::c_grid<2>(0, 0));
+      const_ref_type q = geom.n_tiles() > 0
+                           ? geom.tile(i).data().const_ref()
+                           : const_ref_type(NULL, scitbx::af::c_grid<2>(0, 0));
 
-      // Check gain and dark sizes
+      // Check gain, dark and geometric correction sizes
       DXTBX_ASSERT(g.size() == 0 || r.accessor().all_eq(g.accessor()));
       DXTBX_ASSERT(p.size() == 0 || r.accessor().all_eq(p.accessor()));
+      DXTBX_ASSERT(q.size() == 0 || r.accessor().all_eq(q.accessor()));
 
-      if (p.size() == 0 && g.size() == 0) {
+      if (p.size() == 0 && g.size() == 0 && q.size() == 0) {
         // Nothing to apply, save the copy
-        result.push_back(ImageTile<double>(data.tile(i).data()));
+        result.push_back(data.tile(i));
       } else {
         // Create the result array
         array_type c(r.accessor(),
                      scitbx::af::init_functor_null<array_type::value_type>());
+        correct.data.push_back(r);
+        correct.gain.push_back(g);
+        correct.pedestal.push_back(p);
+        correct.geometry.push_back(q);
+        correct.result.push_back(c.ref());
 
-        // Copy the data values
-        std::uninitialized_copy(r.begin(), r.end(), c.begin());
+        // Add the image tile
+        result.push_back(ImageTile<double>(c));
+      }
+    }
+    detail::for_each_tile(correct, correct.result.size(), num_threads_);
 
-        // Apply dark
-        if (p.size() > 0) {
-          for (std::size_t j = 0; j < r.size(); ++j) {
-            c[j] = c[j] - p[j];
-          }
-        }
+    // Return the result
+    return result;
+  }
 
-        // Apply gain
-        if (g.size() > 0) {
-          for (std::size_t j = 0; j < r.size(); ++j) {
-            DXTBX_ASSERT(g[j] > 0);
-            c[j] = c[j] / g[j];
-          }
+  /**
+   * Get the corrected data for a sparse image. Only the stored pixels are
+   * divided by the gain and, optionally, the geometric correction. If the raw
+   * data is dense, or a pedestal would make the unlit pixels non-zero, the
+   * dense corrected data is converted instead.
+   * @param index The image index
+   * @param solid_angle Apply the relative solid angle correction
+   * @param polarization Apply the polarization correction
+   * @param obliquity Apply the sensor obliquity correction
+   * @returns The corrected sparse data
+   */
+  SparseImage<double> get_corrected_sparse_data(std::size_t index,
+                                                bool solid_angle = false,
+                                                bool polarization = false,
+                                                bool obliquity = false) {
+    typedef scitbx::af::const_ref<double, scitbx::af::c_grid<2> > const_ref_type;
+
+    // Use the dense data if needed
+    DXTBX_ASSERT(index < indices_.size());
+    ImageBuffer buffer = get_raw_data(index);
+    Image<double> dark = get_pedestal(index);
+    if (!buffer.is_sparse() || dark.n_tiles() > 0) {
+      return SparseImage<double>(
+        get_corrected_data(index, solid_angle, polarization, obliquity));
+    }
+
+    // Get the multi-tile data, gain and geometric correction
+    SparseImage<double> data = buffer.as_sparse_double();
+    Image<double> gain = get_gain(index);
+    Image<double> geom;
+    if (solid_angle || polarization || obliquity) {
+      geom = get_geometric_correction(index, solid_angle, polarization, obliquity);
+    }
+    DXTBX_ASSERT(gain.n_tiles() == 0 || data.n_tiles() == gain.n_tiles());
+    DXTBX_ASSERT(geom.n_tiles() == 0 || data.n_tiles() == geom.n_tiles());
+
+    // Loop through tiles
+    SparseImage<double> result;
+    for (std::size_t i = 0; i < data.n_tiles(); ++i) {
+      SparseImageTile<double> tile = data.tile(i);
+      if (gain.n_tiles() == 0 && geom.n_tiles() == 0) {
+        // Nothing to apply, save the copy
+        result.push_back(tile);
+        continue;
+      }
+
+      // Copy the values so the reader's buffers are not modified
+      scitbx::af::shared<std::size_t> indices = tile.indices();
+      scitbx::af::shared<double> values = tile.values();
+      scitbx::af::shared<double> c(values.begin(), values.end());
+
+      // Apply gain
+      if (gain.n_tiles() > 0) {
+        const_ref_type g = gain.tile(i).const_ref();
+        DXTBX_ASSERT(tile.accessor().all_eq(g.accessor()));
+        for (std::size_t j = 0; j < indices.size(); ++j) {
+          DXTBX_ASSERT(g[indices[j]] > 0);
+          c[j] = c[j] / g[indices[j]];
         }
+      }
 
-        // Add the image tile
-        result.push_back(ImageTile<double>(c));
+      // Apply geometric correction
+      if (geom.n_tiles() > 0) {
+        const_ref_type q = geom.tile(i).const_ref();
+        DXTBX_ASSERT(tile.accessor().all_eq(q.accessor()));
+        for (std::size_t j = 0; j < indices.size(); ++j) {
+          DXTBX_ASSERT(q[indices[j]] > 0);
+          c[j] = c[j] / q[indices[j]];
+        }
       }
+
+      // Add the image tile
+      result.push_back(
+        SparseImageTile<double>(tile.accessor(), indices, c, tile.name().c_str()));
+    }
+    return result;
+  }
+
+  /**
+   * Get the geometric correction factors for each pixel: the product of the
+   * requested relative solid angle, polarization and sensor obliquity
+   * factors. The result is cached and only recomputed when the detector or
+   * beam geometry changes.
+   * @param index The image index
+   * @param solid_angle Include the relative solid angle
+   * @param polarization Include the polarization factor
+   * @param obliquity Include the sensor obliquity factor
+   * @returns The geometric correction
+   */
+  Image<double> get_geometric_correction(std::size_t index,
+                                         bool solid_angle,
+                                         bool polarization,
+                                         bool obliquity) {
+    DXTBX_ASSERT(index < indices_.size());
+    detector_ptr detector_pointer = get_detector_for_image(index);
+    const Detector &detector = detail::safe_reference(detector_pointer);
+    beam_ptr beam = get_beam_for_image(index);
+    if (polarization) {
+      DXTBX_ASSERT(beam != NULL);
     }
-
-    // Return the result
-    return result;
+    std::vector<double> key = detail::geometric_correction_key(
+      detector, beam, solid_angle, polarization, obliquity);
+    thread_cache_ptr cache_pointer = thread_cache();
+    GeometricCorrectionCache &cache = cache_pointer->geometric_correction;
+    if (cache.key != key) {
+      cache.image = detail::geometric_correction(
+        detector, beam, solid_angle, polarization, obliquity);
+      cache.key = key;
+    }
+    return cache.image;
   }
 
   /**
@@ -710,9 +1631,12 @@ public:
   Image<double> get_gain(std::size_t index) {
     // If the external lookup is empty
     DXTBX_ASSERT(index < indices_.size());
-    if (external_lookup().gain().get_data().empty()) {
+    Image<double> external_gain =
+      get_lookup_data(external_lookup().gain(), thread_cache()->gain);
+    if (external_gain.empty()) {
       // Get the detector
-      Detector detector = detail::safe_dereference(get_detector_for_image(index));
+      detector_ptr detector_pointer = get_detector_for_image(index);
+      const Detector &detector = detail::safe_reference(detector_pointer);
 
       // Compute the gain for each panel
       bool use_detector_gain = true;
@@ -741,7 +1665,7 @@ public:
         return result;
       }
     }
-    return external_lookup().gain().get_data();
+    return external_gain;
   }
 
   /**
@@ -753,9 +1677,12 @@ public:
     //
     // If the external lookup is empty
     DXTBX_ASSERT(index < indices_.size());
-    if (external_lookup().pedestal().get_data().empty()) {
+    Image<double> external_pedestal =
+      get_lookup_data(external_lookup().pedestal(), thread_cache()->pedestal);
+    if (external_pedestal.empty()) {
       // Get the detector
-      Detector detector = detail::safe_dereference(get_detector_for_image(index));
+      detector_ptr detector_pointer = get_detector_for_image(index);
+      const Detector &detector = detail::safe_reference(detector_pointer);
 
       // Compute the pedestal for each panel
       bool use_detector_pedestal = false;
@@ -780,7 +1707,7 @@ public:
         return result;
       }
     }
-    return external_lookup().pedestal().get_data();
+    return external_pedestal;
   }
 
   /**
@@ -796,7 +1723,8 @@ public:
    * @returns The mask
    */
   Image<bool> get_empty_mask() const {
-    Detector detector = detail::safe_dereference(get_detector_for_image(0));
+    detector_ptr detector_pointer = get_detector_for_image(0);
+    const Detector &detector = detail::safe_reference(detector_pointer);
     Image<bool> mask;
     for (std::size_t i = 0; i < detector.size(); ++i) {
       std::size_t xsize = detector[i].get_image_size()[0];
@@ -813,11 +1741,20 @@ public:
    * @returns The mask
    */
   Image<bool> get_untrusted_rectangle_mask(Image<bool> mask) const {
-    Detector detector = detail::safe_dereference(get_detector_for_image(0));
+    detector_ptr detector_pointer = get_detector_for_image(0);
+    const Detector &detector = detail::safe_reference(detector_pointer);
     DXTBX_ASSERT(mask.n_tiles() == detector.size());
+    std::vector<scitbx::af::shared<scitbx::af::int4> > untrusted_rectangles;
+    for (std::size_t i = 0; i < detector.size(); ++i) {
+      untrusted_rectangles.push_back(detector[i].get_mask());
+    }
+    detail::UntrustedRectangleMaskTiles untrusted;
     for (std::size_t i = 0; i < detector.size(); ++i) {
-      detector[i].apply_untrusted_rectangle_mask(mask.tile(i).data().ref());
+      untrusted.panels.push_back(&detector[i]);
+      untrusted.rectangles.push_back(untrusted_rectangles[i].const_ref());
+      untrusted.mask.push_back(mask.tile(i).data().ref());
     }
+    detail::for_each_tile(untrusted, detector.size(), num_threads_);
     return mask;
   }
 
@@ -827,18 +1764,20 @@ public:
    * @returns The external mask
    */
   Image<bool> get_external_mask(Image<bool> mask) {
-    Image<bool> external_mask = external_lookup().mask().get_data();
+    Image<bool> external_mask =
+      get_lookup_data(external_lookup().mask(), thread_cache()->mask);
     if (!external_mask.empty()) {
       DXTBX_ASSERT(external_mask.n_tiles() == mask.n_tiles());
+      detail::CombineMaskTiles combine;
       for (std::size_t i = 0; i < mask.n_tiles(); ++i) {
         scitbx::af::ref<bool, scitbx::af::c_grid<2> > m1 = mask.tile(i).data().ref();
         scitbx::af::const_ref<bool, scitbx::af::c_grid<2> > m2 =
           external_mask.tile(i).data().const_ref();
         DXTBX_ASSERT(m1.accessor().all_eq(m2.accessor()));
-        for (std::size_t j = 0; j < m1.size(); ++j) {
-          m1[j] = m1[j] && m2[j];
-        }
+        combine.mask.push_back(m1);
+        combine.other.push_back(m2);
       }
+      detail::for_each_tile(combine, mask.n_tiles(), num_threads_);
     }
     return mask;
   }
@@ -868,14 +1807,32 @@ public:
    * @returns The mask
    */
   Image<bool> get_trusted_range_mask(Image<bool> mask, std::size_t index) {
-    Detector detector = detail::safe_dereference(get_detector_for_image(index));
+    detector_ptr detector_pointer = get_detector_for_image(index);
+    const Detector &detector = detail::safe_reference(detector_pointer);
+    ImageBuffer buffer = get_raw_data(index);
+    if (buffer.is_sparse()) {
+      SparseImage<double> data = buffer.as_sparse_double();
+      DXTBX_ASSERT(mask.n_tiles() == data.n_tiles());
+      DXTBX_ASSERT(data.n_tiles() == detector.size());
+      detail::SparseTrustedRangeMaskTiles trusted;
+      for (std::size_t i = 0; i < detector.size(); ++i) {
+        trusted.panels.push_back(&detector[i]);
+        trusted.data.push_back(data.tile(i));
+        trusted.mask.push_back(mask.tile(i).data().ref());
+      }
+      detail::for_each_tile(trusted, detector.size(), num_threads_);
+      return mask;
+    }
     Image<double> data = get_raw_data_as_double(index);
     DXTBX_ASSERT(mask.n_tiles() == data.n_tiles());
     DXTBX_ASSERT(data.n_tiles() == detector.size());
+    detail::TrustedRangeMaskTiles trusted;
     for (std::size_t i = 0; i < detector.size(); ++i) {
-      detector[i].apply_trusted_range_mask(data.tile(i).data().const_ref(),
-                                           mask.tile(i).data().ref());
+      trusted.panels.push_back(&detector[i]);
+      trusted.data.push_back(data.tile(i).const_ref());
+      trusted.mask.push_back(mask.tile(i).data().ref());
     }
+    detail::for_each_tile(trusted, detector.size(), num_threads_);
     return mask;
   }
 
@@ -897,12 +1854,162 @@ public:
     return get_dynamic_mask(index);
   }
 
+  /**
+   * Get the raw image data binned into blocks of bin_size x bin_size pixels.
+   * Masked pixels are excluded from the sums and partially masked blocks are
+   * scaled up to the full block. The result matches the detector returned by
+   * Detector::binned.
+   * @param index The image index
+   * @param bin_size The number of pixels along each side of a block
+   * @returns The binned image data
+   */
+  ImageBuffer get_binned_raw_data(std::size_t index, std::size_t bin_size) {
+    ImageBuffer buffer = get_raw_data(index).dense();
+    Image<bool> mask = get_mask(index);
+
+    // Blocks with no valid pixels are set to be outside the trusted range
+    detector_ptr detector_pointer = get_detector_for_image(index);
+    const Detector &detector = detail::safe_reference(detector_pointer);
+    std::vector<double> empty_value(detector.size());
+    for (std::size_t i = 0; i < detector.size(); ++i) {
+      empty_value[i] = detector[i].get_trusted_range()[0];
+    }
+
+    // Bin the data
+    ImageBuffer result;
+    if (buffer.is_int()) {
+      result = ImageBuffer(
+        format::bin_image(buffer.as_int(), mask, bin_size, empty_value));
+    } else if (buffer.is_float()) {
+      result = ImageBuffer(
+        format::bin_image(buffer.as_float(), mask, bin_size, empty_value));
+    } else if (buffer.is_double()) {
+      result = ImageBuffer(
+        format::bin_image(buffer.as_double(), mask, bin_size, empty_value));
+    } else {
+      throw DXTBX_ERROR("Problem reading raw data");
+    }
+    return result;
+  }
+
+  /**
+   * Get a multi-resolution pyramid of the raw image data for viewers. The
+   * levels are pooled from the full resolution data in a single pass and the
+   * masked pixels are left out.
+   * @param index The image index
+   * @param num_levels The number of levels
+   * @param use_max Pool with the maximum rather than the mean
+   * @returns The pyramid
+   */
+  format::ImagePyramid get_pyramid(std::size_t index,
+                                   std::size_t num_levels,
+                                   bool use_max) {
+    ImageBuffer buffer = get_raw_data(index).dense();
+    Image<bool> mask = get_mask(index);
+    if (buffer.is_int()) {
+      return format::ImagePyramid(buffer.as_int(), mask, num_levels, use_max);
+    } else if (buffer.is_float()) {
+      return format::ImagePyramid(buffer.as_float(), mask, num_levels, use_max);
+    } else if (buffer.is_double()) {
+      return format::ImagePyramid(buffer.as_double(), mask, num_levels, use_max);
+    }
+    throw DXTBX_ERROR("Problem reading raw data");
+  }
+
+  /**
+   * Assemble the raw data of an image into a single 2D image for display.
+   * The masked pixels are left out.
+   * @param index The image index
+   * @param assembler The assembler for the detector
+   * @param gap_value The value of pixels in the gaps or fully masked
+   * @param num_threads The number of threads
+   * @returns The assembled image
+   */
+  ImageAssembler::array_type get_assembled_data(std::size_t index,
+                                                const ImageAssembler &assembler,
+                                                double gap_value,
+                                                int num_threads) {
+    return assembler.assemble(
+      get_raw_data(index), get_mask(index), gap_value, num_threads);
+  }
+
+  /**
+   * Add the raw data of a range of images to a histogram. The images are read
+   * in turn and the pixels of each image are binned in parallel. The mask
+   * includes the trusted range so the histogram of the full range of values
+   * needs use_mask = false.
+   * @param histogram The histogram
+   * @param first The first image index
+   * @param last The last image index (exclusive)
+   * @param use_mask Leave out the masked pixels
+   * @param num_threads The number of threads
+   */
+  void accumulate_histogram(format::PixelHistogram &histogram,
+                            std::size_t first,
+                            std::size_t last,
+                            bool use_mask,
+                            int num_threads) {
+    DXTBX_ASSERT(first <= last && last <= size());
+    for (std::size_t index = first; index < last; ++index) {
+      ImageBuffer buffer = get_raw_data(index).dense();
+      Image<bool> mask = use_mask ? get_mask(index) : Image<bool>();
+      if (buffer.is_int()) {
+        histogram.add_image(buffer.as_int(), mask, num_threads);
+      } else if (buffer.is_float()) {
+        histogram.add_image(buffer.as_float(), mask, num_threads);
+      } else if (buffer.is_double()) {
+        histogram.add_image(buffer.as_double(), mask, num_threads);
+      } else {
+        throw DXTBX_ERROR("Problem reading raw data");
+      }
+    }
+  }
+
+  /**
+   * Add the raw data of a range of images to a bad pixel finder. Only the
+   * static mask is applied, so saturated or negative pixels which the trusted
+   * range would remove are still counted as hot or dead.
+   * @param finder The bad pixel finder
+   * @param first The first image index
+   * @param last The last image index (exclusive)
+   */
+  void accumulate_bad_pixels(masking::BadPixelFinder &finder,
+                             std::size_t first,
+                             std::size_t last) {
+    DXTBX_ASSERT(first <= last && last <= size());
+    Image<bool> mask = get_static_mask();
+    for (std::size_t index = first; index < last; ++index) {
+      ImageBuffer buffer = get_raw_data(index).dense();
+      if (buffer.is_int()) {
+        finder.add_image(buffer.as_int(), mask);
+      } else if (buffer.is_float()) {
+        finder.add_image(buffer.as_float(), mask);
+      } else if (buffer.is_double()) {
+        finder.add_image(buffer.as_double(), mask);
+      } else {
+        throw DXTBX_ERROR("Problem reading raw data");
+      }
+    }
+  }
+
+  /**
+   * Get the mask binned into blocks of bin_size x bin_size pixels. A block is
+   * valid if any pixel in the block is valid.
+   * @param index The image index
+   * @param bin_size The number of pixels along each side of a block
+   * @returns The binned mask
+   */
+  Image<bool> get_binned_mask(std::size_t index, std::size_t bin_size) {
+    return format::bin_mask(get_mask(index), bin_size);
+  }
+
   /**
    * @param index The image index
    * @returns the beam at index
    */
   virtual beam_ptr get_beam_for_image(std::size_t index = 0) const {
     DXTBX_ASSERT(index < indices_.size());
+    data_.load_models(indices_[index]);
     return data_.get_beam(indices_[index]);
   }
 
@@ -912,6 +2019,7 @@ public:
    */
   virtual detector_ptr get_detector_for_image(std::size_t index = 0) const {
     DXTBX_ASSERT(index < indices_.size());
+    data_.load_models(indices_[index]);
     return data_.get_detector(indices_[index]);
   }
 
@@ -921,6 +2029,7 @@ public:
    */
   virtual goniometer_ptr get_goniometer_for_image(std::size_t index = 0) const {
     DXTBX_ASSERT(index < indices_.size());
+    data_.load_models(indices_[index]);
     return data_.get_goniometer(indices_[index]);
   }
 
@@ -930,16 +2039,19 @@ public:
    */
   virtual scan_ptr get_scan_for_image(std::size_t index = 0) const {
     DXTBX_ASSERT(index < indices_.size());
+    data_.load_models(indices_[index]);
     return data_.get_scan(indices_[index]);
   }
 
   /**
-   * Set the beam model
+   * Set the beam model. The models of the image are read from the model
+   * provider first, so the provider never replaces a model set here.
    * @param index The image index
    * @param beam The beam model
    */
   virtual void set_beam_for_image(const beam_ptr &beam, std::size_t index = 0) {
     DXTBX_ASSERT(index < indices_.size());
+    data_.load_models(indices_[index]);
     data_.set_beam(beam, indices_[index]);
   }
 
@@ -951,6 +2063,7 @@ public:
   virtual void set_detector_for_image(const detector_ptr &detector,
                                       std::size_t index = 0) {
     DXTBX_ASSERT(index < indices_.size());
+    data_.load_models(indices_[index]);
     data_.set_detector(detector, indices_[index]);
   }
 
@@ -962,6 +2075,7 @@ public:
   virtual void set_goniometer_for_image(const goniometer_ptr &goniometer,
                                         std::size_t index = 0) {
     DXTBX_ASSERT(index < indices_.size());
+    data_.load_models(indices_[index]);
     data_.set_goniometer(goniometer, indices_[index]);
   }
 
@@ -973,6 +2087,7 @@ public:
   virtual void set_scan_for_image(const scan_ptr &scan, std::size_t index = 0) {
     DXTBX_ASSERT(scan == NULL || scan->get_num_images() == 1);
     DXTBX_ASSERT(index < indices_.size());
+    data_.load_models(indices_[index]);
     data_.set_scan(scan, indices_[index]);
   }
 
@@ -1076,24 +2191,121 @@ public:
    * manually cleared before moving onto the next imageset.
    */
   void clear_cache() {
-    data_cache_ = DataCache<ImageBuffer>();
-    double_raw_data_cache_ = DataCache<Image<double> >();
+    detail::cache_lock lock(cache_mutex_);
+    thread_caches_.clear();
   }
 
 protected:
   ImageSetData data_;
   scitbx::af::shared<std::size_t> indices_;
-  DataCache<ImageBuffer> data_cache_;
-  DataCache<Image<double> > double_raw_data_cache_;
+  ThreadCacheMap thread_caches_;
+  std::size_t thread_cache_clock_;
+  detail::cache_mutex cache_mutex_;
+  int num_threads_;
+
+  /**
+   * Convert an image to double, converting the tiles in parallel
+   * @param image The image
+   * @returns The converted image
+   */
+  template <typename T>
+  Image<double> convert_to_double(const Image<T> &image) const {
+    Image<double> result;
+    detail::ConvertTiles<T> convert;
+    for (std::size_t i = 0; i < image.n_tiles(); ++i) {
+      scitbx::af::const_ref<T, scitbx::af::c_grid<2> > source =
+        image.tile(i).const_ref();
+      scitbx::af::versa<double, scitbx::af::c_grid<2> > data(
+        source.accessor(), scitbx::af::init_functor_null<double>());
+      convert.source.push_back(source);
+      convert.result.push_back(data.ref());
+      result.push_back(ImageTile<double>(data));
+    }
+    detail::for_each_tile(convert, image.n_tiles(), num_threads_);
+    return result;
+  }
+
+  /**
+   * Get the caches of the calling thread. The caches are not dropped for
+   * another thread while the caller holds the pointer.
+   * @returns The caches of the calling thread
+   */
+  thread_cache_ptr thread_cache() {
+    thread_cache_ptr result;
+    thread_cache_ptr evicted;
+    {
+      detail::cache_lock lock(cache_mutex_);
+      unsigned long id = detail::current_thread_id();
+      thread_cache_ptr &cache = thread_caches_[id];
+      if (cache == NULL) {
+        // Caches held outside the map are in use by their thread and are kept
+        if (thread_caches_.size() > max_thread_caches) {
+          ThreadCacheMap::iterator oldest = thread_caches_.end();
+          for (ThreadCacheMap::iterator it = thread_caches_.begin();
+               it != thread_caches_.end();
+               ++it) {
+            if (it->first != id && it->second.use_count() == 1
+                && (oldest == thread_caches_.end()
+                    || it->second->last_used < oldest->second->last_used)) {
+              oldest = it;
+            }
+          }
+          if (oldest != thread_caches_.end()) {
+            evicted.swap(oldest->second);
+            thread_caches_.erase(oldest);
+          }
+        }
+        cache = boost::make_shared<ThreadCache>();
+      }
+      cache->last_used = ++thread_cache_clock_;
+      result = cache;
+    }
+
+    // Arrays of the dropped caches may still be shared with Python objects,
+    // whose reference counts are only changed with the GIL held
+    if (evicted) {
+      detail::gil_guard gil;
+      evicted.reset();
+    }
+    return result;
+  }
+
+  /**
+   * Get the calling thread's copy of an external lookup map, copying the map
+   * again if it has been set since
+   * @param item The external lookup item
+   * @param cache The thread's copy
+   * @returns The external lookup map
+   */
+  template <typename T>
+  Image<T> get_lookup_data(const ExternalLookupItem<T> &item, LookupCache<T> &cache) {
+    detail::cache_lock lock(cache_mutex_);
+    if (!cache.valid || cache.version != item.version()) {
+      cache.image = detail::deep_copy(item.get_data());
+      cache.version = item.version();
+      cache.valid = true;
+    }
+    return cache.image;
+  }
 
   Image<double> get_raw_data_as_double(std::size_t index) {
     DXTBX_ASSERT(index < indices_.size());
-    if (double_raw_data_cache_.index == index) {
-      return double_raw_data_cache_.image;
+    thread_cache_ptr cache_pointer = thread_cache();
+    ThreadCache &cache = *cache_pointer;
+    if (cache.double_raw_data.index == index) {
+      return cache.double_raw_data.image;
     }
-    Image<double> image = get_raw_data(index).as_double();
-    double_raw_data_cache_.index = index;
-    double_raw_data_cache_.image = image;
+    ImageBuffer buffer = get_raw_data(index);
+    Image<double> image;
+    if (num_threads_ > 1 && buffer.is_int()) {
+      image = convert_to_double(buffer.as_int());
+    } else if (num_threads_ > 1 && buffer.is_float()) {
+      image = convert_to_double(buffer.as_float());
+    } else {
+      image = buffer.as_double();
+    }
+    cache.double_raw_data.index = index;
+    cache.double_raw_data.image = image;
     return image;
   }
 };
@@ -1271,6 +2483,27 @@ public:
    */
   virtual ~ImageSequence() {}
 
+protected:
+  /**
+   * Construct a view on an existing sequence. The per-image models held in
+   * the imageset data are shared with the sequence and are not modified.
+   * @param sequence The sequence to view
+   * @param indices The image indices
+   * @param scan The scan model for the view
+   */
+  ImageSequence(const ImageSequence &sequence,
+                const scitbx::af::const_ref<std::size_t> &indices,
+                const scan_ptr &scan)
+      : ImageSet(sequence.data_, indices),
+        beam_(sequence.beam_),
+        detector_(sequence.detector_),
+        goniometer_(sequence.goniometer_),
+        scan_(scan) {
+    DXTBX_ASSERT(scan.get() != NULL);
+    DXTBX_ASSERT(scan->get_num_images() == size());
+  }
+
+public:
   /**
    * Get the dynamic mask for the requested image
    * @param index The image index
@@ -1508,6 +2741,376 @@ protected:
   scan_ptr scan_;
 };
 
+namespace detail {
+
+  /**
+   * Get the image buffer as an image of the requested type
+   */
+  template <typename T>
+  Image<T> image_buffer_as(const ImageBuffer &buffer);
+
+  template <>
+  inline Image<int> image_buffer_as<int>(const ImageBuffer &buffer) {
+    return buffer.as_int();
+  }
+
+  template <>
+  inline Image<float> image_buffer_as<float>(const ImageBuffer &buffer) {
+    return buffer.as_float();
+  }
+
+  template <>
+  inline Image<double> image_buffer_as<double>(const ImageBuffer &buffer) {
+    return buffer.as_double();
+  }
+
+  /**
+   * Compute the indices of the first image in each block
+   * @param indices The image indices
+   * @param block_size The number of images in a block
+   * @returns The first index of each block
+   */
+  inline scitbx::af::shared<std::size_t> block_indices(
+    const scitbx::af::const_ref<std::size_t> &indices,
+    std::size_t block_size) {
+    DXTBX_ASSERT(block_size > 0);
+    if (indices.size() % block_size != 0) {
+      throw DXTBX_ERROR("Number of images is not a multiple of the block size");
+    }
+    scitbx::af::shared<std::size_t> result;
+    for (std::size_t i = 0; i < indices.size(); i += block_size) {
+      result.push_back(indices[i]);
+    }
+    return result;
+  }
+
+  /**
+   * Merge blocks of images in a scan. The oscillation width is multiplied by the
+   * block size, the exposure times are summed and the epoch of each block is
+   * that of the first image in the block.
+   * @param scan The scan
+   * @param block_size The number of images in a block
+   * @returns The merged scan
+   */
+  inline Scan summed_scan(const Scan &scan, std::size_t block_size) {
+    DXTBX_ASSERT(block_size > 0);
+    DXTBX_ASSERT(scan.get_num_images() % block_size == 0);
+    std::size_t num_blocks = scan.get_num_images() / block_size;
+    scitbx::af::shared<double> exposure_times = scan.get_exposure_times();
+    scitbx::af::shared<double> epochs = scan.get_epochs();
+    scitbx::af::shared<double> block_exposure_times(num_blocks, 0.0);
+    scitbx::af::shared<double> block_epochs(num_blocks, 0.0);
+    for (std::size_t i = 0; i < num_blocks; ++i) {
+      block_epochs[i] = epochs[i * block_size];
+      for (std::size_t j = 0; j < block_size; ++j) {
+        block_exposure_times[i] += exposure_times[i * block_size + j];
+      }
+    }
+    int first = scan.get_image_range()[0];
+    scitbx::vec2<double> oscillation = scan.get_oscillation();
+    return Scan(scitbx::vec2<int>(first, first + (int)num_blocks - 1),
+                scitbx::vec2<double>(oscillation[0], oscillation[1] * block_size),
+                block_exposure_times,
+                block_epochs,
+                scan.get_batch_offset());
+  }
+
+}  // namespace detail
+
+/**
+ * A view of a sequence in which each block of consecutive images is presented
+ * as a single image. The image data is the sum of the images in the block and
+ * the mask is the union of the invalid pixels in the images in the block. The
+ * scan covers the same oscillation range with fewer, wider images.
+ */
+class SummedImageSequence : public ImageSequence {
+public:
+  /**
+   * Construct the summed sequence
+   * @param sequence The sequence of raw images
+   * @param block_size The number of raw images to sum per image
+   */
+  SummedImageSequence(const ImageSequence &sequence, std::size_t block_size)
+      : ImageSequence(
+        sequence,
+        detail::block_indices(sequence.indices().const_ref(), block_size).const_ref(),
+        scan_ptr(new Scan(detail::summed_scan(
+          detail::safe_dereference(sequence.get_scan()), block_size)))),
+        sequence_(sequence),
+        block_size_(block_size) {
+    update_block_scans();
+  }
+
+  /**
+   * Destructor
+   */
+  virtual ~SummedImageSequence() {}
+
+  /**
+   * @returns The sequence of raw images
+   */
+  ImageSequence sequence() const {
+    return sequence_;
+  }
+
+  /**
+   * @returns The number of raw images in each image
+   */
+  std::size_t get_block_size() const {
+    return block_size_;
+  }
+
+  /**
+   * Get the summed image data
+   * @param index The image index
+   * @returns The sum of the raw images in the block
+   */
+  virtual ImageBuffer get_raw_data(std::size_t index) {
+    DXTBX_ASSERT(index < indices_.size());
+    thread_cache_ptr cache_pointer = thread_cache();
+    ThreadCache &cache = *cache_pointer;
+    if (cache.data.index != index) {
+      read_block(index, cache);
+    }
+    return cache.data.image;
+  }
+
+  /**
+   * Get the summed image data for a subset of the detector panels
+   * @param index The image index
+   * @param panels The panel indices
+   * @returns The summed image data with one tile per requested panel
+   */
+  virtual ImageBuffer get_raw_data_for_panels(
+    std::size_t index,
+    const scitbx::af::const_ref<std::size_t> &panels) {
+    return detail::select_tiles(get_raw_data(index), panels);
+  }
+
+  /**
+   * Get the dynamic mask for the requested image. A pixel is masked if it is
+   * masked in any of the raw images in the block.
+   * @param index The image index
+   * @returns The image mask
+   */
+  virtual Image<bool> get_dynamic_mask(std::size_t index) {
+    DXTBX_ASSERT(index < indices_.size());
+    thread_cache_ptr cache_pointer = thread_cache();
+    ThreadCache &cache = *cache_pointer;
+    if (cache.trusted_mask.index != index) {
+      read_block(index, cache);
+    }
+
+    // Combine the dynamic masks at each raw image angle
+    Image<bool> dyn_mask;
+    ImageSetData::masker_ptr masker = data_.masker();
+    if (masker != NULL) {
+      scan_ptr raw_scan_pointer = sequence_.get_scan();
+      const Scan &raw_scan = detail::safe_reference(raw_scan_pointer);
+      DXTBX_ASSERT(detector_ != NULL);
+      for (std::size_t k = 0; k < block_size_; ++k) {
+        double scan_angle = rad_as_deg(raw_scan.get_angle_from_image_index(
+          index * block_size_ + k + raw_scan.get_image_range()[0]));
+        Image<bool> mask = masker->get_mask(*detector_, scan_angle);
+        if (dyn_mask.empty()) {
+          dyn_mask = mask;
+        } else {
+          combine_mask(dyn_mask, mask);
+        }
+      }
+    }
+
+    // Combine with the static mask and the trusted range mask of the block
+    Image<bool> mask = get_static_mask(dyn_mask);
+    combine_mask(mask, cache.trusted_mask.image);
+    return mask;
+  }
+
+  /**
+   * @param index The image index
+   * @returns the scan at index
+   */
+  virtual scan_ptr get_scan_for_image(std::size_t index = 0) const {
+    DXTBX_ASSERT(index < block_scans_.size());
+    return block_scans_[index];
+  }
+
+  /**
+   * Set the beam model
+   * @param beam The beam model
+   */
+  void set_beam(const beam_ptr &beam) {
+    sequence_.set_beam(beam);
+    beam_ = beam;
+  }
+
+  /**
+   * Set the detector model
+   * @param detector The detector model
+   */
+  void set_detector(const detector_ptr &detector) {
+    sequence_.set_detector(detector);
+    detector_ = detector;
+  }
+
+  /**
+   * Set the goniometer model
+   * @param goniometer The goniometer model
+   */
+  void set_goniometer(const goniometer_ptr &goniometer) {
+    sequence_.set_goniometer(goniometer);
+    goniometer_ = goniometer;
+  }
+
+  /**
+   * Set the scan model. The scan must have the same number of images.
+   * @param scan The scan model
+   */
+  void set_scan(const scan_ptr &scan) {
+    DXTBX_ASSERT(scan.get() != NULL);
+    DXTBX_ASSERT(scan->get_num_images() == size());
+    scan_ = scan;
+    update_block_scans();
+  }
+
+  /**
+   * Convert the summed sequence to an imageset of the first raw image in each
+   * block
+   * @returns An imageset
+   */
+  ImageSet as_imageset() const {
+    ImageSet result(data_, indices_.const_ref());
+    return result;
+  }
+
+  /**
+   * Get the complete sequence
+   * @returns The complete summed sequence
+   */
+  SummedImageSequence complete_sequence() const {
+    return SummedImageSequence(sequence_.complete_sequence(), block_size_);
+  }
+
+  /**
+   * Get a partial sequence
+   * @param first The first index
+   * @param last The last index
+   * @returns The partial summed sequence
+   */
+  SummedImageSequence partial_sequence(std::size_t first, std::size_t last) const {
+    DXTBX_ASSERT(last > first);
+    DXTBX_ASSERT(last <= size());
+    return SummedImageSequence(
+      sequence_.partial_sequence(first * block_size_, last * block_size_),
+      block_size_);
+  }
+
+protected:
+  ImageSequence sequence_;
+  std::size_t block_size_;
+  std::vector<scan_ptr> block_scans_;
+
+  /**
+   * Construct the single image scan for each image
+   */
+  void update_block_scans() {
+    block_scans_.clear();
+    for (std::size_t i = 0; i < size(); ++i) {
+      block_scans_.push_back(scan_ptr(new Scan((*scan_)[i])));
+    }
+  }
+
+  /**
+   * Combine two masks in place
+   */
+  static void combine_mask(Image<bool> &mask, const Image<bool> &other) {
+    DXTBX_ASSERT(mask.n_tiles() == other.n_tiles());
+    for (std::size_t i = 0; i < mask.n_tiles(); ++i) {
+      scitbx::af::ref<bool, scitbx::af::c_grid<2> > m1 = mask.tile(i).data().ref();
+      scitbx::af::const_ref<bool, scitbx::af::c_grid<2> > m2 =
+        other.tile(i).data().const_ref();
+      DXTBX_ASSERT(m1.accessor().all_eq(m2.accessor()));
+      for (std::size_t j = 0; j < m1.size(); ++j) {
+        m1[j] = m1[j] && m2[j];
+      }
+    }
+  }
+
+  /**
+   * Read the raw images in a block, sum the data and compute the trusted range
+   * mask for the block. The results are stored in the caches.
+   * @param index The image index
+   * @param cache The caches of the calling thread
+   */
+  void read_block(std::size_t index, ThreadCache &cache) {
+    ImageBuffer first = data_.get_data(indices_[index]).dense();
+    Image<bool> mask;
+    ImageBuffer image;
+    if (first.is_int()) {
+      image = ImageBuffer(sum_block<int>(index, first.as_int(), mask));
+    } else if (first.is_float()) {
+      image = ImageBuffer(sum_block<float>(index, first.as_float(), mask));
+    } else if (first.is_double()) {
+      image = ImageBuffer(sum_block<double>(index, first.as_double(), mask));
+    } else {
+      throw DXTBX_ERROR("Problem reading raw data");
+    }
+    cache.data.index = index;
+    cache.data.image = image;
+    cache.double_raw_data = DataCache<Image<double> >();
+    cache.trusted_mask.index = index;
+    cache.trusted_mask.image = mask;
+  }
+
+  /**
+   * Sum the raw images in a block
+   * @param index The image index
+   * @param first The first raw image in the block
+   * @param mask The trusted range mask of the block
+   * @returns The summed image
+   */
+  template <typename T>
+  Image<T> sum_block(std::size_t index, const Image<T> &first, Image<bool> &mask) {
+    typedef typename Image<T>::array_type array_type;
+    typedef scitbx::af::versa<bool, scitbx::af::c_grid<2> > mask_type;
+
+    detector_ptr detector_pointer = get_detector_for_image(index);
+    const Detector &detector = detail::safe_reference(detector_pointer);
+    DXTBX_ASSERT(first.n_tiles() == detector.size());
+
+    // Copy the first image so the reader's buffers are not modified
+    Image<T> result;
+    mask = Image<bool>();
+    for (std::size_t i = 0; i < first.n_tiles(); ++i) {
+      array_type data = first.tile(i).data();
+      array_type sum(data.accessor(), scitbx::af::init_functor_null<T>());
+      std::uninitialized_copy(data.begin(), data.end(), sum.begin());
+      mask_type m(data.accessor(), true);
+      detector[i].apply_trusted_range_mask(data.const_ref(), m.ref());
+      result.push_back(ImageTile<T>(sum, first.tile(i).name().c_str()));
+      mask.push_back(ImageTile<bool>(m));
+    }
+
+    // Add the remaining images in the block
+    for (std::size_t k = 1; k < block_size_; ++k) {
+      Image<T> image =
+        detail::image_buffer_as<T>(data_.get_data(indices_[index] + k));
+      DXTBX_ASSERT(image.n_tiles() == result.n_tiles());
+      for (std::size_t i = 0; i < image.n_tiles(); ++i) {
+        scitbx::af::const_ref<T, scitbx::af::c_grid<2> > data =
+          image.tile(i).const_ref();
+        scitbx::af::ref<T, scitbx::af::c_grid<2> > sum = result.tile(i).data().ref();
+        DXTBX_ASSERT(data.accessor().all_eq(sum.accessor()));
+        for (std::size_t j = 0; j < data.size(); ++j) {
+          sum[j] += data[j];
+        }
+        detector[i].apply_trusted_range_mask(data, mask.tile(i).data().ref());
+      }
+    }
+    return result;
+  }
+};
+
 }  // namespace dxtbx
 
 #endif  // DXTBX_IMAGESET_H
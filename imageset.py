@@ -1,7 +1,11 @@
 from __future__ import absolute_import, division, print_function
 
+import json
+import os
 from builtins import range
 
+import numpy as np
+
 import boost_adaptbx.boost.python
 
 import dxtbx.format.image  # noqa: F401, import dependency for unpickling
@@ -11,10 +15,12 @@ from dxtbx_imageset_ext import (
     ExternalLookup,
     ExternalLookupItemBool,
     ExternalLookupItemDouble,
+    ImageAssembler,
     ImageGrid,
     ImageSequence,
     ImageSet,
     ImageSetData,
+    SummedImageSequence,
 )
 
 ext = boost_adaptbx.boost.python.import_ext("dxtbx_ext")
@@ -25,6 +31,7 @@ __all__ = (
     "ExternalLookup",
     "ExternalLookupItemBool",
     "ExternalLookupItemDouble",
+    "ImageAssembler",
     "ImageGrid",
     "ImageSet",
     "ImageSetData",
@@ -32,6 +39,8 @@ __all__ = (
     "ImageSetLazy",
     "ImageSequence",
     "MemReader",
+    "PyramidCache",
+    "SummedImageSequence",
 )
 
 
@@ -67,6 +76,15 @@ class MemReader(object):
         format_instance = self._images[index]
         return format_instance.get_raw_data()
 
+    def read_panels(self, index, panels):
+        format_instance = self._images[index]
+        if hasattr(format_instance, "get_raw_data_for_panels"):
+            return format_instance.get_raw_data_for_panels(panels)
+        raw_data = self.read(index)
+        if not isinstance(raw_data, tuple):
+            raw_data = (raw_data,)
+        return tuple(raw_data[panel] for panel in panels)
+
     @staticmethod
     def is_single_file_reader():
         return False
@@ -173,69 +191,30 @@ class ImageSetLazy(ImageSet):
     """
     Lazy ImageSet class that doesn't necessitate setting the models ahead of time.
     Only when a particular model (like detector or beam) for an image is requested,
-    it sets the model using the format class and then returns the model
+    it is read using the model provider of the imageset data and cached. Format
+    classes install their reader as the provider when the file has been checked.
+    Identical models of consecutive images are shared, so changing a model in
+    place changes it for each image sharing it; use set_beam etc. to replace the
+    model of a single image.
     """
 
-    def _get_item_from_parent_or_format(self, item_name, index):
-        """
-        Obtain an $item_name (eg. detector, beam, ...) of the given index from
-        the parent class using get_detector, get_beam, ...
-        If the parent class returns None then lookup the item using the format
-        class (if defined) and store a local reference to the item using
-        self.set_detector, set_beam, ..
-        """
-        if index is None:
-            index = 0
-        item = getattr(super(ImageSetLazy, self), "get_" + item_name)(index)
-        if item is None:
-            # If check_format=False was used, then _current_instance_ will not be set, so assume a None is correct
-            format_class = self.get_format_class()
-            if (
-                hasattr(format_class, "_current_instance_")
-                and format_class._current_instance_ is not None
-            ):
-                format_instance = format_class._current_instance_
-                getter_function = getattr(format_instance, "get_" + item_name)
-                item = getter_function(self.indices()[index])
-                setter_function = getattr(self, "set_" + item_name)
-                setter_function(item, index)
-        return item
-
     def get_detector(self, index=None):
-        return self._get_item_from_parent_or_format("detector", index)
+        return super(ImageSetLazy, self).get_detector(index or 0)
 
     def get_beam(self, index=None):
-        return self._get_item_from_parent_or_format("beam", index)
+        return super(ImageSetLazy, self).get_beam(index or 0)
 
     def get_goniometer(self, index=None):
-        return self._get_item_from_parent_or_format("goniometer", index)
+        return super(ImageSetLazy, self).get_goniometer(index or 0)
 
     def get_scan(self, index=None):
-        return self._get_item_from_parent_or_format("scan", index)
-
-    def _load_models(self, index):
-        if index is None:
-            index = 0
-        # Sets the list for detector, beam etc before being accessed by functions in imageset.h
-        self.get_detector(index)
-        self.get_beam(index)
-        self.get_goniometer(index)
-        self.get_scan(index)
+        return super(ImageSetLazy, self).get_scan(index or 0)
 
     def __getitem__(self, item):
         if isinstance(item, slice):
             return ImageSetLazy(self.data(), indices=self.indices()[item])
-        self._load_models(item)
         return super(ImageSetLazy, self).__getitem__(item)
 
-    def get_corrected_data(self, index):
-        self._load_models(index)
-        return super(ImageSetLazy, self).get_corrected_data(index)
-
-    def get_gain(self, index):
-        self._load_models(index)
-        return super(ImageSetLazy, self).get_gain(index)
-
 
 @boost_adaptbx.boost.python.inject_into(ImageSequence)
 class _(object):
@@ -285,6 +264,135 @@ class _(object):
         return self.data().get_template()
 
 
+class PyramidCache(object):
+    """A compact on-disk cache of the coarse levels of the image pyramids of an
+    imageset, for viewers which scrub through a sweep at low zoom.
+
+    Each stored level of each panel is kept in a single float32 .npy file for
+    the whole imageset, memory mapped so that reading one frame at one level
+    only touches that slice of the file. Masked pixels are stored as NaN.
+    Frames are added the first time they are requested. Only the levels from
+    first_level up are stored, since the finer levels are as large as the
+    image data they are made from. The cache is rebuilt if the imageset or the
+    pyramid parameters do not match the ones it was made with. Frames should
+    only be added by one process at a time.
+    """
+
+    def __init__(self, directory, imageset, num_levels=4, first_level=2, pooling="max"):
+        """
+        Params:
+            directory: The directory holding the cache
+            imageset: The imageset
+            num_levels: The number of levels in the pyramid
+            first_level: The finest level to store
+            pooling: Pool with the "max" or the "mean"
+        """
+        assert 0 <= first_level < num_levels
+        assert pooling in ("max", "mean")
+        self._imageset = imageset
+        self._num_levels = num_levels
+        self._first_level = first_level
+        self._pooling = pooling
+
+        # The shape of each panel at each stored level
+        shapes = []
+        for panel in imageset.get_detector():
+            xsize, ysize = panel.get_image_size()
+            panel_shapes = []
+            for level in range(num_levels):
+                xsize, ysize = (xsize + 1) // 2, (ysize + 1) // 2
+                panel_shapes.append((ysize, xsize))
+            shapes.append(panel_shapes)
+
+        metadata = {
+            "paths": [imageset.get_path(i) for i in range(len(imageset))],
+            "num_levels": num_levels,
+            "first_level": first_level,
+            "pooling": pooling,
+            "shapes": shapes,
+        }
+        if not os.path.isdir(directory):
+            os.makedirs(directory)
+        metadata_path = os.path.join(directory, "pyramid.json")
+        mode = "w+"
+        if os.path.exists(metadata_path):
+            with open(metadata_path) as f:
+                if json.load(f) == json.loads(json.dumps(metadata)):
+                    mode = "r+"
+
+        def open_array(name, dtype, shape):
+            return np.lib.format.open_memmap(
+                os.path.join(directory, name), mode=mode, dtype=dtype, shape=shape
+            )
+
+        n = len(imageset)
+        self._valid = open_array("valid.npy", np.bool_, (n,))
+        self._levels = {}
+        for level in range(first_level, num_levels):
+            self._levels[level] = [
+                open_array(
+                    "level_%d_panel_%d.npy" % (level, i),
+                    np.float32,
+                    (n,) + panel_shapes[level],
+                )
+                for i, panel_shapes in enumerate(shapes)
+            ]
+        if mode == "w+":
+            self._valid[:] = False
+            self._valid.flush()
+            with open(metadata_path, "w") as f:
+                json.dump(metadata, f)
+
+    def levels(self):
+        """Return the stored levels"""
+        return list(range(self._first_level, self._num_levels))
+
+    def __contains__(self, index):
+        """Return True if the pyramid of the frame is cached"""
+        return bool(self._valid[index])
+
+    def __len__(self):
+        """Return the number of frames cached"""
+        return int(np.count_nonzero(self._valid))
+
+    def get(self, index, level):
+        """Get a level of the pyramid of a frame, computing the pyramid if it is
+        not yet cached.
+
+        Params:
+            index: The image index
+            level: The pyramid level
+
+        Returns:
+            A tuple of float32 arrays, one per panel, with NaN for masked pixels
+        """
+        if level not in self._levels:
+            raise IndexError("Pyramid level %d is not stored" % level)
+        if not self._valid[index]:
+            self.update(index)
+        return tuple(panel[index] for panel in self._levels[level])
+
+    def update(self, index):
+        """Compute the pyramid of a frame and add it to the cache
+
+        Params:
+            index: The image index
+        """
+        pyramid = self._imageset.get_pyramid(
+            index, num_levels=self._num_levels, pooling=self._pooling
+        )
+        for level, panels in self._levels.items():
+            values = pyramid.level(level)
+            masks = pyramid.mask(level)
+            for panel, value, mask in zip(panels, values, masks):
+                data = value.as_numpy_array().astype(np.float32)
+                data[~mask.as_numpy_array()] = np.nan
+                panel[index] = data
+                panel.flush()
+        self._valid[index] = True
+        self._valid.flush()
+
+
 def _analyse_files(filenames):
     """Group images by filename into image sets.
 
@@ -6,8 +6,10 @@ from rstbx.cftbx.coordinate_frame_helpers import align_reference_frame
 from scitbx import matrix
 from scitbx.array_family import flex
 
+from dxtbx.format.image import ImageBool
 from dxtbx.model import MultiAxisGoniometer
 from dxtbx_masking_ext import (
+    BadPixelFinder,
     GoniometerShadowMasker,
     SmarGonShadowMasker,
     is_inside_polygon,
@@ -17,8 +19,11 @@ from dxtbx_masking_ext import (
 )
 
 __all__ = [
+    "BadPixelFinder",
     "GoniometerShadowMasker",
     "SmarGonShadowMasker",
+    "apply_bad_pixel_mask",
+    "find_bad_pixels",
     "is_inside_polygon",
     "mask_untrusted_circle",
     "mask_untrusted_polygon",
@@ -26,6 +31,40 @@ __all__ = [
 ]
 
 
+def find_bad_pixels(imageset, **kwargs):
+    """Find hot, dead and stuck pixels in a single pass through an imageset.
+
+    The images are read and compared with their neighbourhoods in C++. Only
+    the static mask of the imageset is applied, so pixels outside the trusted
+    range are still examined.
+
+    Args:
+        imageset: The imageset to read
+        kwargs: Parameters passed to the BadPixelFinder, including max_memory,
+            the largest number of bytes to use for the per-pixel counts
+
+    Returns:
+        The BadPixelFinder containing the mask and the per-pixel counts
+    """
+    finder = BadPixelFinder(**kwargs)
+    imageset.accumulate_bad_pixels(finder, 0, len(imageset))
+    return finder
+
+
+def apply_bad_pixel_mask(imageset, mask):
+    """Combine a bad pixel mask with the external mask of an imageset.
+
+    Args:
+        imageset: The imageset to update
+        mask: A tuple of flex.bool, one per panel (True for good pixels)
+    """
+    if not imageset.external_lookup.mask.data.empty():
+        mask = tuple(
+            m1 & m2.data() for m1, m2 in zip(mask, imageset.external_lookup.mask.data)
+        )
+    imageset.external_lookup.mask.data = ImageBool(mask)
+
+
 class GoniometerMaskerFactory(object):
     @staticmethod
     def mini_kappa(goniometer, cone_opening_angle=43.60281897270362):
@@ -0,0 +1,279 @@
+#ifndef DXTBX_MASKING_BAD_PIXEL_FINDER_H
+#define DXTBX_MASKING_BAD_PIXEL_FINDER_H
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+#include <boost/cstdint.hpp>
+#include <scitbx/array_family/versa.h>
+#include <scitbx/array_family/accessors/c_grid.h>
+#include <dxtbx/format/image.h>
+#include <dxtbx/error.h>
+
+namespace dxtbx { namespace masking {
+
+  using dxtbx::format::Image;
+  using dxtbx::format::ImageTile;
+
+  /**
+   * A class to find hot, dead and stuck pixels from a stream of images.
+   *
+   * Each image is compared pixel by pixel with the median of the valid pixels
+   * in the surrounding 3x3 neighbourhood. For each pixel the number of images
+   * in which it was observed and the number of images in which it looked
+   * hot (far above its neighbours), dead (zero or negative while its
+   * neighbours are not) or stuck (the same non-zero value as in the previous
+   * image) are counted. Only these counts and the previous value are stored,
+   * in 12 bytes per pixel, so the memory used does not depend on the number
+   * of images. The counts are 16 bit; when a pixel has been observed 65535
+   * times all its counts are halved, which keeps the fractions and weights
+   * recent images more. The previous value is stored in single precision.
+   */
+  class BadPixelFinder {
+  public:
+    typedef scitbx::af::versa<int, scitbx::af::c_grid<2> > int_array_type;
+
+    /**
+     * @param n_sigma The number of sigma above the neighbourhood for a hot pixel
+     * @param hot_fraction The fraction of images a pixel must be hot in
+     * @param dead_fraction The fraction of images a pixel must be dead in
+     * @param stuck_fraction The fraction of images a pixel must be stuck in
+     * @param min_images The number of observations needed to flag a pixel
+     * @param max_memory The largest number of bytes to use for the counts
+     */
+    BadPixelFinder(double n_sigma,
+                   double hot_fraction,
+                   double dead_fraction,
+                   double stuck_fraction,
+                   std::size_t min_images,
+                   std::size_t max_memory)
+        : n_sigma_(n_sigma),
+          hot_fraction_(hot_fraction),
+          dead_fraction_(dead_fraction),
+          stuck_fraction_(stuck_fraction),
+          min_images_(min_images),
+          max_memory_(max_memory),
+          num_images_(0) {
+      DXTBX_ASSERT(n_sigma > 0);
+      DXTBX_ASSERT(hot_fraction > 0 && hot_fraction <= 1);
+      DXTBX_ASSERT(dead_fraction > 0 && dead_fraction <= 1);
+      DXTBX_ASSERT(stuck_fraction > 0 && stuck_fraction <= 1);
+      DXTBX_ASSERT(min_images > 0);
+    }
+
+    /**
+     * Accumulate the statistics from an image
+     * @param data The image data
+     * @param mask The image mask (true for valid pixels)
+     */
+    template <typename T>
+    void add_image(const Image<T> &data, const Image<bool> &mask) {
+      DXTBX_ASSERT(data.n_tiles() == mask.n_tiles());
+      if (num_images_ == 0) {
+        initialize(data);
+      }
+      DXTBX_ASSERT(data.n_tiles() == state_.size());
+      for (std::size_t t = 0; t < data.n_tiles(); ++t) {
+        add_tile(
+          t, data.tile(t).data().const_ref(), mask.tile(t).data().const_ref());
+      }
+      num_images_++;
+    }
+
+    /**
+     * @returns The number of images added
+     */
+    std::size_t num_images() const {
+      return num_images_;
+    }
+
+    /**
+     * @returns The largest number of bytes to use for the counts
+     */
+    std::size_t max_memory() const {
+      return max_memory_;
+    }
+
+    /**
+     * @returns The number of bytes used for the counts
+     */
+    std::size_t memory_used() const {
+      std::size_t n = 0;
+      for (std::size_t t = 0; t < state_.size(); ++t) {
+        n += state_[t].size() * sizeof(PixelState);
+      }
+      return n;
+    }
+
+    /**
+     * Get the bad pixel mask
+     * @returns The mask (true for good pixels)
+     */
+    Image<bool> mask() const {
+      typedef scitbx::af::versa<bool, scitbx::af::c_grid<2> > bool_array_type;
+      Image<bool> result;
+      for (std::size_t t = 0; t < state_.size(); ++t) {
+        bool_array_type m(grids_[t], true);
+        for (std::size_t i = 0; i < m.size(); ++i) {
+          const PixelState &s = state_[t][i];
+          double n = s.observed;
+          if (n >= min_images_) {
+            m[i] = s.hot < hot_fraction_ * n && s.dead < dead_fraction_ * n
+                   && s.stuck < stuck_fraction_ * n;
+          }
+        }
+        result.push_back(ImageTile<bool>(m));
+      }
+      return result;
+    }
+
+    /**
+     * @returns The number of images in which each pixel was observed
+     */
+    Image<int> num_observed() const {
+      return as_image(&PixelState::observed);
+    }
+
+    /**
+     * @returns The number of images in which each pixel looked hot
+     */
+    Image<int> num_hot() const {
+      return as_image(&PixelState::hot);
+    }
+
+    /**
+     * @returns The number of images in which each pixel looked dead
+     */
+    Image<int> num_dead() const {
+      return as_image(&PixelState::dead);
+    }
+
+    /**
+     * @returns The number of images in which each pixel looked stuck
+     */
+    Image<int> num_stuck() const {
+      return as_image(&PixelState::stuck);
+    }
+
+  protected:
+    struct PixelState {
+      boost::uint16_t observed;
+      boost::uint16_t hot;
+      boost::uint16_t dead;
+      boost::uint16_t stuck;
+      float last;
+
+      PixelState()
+          : observed(0),
+            hot(0),
+            dead(0),
+            stuck(0),
+            last(std::numeric_limits<float>::quiet_NaN()) {}
+    };
+
+    template <typename T>
+    void initialize(const Image<T> &data) {
+      std::size_t num_pixels = 0;
+      for (std::size_t t = 0; t < data.n_tiles(); ++t) {
+        num_pixels += data.tile(t).accessor().size_1d();
+      }
+      if (num_pixels * sizeof(PixelState) > max_memory_) {
+        throw DXTBX_ERROR("Bad pixel counts need more than the memory budget");
+      }
+      for (std::size_t t = 0; t < data.n_tiles(); ++t) {
+        scitbx::af::c_grid<2> grid = data.tile(t).accessor();
+        grids_.push_back(grid);
+        state_.push_back(std::vector<PixelState>(grid.size_1d()));
+      }
+    }
+
+    template <typename T>
+    void add_tile(std::size_t t,
+                  const scitbx::af::const_ref<T, scitbx::af::c_grid<2> > &data,
+                  const scitbx::af::const_ref<bool, scitbx::af::c_grid<2> > &mask) {
+      DXTBX_ASSERT(data.accessor().all_eq(mask.accessor()));
+      DXTBX_ASSERT(data.accessor().all_eq(grids_[t]));
+      std::vector<PixelState> &state = state_[t];
+      std::size_t ysize = data.accessor()[0];
+      std::size_t xsize = data.accessor()[1];
+      double neighbours[8];
+      for (std::size_t j = 0; j < ysize; ++j) {
+        for (std::size_t i = 0; i < xsize; ++i) {
+          PixelState &s = state[j * xsize + i];
+          if (!mask(j, i)) {
+            s.last = std::numeric_limits<float>::quiet_NaN();
+            continue;
+          }
+
+          // Collect the valid neighbouring pixels
+          std::size_t n = 0;
+          std::size_t j0 = j > 0 ? j - 1 : 0;
+          std::size_t i0 = i > 0 ? i - 1 : 0;
+          std::size_t j1 = std::min(j + 2, ysize);
+          std::size_t i1 = std::min(i + 2, xsize);
+          for (std::size_t jj = j0; jj < j1; ++jj) {
+            for (std::size_t ii = i0; ii < i1; ++ii) {
+              if ((jj != j || ii != i) && mask(jj, ii)) {
+                neighbours[n++] = data(jj, ii);
+              }
+            }
+          }
+          double value = data(j, i);
+          if (n == 0) {
+            s.last = static_cast<float>(value);
+            continue;
+          }
+
+          // Halve the counts before they overflow
+          if (s.observed == std::numeric_limits<boost::uint16_t>::max()) {
+            s.observed /= 2;
+            s.hot /= 2;
+            s.dead /= 2;
+            s.stuck /= 2;
+          }
+
+          // Compare the pixel with the neighbourhood median
+          std::nth_element(neighbours, neighbours + n / 2, neighbours + n);
+          double median = neighbours[n / 2];
+          s.observed++;
+          if (value > median + n_sigma_ * std::sqrt(std::max(median, 1.0))) {
+            s.hot++;
+          }
+          if (value <= 0 && median > 0) {
+            s.dead++;
+          }
+          if (value > 0 && static_cast<float>(value) == s.last) {
+            s.stuck++;
+          }
+          s.last = static_cast<float>(value);
+        }
+      }
+    }
+
+    Image<int> as_image(boost::uint16_t PixelState::*count) const {
+      Image<int> result;
+      for (std::size_t t = 0; t < state_.size(); ++t) {
+        int_array_type c(grids_[t]);
+        for (std::size_t i = 0; i < c.size(); ++i) {
+          c[i] = state_[t][i].*count;
+        }
+        result.push_back(ImageTile<int>(c));
+      }
+      return result;
+    }
+
+    double n_sigma_;
+    double hot_fraction_;
+    double dead_fraction_;
+    double stuck_fraction_;
+    std::size_t min_images_;
+    std::size_t max_memory_;
+    std::size_t num_images_;
+    std::vector<scitbx::af::c_grid<2> > grids_;
+    std::vector<std::vector<PixelState> > state_;
+  };
+
+}}  // namespace dxtbx::masking
+
+#endif  // DXTBX_MASKING_BAD_PIXEL_FINDER_H
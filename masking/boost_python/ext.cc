@@ -3,6 +3,7 @@
 #include <boost/python/def.hpp>
 #include <dxtbx/masking/masking.h>
 #include <dxtbx/masking/goniometer_shadow_masking.h>
+#include <dxtbx/masking/bad_pixel_finder.h>
 
 namespace dxtbx { namespace masking { namespace boost_python {
 
@@ -32,6 +33,27 @@ namespace dxtbx { namespace masking { namespace boost_python {
     return list;
   }
 
+  static boost::python::dict GoniometerShadowMasker_estimate_shadows(
+    const GoniometerShadowMasker &masker,
+    const Detector &detector,
+    const scitbx::af::const_ref<double, scitbx::af::c_grid<2> > &angles,
+    int num_threads) {
+    ShadowEstimate estimate = masker.estimate_shadows(detector, angles, num_threads);
+    std::size_t num_panels = estimate.fraction.accessor()[1];
+    boost::python::list boundary;
+    for (std::size_t i = 0; i < estimate.fraction.accessor()[0]; ++i) {
+      boost::python::list panels;
+      for (std::size_t j = 0; j < num_panels; ++j) {
+        panels.append(estimate.boundary[i * num_panels + j]);
+      }
+      boundary.append(panels);
+    }
+    boost::python::dict result;
+    result["fraction"] = estimate.fraction;
+    result["boundary"] = boundary;
+    return result;
+  }
+
   // Copied from dxtbx/boost_python/imageset_ext.cc
   template <typename T>
   boost::python::tuple image_as_tuple(const Image<T> &image) {
@@ -50,6 +72,26 @@ namespace dxtbx { namespace masking { namespace boost_python {
     return image_as_tuple<bool>(masker.get_mask(detector, scan_angle));
   }
 
+  boost::python::tuple BadPixelFinder_mask(const BadPixelFinder &self) {
+    return image_as_tuple<bool>(self.mask());
+  }
+
+  boost::python::tuple BadPixelFinder_num_observed(const BadPixelFinder &self) {
+    return image_as_tuple<int>(self.num_observed());
+  }
+
+  boost::python::tuple BadPixelFinder_num_hot(const BadPixelFinder &self) {
+    return image_as_tuple<int>(self.num_hot());
+  }
+
+  boost::python::tuple BadPixelFinder_num_dead(const BadPixelFinder &self) {
+    return image_as_tuple<int>(self.num_dead());
+  }
+
+  boost::python::tuple BadPixelFinder_num_stuck(const BadPixelFinder &self) {
+    return image_as_tuple<int>(self.num_stuck());
+  }
+
   struct GoniometerShadowMaskerPickleSuite : boost::python::pickle_suite {
     static boost::python::tuple getinitargs(const GoniometerShadowMasker &obj) {
       return boost::python::make_tuple(
@@ -86,6 +128,10 @@ namespace dxtbx { namespace masking { namespace boost_python {
       .def("set_goniometer_angles", &GoniometerShadowMasker::set_goniometer_angles)
       .def("project_extrema", GoniometerShadowMasker_project_extrema)
       .def("get_mask", GoniometerShadowMasker_get_mask)
+      .def("extrema_at_angles", &GoniometerShadowMasker::extrema_at_angles)
+      .def("estimate_shadows",
+           GoniometerShadowMasker_estimate_shadows,
+           (arg("detector"), arg("angles"), arg("num_threads") = 1))
       .def_pickle(GoniometerShadowMaskerPickleSuite());
 
     class_<SmarGonShadowMasker, bases<GoniometerShadowMasker> >("SmarGonShadowMasker",
@@ -93,5 +139,28 @@ namespace dxtbx { namespace masking { namespace boost_python {
       .def(init<const MultiAxisGoniometer &>())
       .def("extrema_at_scan_angle", &SmarGonShadowMasker::extrema_at_scan_angle)
       .def_pickle(SmarGonShadowMaskerPickleSuite());
+
+    class_<BadPixelFinder>("BadPixelFinder", no_init)
+      .def(init<double, double, double, double, std::size_t, std::size_t>(
+        (arg("n_sigma") = 10.0,
+         arg("hot_fraction") = 0.5,
+         arg("dead_fraction") = 0.9,
+         arg("stuck_fraction") = 0.9,
+         arg("min_images") = 10,
+         arg("max_memory") = std::size_t(1) << 30)))
+      .def("add_image",
+           &BadPixelFinder::add_image<int>,
+           (arg("data"), arg("mask")))
+      .def("add_image",
+           &BadPixelFinder::add_image<double>,
+           (arg("data"), arg("mask")))
+      .def("num_images", &BadPixelFinder::num_images)
+      .def("max_memory", &BadPixelFinder::max_memory)
+      .def("memory_used", &BadPixelFinder::memory_used)
+      .def("mask", &BadPixelFinder_mask)
+      .def("num_observed", &BadPixelFinder_num_observed)
+      .def("num_hot", &BadPixelFinder_num_hot)
+      .def("num_dead", &BadPixelFinder_num_dead)
+      .def("num_stuck", &BadPixelFinder_num_stuck);
   }
 }}}  // namespace dxtbx::masking::boost_python
@@ -8,7 +8,13 @@
 #include <boost/geometry/geometries/adapted/boost_tuple.hpp>
 #include <boost/geometry/geometries/geometries.hpp>
 #include <cmath>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
 #include <scitbx/array_family/shared.h>
+#include <scitbx/array_family/versa.h>
+#include <scitbx/array_family/accessors/c_grid.h>
 #include <dxtbx/error.h>
 #include <dxtbx/masking/masking.h>
 #include <dxtbx/format/image.h>
@@ -30,6 +36,20 @@ namespace dxtbx { namespace masking {
   using scitbx::vec3;
   using scitbx::constants::pi;
 
+  /**
+   * The shadow on each panel at each of a list of goniometer settings
+   */
+  struct ShadowEstimate {
+    /** The shadowed fraction of the pixels, one row per setting */
+    scitbx::af::versa<double, scitbx::af::c_grid<2> > fraction;
+    /** The shadow boundary on each panel in pixels, ordered as fraction */
+    scitbx::af::shared<scitbx::af::shared<vec2<double> > > boundary;
+
+    ShadowEstimate(std::size_t num_settings, std::size_t num_panels)
+        : fraction(scitbx::af::c_grid<2>(num_settings, num_panels), 0.0),
+          boundary(num_settings * num_panels) {}
+  };
+
   /**
    * A class to mask multiple resolution ranges
    */
@@ -67,119 +87,126 @@ namespace dxtbx { namespace masking {
 
     virtual scitbx::af::shared<vec3<double> > extrema_at_scan_angle(
       double scan_angle) const {
-      scitbx::af::shared<vec3<double> > axes = goniometer_.get_axes();
       scitbx::af::shared<double> angles = goniometer_.get_angles();
-      std::size_t scan_axis = goniometer_.get_scan_axis();
-      angles[scan_axis] = scan_angle;
-      scitbx::af::shared<vec3<double> > extrema(extrema_at_datum_.begin(),
-                                                extrema_at_datum_.end());
+      angles[goniometer_.get_scan_axis()] = scan_angle;
+      return extrema_at_angles(angles.const_ref());
+    }
 
-      for (std::size_t i = 0; i < axes.size(); i++) {
-        scitbx::mat3<double> rotation =
-          scitbx::math::r3_rotation::axis_and_angle_as_matrix(axes[i], angles[i], true);
-        for (std::size_t j = 0; j < axis_.size(); j++) {
-          if (axis_[j] > i) {
-            continue;
-          }
-          extrema[j] = rotation * extrema[j];
-        }
-      }
-      return extrema;
+    /**
+     * Compute the extrema at a setting of the goniometer
+     * @param angles The angle of each goniometer axis (degrees)
+     * @returns The extrema
+     */
+    scitbx::af::shared<vec3<double> > extrema_at_angles(
+      const scitbx::af::const_ref<double> &angles) const {
+      scitbx::af::shared<vec3<double> > axes = goniometer_.get_axes();
+      DXTBX_ASSERT(angles.size() == axes.size());
+      std::vector<vec3<double> > extrema;
+      compute_extrema(
+        std::vector<vec3<double> >(axes.begin(), axes.end()), angles.begin(), extrema);
+      return scitbx::af::shared<vec3<double> >(extrema.begin(), extrema.end());
     }
 
     scitbx::af::shared<scitbx::af::shared<vec2<double> > > project_extrema(
       const Detector &detector,
       double scan_angle) const {
-      scitbx::af::shared<vec3<double> > coords = extrema_at_scan_angle(scan_angle);
-
-      typedef boost::tuple<double, double> point_t;
-      typedef boost::geometry::model::polygon<point_t> polygon_t;
-      typedef boost::geometry::model::multi_point<point_t> multi_point_t;
+      scitbx::af::shared<vec3<double> > extrema = extrema_at_scan_angle(scan_angle);
+      std::vector<vec3<double> > coords(extrema.begin(), extrema.end());
 
       scitbx::af::shared<scitbx::af::shared<vec2<double> > > result;
-
       for (std::size_t i = 0; i < detector.size(); i++) {
-        Panel panel = detector[i];
-        multi_point_t points;
-        scitbx::af::shared<vec2<double> > shadow_points;
-
-        /* project coordinates onto panel plane */
-        for (std::size_t j = 0; j < coords.size(); j++) {
-          vec3<double> coord = panel.get_D_matrix() * coords[j];
-          double z = coord[2];
-          double eps = 1e-5;
-          if (z > eps) {
-            point_t p(coord[0] / z, coord[1] / z);
-            /*points.push_back(p);*/
-            boost::geometry::append(points, p);
-          }
-        }
-        if (points.size() < 3) {
-          result.push_back(shadow_points);
-          continue;
+        std::string invalid;
+        std::vector<vec2<double> > shadow_points =
+          project_onto_panel(PanelGeometry(detector[i]), coords, invalid);
+        if (!invalid.empty()) {
+          std::cout << invalid << std::endl;
         }
+        result.push_back(scitbx::af::shared<vec2<double> >(shadow_points.begin(),
+                                                           shadow_points.end()));
+      }
+      return result;
+    }
 
-        polygon_t poly;
-        boost::geometry::convex_hull(points, poly);
-
-        if (poly.outer().size() == 0) {
-          result.push_back(shadow_points);
-          continue;
-        }
+    /**
+     * Estimate the shadow on each panel at many settings of the goniometer.
+     * The shadow boundaries are computed as in project_extrema and the
+     * shadowed pixels are counted row by row from the boundary, so the
+     * fractions are those of the masks from get_mask without building them.
+     * The settings are evaluated in parallel.
+     * @param detector The detector model
+     * @param angles The angle of each goniometer axis (degrees) with one row
+     *               per setting
+     * @param num_threads The number of threads to use
+     * @returns The shadowed fraction of the pixels of each panel and the
+     *          shadow boundary on each panel at each setting
+     */
+    ShadowEstimate estimate_shadows(
+      const Detector &detector,
+      const scitbx::af::const_ref<double, scitbx::af::c_grid<2> > &angles,
+      int num_threads = 1) const {
+      DXTBX_ASSERT(num_threads > 0);
+      scitbx::af::shared<vec3<double> > axes_array = goniometer_.get_axes();
+      DXTBX_ASSERT(angles.accessor()[1] == axes_array.size());
+      std::vector<vec3<double> > axes(axes_array.begin(), axes_array.end());
+      std::vector<PanelGeometry> panels;
+      for (std::size_t i = 0; i < detector.size(); i++) {
+        panels.push_back(PanelGeometry(detector[i]));
+      }
 
-        // Construct detector polygon - points should be clockwise
-        std::vector<point_t> corners;
-        corners.push_back(point_t(0, 0));
-        corners.push_back(point_t(0, panel.get_image_size_mm()[1]));
-        corners.push_back(
-          point_t(panel.get_image_size_mm()[0], panel.get_image_size_mm()[1]));
-        corners.push_back(point_t(panel.get_image_size_mm()[0], 0));
-        corners.push_back(point_t(0, 0));
-        polygon_t det;
-        boost::geometry::assign_points(det, corners);
-
-        // Check the validity of the polygon
-        boost::geometry::validity_failure_type failure;
-        bool valid = boost::geometry::is_valid(poly, failure);
-
-        // if the invalidity is only due to lack of closing points and/or wrongly
-        // oriented rings, then bg::correct can fix it
-        bool could_be_fixed = (failure == boost::geometry::failure_not_closed
-                               || boost::geometry::failure_wrong_orientation);
-        if (!valid) {
-          if (could_be_fixed) {
-            boost::geometry::correct(poly);
-            valid = boost::geometry::is_valid(poly);
+      int num_settings = static_cast<int>(angles.accessor()[0]);
+      std::size_t num_panels = panels.size();
+      ShadowEstimate result(num_settings, num_panels);
+      std::vector<std::vector<vec2<double> > > boundary(num_settings * num_panels);
+      double *fraction = result.fraction.begin();
+      std::vector<char> failed(num_settings, 0);
+      std::vector<std::string> errors(num_settings);
+      std::vector<std::string> invalid(num_settings);
+#pragma omp parallel for num_threads(num_threads) schedule(dynamic) if (num_threads > 1)
+      for (int i = 0; i < num_settings; ++i) {
+        try {
+          std::vector<vec3<double> > coords;
+          compute_extrema(axes, &angles(i, 0), coords);
+          for (std::size_t j = 0; j < num_panels; ++j) {
+            std::size_t k = i * num_panels + j;
+            std::string message;
+            boundary[k] = project_onto_panel(panels[j], coords, message);
+            if (invalid[i].empty()) {
+              invalid[i] = message;
+            }
+            vec2<std::size_t> image_size = panels[j].image_size;
+            double num_pixels = static_cast<double>(image_size[0] * image_size[1]);
+            double inside = count_inside(boundary[k], image_size) / num_pixels;
+            fraction[k] = invert_mask_ ? 1.0 - inside : inside;
           }
+        } catch (const std::exception &e) {
+          failed[i] = 1;
+          errors[i] = e.what();
         }
-        if (!valid) {
-          std::cout << "Invalid polygon geometry (" << failure
-                    << "): " << boost::geometry::dsv(poly) << std::endl;
-          std::cout << boost::geometry::dsv(points) << std::endl;
-          result.push_back(shadow_points);
-          continue;
+      }
+      for (int i = 0; i < num_settings; ++i) {
+        if (failed[i]) {
+          throw DXTBX_ERROR(errors[i]);
         }
+      }
 
-        polygon_t shadow;
-        boost::geometry::convex_hull(poly, shadow);
-
-        // Compute the intersection of the shadow in the detector plane with the
-        // detector
-        std::deque<polygon_t> output;
-        boost::geometry::intersection(det, shadow, output);
-
-        // Extract the coordinates of the shadow on the detector, and convert from
-        // mm to pixel coordinates
-        if (output.size()) {
-          vec2<double> px = panel.get_pixel_size();
-          polygon_t hull = output[0];
-          BOOST_FOREACH (point_t const &point, hull.outer()) {
-            vec2<double> p(boost::geometry::get<0>(point) / px[0],
-                           boost::geometry::get<1>(point) / px[1]);
-            shadow_points.push_back(p);
+      // Report the invalid shadows once, outside the parallel loop
+      std::size_t num_invalid = 0;
+      std::string first_invalid;
+      for (int i = 0; i < num_settings; ++i) {
+        if (!invalid[i].empty()) {
+          if (num_invalid++ == 0) {
+            first_invalid = invalid[i];
           }
         }
-        result.push_back(shadow_points);
+      }
+      if (num_invalid > 0) {
+        std::cout << "Invalid shadow at " << num_invalid
+                  << " goniometer settings, first " << first_invalid << std::endl;
+      }
+
+      for (std::size_t k = 0; k < boundary.size(); ++k) {
+        result.boundary[k] =
+          scitbx::af::shared<vec2<double> >(boundary[k].begin(), boundary[k].end());
       }
       return result;
     }
@@ -220,6 +247,205 @@ namespace dxtbx { namespace masking {
     virtual ~GoniometerShadowMasker(){};
 
   protected:
+    /**
+     * The geometry of a panel needed to project the shadow onto it
+     */
+    struct PanelGeometry {
+      scitbx::mat3<double> D;
+      vec2<double> image_size_mm;
+      vec2<double> pixel_size;
+      vec2<std::size_t> image_size;
+
+      PanelGeometry(const Panel &panel)
+          : D(panel.get_D_matrix()),
+            image_size_mm(panel.get_image_size_mm()),
+            pixel_size(panel.get_pixel_size()),
+            image_size(panel.get_image_size()) {}
+    };
+
+    /**
+     * Compute the extrema at a setting of the goniometer
+     * @param axes The goniometer axes
+     * @param angles The angle of each axis (degrees)
+     * @param extrema The extrema
+     */
+    virtual void compute_extrema(const std::vector<vec3<double> > &axes,
+                                 const double *angles,
+                                 std::vector<vec3<double> > &extrema) const {
+      extrema.assign(extrema_at_datum_.begin(), extrema_at_datum_.end());
+      for (std::size_t i = 0; i < axes.size(); i++) {
+        scitbx::mat3<double> rotation =
+          scitbx::math::r3_rotation::axis_and_angle_as_matrix(axes[i], angles[i], true);
+        for (std::size_t j = 0; j < axis_.size(); j++) {
+          if (axis_[j] > i) {
+            continue;
+          }
+          extrema[j] = rotation * extrema[j];
+        }
+      }
+    }
+
+    /**
+     * Project the extrema onto a panel. The shadow is empty if its polygon is
+     * invalid, and the polygon is described in invalid for the caller to report.
+     * @returns The shadow boundary on the panel in pixels
+     */
+    std::vector<vec2<double> > project_onto_panel(
+      const PanelGeometry &panel,
+      const std::vector<vec3<double> > &coords,
+      std::string &invalid) const {
+      typedef boost::tuple<double, double> point_t;
+      typedef boost::geometry::model::polygon<point_t> polygon_t;
+      typedef boost::geometry::model::multi_point<point_t> multi_point_t;
+
+      multi_point_t points;
+      std::vector<vec2<double> > shadow_points;
+
+      /* project coordinates onto panel plane */
+      for (std::size_t j = 0; j < coords.size(); j++) {
+        vec3<double> coord = panel.D * coords[j];
+        double z = coord[2];
+        double eps = 1e-5;
+        if (z > eps) {
+          point_t p(coord[0] / z, coord[1] / z);
+          /*points.push_back(p);*/
+          boost::geometry::append(points, p);
+        }
+      }
+      if (points.size() < 3) {
+        return shadow_points;
+      }
+
+      polygon_t poly;
+      boost::geometry::convex_hull(points, poly);
+
+      if (poly.outer().size() == 0) {
+        return shadow_points;
+      }
+
+      // Construct detector polygon - points should be clockwise
+      std::vector<point_t> corners;
+      corners.push_back(point_t(0, 0));
+      corners.push_back(point_t(0, panel.image_size_mm[1]));
+      corners.push_back(point_t(panel.image_size_mm[0], panel.image_size_mm[1]));
+      corners.push_back(point_t(panel.image_size_mm[0], 0));
+      corners.push_back(point_t(0, 0));
+      polygon_t det;
+      boost::geometry::assign_points(det, corners);
+
+      // Check the validity of the polygon
+      boost::geometry::validity_failure_type failure;
+      bool valid = boost::geometry::is_valid(poly, failure);
+
+      // if the invalidity is only due to lack of closing points and/or wrongly
+      // oriented rings, then bg::correct can fix it
+      bool could_be_fixed = (failure == boost::geometry::failure_not_closed
+                             || boost::geometry::failure_wrong_orientation);
+      if (!valid) {
+        if (could_be_fixed) {
+          boost::geometry::correct(poly);
+          valid = boost::geometry::is_valid(poly);
+        }
+      }
+      if (!valid) {
+        std::ostringstream message;
+        message << "Invalid polygon geometry (" << failure
+                << "): " << boost::geometry::dsv(poly) << std::endl
+                << boost::geometry::dsv(points);
+        invalid = message.str();
+        return shadow_points;
+      }
+
+      polygon_t shadow;
+      boost::geometry::convex_hull(poly, shadow);
+
+      // Compute the intersection of the shadow in the detector plane with the
+      // detector
+      std::deque<polygon_t> output;
+      boost::geometry::intersection(det, shadow, output);
+
+      // Extract the coordinates of the shadow on the detector, and convert from
+      // mm to pixel coordinates
+      if (output.size()) {
+        polygon_t hull = output[0];
+        BOOST_FOREACH (point_t const &point, hull.outer()) {
+          vec2<double> p(boost::geometry::get<0>(point) / panel.pixel_size[0],
+                         boost::geometry::get<1>(point) / panel.pixel_size[1]);
+          shadow_points.push_back(p);
+        }
+      }
+      return shadow_points;
+    }
+
+    /**
+     * Count the pixels masked by mask_untrusted_polygon. Along each row the
+     * even-odd rule of is_inside_polygon puts the pixel centres between
+     * alternate pairs of sorted edge crossings inside the polygon, so the
+     * pixels can be counted from the crossings without testing each one.
+     * @param polygon The polygon in pixels
+     * @param image_size The panel size in pixels
+     * @returns The number of pixels inside the polygon
+     */
+    static std::size_t count_inside(const std::vector<vec2<double> > &polygon,
+                                    vec2<std::size_t> image_size) {
+      if (polygon.size() < 3) {
+        return 0;
+      }
+      int x0 = (int)std::floor(polygon[0][0]);
+      int y0 = (int)std::floor(polygon[0][1]);
+      int x1 = x0;
+      int y1 = y0;
+      for (std::size_t i = 1; i < polygon.size(); ++i) {
+        int x = (int)std::floor(polygon[i][0]);
+        int y = (int)std::floor(polygon[i][1]);
+        x0 = std::min(x0, x);
+        y0 = std::min(y0, y);
+        x1 = std::max(x1, x);
+        y1 = std::max(y1, y);
+      }
+      x0 = std::max(x0, 0);
+      y0 = std::max(y0, 0);
+      x1 = std::min(x1 + 1, (int)image_size[0]);
+      y1 = std::min(y1 + 1, (int)image_size[1]);
+
+      std::size_t count = 0;
+      std::vector<double> crossings;
+      for (int j = y0; j < y1; ++j) {
+        double y = j + 0.5;
+        crossings.clear();
+        for (std::size_t a = 0, b = polygon.size() - 1; a < polygon.size(); b = a++) {
+          if ((polygon[a][1] > y) != (polygon[b][1] > y)) {
+            crossings.push_back((polygon[b][0] - polygon[a][0]) * (y - polygon[a][1])
+                                  / (polygon[b][1] - polygon[a][1])
+                                + polygon[a][0]);
+          }
+        }
+        std::sort(crossings.begin(), crossings.end());
+        for (std::size_t k = 0; k + 1 < crossings.size(); k += 2) {
+          count += num_centres_below(crossings[k + 1], x0, x1)
+                   - num_centres_below(crossings[k], x0, x1);
+        }
+      }
+      return count;
+    }
+
+    /**
+     * @returns The number of pixels in [x0, x1) whose centre is below x
+     */
+    static std::size_t num_centres_below(double x, int x0, int x1) {
+      int n = x0;
+      if (x > x0) {
+        n = std::min((int)std::ceil(x - 0.5), x1);
+      }
+      while (n > x0 && !(n - 1 + 0.5 < x)) {
+        --n;
+      }
+      while (n < x1 && n + 0.5 < x) {
+        ++n;
+      }
+      return n - x0;
+    }
+
     MultiAxisGoniometer goniometer_;
     scitbx::af::shared<vec3<double> > extrema_at_datum_;
     scitbx::af::shared<std::size_t> axis_;
@@ -279,14 +505,15 @@ namespace dxtbx { namespace masking {
       axis_ = scitbx::af::shared<std::size_t>(extrema_at_datum_.size(), 1);
     }
 
-    scitbx::af::shared<vec3<double> > extrema_at_scan_angle(double scan_angle) const {
-      scitbx::af::shared<vec3<double> > extrema =
-        GoniometerShadowMasker::extrema_at_scan_angle(scan_angle);
+    scitbx::af::shared<vec3<double> > faceA;
+    scitbx::af::shared<vec3<double> > faceB;
+    scitbx::af::shared<vec3<double> > faceE;
 
-      scitbx::af::shared<vec3<double> > axes = goniometer_.get_axes();
-      scitbx::af::shared<double> angles = goniometer_.get_angles();
-      std::size_t scan_axis = goniometer_.get_scan_axis();
-      angles[scan_axis] = scan_angle;
+  protected:
+    void compute_extrema(const std::vector<vec3<double> > &axes,
+                         const double *angles,
+                         std::vector<vec3<double> > &extrema) const {
+      GoniometerShadowMasker::compute_extrema(axes, angles, extrema);
 
       vec3<double> s = faceB[0];
       vec3<double> m = faceB[1];
@@ -296,7 +523,7 @@ namespace dxtbx { namespace masking {
       scitbx::mat3<double> Rchi =
         scitbx::math::r3_rotation::axis_and_angle_as_matrix(axes[1], angles[1], true);
       vec3<double> sk = Rchi * s;
-      scitbx::af::shared<vec3<double> > coords;
+      std::vector<vec3<double> > coords;
       coords.push_back(vec3<double>(sk[0], sk[1], 0));
       coords.push_back(vec3<double>(sk[0], sk[1], sk[2]));
       coords.push_back(vec3<double>(sk[0] + m[0] / 2, sk[1] + m[1] / 2, sk[2]));
@@ -324,14 +551,8 @@ namespace dxtbx { namespace masking {
         coords[i] = Romega * coords[i];
       }
 
-      extrema.extend(coords.begin(), coords.end());
-
-      return extrema;
+      extrema.insert(extrema.end(), coords.begin(), coords.end());
     }
-
-    scitbx::af::shared<vec3<double> > faceA;
-    scitbx::af::shared<vec3<double> > faceB;
-    scitbx::af::shared<vec3<double> > faceE;
   };
 }}  // namespace dxtbx::masking
 
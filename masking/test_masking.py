@@ -3,6 +3,7 @@ from __future__ import absolute_import, division, print_function
 import math
 import os
 import pickle
+import random
 
 import pytest
 
@@ -10,7 +11,9 @@ from scitbx import matrix
 from scitbx.array_family import flex
 from scitbx.math import principal_axes_of_inertia_2d
 
+from dxtbx.format.image import ImageBool, ImageDouble, ImageInt
 from dxtbx.masking import (
+    BadPixelFinder,
     GoniometerMaskerFactory,
     is_inside_polygon,
     mask_untrusted_polygon,
@@ -428,6 +431,57 @@ def test_dls_i19_2_diamond_anvil_cell(
     assert mask2[0].count(True) == mask2[0].count(True)
 
 
+def test_estimate_shadows(
+    kappa_goniometer,
+    smargon_goniometer,
+    dls_i19_2_goniometer,
+    pilatus_6M,
+    dls_i19_2_detector,
+):
+    cases = (
+        (
+            GoniometerMaskerFactory.mini_kappa(kappa_goniometer(0, 0, 0)),
+            pilatus_6M(distance=170),
+            ((0, 180, 0), (0, 180, -45), (0, 180, 45), (0, -70, 100)),
+        ),
+        (
+            GoniometerMaskerFactory.smargon(smargon_goniometer(0, 0, 0)),
+            pilatus_6M(distance=170),
+            ((48, 45, 100), (0, 90, 50)),
+        ),
+        (
+            GoniometerMaskerFactory.diamond_anvil_cell(
+                dls_i19_2_goniometer(0, 0, 0), cone_opening_angle=2 * 38 * math.pi / 180
+            ),
+            dls_i19_2_detector(distance=90.29),
+            ((-35, 0, -90), (-35, 0, -60)),
+        ),
+    )
+    for masker, detector, settings in cases:
+        angles = flex.double([a for setting in settings for a in setting])
+        angles.reshape(flex.grid(len(settings), 3))
+        result = masker.estimate_shadows(detector, angles)
+        assert result["fraction"].all() == (len(settings), len(detector))
+        assert len(result["boundary"]) == len(settings)
+
+        for i, setting in enumerate(settings):
+            masker.set_goniometer_angles(flex.double(setting))
+            scan_angle = setting[2]
+            assert list(masker.extrema_at_angles(flex.double(setting))) == list(
+                masker.extrema_at_scan_angle(scan_angle)
+            )
+            shadow = masker.project_extrema(detector, scan_angle)
+            mask = masker.get_mask(detector, scan_angle)
+            for j in range(len(detector)):
+                assert list(result["boundary"][i][j]) == list(shadow[j])
+                assert result["fraction"][i, j] == pytest.approx(
+                    mask[j].count(False) / mask[j].size()
+                )
+
+        threaded = masker.estimate_shadows(detector, angles, num_threads=2)
+        assert threaded["fraction"].all_eq(result["fraction"])
+
+
 class PyGoniometerShadowMasker(object):
     def __init__(self, goniometer, extrema_at_datum, axis):
         # axis is an array of size_t the same size as extrema_at_datum,
@@ -701,3 +755,54 @@ class PySmarGonShadowMasker(PyGoniometerShadowMasker):
         extrema.extend(coords)
 
         return extrema
+
+
+def test_bad_pixel_finder():
+    random.seed(0)
+    finder = BadPixelFinder(min_images=10)
+    mask = flex.bool(flex.grid(20, 30), True)
+    mask[0, 0] = False
+    for k in range(20):
+        data = flex.double(flex.grid(20, 30))
+        for i in range(len(data)):
+            data[i] = random.randint(8, 12)
+        data[5, 5] = 1000
+        data[10, 10] = 0
+        data[15, 15] = 7
+        if k < 5:
+            data[3, 20] = 0
+        finder.add_image(ImageDouble(data), ImageBool(mask))
+    assert finder.num_images() == 20
+
+    num_observed = finder.num_observed()[0]
+    assert num_observed[0, 0] == 0
+    assert num_observed[1, 1] == 20
+    assert finder.num_hot()[0][5, 5] == 20
+    assert finder.num_dead()[0][10, 10] == 20
+    assert finder.num_stuck()[0][15, 15] == 19
+    assert finder.num_dead()[0][3, 20] == 5
+
+    result = finder.mask()[0]
+    assert result.all() == mask.all()
+    bad = [(j, i) for j in range(20) for i in range(30) if not result[j, i]]
+    assert bad == [(5, 5), (10, 10), (15, 15)]
+
+    # Pixels with too few observations are not flagged
+    finder = BadPixelFinder(min_images=10)
+    data = flex.double(flex.grid(20, 30), 10)
+    data[5, 5] = 1000
+    finder.add_image(ImageDouble(data), ImageBool(mask))
+    assert finder.mask()[0].all_eq(True)
+
+    # Integer data is accepted and the counts use 12 bytes per pixel
+    finder = BadPixelFinder(min_images=1)
+    data = flex.int(flex.grid(20, 30), 10)
+    data[5, 5] = 1000
+    finder.add_image(ImageInt(data), ImageBool(mask))
+    assert finder.num_hot()[0][5, 5] == 1
+    assert finder.memory_used() == 12 * 20 * 30
+
+    # The memory budget is checked when the first image is added
+    finder = BadPixelFinder(max_memory=12 * 20 * 30 - 1)
+    with pytest.raises(RuntimeError):
+        finder.add_image(ImageInt(data), ImageBool(mask))
@@ -1,7 +1,6 @@
 from __future__ import absolute_import, division, print_function
 
 import collections
-import copy
 import json
 import os
 import sys
@@ -30,6 +29,7 @@ from dxtbx_model_ext import (
     BeamBase,
     Crystal,
     CrystalBase,
+    CrystalSimilarityIndex,
     Detector,
     DetectorNode,
     Experiment,
@@ -47,10 +47,14 @@ from dxtbx_model_ext import (
     Panel,
     ParallaxCorrectedPxMmStrategy,
     PxMmStrategy,
+    RotationPredictor,
     Scan,
     ScanBase,
     SimplePxMmStrategy,
     Spectrum,
+    SpectrumTable,
+    SpectrumView,
+    StillsPredictor,
     VirtualPanel,
     VirtualPanelFrame,
     get_mod2pi_angles_in_range,
@@ -67,6 +71,7 @@ __all__ = (
     "Crystal",
     "CrystalBase",
     "CrystalFactory",
+    "CrystalSimilarityIndex",
     "Detector",
     "DetectorFactory",
     "DetectorNode",
@@ -90,11 +95,15 @@ __all__ = (
     "ParallaxCorrectedPxMmStrategy",
     "ProfileModelFactory",
     "PxMmStrategy",
+    "RotationPredictor",
     "Scan",
     "ScanBase",
     "ScanFactory",
     "SimplePxMmStrategy",
     "Spectrum",
+    "SpectrumTable",
+    "SpectrumView",
+    "StillsPredictor",
     "VirtualPanel",
     "VirtualPanelFrame",
     "get_mod2pi_angles_in_range",
@@ -510,6 +519,40 @@ class _(object):
         return xl
 
 
+@boost_adaptbx.boost.python.inject_into(SpectrumTable)
+class _(object):
+    @staticmethod
+    def from_hdf5(energies, weights, num_threads=1):
+        """
+        Load a table of spectra from HDF5 datasets.
+
+        :param energies: The energies (eV), either a shared axis of shape (m,)
+                         or one row per shot of shape (n, m)
+        :param weights: The weights, one row per shot of shape (n, m)
+        :param num_threads: The number of threads used to compute the statistics
+        :returns: The spectrum table
+        """
+        weights = weights[()].astype("float64")
+        energies = energies[()].astype("float64")
+        if len(weights.shape) != 2:
+            raise ValueError("Spectrum weights must have one row per shot")
+        num_shots, num_points = weights.shape
+        flex_weights = flex.double(weights.ravel())
+        if energies.shape == (num_points,):
+            flex_weights.reshape(flex.grid(num_shots, num_points))
+            return SpectrumTable(
+                flex.double(energies), flex_weights, num_threads=num_threads
+            )
+        if energies.shape != weights.shape:
+            raise ValueError("Spectrum energies and weights have different shapes")
+        return SpectrumTable(
+            flex.double(energies.ravel()),
+            flex_weights,
+            flex.size_t(num_shots, num_points),
+            num_threads=num_threads,
+        )
+
+
 @boost_adaptbx.boost.python.inject_into(Experiment)
 class _(object):
     def load_models(self, index=None):
@@ -522,6 +565,51 @@ class _(object):
         self.scan = self.imageset.get_scan(index)
 
 
+def _imageset_to_dict(imset):
+    """Serialize an imageset to the dictionary used in an experiment list."""
+
+    def get_template(imset):
+        if imset.reader().is_single_file_reader():
+            return imset.reader().master_path()
+        else:
+            return imset.get_template()
+
+    if isinstance(imset, ImageSequence):
+        # FIXME_HACK
+        template = get_template(imset)
+        r = collections.OrderedDict(
+            [("__id__", "ImageSequence"), ("template", template)]
+        )
+        # elif isinstance(imset, MemImageSet):
+        #   r = collections.OrderedDict([
+        #     ('__id__', 'MemImageSet')])
+        if imset.reader().is_single_file_reader():
+            r["single_file_indices"] = list(imset.indices())
+    elif isinstance(imset, ImageSet):
+        r = collections.OrderedDict([("__id__", "ImageSet"), ("images", imset.paths())])
+        if imset.reader().is_single_file_reader():
+            r["single_file_indices"] = list(imset.indices())
+    elif isinstance(imset, ImageGrid):
+        r = collections.OrderedDict(
+            [
+                ("__id__", "ImageGrid"),
+                ("images", imset.paths()),
+                ("grid_size", imset.get_grid_size()),
+            ]
+        )
+        if imset.reader().is_single_file_reader():
+            r["single_file_indices"] = list(imset.indices())
+    else:
+        raise TypeError("expected ImageSet or ImageSequence, got %s" % type(imset))
+    r["mask"] = imset.external_lookup.mask.filename
+    r["gain"] = imset.external_lookup.gain.filename
+    r["pedestal"] = imset.external_lookup.pedestal.filename
+    r["dx"] = imset.external_lookup.dx.filename
+    r["dy"] = imset.external_lookup.dy.filename
+    r["params"] = imset.params()
+    return r
+
+
 @boost_adaptbx.boost.python.inject_into(ExperimentList)
 class _(object):
     def __repr__(self):
@@ -618,53 +706,10 @@ class _(object):
 
             result["experiment"].append(obj)
 
-        def get_template(imset):
-            if imset.reader().is_single_file_reader():
-                return imset.reader().master_path()
-            else:
-                return imset.get_template()
-
         # Serialize all the imagesets
-        result["imageset"] = []
-        for imset in index_lookup["imageset"]:
-            if isinstance(imset, ImageSequence):
-                # FIXME_HACK
-                template = get_template(imset)
-                r = collections.OrderedDict(
-                    [("__id__", "ImageSequence"), ("template", template)]
-                )
-                # elif isinstance(imset, MemImageSet):
-                #   r = collections.OrderedDict([
-                #     ('__id__', 'MemImageSet')])
-                if imset.reader().is_single_file_reader():
-                    r["single_file_indices"] = list(imset.indices())
-            elif isinstance(imset, ImageSet):
-                r = collections.OrderedDict(
-                    [("__id__", "ImageSet"), ("images", imset.paths())]
-                )
-                if imset.reader().is_single_file_reader():
-                    r["single_file_indices"] = list(imset.indices())
-            elif isinstance(imset, ImageGrid):
-                r = collections.OrderedDict(
-                    [
-                        ("__id__", "ImageGrid"),
-                        ("images", imset.paths()),
-                        ("grid_size", imset.get_grid_size()),
-                    ]
-                )
-                if imset.reader().is_single_file_reader():
-                    r["single_file_indices"] = list(imset.indices())
-            else:
-                raise TypeError(
-                    "expected ImageSet or ImageSequence, got %s" % type(imset)
-                )
-            r["mask"] = imset.external_lookup.mask.filename
-            r["gain"] = imset.external_lookup.gain.filename
-            r["pedestal"] = imset.external_lookup.pedestal.filename
-            r["dx"] = imset.external_lookup.dx.filename
-            r["dy"] = imset.external_lookup.dy.filename
-            r["params"] = imset.params()
-            result["imageset"].append(r)
+        result["imageset"] = [
+            _imageset_to_dict(imset) for imset in index_lookup["imageset"]
+        ]
 
         # Extract all the ordered model dictionaries - is important these
         # preserve the same order as used in experiment serialization above
@@ -870,21 +915,20 @@ class _(object):
                 list of operators, one per experiment.
             in_place (bool): Apply the change of basis operations in-place to the
                 current ExperimentList. Default is to return a copy of the
-                ExperimentList.
+                ExperimentList, which shares all models except the crystals
+                with the current ExperimentList.
 
         Returns:
             The reindexed ExperimentList
         """
-        if isinstance(change_of_basis_ops, cctbx.sgtbx.change_of_basis_op):
-            change_of_basis_ops = [change_of_basis_ops] * len(self)
-        assert len(change_of_basis_ops) == len(self), (
-            "Number of change_of_basis_ops (%i) not equal to the number of experiments (%i)"
-            % (len(change_of_basis_ops), len(self))
-        )
+        if not isinstance(change_of_basis_ops, cctbx.sgtbx.change_of_basis_op):
+            assert len(change_of_basis_ops) == len(self), (
+                "Number of change_of_basis_ops (%i) not equal to the number of experiments (%i)"
+                % (len(change_of_basis_ops), len(self))
+            )
         if in_place:
             return_expts = self
         else:
-            return_expts = copy.deepcopy(self)
-        for expt, cb_op in zip(return_expts, change_of_basis_ops):
-            expt.crystal = expt.crystal.change_basis(cb_op)
+            return_expts = self[:]
+        return_expts.reindex_crystals(change_of_basis_ops)
         return return_expts
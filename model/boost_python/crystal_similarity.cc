@@ -0,0 +1,80 @@
+/*
+ * crystal_similarity.cc
+ *
+ *  This code is distributed under the BSD license, a copy of which is
+ *  included in the root directory of this package.
+ */
+#include <boost/python.hpp>
+#include <boost/python/def.hpp>
+#include <vector>
+#include <dxtbx/model/crystal_similarity.h>
+
+namespace dxtbx { namespace model { namespace boost_python {
+
+  using namespace boost::python;
+
+  typedef CrystalSimilarityIndex::crystal_pointer crystal_pointer;
+
+  static std::vector<crystal_pointer> crystal_list(object crystals) {
+    std::vector<crystal_pointer> result;
+    for (std::size_t i = 0; i < len(crystals); ++i) {
+      result.push_back(extract<crystal_pointer>(crystals[i])());
+    }
+    return result;
+  }
+
+  static CrystalSimilarityIndex *make_crystal_similarity_index(
+    object crystals,
+    double angle_tolerance,
+    double uc_rel_length_tolerance,
+    double uc_abs_angle_tolerance) {
+    std::vector<crystal_pointer> list = crystal_list(crystals);
+    return new CrystalSimilarityIndex(
+      scitbx::af::const_ref<crystal_pointer>(list.empty() ? NULL : &list[0],
+                                             list.size()),
+      angle_tolerance,
+      uc_rel_length_tolerance,
+      uc_abs_angle_tolerance);
+  }
+
+  static scitbx::af::shared<std::size_t> CrystalSimilarityIndex_find_similar(
+    const CrystalSimilarityIndex &self,
+    const CrystalBase &crystal) {
+    return self.find_similar(crystal);
+  }
+
+  static scitbx::af::shared<int> CrystalSimilarityIndex_find_nearest(
+    const CrystalSimilarityIndex &self,
+    object crystals) {
+    std::vector<crystal_pointer> list = crystal_list(crystals);
+    return self.find_nearest(scitbx::af::const_ref<crystal_pointer>(
+      list.empty() ? NULL : &list[0], list.size()));
+  }
+
+  static list CrystalSimilarityIndex_orientations(const CrystalSimilarityIndex &self) {
+    scitbx::af::shared<scitbx::af::tiny<double, 4> > q = self.orientations();
+    list result;
+    for (std::size_t i = 0; i < q.size(); ++i) {
+      result.append(make_tuple(q[i][0], q[i][1], q[i][2], q[i][3]));
+    }
+    return result;
+  }
+
+  void export_crystal_similarity() {
+    class_<CrystalSimilarityIndex>("CrystalSimilarityIndex", no_init)
+      .def("__init__",
+           make_constructor(&make_crystal_similarity_index,
+                            default_call_policies(),
+                            (arg("crystals"),
+                             arg("angle_tolerance") = 0.01,
+                             arg("uc_rel_length_tolerance") = 0.01,
+                             arg("uc_abs_angle_tolerance") = 1.0)))
+      .def("__len__", &CrystalSimilarityIndex::size)
+      .def("crystal", &CrystalSimilarityIndex::crystal)
+      .def("orientations", &CrystalSimilarityIndex_orientations)
+      .def("find_similar", &CrystalSimilarityIndex_find_similar, (arg("crystal")))
+      .def("find_nearest", &CrystalSimilarityIndex_find_nearest, (arg("crystals")))
+      .def("clusters", &CrystalSimilarityIndex::clusters);
+  }
+
+}}}  // namespace dxtbx::model::boost_python
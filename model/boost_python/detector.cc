@@ -366,6 +366,7 @@ namespace dxtbx { namespace model { namespace boost_python {
       .def("rotate_around_origin",
            &rotate_around_origin,
            (arg("axis"), arg("angle"), arg("deg") = true))
+      .def("binned", &Detector::binned, (arg("bin_size")))
       .def("__str__", &detector_to_string)
       .def("__deepcopy__", &detector_deepcopy)
       .def("__copy__", &detector_deepcopy)
@@ -206,6 +206,19 @@ namespace dxtbx { namespace model { namespace boost_python {
     self.erase(n);
   }
 
+  void experiment_list_reindex_crystals(ExperimentList &self, object ops) {
+    scitbx::af::shared<cctbx::sgtbx::change_of_basis_op> op_list;
+    extract<cctbx::sgtbx::change_of_basis_op> get_op(ops);
+    if (get_op.check()) {
+      op_list.push_back(get_op());
+    } else {
+      for (std::size_t i = 0; i < len(ops); ++i) {
+        op_list.push_back(extract<cctbx::sgtbx::change_of_basis_op>(ops[i])());
+      }
+    }
+    self.reindex_crystals(op_list.const_ref());
+  }
+
   void export_experiment_list() {
     class_<ExperimentList>("ExperimentList")
       .def("__init__", make_constructor(&make_experiment_list, default_call_policies()))
@@ -252,6 +265,7 @@ namespace dxtbx { namespace model { namespace boost_python {
             arg("profile") = boost::python::object(),
             arg("imageset") = boost::python::object(),
             arg("scaling_model") = boost::python::object()))
+      .def("reindex_crystals", &experiment_list_reindex_crystals, (arg("ops")))
       .def("is_consistent", &ExperimentList::is_consistent)
       .def("__len__", &ExperimentList::size)
       .def_pickle(ExperimentListPickleSuite());
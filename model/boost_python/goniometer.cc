@@ -92,6 +92,14 @@ namespace dxtbx { namespace model { namespace boost_python {
     goniometer.set_setting_rotation_at_scan_points(S_list.const_ref());
   }
 
+  boost::python::dict goniometer_settings_to_dict(const GoniometerSettings &settings) {
+    boost::python::dict result;
+    result["setting_rotation"] = settings.setting_rotation;
+    result["fixed_rotation"] = settings.fixed_rotation;
+    result["rotation_axis"] = settings.rotation_axis;
+    return result;
+  }
+
   template <>
   boost::python::dict to_dict<Goniometer>(const Goniometer &obj) {
     boost::python::dict result;
@@ -98,6 +98,39 @@ namespace dxtbx { namespace model { namespace boost_python {
       new KappaGoniometer(alpha, omega, kappa, phi, direction, scan_axis));
   }
 
+  boost::python::dict goniometer_settings_to_dict(const GoniometerSettings &settings);
+
+  static boost::python::dict KappaGoniometer_compute_settings(
+    const KappaGoniometer &self,
+    const scitbx::af::const_ref<double> &omega,
+    const scitbx::af::const_ref<double> &kappa,
+    const scitbx::af::const_ref<double> &phi,
+    int num_threads) {
+    return goniometer_settings_to_dict(
+      self.compute_settings(omega, kappa, phi, num_threads));
+  }
+
+  static boost::python::tuple KappaGoniometer_euler_angles(
+    const KappaGoniometer &self,
+    const scitbx::af::const_ref<double> &omega,
+    const scitbx::af::const_ref<double> &kappa,
+    const scitbx::af::const_ref<double> &phi,
+    int num_threads) {
+    EulerAngles result = self.euler_angles(omega, kappa, phi, num_threads);
+    return boost::python::make_tuple(result.omega, result.chi, result.phi);
+  }
+
+  static boost::python::tuple KappaGoniometer_kappa_angles(
+    const KappaGoniometer &self,
+    const scitbx::af::const_ref<double> &omega,
+    const scitbx::af::const_ref<double> &chi,
+    const scitbx::af::const_ref<double> &phi,
+    int num_threads) {
+    KappaAngles result = self.kappa_angles(omega, chi, phi, num_threads);
+    return boost::python::make_tuple(
+      result.omega, result.kappa, result.phi, result.valid);
+  }
+
   void export_kappa_goniometer() {
     enum_<KappaGoniometer::Direction>("KappaDirection")
       .value("PlusY", KappaGoniometer::PlusY)
@@ -133,6 +166,16 @@ namespace dxtbx { namespace model { namespace boost_python {
       .def("get_omega_axis", &KappaGoniometer::get_omega_axis)
       .def("get_kappa_axis", &KappaGoniometer::get_kappa_axis)
       .def("get_phi_axis", &KappaGoniometer::get_phi_axis)
+      .def("get_chi_axis", &KappaGoniometer::get_chi_axis)
+      .def("compute_settings",
+           &KappaGoniometer_compute_settings,
+           (arg("omega"), arg("kappa"), arg("phi"), arg("num_threads") = 1))
+      .def("euler_angles",
+           &KappaGoniometer_euler_angles,
+           (arg("omega"), arg("kappa"), arg("phi"), arg("num_threads") = 1))
+      .def("kappa_angles",
+           &KappaGoniometer_kappa_angles,
+           (arg("omega"), arg("chi"), arg("phi"), arg("num_threads") = 1))
       .def("__str__", &kappa_goniometer_to_string)
       .def_pickle(KappaGoniometerPickleSuite());
   }
@@ -24,11 +24,13 @@ namespace dxtbx { namespace model { namespace boost_python {
   void export_scan();
   void export_scan_helpers();
   void export_crystal();
+  void export_crystal_similarity();
   void export_parallax_correction();
   void export_pixel_to_millimeter();
   void export_experiment();
   void export_experiment_list();
   void export_spectrum();
+  void export_prediction();
 
   BOOST_PYTHON_MODULE(dxtbx_model_ext) {
     export_beam();
@@ -40,11 +42,13 @@ namespace dxtbx { namespace model { namespace boost_python {
     export_scan();
     export_scan_helpers();
     export_crystal();
+    export_crystal_similarity();
     export_parallax_correction();
     export_pixel_to_millimeter();
     export_experiment();
     export_experiment_list();
     export_spectrum();
+    export_prediction();
   }
 
 }}}  // namespace dxtbx::model::boost_python
@@ -108,6 +108,15 @@ namespace dxtbx { namespace model { namespace boost_python {
     return g;
   };
 
+  boost::python::dict goniometer_settings_to_dict(const GoniometerSettings &settings);
+
+  static boost::python::dict MultiAxisGoniometer_compute_settings(
+    const MultiAxisGoniometer &self,
+    const scitbx::af::const_ref<double, scitbx::af::c_grid<2> > &angles,
+    int num_threads) {
+    return goniometer_settings_to_dict(self.compute_settings(angles, num_threads));
+  }
+
   static boost::shared_ptr<MultiAxisGoniometer> make_multi_axis_goniometer(
     const scitbx::af::const_ref<vec3<double> > &axes,
     const scitbx::af::const_ref<double> &angles,
@@ -131,6 +140,9 @@ namespace dxtbx { namespace model { namespace boost_python {
       .def("set_angles", &MultiAxisGoniometer::set_angles)
       .def("get_names", &MultiAxisGoniometer::get_names)
       .def("get_scan_axis", &MultiAxisGoniometer::get_scan_axis)
+      .def("compute_settings",
+           &MultiAxisGoniometer_compute_settings,
+           (arg("angles"), arg("num_threads") = 1))
       .def("__str__", &multi_axis_goniometer_to_string)
       .def("to_dict", &to_dict)
       .def("from_dict", &from_dict, return_value_policy<manage_new_object>())
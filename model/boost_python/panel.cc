@@ -515,6 +515,11 @@ namespace dxtbx { namespace model { namespace boost_python {
       .def("get_two_theta_at_pixel", &Panel::get_two_theta_at_pixel)
       .def("get_two_theta_array", &Panel::get_two_theta_array)
       .def("get_cos2_two_theta_array", &Panel::get_cos2_two_theta_array)
+      .def("get_solid_angle_array", &Panel::get_solid_angle_array)
+      .def("get_polarization_array",
+           &Panel::get_polarization_array,
+           (arg("s0"), arg("polarization_normal"), arg("polarization_fraction")))
+      .def("get_obliquity_array", &Panel::get_obliquity_array)
       .def("get_resolution_at_pixel", &Panel::get_resolution_at_pixel)
       .def("get_max_resolution_at_corners", &Panel::get_max_resolution_at_corners)
       .def("get_max_resolution_ellipse", &Panel::get_max_resolution_ellipse)
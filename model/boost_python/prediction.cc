@@ -0,0 +1,113 @@
+/*
+ * prediction.cc
+ *
+ *  This code is distributed under the BSD license, a copy of which is
+ *  included in the root directory of this package.
+ */
+#include <boost/python.hpp>
+#include <boost/python/def.hpp>
+#include <vector>
+#include <dxtbx/model/prediction.h>
+#include <dxtbx/model/experiment.h>
+
+namespace dxtbx { namespace model { namespace boost_python {
+
+  using namespace boost::python;
+
+  static RotationPredictor *make_rotation_predictor(const Experiment &experiment) {
+    DXTBX_ASSERT(experiment.get_beam() != NULL);
+    DXTBX_ASSERT(experiment.get_detector() != NULL);
+    DXTBX_ASSERT(experiment.get_goniometer() != NULL);
+    DXTBX_ASSERT(experiment.get_scan() != NULL);
+    DXTBX_ASSERT(experiment.get_crystal() != NULL);
+    return new RotationPredictor(*experiment.get_beam(),
+                                 *experiment.get_detector(),
+                                 *experiment.get_goniometer(),
+                                 *experiment.get_scan(),
+                                 *experiment.get_crystal());
+  }
+
+  static dict RotationPredictor_predict(const RotationPredictor &self,
+                                        double d_min,
+                                        int num_threads) {
+    RotationPredictions predictions = self.predict(d_min, num_threads);
+    dict result;
+    result["miller_index"] = predictions.miller_index;
+    result["panel"] = predictions.panel;
+    result["entering"] = predictions.entering;
+    result["s1"] = predictions.s1;
+    result["xyzcal.px"] = predictions.xyz_px;
+    result["xyzcal.mm"] = predictions.xyz_mm;
+    return result;
+  }
+
+  template <typename T>
+  static std::vector<T> to_vector(object items) {
+    std::vector<T> result;
+    for (std::size_t i = 0; i < len(items); ++i) {
+      result.push_back(extract<T>(items[i])());
+    }
+    return result;
+  }
+
+  template <typename T>
+  static scitbx::af::const_ref<T> as_const_ref(const std::vector<T> &items) {
+    return scitbx::af::const_ref<T>(items.empty() ? NULL : &items[0], items.size());
+  }
+
+  static dict StillsPredictor_predict(const StillsPredictor &self,
+                                      object crystals,
+                                      object beams,
+                                      object spectra,
+                                      double d_min,
+                                      int num_threads) {
+    std::vector<StillsPredictor::crystal_pointer> crystal_list =
+      to_vector<StillsPredictor::crystal_pointer>(crystals);
+    std::vector<StillsPredictor::beam_pointer> beam_list =
+      to_vector<StillsPredictor::beam_pointer>(beams);
+    std::vector<Spectrum> spectrum_list = to_vector<Spectrum>(spectra);
+    StillsPredictions predictions = self.predict(as_const_ref(crystal_list),
+                                                 as_const_ref(beam_list),
+                                                 as_const_ref(spectrum_list),
+                                                 d_min,
+                                                 num_threads);
+    dict result;
+    result["id"] = predictions.shot;
+    result["miller_index"] = predictions.miller_index;
+    result["panel"] = predictions.panel;
+    result["s1"] = predictions.s1;
+    result["wavelength"] = predictions.wavelength;
+    result["spectral_weight"] = predictions.spectral_weight;
+    result["xyzcal.px"] = predictions.xyz_px;
+    result["xyzcal.mm"] = predictions.xyz_mm;
+    return result;
+  }
+
+  void export_prediction() {
+    class_<RotationPredictor>("RotationPredictor", no_init)
+      .def("__init__",
+           make_constructor(
+             &make_rotation_predictor, default_call_policies(), (arg("experiment"))))
+      .def(init<const BeamBase &,
+                const Detector &,
+                const Goniometer &,
+                const Scan &,
+                const CrystalBase &>(
+        (arg("beam"), arg("detector"), arg("goniometer"), arg("scan"), arg("crystal"))))
+      .def("num_images", &RotationPredictor::num_images)
+      .def("predict",
+           &RotationPredictor_predict,
+           (arg("d_min"), arg("num_threads") = 1));
+
+    class_<StillsPredictor>("StillsPredictor", no_init)
+      .def(init<const Detector &>((arg("detector"))))
+      .def("predict",
+           &StillsPredictor_predict,
+           (arg("crystals"),
+            arg("beams"),
+            arg("spectra"),
+            arg("d_min"),
+            arg("num_threads") = 1));
+  }
+
+}}}  // namespace dxtbx::model::boost_python
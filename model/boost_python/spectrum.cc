@@ -6,6 +6,7 @@
 #include <string>
 #include <sstream>
 #include <dxtbx/model/spectrum.h>
+#include <dxtbx/model/spectrum_table.h>
 #include <dxtbx/model/boost_python/to_from_dict.h>
 #include <scitbx/array_family/boost_python/flex_wrapper.h>
 
@@ -78,6 +79,45 @@ namespace dxtbx { namespace model { namespace boost_python {
       .def_pickle(SpectrumPickleSuite());
 
     scitbx::af::boost_python::flex_wrapper<Spectrum>::plain("flex_Spectrum");
+
+    // Export SpectrumView
+    class_<SpectrumView>("SpectrumView", no_init)
+      .def("energy", &SpectrumView::energy)
+      .def("weight", &SpectrumView::weight)
+      .def("get_weighted_energy_eV", &SpectrumView::get_weighted_energy_eV)
+      .def("get_weighted_energy_variance", &SpectrumView::get_weighted_energy_variance)
+      .def("get_weighted_wavelength", &SpectrumView::get_weighted_wavelength)
+      .def("get_emin_eV", &SpectrumView::get_emin_eV)
+      .def("get_emax_eV", &SpectrumView::get_emax_eV)
+      .def("to_spectrum", &SpectrumView::to_spectrum)
+      .def("__len__", &SpectrumView::size);
+
+    // Export SpectrumTable
+    class_<SpectrumTable>("SpectrumTable")
+      .def(init<const vecd &,
+                const scitbx::af::const_ref<double, scitbx::af::c_grid<2> > &,
+                int>((arg("energies"), arg("weights"), arg("num_threads") = 1)))
+      .def(init<const scitbx::af::const_ref<double> &,
+                const scitbx::af::const_ref<double> &,
+                const scitbx::af::const_ref<std::size_t> &,
+                int>(
+        (arg("energies"), arg("weights"), arg("counts"), arg("num_threads") = 1)))
+      .def("has_shared_axis", &SpectrumTable::has_shared_axis)
+      .def("energies", &SpectrumTable::energies)
+      .def("weights", &SpectrumTable::weights)
+      .def("offsets", &SpectrumTable::offsets)
+      .def("append", &SpectrumTable::append)
+      .def("spectrum", &SpectrumTable::spectrum)
+      .def("to_spectrum", &SpectrumTable::to_spectrum)
+      .def("weighted_energies", &SpectrumTable::weighted_energies)
+      .def("weighted_energy_variances", &SpectrumTable::weighted_energy_variances)
+      .def("weighted_wavelengths", &SpectrumTable::weighted_wavelengths)
+      .def("emin", &SpectrumTable::emin)
+      .def("emax", &SpectrumTable::emax)
+      .def("sort_indices", &SpectrumTable::sort_indices)
+      .def("bin_indices", &SpectrumTable::bin_indices)
+      .def("select", &SpectrumTable::select)
+      .def("__len__", &SpectrumTable::size);
   }
 
 }}}  // namespace dxtbx::model::boost_python
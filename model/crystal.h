@@ -141,6 +141,35 @@ namespace dxtbx { namespace model {
       return inv_cov_mat;
     }
 
+    /**
+     * Propagate the covariance of the elements of B to the elements of R * B * M
+     * for fixed matrices R and M. Elements are ordered by flattening the
+     * matrices in row major order.
+     */
+    inline scitbx::af::versa<double, scitbx::af::c_grid<2> > transform_B_covariance(
+      const double *cov,
+      const mat3<double> &R,
+      const mat3<double> &M) {
+      // The Jacobian d(R B M)[i, j] / dB[k, l] = R[i, k] * M[l, j]
+      double J[81];
+      for (std::size_t i = 0; i < 3; ++i) {
+        for (std::size_t j = 0; j < 3; ++j) {
+          for (std::size_t k = 0; k < 3; ++k) {
+            for (std::size_t l = 0; l < 3; ++l) {
+              J[(i * 3 + j) * 9 + k * 3 + l] = R(i, k) * M(l, j);
+            }
+          }
+        }
+      }
+      double J_cov[81];
+      scitbx::matrix::multiply<double, double, double>(J, cov, 9, 9, 9, J_cov);
+      scitbx::af::versa<double, scitbx::af::c_grid<2> > result(
+        scitbx::af::c_grid<2>(9, 9));
+      scitbx::matrix::multiply_transpose<double, double, double>(
+        J_cov, J, 9, 9, 9, result.begin());
+      return result;
+    }
+
   }  // namespace detail
 
   /** Base class for crystal objects */
@@ -622,8 +651,8 @@ namespace dxtbx { namespace model {
                     real_space_b,
                     real_space_c,
                     get_space_group().change_basis(change_of_basis_op)));
+      mat3<double> M_inv = M.inverse();
       if (get_num_scan_points() > 0) {
-        mat3<double> M_inv = M.inverse();
         scitbx::af::shared<mat3<double> > new_A_at_scan_points;
         for (std::size_t i = 0; i < get_num_scan_points(); ++i) {
           new_A_at_scan_points.push_back(get_A_at_scan_point(i) * M_inv);
@@ -634,6 +663,26 @@ namespace dxtbx { namespace model {
         other->set_recalculated_unit_cell(
           recalculated_unit_cell_->change_basis(change_of_basis_op));
       }
+
+      // The new A = A * M_inv, so the new B = U_new^T * U * B * M_inv
+      if (cov_B_.size() > 0) {
+        mat3<double> R = other->get_U().transpose() * get_U();
+        other->set_B_covariance(
+          detail::transform_B_covariance(cov_B_.begin(), R, M_inv).const_ref());
+      }
+      if (cov_B_at_scan_points_.size() > 0) {
+        std::size_t num_scan_points = cov_B_at_scan_points_.accessor()[0];
+        scitbx::af::versa<double, scitbx::af::c_grid<3> > cov(
+          scitbx::af::c_grid<3>(num_scan_points, 9, 9));
+        for (std::size_t i = 0; i < num_scan_points; ++i) {
+          mat3<double> R =
+            other->get_U_at_scan_point(i).transpose() * get_U_at_scan_point(i);
+          scitbx::af::versa<double, scitbx::af::c_grid<2> > cov_i =
+            detail::transform_B_covariance(&cov_B_at_scan_points_[i * 81], R, M_inv);
+          std::copy(cov_i.begin(), cov_i.end(), cov.begin() + i * 81);
+        }
+        other->set_B_covariance_at_scan_points(cov.const_ref());
+      }
       return other;
     }
 
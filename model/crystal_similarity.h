@@ -0,0 +1,335 @@
+/*
+ * crystal_similarity.h
+ *
+ *  This code is distributed under the BSD license, a copy of which is
+ *  included in the root directory of this package.
+ */
+#ifndef DXTBX_MODEL_CRYSTAL_SIMILARITY_H
+#define DXTBX_MODEL_CRYSTAL_SIMILARITY_H
+
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <vector>
+#include <boost/shared_ptr.hpp>
+#include <scitbx/array_family/shared.h>
+#include <scitbx/array_family/ref.h>
+#include <scitbx/array_family/tiny_types.h>
+#include <dxtbx/model/crystal.h>
+#include <dxtbx/error.h>
+
+namespace dxtbx { namespace model {
+
+  /**
+   * An index for finding similar crystals among many crystals at once.
+   *
+   * Comparing every pair of crystals with CrystalBase::is_similar_to is
+   * quadratic in the number of crystals, and each comparison recomputes the
+   * orientation quaternion and unit cells of both crystals. Here the
+   * orientation quaternion, cell parameters, space group and number of scan
+   * points of each crystal are computed once and packed into arrays. The
+   * crystals are then binned by space group and orientation, with bins the
+   * size of the angle tolerance, so only crystals in neighbouring bins are
+   * candidates. Candidates are filtered on the packed cell parameters and the
+   * remaining pairs are checked with is_similar_to, so the results are the
+   * same as those of the pairwise comparisons.
+   */
+  class CrystalSimilarityIndex {
+  public:
+    typedef boost::shared_ptr<CrystalBase> crystal_pointer;
+
+    /**
+     * @param crystals The crystals to index
+     * @param angle_tolerance The orientation tolerance (degrees)
+     * @param uc_rel_length_tolerance The relative cell length tolerance
+     * @param uc_abs_angle_tolerance The cell angle tolerance (degrees)
+     */
+    CrystalSimilarityIndex(const scitbx::af::const_ref<crystal_pointer> &crystals,
+                           double angle_tolerance = 0.01,
+                           double uc_rel_length_tolerance = 0.01,
+                           double uc_abs_angle_tolerance = 1.0)
+        : angle_tolerance_(angle_tolerance),
+          uc_rel_length_tolerance_(uc_rel_length_tolerance),
+          uc_abs_angle_tolerance_(uc_abs_angle_tolerance) {
+      DXTBX_ASSERT(angle_tolerance >= 0);
+      DXTBX_ASSERT(uc_rel_length_tolerance >= 0);
+      DXTBX_ASSERT(uc_abs_angle_tolerance >= 0);
+
+      // Quaternions of rotations within the tolerance differ by at most the
+      // chord length 2 sin(angle / 4) in each component (up to sign)
+      bin_size_ = 2.0 * std::sin(deg_as_rad(std::min(angle_tolerance, 360.0)) / 4.0)
+                  + 1e-9;
+      for (std::size_t i = 0; i < crystals.size(); ++i) {
+        DXTBX_ASSERT(crystals[i] != NULL);
+        Entry entry = make_entry(*crystals[i]);
+        if (entry.space_group == space_groups_.size()) {
+          space_groups_.push_back(crystals[i]->get_space_group());
+        }
+        crystals_.push_back(crystals[i]);
+        entries_.push_back(entry);
+        bins_[bin_key(entries_.back(), 1.0)].push_back(i);
+      }
+    }
+
+    /**
+     * @returns The number of crystals
+     */
+    std::size_t size() const {
+      return crystals_.size();
+    }
+
+    /**
+     * @returns The crystal at the index
+     */
+    crystal_pointer crystal(std::size_t index) const {
+      DXTBX_ASSERT(index < size());
+      return crystals_[index];
+    }
+
+    /**
+     * @returns The orientation quaternion of each crystal
+     */
+    scitbx::af::shared<scitbx::af::tiny<double, 4> > orientations() const {
+      scitbx::af::shared<scitbx::af::tiny<double, 4> > result;
+      for (std::size_t i = 0; i < entries_.size(); ++i) {
+        result.push_back(entries_[i].q);
+      }
+      return result;
+    }
+
+    /**
+     * Find the indexed crystals that are similar to a crystal
+     * @param crystal The crystal
+     * @returns The indices of the similar crystals in increasing order
+     */
+    scitbx::af::shared<std::size_t> find_similar(const CrystalBase &crystal) const {
+      return find_similar(crystal, make_entry(crystal));
+    }
+
+    /**
+     * Find the most closely aligned similar crystal for each of a list of
+     * crystals
+     * @param crystals The crystals
+     * @returns The index of the similar crystal with the smallest rotation
+     *          from each crystal, or -1 if there is no similar crystal
+     */
+    scitbx::af::shared<int> find_nearest(
+      const scitbx::af::const_ref<crystal_pointer> &crystals) const {
+      scitbx::af::shared<int> result;
+      for (std::size_t i = 0; i < crystals.size(); ++i) {
+        DXTBX_ASSERT(crystals[i] != NULL);
+        Entry entry = make_entry(*crystals[i]);
+        scitbx::af::shared<std::size_t> similar = find_similar(*crystals[i], entry);
+        int nearest = -1;
+        double best = 0;
+        for (std::size_t k = 0; k < similar.size(); ++k) {
+          double d = std::abs(dot(entry.q, entries_[similar[k]].q));
+          if (nearest < 0 || d > best) {
+            nearest = static_cast<int>(similar[k]);
+            best = d;
+          }
+        }
+        result.push_back(nearest);
+      }
+      return result;
+    }
+
+    /**
+     * Group the crystals into clusters of similar crystals. Two crystals are
+     * in the same cluster if they are linked by a chain of similar crystals.
+     * @returns The cluster of each crystal, numbered in order of first member
+     */
+    scitbx::af::shared<std::size_t> clusters() const {
+      std::vector<std::size_t> parent(size());
+      for (std::size_t i = 0; i < parent.size(); ++i) {
+        parent[i] = i;
+      }
+      for (std::size_t i = 0; i < size(); ++i) {
+        std::vector<std::size_t> candidates = find_candidates(entries_[i]);
+        for (std::size_t k = 0; k < candidates.size(); ++k) {
+          std::size_t j = candidates[k];
+          if (j <= i) {
+            continue;
+          }
+          std::size_t root_i = find_root(parent, i);
+          std::size_t root_j = find_root(parent, j);
+          if (root_i == root_j) {
+            continue;
+          }
+          if (crystals_[i]->is_similar_to(*crystals_[j],
+                                          angle_tolerance_,
+                                          uc_rel_length_tolerance_,
+                                          uc_abs_angle_tolerance_)) {
+            parent[std::max(root_i, root_j)] = std::min(root_i, root_j);
+          }
+        }
+      }
+
+      // Number the clusters in order of their first member
+      scitbx::af::shared<std::size_t> result(size());
+      std::vector<std::size_t> label(size(), size());
+      std::size_t num_clusters = 0;
+      for (std::size_t i = 0; i < size(); ++i) {
+        std::size_t root = find_root(parent, i);
+        if (label[root] == size()) {
+          label[root] = num_clusters++;
+        }
+        result[i] = label[root];
+      }
+      return result;
+    }
+
+  protected:
+    struct Entry {
+      scitbx::af::tiny<double, 4> q;
+      scitbx::af::double6 cell;
+      std::size_t space_group;
+      std::size_t num_scan_points;
+    };
+
+    struct BinKey {
+      int v[5];
+      bool operator<(const BinKey &other) const {
+        return std::lexicographical_compare(v, v + 5, other.v, other.v + 5);
+      }
+    };
+
+    static double dot(const scitbx::af::tiny<double, 4> &a,
+                      const scitbx::af::tiny<double, 4> &b) {
+      return a[0] * b[0] + a[1] * b[1] + a[2] * b[2] + a[3] * b[3];
+    }
+
+    static std::size_t find_root(std::vector<std::size_t> &parent, std::size_t i) {
+      while (parent[i] != i) {
+        parent[i] = parent[parent[i]];
+        i = parent[i];
+      }
+      return i;
+    }
+
+    /**
+     * @returns The id of a space group, or the number of space groups if no
+     *          indexed crystal has the space group
+     */
+    std::size_t space_group_id(const cctbx::sgtbx::space_group &space_group) const {
+      for (std::size_t i = 0; i < space_groups_.size(); ++i) {
+        if (space_groups_[i] == space_group) {
+          return i;
+        }
+      }
+      return space_groups_.size();
+    }
+
+    /**
+     * Compute the packed parameters of a crystal
+     */
+    Entry make_entry(const CrystalBase &crystal) const {
+      Entry entry;
+      mat3<double> U = crystal.get_U();
+      DXTBX_ASSERT(detail::is_r3_rotation_matrix(U));
+      entry.q = scitbx::math::r3_rotation::matrix_as_unit_quaternion(U);
+      entry.cell = crystal.get_unit_cell().parameters();
+      entry.num_scan_points = crystal.get_num_scan_points();
+      entry.space_group = space_group_id(crystal.get_space_group());
+      return entry;
+    }
+
+    BinKey bin_key(const Entry &entry, double sign) const {
+      BinKey key;
+      key.v[0] = static_cast<int>(entry.space_group);
+      for (std::size_t k = 0; k < 4; ++k) {
+        key.v[k + 1] = static_cast<int>(std::floor(sign * entry.q[k] / bin_size_));
+      }
+      return key;
+    }
+
+    /**
+     * Check the packed parameters of two crystals could be similar. The
+     * tolerances are slightly widened so no similar pair is rejected because
+     * of rounding; is_similar_to makes the final decision.
+     */
+    bool may_be_similar(const Entry &a, const Entry &b) const {
+      if (a.space_group != b.space_group || a.num_scan_points != b.num_scan_points) {
+        return false;
+      }
+      double cos_half_angle = std::cos(deg_as_rad(angle_tolerance_) / 2.0);
+      if (angle_tolerance_ < 360.0 && std::abs(dot(a.q, b.q)) < cos_half_angle - 1e-9) {
+        return false;
+      }
+      for (std::size_t k = 0; k < 3; ++k) {
+        double ratio = std::min(a.cell[k], b.cell[k]) / std::max(a.cell[k], b.cell[k]);
+        if (1.0 - ratio > uc_rel_length_tolerance_ + 1e-9) {
+          return false;
+        }
+      }
+      for (std::size_t k = 3; k < 6; ++k) {
+        if (std::abs(a.cell[k] - b.cell[k]) > uc_abs_angle_tolerance_ + 1e-9) {
+          return false;
+        }
+      }
+      return true;
+    }
+
+    scitbx::af::shared<std::size_t> find_similar(const CrystalBase &crystal,
+                                                 const Entry &entry) const {
+      std::vector<std::size_t> candidates = find_candidates(entry);
+      scitbx::af::shared<std::size_t> result;
+      for (std::size_t i = 0; i < candidates.size(); ++i) {
+        std::size_t j = candidates[i];
+        if (crystals_[j]->is_similar_to(crystal,
+                                        angle_tolerance_,
+                                        uc_rel_length_tolerance_,
+                                        uc_abs_angle_tolerance_)) {
+          result.push_back(j);
+        }
+      }
+      return result;
+    }
+
+    /**
+     * Find the indexed crystals in the neighbouring bins of a crystal, and in
+     * those of the equivalent negated quaternion, which pass the packed checks
+     * @returns The candidates in increasing order
+     */
+    std::vector<std::size_t> find_candidates(const Entry &entry) const {
+      std::vector<std::size_t> result;
+      if (entry.space_group == space_groups_.size()) {
+        return result;
+      }
+      for (int s = 0; s < 2; ++s) {
+        BinKey centre = bin_key(entry, s == 0 ? 1.0 : -1.0);
+        for (int n = 0; n < 81; ++n) {
+          BinKey key = centre;
+          for (int k = 0, m = n; k < 4; ++k, m /= 3) {
+            key.v[k + 1] += m % 3 - 1;
+          }
+          std::map<BinKey, std::vector<std::size_t> >::const_iterator it =
+            bins_.find(key);
+          if (it == bins_.end()) {
+            continue;
+          }
+          for (std::size_t i = 0; i < it->second.size(); ++i) {
+            if (may_be_similar(entry, entries_[it->second[i]])) {
+              result.push_back(it->second[i]);
+            }
+          }
+        }
+      }
+      std::sort(result.begin(), result.end());
+      result.erase(std::unique(result.begin(), result.end()), result.end());
+      return result;
+    }
+
+    double angle_tolerance_;
+    double uc_rel_length_tolerance_;
+    double uc_abs_angle_tolerance_;
+    double bin_size_;
+    std::vector<crystal_pointer> crystals_;
+    std::vector<Entry> entries_;
+    std::vector<cctbx::sgtbx::space_group> space_groups_;
+    std::map<BinKey, std::vector<std::size_t> > bins_;
+  };
+
+}}  // namespace dxtbx::model
+
+#endif  // DXTBX_MODEL_CRYSTAL_SIMILARITY_H
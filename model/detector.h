@@ -110,6 +110,60 @@ namespace dxtbx { namespace model {
       return distance;
     }
 
+    /**
+     * Bin the pixels of a panel in place. Each block of bin_size x bin_size
+     * pixels becomes a single pixel and incomplete blocks at the far edges of
+     * the panel are dropped. The upper trusted range and pedestal are scaled
+     * by the number of pixels in a block and the untrusted rectangles are
+     * reduced to the blocks that they completely cover.
+     * @param panel The panel to bin
+     * @param bin_size The number of pixels along each side of a block
+     */
+    inline void bin_panel(Panel &panel, std::size_t bin_size) {
+      DXTBX_ASSERT(bin_size > 0);
+      int n = (int)bin_size;
+      double npix = (double)(bin_size * bin_size);
+
+      // Set the pixel and image size
+      tiny<double, 2> pixel_size = panel.get_pixel_size();
+      tiny<std::size_t, 2> image_size = panel.get_image_size();
+      panel.set_pixel_size(
+        tiny<double, 2>(pixel_size[0] * bin_size, pixel_size[1] * bin_size));
+      panel.set_image_size(
+        tiny<std::size_t, 2>(image_size[0] / bin_size, image_size[1] / bin_size));
+      int2 offset = panel.get_raw_image_offset();
+      panel.set_raw_image_offset(int2(offset[0] / n, offset[1] / n));
+
+      // Binned values are the sum of the pixels in the block
+      tiny<double, 2> trusted_range = panel.get_trusted_range();
+      panel.set_trusted_range(
+        tiny<double, 2>(trusted_range[0], trusted_range[1] * npix));
+      panel.set_pedestal(panel.get_pedestal() * npix);
+
+      // Keep the blocks which are completely covered by untrusted rectangles
+      scitbx::af::shared<int4> mask = panel.get_mask();
+      scitbx::af::shared<int4> binned_mask;
+      for (std::size_t i = 0; i < mask.size(); ++i) {
+        int4 m((mask[i][0] + n - 1) / n,
+               (mask[i][1] + n - 1) / n,
+               mask[i][2] / n,
+               mask[i][3] / n);
+        if (m[0] < m[2] && m[1] < m[3]) {
+          binned_mask.push_back(m);
+        }
+      }
+      panel.set_mask(binned_mask.const_ref());
+
+      // Offset arrays are per pixel so cannot be kept
+      std::string strategy = panel.get_px_mm_strategy()->name();
+      if (strategy == "OffsetPxMmStrategy") {
+        panel.set_px_mm_strategy(boost::make_shared<SimplePxMmStrategy>());
+      } else if (strategy == "OffsetParallaxCorrectedPxMmStrategy") {
+        panel.set_px_mm_strategy(boost::make_shared<ParallaxCorrectedPxMmStrategy>(
+          panel.get_mu(), panel.get_thickness()));
+      }
+    }
+
   }  // namespace detail
 
   /**
@@ -764,6 +818,20 @@ namespace dxtbx { namespace model {
       }
     }
 
+    /**
+     * Get a copy of the detector with the pixels of every panel binned into
+     * blocks of bin_size x bin_size pixels.
+     * @param bin_size The number of pixels along each side of a block
+     * @returns The binned detector
+     */
+    Detector binned(std::size_t bin_size) const {
+      Detector result(*this);
+      for (std::size_t i = 0; i < result.size(); ++i) {
+        detail::bin_panel(result[i], bin_size);
+      }
+      return result;
+    }
+
   protected:
     friend std::ostream &operator<<(std::ostream &os, const Detector &d);
 
@@ -13,6 +13,9 @@
 
 #include <iostream>
 #include <cmath>
+#include <map>
+#include <utility>
+#include <vector>
 #include <boost/shared_ptr.hpp>
 #include <boost/python.hpp>
 #include <boost/python/def.hpp>
@@ -330,6 +333,47 @@ namespace dxtbx { namespace model {
       }
     }
 
+    /**
+     * Apply change of basis operators to the crystal models in place. Each
+     * crystal is reindexed once for each distinct operator applied to it, so
+     * crystals shared between experiments remain shared; all other models
+     * are left untouched.
+     * @param ops One operator for all the experiments or one per experiment
+     */
+    void reindex_crystals(
+      const scitbx::af::const_ref<cctbx::sgtbx::change_of_basis_op> &ops) {
+      DXTBX_ASSERT(ops.size() == 1 || ops.size() == size());
+      typedef std::pair<std::size_t, boost::shared_ptr<CrystalBase> > reindexed_type;
+      // Keyed on the crystal itself, since shared pointers converted from
+      // Python have their own owners. The crystals are kept alive so that a
+      // new crystal can not take the address of one already reindexed.
+      std::map<const CrystalBase *, std::vector<reindexed_type> > reindexed;
+      std::vector<boost::shared_ptr<CrystalBase> > originals;
+      for (std::size_t i = 0; i < size(); ++i) {
+        boost::shared_ptr<CrystalBase> crystal = data_[i].get_crystal();
+        if (crystal == NULL) {
+          continue;
+        }
+        std::size_t op = ops.size() == 1 ? 0 : i;
+        std::vector<reindexed_type> &done = reindexed[crystal.get()];
+        if (done.empty()) {
+          originals.push_back(crystal);
+        }
+        boost::shared_ptr<CrystalBase> result;
+        for (std::size_t j = 0; j < done.size(); ++j) {
+          if (ops[done[j].first].c() == ops[op].c()) {
+            result = done[j].second;
+            break;
+          }
+        }
+        if (result == NULL) {
+          result = crystal->change_basis(ops[op]);
+          done.push_back(reindexed_type(op, result));
+        }
+        data_[i].set_crystal(result);
+      }
+    }
+
     /**
      * Replace all other models
      */
@@ -1,5 +1,6 @@
 from __future__ import absolute_import, division, print_function
 
+import collections
 import copy
 import errno
 import json
@@ -31,6 +32,7 @@ from dxtbx.model import (
     GoniometerFactory,
     ProfileModelFactory,
     ScanFactory,
+    _imageset_to_dict,
 )
 from dxtbx.sequence_filenames import template_image_range
 from dxtbx.serialize import xds
@@ -46,6 +48,7 @@ __all__ = [
     "BeamComparison",
     "DetectorComparison",
     "ExperimentListFactory",
+    "ExperimentListJournal",
     "GoniometerComparison",
     "SequenceDiff",
 ]
@@ -758,3 +761,204 @@ class ExperimentListTemplateImporter(object):
             self.experiments.extend(
                 ExperimentListFactory.from_datablock_and_crystal(db, None)
             )
+
+
+class ExperimentListJournal(object):
+    """
+    An append-only journal for checkpointing a growing experiment list.
+
+    Each checkpoint appends only the experiments added since the previous
+    checkpoint, together with the models and imagesets they reference which
+    have not been written before, so the cost of a checkpoint depends on what
+    changed rather than on the size of the list. As in ExperimentList.to_dict,
+    models are shared by identity. Every checkpoint ends with a marker record;
+    anything after the last marker (e.g. from an interrupted write) is ignored
+    on loading and discarded when the journal is reopened.
+
+    Models are written once, so changes made to a model after it has been
+    checkpointed are not recorded.
+    """
+
+    members = (
+        "beam",
+        "detector",
+        "goniometer",
+        "scan",
+        "crystal",
+        "profile",
+        "scaling_model",
+        "imageset",
+    )
+
+    def __init__(self, filename, check_format=True):
+        """
+        Open a journal, loading the experiments already checkpointed to it.
+
+        Args:
+            filename (str): The journal file, created on the first checkpoint
+            check_format (bool): Verify the image formats of loaded imagesets
+        """
+        self.filename = filename
+        self.experiments = ExperimentList()
+        self._indices = {name: {} for name in self.members}
+        if os.path.exists(filename):
+            obj, size = ExperimentListJournal._read(filename)
+            with open(filename, "r+b") as outfile:
+                outfile.truncate(size)
+            self.experiments = ExperimentListJournal._decode(
+                obj, filename, check_format
+            )
+            for expt, record in zip(self.experiments, obj["experiment"]):
+                for name in self.members:
+                    if name in record:
+                        self._indices[name][getattr(expt, name)] = record[name]
+        self._num_written = len(self.experiments)
+
+    def __len__(self):
+        """The number of experiments checkpointed to the journal."""
+        return self._num_written
+
+    def checkpoint(self, experiments=None):
+        """
+        Append the experiments added since the last checkpoint to the journal.
+
+        Args:
+            experiments (ExperimentList): The full list of experiments, whose
+                first len(self) entries must be those already checkpointed. If
+                not given, the list loaded from the journal is used.
+
+        Returns:
+            int: The number of experiments written
+        """
+        if experiments is None:
+            experiments = self.experiments
+        if len(experiments) < self._num_written:
+            raise ValueError(
+                "Journal holds %d experiments but only %d were given"
+                % (self._num_written, len(experiments))
+            )
+        new_indices = {name: {} for name in self.members}
+        records = []
+        for expt in experiments[self._num_written :]:
+            obj = collections.OrderedDict()
+            obj["__id__"] = "Experiment"
+            obj["identifier"] = expt.identifier
+            for name in self.members:
+                model = getattr(expt, name)
+                if model is None:
+                    continue
+                index = self._indices[name].get(model)
+                if index is None:
+                    index = new_indices[name].get(model)
+                if index is None:
+                    index = len(self._indices[name]) + len(new_indices[name])
+                    new_indices[name][model] = index
+                    if name == "imageset":
+                        data = _imageset_to_dict(model)
+                    else:
+                        data = model.to_dict()
+                    records.append(
+                        collections.OrderedDict(
+                            [("__id__", name), ("index", index), ("data", data)]
+                        )
+                    )
+                obj[name] = index
+            records.append(obj)
+        if not records:
+            return 0
+        records.append(
+            collections.OrderedDict(
+                [("__id__", "checkpoint"), ("experiments", len(experiments))]
+            )
+        )
+
+        # Datablock depends on model/__init__
+        from dxtbx.datablock import AutoEncoder
+
+        text = "".join(
+            json.dumps(
+                record, separators=(",", ":"), ensure_ascii=True, cls=AutoEncoder
+            )
+            + "\n"
+            for record in records
+        )
+        with open(self.filename, "ab") as outfile:
+            outfile.write(text.encode("ascii"))
+            outfile.flush()
+            os.fsync(outfile.fileno())
+
+        # Only remember what was written once it is safely on disk
+        for name in self.members:
+            self._indices[name].update(new_indices[name])
+        num_new = len(experiments) - self._num_written
+        self._num_written = len(experiments)
+        self.experiments = experiments
+        return num_new
+
+    @staticmethod
+    def load(filename, check_format=True):
+        """
+        Load the experiments checkpointed to a journal.
+
+        Args:
+            filename (str): The journal file
+            check_format (bool): Verify the image formats of loaded imagesets
+
+        Returns:
+            ExperimentList: The experiments up to the last complete checkpoint
+        """
+        obj, _ = ExperimentListJournal._read(filename)
+        return ExperimentListJournal._decode(obj, filename, check_format)
+
+    @staticmethod
+    def _read(filename):
+        """
+        Read the records of a journal up to the last complete checkpoint.
+
+        Returns:
+            tuple: The experiment list dictionary and the size in bytes of the
+                complete part of the journal
+        """
+        obj = collections.OrderedDict([("__id__", "ExperimentList")])
+        obj["experiment"] = []
+        for name in ExperimentListJournal.members:
+            obj[name] = []
+        pending = []
+        size = 0
+        offset = 0
+        with open(filename, "rb") as infile:
+            for line in infile:
+                offset += len(line)
+                if not line.endswith(b"\n"):
+                    break
+                try:
+                    record = json.loads(line.decode("ascii"), object_hook=_decode_dict)
+                except ValueError:
+                    break
+                if record.get("__id__") != "checkpoint":
+                    pending.append(record)
+                    continue
+                for record in pending:
+                    name = record["__id__"]
+                    if name == "Experiment":
+                        obj["experiment"].append(record)
+                    elif record["index"] == len(obj[name]):
+                        obj[name].append(record["data"])
+                    else:
+                        raise InvalidExperimentListError(
+                            "Journal %s has %s %d out of order"
+                            % (filename, name, record["index"])
+                        )
+                pending = []
+                size = offset
+        return obj, size
+
+    @staticmethod
+    def _decode(obj, filename, check_format):
+        """Convert the dictionary read from a journal to an experiment list."""
+        if not obj["experiment"]:
+            return ExperimentList()
+        directory = os.path.dirname(os.path.abspath(filename))
+        return ExperimentListFactory.from_dict(
+            obj, check_format=check_format, directory=directory
+        )
@@ -32,6 +32,21 @@ namespace dxtbx { namespace model {
   /** A goniometer base class */
   class GoniometerBase {};
 
+  /**
+   * The setting rotation, fixed rotation and rotation axis (in the laboratory
+   * frame) of a goniometer for each of many sets of axis angles.
+   */
+  struct GoniometerSettings {
+    scitbx::af::shared<mat3<double> > setting_rotation;
+    scitbx::af::shared<mat3<double> > fixed_rotation;
+    scitbx::af::shared<vec3<double> > rotation_axis;
+
+    GoniometerSettings() {}
+
+    GoniometerSettings(std::size_t n)
+        : setting_rotation(n), fixed_rotation(n), rotation_axis(n) {}
+  };
+
   /**
    * A class to represent the rotation axis for a standard rotation
    * geometry diffraction data set.
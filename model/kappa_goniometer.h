@@ -11,11 +11,14 @@
 #ifndef DXTBX_MODEL_KAPPA_GONIOMETER_H
 #define DXTBX_MODEL_KAPPA_GONIOMETER_H
 
+#include <cmath>
 #include <iostream>
 #include <scitbx/vec3.h>
 #include <scitbx/mat3.h>
 #include <scitbx/math/r3_rotation.h>
 #include <scitbx/constants.h>
+#include <scitbx/array_family/shared.h>
+#include <scitbx/array_family/ref.h>
 #include <dxtbx/error.h>
 #include "goniometer.h"
 
@@ -26,6 +29,31 @@ namespace dxtbx { namespace model {
   using scitbx::constants::pi;
   using scitbx::math::r3_rotation::axis_and_angle_as_matrix;
 
+  /**
+   * The angles of the Eulerian settings equivalent to many kappa settings
+   */
+  struct EulerAngles {
+    scitbx::af::shared<double> omega;
+    scitbx::af::shared<double> chi;
+    scitbx::af::shared<double> phi;
+
+    EulerAngles(std::size_t n) : omega(n), chi(n), phi(n) {}
+  };
+
+  /**
+   * The angles of the kappa settings equivalent to many Eulerian settings.
+   * Eulerian settings with a chi angle the kappa arm cannot reach are not
+   * valid and have zero angles.
+   */
+  struct KappaAngles {
+    scitbx::af::shared<double> omega;
+    scitbx::af::shared<double> kappa;
+    scitbx::af::shared<double> phi;
+    scitbx::af::shared<bool> valid;
+
+    KappaAngles(std::size_t n) : omega(n), kappa(n), phi(n), valid(n) {}
+  };
+
   /**
    * A class representing a kappa goniometer where omega is the primary axis
    * (i,e. aligned with X in the CBF coordinate frame) and has the kappa arm
@@ -134,6 +162,144 @@ namespace dxtbx { namespace model {
       return kappa_axis_;
     }
 
+    /**
+     * Get the axis of the equivalent Eulerian chi rotation. This is the
+     * direction of the kappa arm perpendicular to the omega axis.
+     */
+    vec3<double> get_chi_axis() const {
+      if (direction_ == PlusY) {
+        return vec3<double>(0.0, 1.0, 0.0);
+      } else if (direction_ == PlusZ) {
+        return vec3<double>(0.0, 0.0, 1.0);
+      } else if (direction_ == MinusY) {
+        return vec3<double>(0.0, -1.0, 0.0);
+      } else if (direction_ == MinusZ) {
+        return vec3<double>(0.0, 0.0, -1.0);
+      } else {
+        throw DXTBX_ERROR("Invalid direction");
+      }
+      return vec3<double>(0.0, 0.0, 0.0);
+    }
+
+    /**
+     * Compute the rotations of the goniometer for many kappa settings at
+     * once, without changing the goniometer.
+     * @param omega The omega angles (degrees)
+     * @param kappa The kappa angles (degrees)
+     * @param phi The phi angles (degrees)
+     * @param num_threads The number of threads
+     * @returns The setting rotation, fixed rotation and rotation axis of each
+     *          setting
+     */
+    GoniometerSettings compute_settings(const scitbx::af::const_ref<double>& omega,
+                                        const scitbx::af::const_ref<double>& kappa,
+                                        const scitbx::af::const_ref<double>& phi,
+                                        int num_threads = 1) const {
+      DXTBX_ASSERT(omega.size() == kappa.size() && omega.size() == phi.size());
+      DXTBX_ASSERT(num_threads > 0);
+      if (scan_axis_ != Omega && scan_axis_ != Phi) {
+        throw DXTBX_ERROR("Invalid scan axis");
+      }
+      bool phi_scan = scan_axis_ == Phi;
+      int n = static_cast<int>(omega.size());
+      GoniometerSettings result(n);
+      mat3<double>* setting = result.setting_rotation.begin();
+      mat3<double>* fixed = result.fixed_rotation.begin();
+      vec3<double>* axis = result.rotation_axis.begin();
+      mat3<double> I(1.0, 0.0, 0.0, 0.0, 1.0, 0.0, 0.0, 0.0, 1.0);
+#pragma omp parallel for num_threads(num_threads) schedule(static) if (num_threads > 1)
+      for (int k = 0; k < n; ++k) {
+        mat3<double> K = axis_and_angle_as_matrix(kappa_axis_, kappa[k], true);
+        setting[k] = I;
+        if (phi_scan) {
+          mat3<double> O = axis_and_angle_as_matrix(omega_axis_, omega[k], true);
+          fixed[k] = I;
+          axis[k] = O * K * phi_axis_;
+        } else {
+          mat3<double> P = axis_and_angle_as_matrix(phi_axis_, phi[k], true);
+          fixed[k] = K * P;
+          axis[k] = omega_axis_;
+        }
+      }
+      return result;
+    }
+
+    /**
+     * Convert many kappa settings to the equivalent Eulerian settings, with
+     * the chi rotation about the chi axis, such that
+     * O(omega) K(kappa) P(phi) = O(omega_e) C(chi) P(phi_e).
+     * @param omega The omega angles (degrees)
+     * @param kappa The kappa angles (degrees)
+     * @param phi The phi angles (degrees)
+     * @param num_threads The number of threads
+     * @returns The Eulerian angles (degrees)
+     */
+    EulerAngles euler_angles(const scitbx::af::const_ref<double>& omega,
+                             const scitbx::af::const_ref<double>& kappa,
+                             const scitbx::af::const_ref<double>& phi,
+                             int num_threads = 1) const {
+      DXTBX_ASSERT(omega.size() == kappa.size() && omega.size() == phi.size());
+      DXTBX_ASSERT(num_threads > 0);
+      double c = cos(alpha_ * pi / 180.0);
+      double s = sin(alpha_ * pi / 180.0);
+      int n = static_cast<int>(omega.size());
+      EulerAngles result(n);
+      double* omega_e = result.omega.begin();
+      double* chi = result.chi.begin();
+      double* phi_e = result.phi.begin();
+#pragma omp parallel for num_threads(num_threads) schedule(static) if (num_threads > 1)
+      for (int k = 0; k < n; ++k) {
+        double half_kappa = kappa[k] * pi / 360.0;
+        double delta = atan2(c * sin(half_kappa), cos(half_kappa)) * 180.0 / pi;
+        omega_e[k] = omega[k] + delta;
+        chi[k] = 2.0 * asin(s * sin(half_kappa)) * 180.0 / pi;
+        phi_e[k] = phi[k] + delta;
+      }
+      return result;
+    }
+
+    /**
+     * Convert many Eulerian settings to the equivalent kappa settings. Of the
+     * two kappa settings giving each chi, the one with |kappa| <= 180 is
+     * chosen.
+     * @param omega The Eulerian omega angles (degrees)
+     * @param chi The chi angles (degrees)
+     * @param phi The Eulerian phi angles (degrees)
+     * @param num_threads The number of threads
+     * @returns The kappa angles (degrees)
+     */
+    KappaAngles kappa_angles(const scitbx::af::const_ref<double>& omega,
+                             const scitbx::af::const_ref<double>& chi,
+                             const scitbx::af::const_ref<double>& phi,
+                             int num_threads = 1) const {
+      DXTBX_ASSERT(omega.size() == chi.size() && omega.size() == phi.size());
+      DXTBX_ASSERT(num_threads > 0);
+      double c = cos(alpha_ * pi / 180.0);
+      double s = sin(alpha_ * pi / 180.0);
+      int n = static_cast<int>(omega.size());
+      KappaAngles result(n);
+      double* omega_k = result.omega.begin();
+      double* kappa = result.kappa.begin();
+      double* phi_k = result.phi.begin();
+      bool* valid = result.valid.begin();
+#pragma omp parallel for num_threads(num_threads) schedule(static) if (num_threads > 1)
+      for (int k = 0; k < n; ++k) {
+        double r = s > 0 ? sin(chi[k] * pi / 360.0) / s : 2.0;
+        if (std::abs(r) > 1.0) {
+          omega_k[k] = kappa[k] = phi_k[k] = 0.0;
+          valid[k] = false;
+          continue;
+        }
+        double half_kappa = asin(r);
+        double delta = atan2(c * sin(half_kappa), cos(half_kappa)) * 180.0 / pi;
+        omega_k[k] = omega[k] - delta;
+        kappa[k] = 2.0 * half_kappa * 180.0 / pi;
+        phi_k[k] = phi[k] - delta;
+        valid[k] = true;
+      }
+      return result;
+    }
+
     friend std::ostream& operator<<(std::ostream& os, const KappaGoniometer& g);
 
   protected:
@@ -13,6 +13,8 @@
 
 #include <iostream>
 #include <scitbx/array_family/shared.h>
+#include <scitbx/array_family/ref.h>
+#include <scitbx/array_family/accessors/c_grid.h>
 #include <scitbx/vec3.h>
 #include <scitbx/mat3.h>
 #include <scitbx/math/r3_rotation.h>
@@ -102,6 +104,45 @@ namespace dxtbx { namespace model {
       return scan_axis_;
     }
 
+    /**
+     * Compute the rotations of the goniometer for many sets of axis angles
+     * at once, without changing the goniometer.
+     * @param angles The angles (degrees), one row per setting in axis order
+     * @param num_threads The number of threads
+     * @returns The setting rotation, fixed rotation and rotation axis of each
+     *          setting
+     */
+    GoniometerSettings compute_settings(
+      const scitbx::af::const_ref<double, scitbx::af::c_grid<2> > &angles,
+      int num_threads = 1) const {
+      DXTBX_ASSERT(angles.accessor()[1] == axes_.size());
+      DXTBX_ASSERT(num_threads > 0);
+      std::size_t num_axes = axes_.size();
+      int n = static_cast<int>(angles.accessor()[0]);
+      GoniometerSettings result(n);
+      mat3<double> *setting = result.setting_rotation.begin();
+      mat3<double> *fixed = result.fixed_rotation.begin();
+      vec3<double> *axis = result.rotation_axis.begin();
+      const vec3<double> *axes = axes_.begin();
+      std::size_t scan_axis = scan_axis_;
+#pragma omp parallel for num_threads(num_threads) schedule(static) if (num_threads > 1)
+      for (int k = 0; k < n; ++k) {
+        const double *a = &angles[k * num_axes];
+        mat3<double> F(1.0, 0.0, 0.0, 0.0, 1.0, 0.0, 0.0, 0.0, 1.0);
+        mat3<double> S(1.0, 0.0, 0.0, 0.0, 1.0, 0.0, 0.0, 0.0, 1.0);
+        for (std::size_t i = 0; i < scan_axis; ++i) {
+          F = axis_and_angle_as_matrix(axes[i], a[i], true) * F;
+        }
+        for (std::size_t i = scan_axis + 1; i < num_axes; ++i) {
+          S = axis_and_angle_as_matrix(axes[i], a[i], true) * S;
+        }
+        setting[k] = S;
+        fixed[k] = F;
+        axis[k] = S * axes[scan_axis];
+      }
+      return result;
+    }
+
     friend std::ostream &operator<<(std::ostream &os, const MultiAxisGoniometer &g);
 
   protected:
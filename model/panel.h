@@ -11,6 +11,7 @@
 #ifndef DXTBX_MODEL_PANEL_H
 #define DXTBX_MODEL_PANEL_H
 
+#include <cmath>
 #include <string>
 #include <iostream>
 #include <boost/shared_ptr.hpp>
@@ -276,6 +277,92 @@ namespace dxtbx { namespace model {
       return result;
     }
 
+    /**
+     * Get the solid angle subtended by every pixel, evaluated at the pixel
+     * centres.
+     * @returns flex::double array containing the solid angle (sr)
+     */
+    scitbx::af::versa<double, scitbx::af::c_grid<2> > get_solid_angle_array() const {
+      size_t fast = image_size_[0], slow = image_size_[1];
+      vec3<double> n = get_normal();
+      double area = pixel_size_[0] * pixel_size_[1];
+
+      scitbx::af::versa<double, scitbx::af::c_grid<2> > result(
+        scitbx::af::c_grid<2>(slow, fast));
+      for (size_t j = 0; j < slow; j++) {
+        for (size_t i = 0; i < fast; i++) {
+          vec3<double> p = get_pixel_lab_coord(vec2<double>(i + 0.5, j + 0.5));
+          double r = p.length();
+          DXTBX_ASSERT(r > 0);
+          result(j, i) = area * std::abs(n * p) / (r * r * r);
+        }
+      }
+      return result;
+    }
+
+    /**
+     * Get the polarization factor at every pixel, evaluated at the pixel
+     * centres. The factor is 0.5 * (1 + cos2(2theta)) for an unpolarized beam.
+     * @param s0 The incident beam vector
+     * @param polarization_normal The normal to the polarization plane
+     * @param polarization_fraction The polarization fraction
+     * @returns flex::double array containing the polarization factor
+     */
+    scitbx::af::versa<double, scitbx::af::c_grid<2> > get_polarization_array(
+      vec3<double> s0,
+      vec3<double> polarization_normal,
+      double polarization_fraction) const {
+      DXTBX_ASSERT(s0.length() > 0);
+      DXTBX_ASSERT(polarization_normal.length() > 0);
+      s0 /= s0.length();
+      polarization_normal /= polarization_normal.length();
+      size_t fast = image_size_[0], slow = image_size_[1];
+
+      scitbx::af::versa<double, scitbx::af::c_grid<2> > result(
+        scitbx::af::c_grid<2>(slow, fast));
+      for (size_t j = 0; j < slow; j++) {
+        for (size_t i = 0; i < fast; i++) {
+          vec3<double> p = get_pixel_lab_coord(vec2<double>(i + 0.5, j + 0.5));
+          double r = p.length();
+          DXTBX_ASSERT(r > 0);
+          double cos_n = (polarization_normal * p) / r;
+          double cos_2theta = (s0 * p) / r;
+          result(j, i) =
+            (1.0 - 2.0 * polarization_fraction) * (1.0 - cos_n * cos_n)
+            + polarization_fraction * (1.0 + cos_2theta * cos_2theta);
+        }
+      }
+      return result;
+    }
+
+    /**
+     * Get the efficiency of the sensor at every pixel relative to a ray at
+     * normal incidence, accounting for the longer path of oblique rays
+     * through the sensor. The efficiency is 1 at every pixel if the sensor
+     * thickness or attenuation coefficient are not set.
+     * @returns flex::double array containing the relative efficiency
+     */
+    scitbx::af::versa<double, scitbx::af::c_grid<2> > get_obliquity_array() const {
+      size_t fast = image_size_[0], slow = image_size_[1];
+      scitbx::af::versa<double, scitbx::af::c_grid<2> > result(
+        scitbx::af::c_grid<2>(slow, fast), 1.0);
+      double mu_t = get_mu() * get_thickness();
+      if (mu_t <= 0) {
+        return result;
+      }
+      vec3<double> n = get_normal();
+      double normal_efficiency = 1.0 - std::exp(-mu_t);
+      for (size_t j = 0; j < slow; j++) {
+        for (size_t i = 0; i < fast; i++) {
+          vec3<double> p = get_pixel_lab_coord(vec2<double>(i + 0.5, j + 0.5));
+          double cos_angle = std::abs(n * p) / p.length();
+          DXTBX_ASSERT(cos_angle > 0);
+          result(j, i) = (1.0 - std::exp(-mu_t / cos_angle)) / normal_efficiency;
+        }
+      }
+      return result;
+    }
+
     /**
      * Get the resolution at a given pixel.
      * @param s0 The incident beam vector
@@ -336,10 +423,19 @@ namespace dxtbx { namespace model {
      */
     void apply_untrusted_rectangle_mask(
       scitbx::af::ref<bool, scitbx::af::c_grid<2> > mask) const {
-      using scitbx::af::int4;
+      apply_untrusted_rectangle_mask(mask, mask_.const_ref());
+    }
+
+    /**
+     * Apply a set of untrusted rectangles to the mask. This neither copies
+     * nor references the panel's own array, so the rectangles can be taken
+     * once on the calling thread and the mask tiles filled in other threads.
+     */
+    void apply_untrusted_rectangle_mask(
+      scitbx::af::ref<bool, scitbx::af::c_grid<2> > mask,
+      const scitbx::af::const_ref<scitbx::af::int4> &untrusted_rectangle) const {
       std::size_t xsize = get_image_size()[0];
       std::size_t ysize = get_image_size()[1];
-      scitbx::af::shared<int4> untrusted_rectangle = get_mask();
       for (std::size_t j = 0; j < untrusted_rectangle.size(); ++j) {
         int x0 = std::max(untrusted_rectangle[j][0], 0);
         int y0 = std::max(untrusted_rectangle[j][1], 0);
@@ -0,0 +1,547 @@
+/*
+ * prediction.h
+ *
+ *  This code is distributed under the BSD license, a copy of which is
+ *  included in the root directory of this package.
+ */
+#ifndef DXTBX_MODEL_PREDICTION_H
+#define DXTBX_MODEL_PREDICTION_H
+
+#include <algorithm>
+#include <cmath>
+#include <exception>
+#include <string>
+#include <vector>
+#include <scitbx/vec2.h>
+#include <scitbx/vec3.h>
+#include <scitbx/mat3.h>
+#include <scitbx/constants.h>
+#include <scitbx/math/r3_rotation.h>
+#include <scitbx/array_family/shared.h>
+#include <scitbx/array_family/ref.h>
+#include <cctbx/miller.h>
+#include <cctbx/sgtbx/space_group.h>
+#include <dxtbx/model/beam.h>
+#include <dxtbx/model/detector.h>
+#include <dxtbx/model/goniometer.h>
+#include <dxtbx/model/scan.h>
+#include <dxtbx/model/crystal.h>
+#include <dxtbx/model/spectrum.h>
+#include <dxtbx/error.h>
+
+namespace dxtbx { namespace model {
+
+  using scitbx::mat3;
+  using scitbx::vec2;
+  using scitbx::vec3;
+
+  namespace detail {
+
+    /**
+     * Find the panel a diffracted beam hits closest to the sample, as in
+     * Detector::get_ray_intersection but returning -1 if no panel is hit
+     * @param detector The detector
+     * @param D The D matrix of each panel
+     * @param s1 The diffracted beam vector
+     * @param mm The millimetre coordinate on the panel
+     * @returns The panel
+     */
+    inline int intersect_panels(const Detector &detector,
+                                const std::vector<mat3<double> > &D,
+                                const vec3<double> &s1,
+                                vec2<double> &mm) {
+      int panel = -1;
+      double w_max = 0;
+      for (std::size_t j = 0; j < D.size(); ++j) {
+        vec3<double> v = D[j] * s1;
+        if (v[2] > w_max) {
+          vec2<double> xy(v[0] / v[2], v[1] / v[2]);
+          if (detector[j].is_coord_valid_mm(xy)) {
+            panel = static_cast<int>(j);
+            mm = xy;
+            w_max = v[2];
+          }
+        }
+      }
+      return panel;
+    }
+
+  }  // namespace detail
+
+  /**
+   * The reflections predicted for a rotation scan, stored as columns
+   */
+  struct RotationPredictions {
+    scitbx::af::shared<cctbx::miller::index<> > miller_index;
+    scitbx::af::shared<std::size_t> panel;
+    scitbx::af::shared<bool> entering;
+    scitbx::af::shared<vec3<double> > s1;
+    /// The pixel coordinates and zero based frame
+    scitbx::af::shared<vec3<double> > xyz_px;
+    /// The millimetre coordinates and rotation angle (radians)
+    scitbx::af::shared<vec3<double> > xyz_mm;
+
+    std::size_t size() const {
+      return miller_index.size();
+    }
+  };
+
+  /**
+   * Predict the reflections recorded in a rotation scan.
+   *
+   * The rotation matrix S R(phi) F A taking Miller indices to the laboratory
+   * frame, and the beam vector s0, are computed at the start and end of every
+   * image. Scan-varying crystal, beam and goniometer models are used where
+   * they are set at each image boundary. For each Miller index within the
+   * resolution limit, and not systematically absent, the diffraction
+   * condition |s0 + r|^2 = |s0|^2 is checked at every image boundary. When
+   * it changes sign during an image the reciprocal lattice point and s0 are
+   * linearly interpolated across the image, and the crossing is solved for
+   * exactly. The diffracted beam is then intersected with the panels. Miller
+   * indices are split between threads, each writing its own results, so the
+   * output order does not depend on the number of threads.
+   */
+  class RotationPredictor {
+  public:
+    /**
+     * @param beam The beam model
+     * @param detector The detector model
+     * @param goniometer The goniometer model
+     * @param scan The scan model
+     * @param crystal The crystal model
+     */
+    RotationPredictor(const BeamBase &beam,
+                      const Detector &detector,
+                      const Goniometer &goniometer,
+                      const Scan &scan,
+                      const CrystalBase &crystal)
+        : detector_(detector),
+          space_group_(crystal.get_space_group()),
+          first_frame_(scan.get_array_range()[0]) {
+      std::size_t num_images = scan.get_num_images();
+      DXTBX_ASSERT(num_images > 0);
+      DXTBX_ASSERT(scan.get_oscillation()[1] > 0);
+      std::size_t num_boundaries = num_images + 1;
+      DXTBX_ASSERT(crystal.get_num_scan_points() == 0
+                   || crystal.get_num_scan_points() == num_boundaries);
+      DXTBX_ASSERT(beam.get_num_scan_points() == 0
+                   || beam.get_num_scan_points() == num_boundaries);
+      DXTBX_ASSERT(goniometer.get_num_scan_points() == 0
+                   || goniometer.get_num_scan_points() == num_boundaries);
+      static_A_ = crystal.get_num_scan_points() == 0;
+
+      // Compute the geometry at each image boundary
+      vec3<double> axis = goniometer.get_rotation_axis_datum();
+      mat3<double> F = goniometer.get_fixed_rotation();
+      for (std::size_t i = 0; i < num_boundaries; ++i) {
+        double phi = deg_as_rad(scan.get_angle_from_array_index(first_frame_ + i));
+        mat3<double> A = static_A_ ? crystal.get_A() : crystal.get_A_at_scan_point(i);
+        mat3<double> S = goniometer.get_num_scan_points() == 0
+                           ? goniometer.get_setting_rotation()
+                           : goniometer.get_setting_rotation_at_scan_point(i);
+        mat3<double> R =
+          scitbx::math::r3_rotation::axis_and_angle_as_matrix(axis, phi, false);
+        phi_.push_back(phi);
+        A_.push_back(A);
+        M_.push_back(S * R * F * A);
+        s0_.push_back(beam.get_num_scan_points() == 0 ? beam.get_s0()
+                                                      : beam.get_s0_at_scan_point(i));
+      }
+
+      // Cache the panel geometry
+      for (std::size_t i = 0; i < detector_.size(); ++i) {
+        D_.push_back(detector_[i].get_D_matrix());
+      }
+    }
+
+    /**
+     * @returns The number of images
+     */
+    std::size_t num_images() const {
+      return M_.size() - 1;
+    }
+
+    /**
+     * Predict the reflections
+     * @param d_min The resolution limit
+     * @param num_threads The number of threads
+     * @returns The predicted reflections
+     */
+    RotationPredictions predict(double d_min, int num_threads = 1) const {
+      DXTBX_ASSERT(d_min > 0);
+      DXTBX_ASSERT(num_threads > 0);
+
+      // Find the range of indices within the resolution limit from the longest
+      // real space vectors in the scan
+      vec3<double> max_length(0, 0, 0);
+      for (std::size_t i = 0; i < A_.size(); ++i) {
+        mat3<double> direct = A_[i].inverse();
+        for (std::size_t k = 0; k < 3; ++k) {
+          max_length[k] = std::max(max_length[k], direct.get_row(k).length());
+        }
+      }
+      int h_max[3];
+      for (std::size_t k = 0; k < 3; ++k) {
+        h_max[k] = static_cast<int>(std::ceil(max_length[k] / d_min));
+      }
+
+      // Predict the reflections for each value of h independently
+      int num_h = 2 * h_max[0] + 1;
+      std::vector<std::vector<Prediction> > results(num_h);
+      std::vector<char> failed(num_h, 0);
+      std::vector<std::string> errors(num_h);
+#pragma omp parallel for num_threads(num_threads) schedule(dynamic) if (num_threads > 1)
+      for (int i = 0; i < num_h; ++i) {
+        try {
+          predict_h(i - h_max[0], h_max, 1.0 / (d_min * d_min), results[i]);
+        } catch (const std::exception &e) {
+          failed[i] = 1;
+          errors[i] = e.what();
+        }
+      }
+      for (int i = 0; i < num_h; ++i) {
+        if (failed[i]) {
+          throw DXTBX_ERROR(errors[i]);
+        }
+      }
+
+      // Collect the results into columns
+      RotationPredictions predictions;
+      for (std::size_t i = 0; i < results.size(); ++i) {
+        for (std::size_t j = 0; j < results[i].size(); ++j) {
+          const Prediction &p = results[i][j];
+          predictions.miller_index.push_back(p.miller_index);
+          predictions.panel.push_back(p.panel);
+          predictions.entering.push_back(p.entering);
+          predictions.s1.push_back(p.s1);
+          predictions.xyz_px.push_back(vec3<double>(p.px[0], p.px[1], p.frame));
+          predictions.xyz_mm.push_back(vec3<double>(p.mm[0], p.mm[1], p.phi));
+        }
+      }
+      return predictions;
+    }
+
+  protected:
+    struct Prediction {
+      cctbx::miller::index<> miller_index;
+      std::size_t panel;
+      bool entering;
+      vec3<double> s1;
+      vec2<double> px;
+      vec2<double> mm;
+      double frame;
+      double phi;
+    };
+
+    /**
+     * Predict the reflections with the given value of h
+     */
+    void predict_h(int h,
+                   const int *h_max,
+                   double inv_d_min_sq,
+                   std::vector<Prediction> &result) const {
+      for (int k = -h_max[1]; k <= h_max[1]; ++k) {
+        for (int l = -h_max[2]; l <= h_max[2]; ++l) {
+          if (h == 0 && k == 0 && l == 0) {
+            continue;
+          }
+          cctbx::miller::index<> hkl(h, k, l);
+          vec3<double> hv(h, k, l);
+          if (static_A_ && (A_[0] * hv).length_sq() > inv_d_min_sq) {
+            continue;
+          }
+          if (space_group_.is_sys_absent(hkl)) {
+            continue;
+          }
+          vec3<double> r0 = M_[0] * hv;
+          double f0 = r0 * (r0 + 2.0 * s0_[0]);
+          for (std::size_t i = 1; i < M_.size(); ++i) {
+            vec3<double> r1 = M_[i] * hv;
+            double f1 = r1 * (r1 + 2.0 * s0_[i]);
+            if ((f0 < 0) != (f1 < 0)) {
+              add_crossing(hkl, i - 1, r0, r1, f0, inv_d_min_sq, result);
+            }
+            r0 = r1;
+            f0 = f1;
+          }
+        }
+      }
+    }
+
+    /**
+     * Solve for the diffraction condition within an image and add the
+     * reflection if it is within the resolution limit and hits a panel
+     */
+    void add_crossing(const cctbx::miller::index<> &hkl,
+                      std::size_t image,
+                      const vec3<double> &r0,
+                      const vec3<double> &r1,
+                      double f0,
+                      double inv_d_min_sq,
+                      std::vector<Prediction> &result) const {
+      // With r(t) = r0 + t dr and s0(t) = s0 + t ds the condition is the
+      // quadratic a t^2 + b t + c = 0, with exactly one root in [0, 1]
+      vec3<double> s0 = s0_[image];
+      vec3<double> dr = r1 - r0;
+      vec3<double> ds = s0_[image + 1] - s0;
+      double a = dr * dr + 2.0 * (dr * ds);
+      double b = 2.0 * (r0 * dr + r0 * ds + dr * s0);
+      double c = f0;
+      double t = 0.0;
+      if (std::abs(a) < 1e-12 * std::abs(b)) {
+        t = -c / b;
+      } else {
+        double discriminant = std::max(b * b - 4.0 * a * c, 0.0);
+        double q = -0.5 * (b + (b < 0 ? -1.0 : 1.0) * std::sqrt(discriminant));
+        double t1 = q / a;
+        double t2 = q != 0 ? c / q : t1;
+        t = std::abs(t1 - 0.5) < std::abs(t2 - 0.5) ? t1 : t2;
+      }
+      t = std::min(std::max(t, 0.0), 1.0);
+      vec3<double> r = r0 + t * dr;
+      if (r.length_sq() > inv_d_min_sq) {
+        return;
+      }
+
+      Prediction p;
+      p.s1 = s0 + t * ds + r;
+      int panel = detail::intersect_panels(detector_, D_, p.s1, p.mm);
+      if (panel < 0) {
+        return;
+      }
+      p.miller_index = hkl;
+      p.panel = panel;
+      p.entering = f0 >= 0;
+      p.px = detector_[panel].millimeter_to_pixel(p.mm);
+      p.frame = first_frame_ + image + t;
+      p.phi = phi_[image] + t * (phi_[image + 1] - phi_[image]);
+      result.push_back(p);
+    }
+
+    Detector detector_;
+    cctbx::sgtbx::space_group space_group_;
+    int first_frame_;
+    bool static_A_;
+    std::vector<double> phi_;
+    std::vector<mat3<double> > A_;
+    std::vector<mat3<double> > M_;
+    std::vector<vec3<double> > s0_;
+    std::vector<mat3<double> > D_;
+  };
+
+  /**
+   * The reflections predicted for a set of still shots, stored as columns
+   */
+  struct StillsPredictions {
+    scitbx::af::shared<std::size_t> shot;
+    scitbx::af::shared<cctbx::miller::index<> > miller_index;
+    scitbx::af::shared<std::size_t> panel;
+    scitbx::af::shared<vec3<double> > s1;
+    /// The wavelength at which the reflection is in the diffracting condition
+    scitbx::af::shared<double> wavelength;
+    /// The spectrum weight at that wavelength relative to the peak weight
+    scitbx::af::shared<double> spectral_weight;
+    /// The pixel coordinates, with z set to zero
+    scitbx::af::shared<vec3<double> > xyz_px;
+    /// The millimetre coordinates, with z set to zero
+    scitbx::af::shared<vec3<double> > xyz_mm;
+
+    std::size_t size() const {
+      return miller_index.size();
+    }
+  };
+
+  /**
+   * Predict the reflections recorded in still shots with a polychromatic beam.
+   *
+   * For a reciprocal lattice point r and a beam along the unit vector u, the
+   * diffracting condition |r + u / lambda|^2 = 1 / lambda^2 is met at the
+   * single wavelength lambda = -2 (r . u) / |r|^2. A reflection is predicted
+   * if this wavelength lies within the 98% bandwidth of the spectrum of the
+   * shot; its spectral weight is the spectrum linearly interpolated at that
+   * energy, relative to the peak of the spectrum. The spectrum energies must
+   * be in increasing order. Shots are split between threads, each writing its
+   * own results, so the output order does not depend on the number of
+   * threads.
+   */
+  class StillsPredictor {
+  public:
+    typedef boost::shared_ptr<CrystalBase> crystal_pointer;
+    typedef boost::shared_ptr<BeamBase> beam_pointer;
+
+    /**
+     * @param detector The detector model, shared by all the shots
+     */
+    StillsPredictor(const Detector &detector) : detector_(detector) {
+      for (std::size_t i = 0; i < detector_.size(); ++i) {
+        D_.push_back(detector_[i].get_D_matrix());
+      }
+    }
+
+    /**
+     * Predict the reflections
+     * @param crystals The crystal of each shot
+     * @param beams The beam of each shot, whose direction is used
+     * @param spectra The spectrum of each shot
+     * @param d_min The resolution limit
+     * @param num_threads The number of threads
+     * @returns The predicted reflections
+     */
+    StillsPredictions predict(const scitbx::af::const_ref<crystal_pointer> &crystals,
+                              const scitbx::af::const_ref<beam_pointer> &beams,
+                              const scitbx::af::const_ref<Spectrum> &spectra,
+                              double d_min,
+                              int num_threads = 1) const {
+      DXTBX_ASSERT(crystals.size() == beams.size());
+      DXTBX_ASSERT(crystals.size() == spectra.size());
+      DXTBX_ASSERT(d_min > 0);
+      DXTBX_ASSERT(num_threads > 0);
+
+      // Copy out everything needed for each shot before the parallel region
+      std::vector<Shot> shots(crystals.size());
+      for (std::size_t i = 0; i < shots.size(); ++i) {
+        DXTBX_ASSERT(crystals[i] != NULL && beams[i] != NULL);
+        shots[i].A = crystals[i]->get_A();
+        shots[i].space_group = crystals[i]->get_space_group();
+        shots[i].unit_s0 = beams[i]->get_unit_s0();
+        Spectrum spectrum = spectra[i];
+        vecd energies = spectrum.get_energies_eV();
+        vecd weights = spectrum.get_weights();
+        DXTBX_ASSERT(energies.size() > 0 && energies.size() == weights.size());
+        shots[i].energies.assign(energies.begin(), energies.end());
+        shots[i].weights.assign(weights.begin(), weights.end());
+        shots[i].emin = std::max(spectrum.get_emin_eV(), energies.front());
+        shots[i].emax = std::max(spectrum.get_emax_eV(), shots[i].emin);
+        shots[i].peak = *std::max_element(weights.begin(), weights.end());
+        DXTBX_ASSERT(shots[i].peak > 0);
+      }
+
+      // Predict the reflections for each shot independently
+      int num_shots = static_cast<int>(shots.size());
+      std::vector<std::vector<Prediction> > results(num_shots);
+      std::vector<char> failed(num_shots, 0);
+      std::vector<std::string> errors(num_shots);
+#pragma omp parallel for num_threads(num_threads) schedule(dynamic) if (num_threads > 1)
+      for (int i = 0; i < num_shots; ++i) {
+        try {
+          predict_shot(shots[i], d_min, results[i]);
+        } catch (const std::exception &e) {
+          failed[i] = 1;
+          errors[i] = e.what();
+        }
+      }
+      for (int i = 0; i < num_shots; ++i) {
+        if (failed[i]) {
+          throw DXTBX_ERROR(errors[i]);
+        }
+      }
+
+      // Collect the results into columns
+      StillsPredictions predictions;
+      for (std::size_t i = 0; i < results.size(); ++i) {
+        for (std::size_t j = 0; j < results[i].size(); ++j) {
+          const Prediction &p = results[i][j];
+          predictions.shot.push_back(i);
+          predictions.miller_index.push_back(p.miller_index);
+          predictions.panel.push_back(p.panel);
+          predictions.s1.push_back(p.s1);
+          predictions.wavelength.push_back(p.wavelength);
+          predictions.spectral_weight.push_back(p.weight);
+          predictions.xyz_px.push_back(vec3<double>(p.px[0], p.px[1], 0));
+          predictions.xyz_mm.push_back(vec3<double>(p.mm[0], p.mm[1], 0));
+        }
+      }
+      return predictions;
+    }
+
+  protected:
+    struct Shot {
+      mat3<double> A;
+      cctbx::sgtbx::space_group space_group;
+      vec3<double> unit_s0;
+      std::vector<double> energies;
+      std::vector<double> weights;
+      double emin;
+      double emax;
+      double peak;
+    };
+
+    struct Prediction {
+      cctbx::miller::index<> miller_index;
+      std::size_t panel;
+      vec3<double> s1;
+      double wavelength;
+      double weight;
+      vec2<double> px;
+      vec2<double> mm;
+    };
+
+    /**
+     * Interpolate the spectrum weight at an energy
+     */
+    static double interpolate_weight(const Shot &shot, double energy) {
+      const std::vector<double> &e = shot.energies;
+      std::size_t j = std::upper_bound(e.begin(), e.end(), energy) - e.begin();
+      if (j == 0 || j == e.size()) {
+        return energy == e.back() ? shot.weights.back() : 0.0;
+      }
+      double t = (energy - e[j - 1]) / (e[j] - e[j - 1]);
+      return shot.weights[j - 1] + t * (shot.weights[j] - shot.weights[j - 1]);
+    }
+
+    /**
+     * Predict the reflections of a shot
+     */
+    void predict_shot(const Shot &shot,
+                      double d_min,
+                      std::vector<Prediction> &result) const {
+      const double hc = scitbx::constants::factor_ev_angstrom;
+      double inv_d_min_sq = 1.0 / (d_min * d_min);
+      double lambda_min = hc / shot.emax;
+      double lambda_max = hc / shot.emin;
+      mat3<double> direct = shot.A.inverse();
+      int h_max[3];
+      for (std::size_t k = 0; k < 3; ++k) {
+        h_max[k] = static_cast<int>(std::ceil(direct.get_row(k).length() / d_min));
+      }
+      for (int h = -h_max[0]; h <= h_max[0]; ++h) {
+        for (int k = -h_max[1]; k <= h_max[1]; ++k) {
+          for (int l = -h_max[2]; l <= h_max[2]; ++l) {
+            vec3<double> r = shot.A * vec3<double>(h, k, l);
+            double r_sq = r.length_sq();
+            double r_dot_u = r * shot.unit_s0;
+            if (r_sq == 0 || r_sq > inv_d_min_sq || r_dot_u >= 0) {
+              continue;
+            }
+            double wavelength = -2.0 * r_dot_u / r_sq;
+            if (wavelength < lambda_min || wavelength > lambda_max) {
+              continue;
+            }
+            cctbx::miller::index<> hkl(h, k, l);
+            if (shot.space_group.is_sys_absent(hkl)) {
+              continue;
+            }
+            Prediction p;
+            p.s1 = shot.unit_s0 / wavelength + r;
+            int panel = detail::intersect_panels(detector_, D_, p.s1, p.mm);
+            if (panel < 0) {
+              continue;
+            }
+            p.miller_index = hkl;
+            p.panel = panel;
+            p.wavelength = wavelength;
+            p.weight = interpolate_weight(shot, hc / wavelength) / shot.peak;
+            p.px = detector_[panel].millimeter_to_pixel(p.mm);
+            result.push_back(p);
+          }
+        }
+      }
+    }
+
+    Detector detector_;
+    std::vector<mat3<double> > D_;
+  };
+
+}}  // namespace dxtbx::model
+
+#endif  // DXTBX_MODEL_PREDICTION_H
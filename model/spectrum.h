@@ -29,6 +29,28 @@ namespace dxtbx { namespace model {
       compute_weighted_energy();
     }
 
+    /**
+     * Initialise the spectrum with precomputed statistics.
+     * @param energies The spectrum energies (eV)
+     * @param weights The spectrum weights (unitless)
+     * @param weighted_energy The weighted energy (eV)
+     * @param weighted_energy_variance The weighted energy variance
+     * @param emin The lower limit of the 98% bandwidth (eV)
+     * @param emax The upper limit of the 98% bandwidth (eV)
+     */
+    Spectrum(vecd energies,
+             vecd weights,
+             double weighted_energy,
+             double weighted_energy_variance,
+             double emin,
+             double emax)
+        : energies_(energies),
+          weights_(weights),
+          emin_(emin),
+          emax_(emax),
+          weighted_energy_(weighted_energy),
+          weighted_energy_variance_(weighted_energy_variance) {}
+
     virtual ~Spectrum() {}
 
     /* Get the spectrum energies (eV) */
@@ -0,0 +1,500 @@
+/*
+ * spectrum_table.h
+ *
+ *  This code is distributed under the BSD license, a copy of which is
+ *  included in the root directory of this package.
+ */
+#ifndef DXTBX_MODEL_SPECTRUM_TABLE_H
+#define DXTBX_MODEL_SPECTRUM_TABLE_H
+
+#include <algorithm>
+#include <vector>
+#include <scitbx/array_family/shared.h>
+#include <scitbx/array_family/ref.h>
+#include <scitbx/array_family/accessors/c_grid.h>
+#include <scitbx/constants.h>
+#include <dxtbx/model/spectrum.h>
+#include <dxtbx/error.h>
+
+namespace dxtbx { namespace model {
+
+  /**
+   * The spectrum of one shot of a SpectrumTable. The view shares the storage
+   * of the table and holds the offsets of the shot into it, so no energies or
+   * weights are copied. Shots added to the table later do not change the
+   * view, though they may move the storage that energies() and weights()
+   * refer to. A Spectrum is only created by to_spectrum.
+   */
+  class SpectrumView {
+  public:
+    SpectrumView(const vecd &energies,
+                 const vecd &weights,
+                 std::size_t energy_offset,
+                 std::size_t weight_offset,
+                 std::size_t size,
+                 double weighted_energy,
+                 double weighted_energy_variance,
+                 double emin,
+                 double emax)
+        : energies_(energies),
+          weights_(weights),
+          energy_offset_(energy_offset),
+          weight_offset_(weight_offset),
+          size_(size),
+          weighted_energy_(weighted_energy),
+          weighted_energy_variance_(weighted_energy_variance),
+          emin_(emin),
+          emax_(emax) {
+      DXTBX_ASSERT(energy_offset + size <= energies.size());
+      DXTBX_ASSERT(weight_offset + size <= weights.size());
+    }
+
+    /**
+     * @returns The number of points in the spectrum
+     */
+    std::size_t size() const {
+      return size_;
+    }
+
+    /**
+     * @returns The energies of the shot in the table storage (eV)
+     */
+    scitbx::af::const_ref<double> energies() const {
+      return scitbx::af::const_ref<double>(energies_.begin() + energy_offset_, size_);
+    }
+
+    /**
+     * @returns The weights of the shot in the table storage
+     */
+    scitbx::af::const_ref<double> weights() const {
+      return scitbx::af::const_ref<double>(weights_.begin() + weight_offset_, size_);
+    }
+
+    /**
+     * @returns An energy of the shot (eV)
+     */
+    double energy(std::size_t index) const {
+      DXTBX_ASSERT(index < size_);
+      return energies_[energy_offset_ + index];
+    }
+
+    /**
+     * @returns A weight of the shot
+     */
+    double weight(std::size_t index) const {
+      DXTBX_ASSERT(index < size_);
+      return weights_[weight_offset_ + index];
+    }
+
+    double get_weighted_energy_eV() const {
+      return weighted_energy_;
+    }
+
+    double get_weighted_energy_variance() const {
+      return weighted_energy_variance_;
+    }
+
+    double get_weighted_wavelength() const {
+      return scitbx::constants::factor_ev_angstrom / weighted_energy_;
+    }
+
+    double get_emin_eV() const {
+      return emin_;
+    }
+
+    double get_emax_eV() const {
+      return emax_;
+    }
+
+    /**
+     * Copy the shot into a Spectrum with the precomputed statistics
+     * @returns The spectrum
+     */
+    Spectrum to_spectrum() const {
+      scitbx::af::const_ref<double> e = energies();
+      scitbx::af::const_ref<double> w = weights();
+      return Spectrum(vecd(e.begin(), e.end()),
+                      vecd(w.begin(), w.end()),
+                      weighted_energy_,
+                      weighted_energy_variance_,
+                      emin_,
+                      emax_);
+    }
+
+  protected:
+    vecd energies_;
+    vecd weights_;
+    std::size_t energy_offset_;
+    std::size_t weight_offset_;
+    std::size_t size_;
+    double weighted_energy_;
+    double weighted_energy_variance_;
+    double emin_;
+    double emax_;
+  };
+
+  /**
+   * A table of the spectra of many shots stored in columns.
+   *
+   * The weights of all shots are stored in a single array with the offset of
+   * each shot, and the energies are either a single axis shared by all shots
+   * or stored in the same layout as the weights. The weighted energy, energy
+   * variance and 98% bandwidth of every shot are computed in one pass when the
+   * spectra are added, using the same definitions as Spectrum, so a run of
+   * shots can be sorted or binned by energy without creating a Spectrum for
+   * each shot.
+   */
+  class SpectrumTable {
+  public:
+    /**
+     * Construct an empty table
+     */
+    SpectrumTable() : shared_axis_(false) {
+      offsets_.push_back(0);
+    }
+
+    /**
+     * Construct a table of spectra sharing an energy axis
+     * @param energies The energy axis (eV)
+     * @param weights The weights of each shot, one row per shot
+     * @param num_threads The number of threads used to compute the statistics
+     */
+    SpectrumTable(const vecd &energies,
+                  const scitbx::af::const_ref<double, scitbx::af::c_grid<2> > &weights,
+                  int num_threads = 1)
+        : energies_(energies),
+          weights_(weights.begin(), weights.end()),
+          shared_axis_(true) {
+      DXTBX_ASSERT(weights.accessor()[1] == energies.size());
+      offsets_.push_back(0);
+      for (std::size_t i = 0; i < weights.accessor()[0]; ++i) {
+        offsets_.push_back(offsets_.back() + energies.size());
+      }
+      compute_statistics(0, num_threads);
+    }
+
+    /**
+     * Construct a table of spectra which each have their own energies
+     * @param energies The energies of all shots (eV)
+     * @param weights The weights of all shots
+     * @param counts The number of points in each shot
+     * @param num_threads The number of threads used to compute the statistics
+     */
+    SpectrumTable(const scitbx::af::const_ref<double> &energies,
+                  const scitbx::af::const_ref<double> &weights,
+                  const scitbx::af::const_ref<std::size_t> &counts,
+                  int num_threads = 1)
+        : energies_(energies.begin(), energies.end()),
+          weights_(weights.begin(), weights.end()),
+          shared_axis_(false) {
+      DXTBX_ASSERT(energies.size() == weights.size());
+      offsets_.push_back(0);
+      for (std::size_t i = 0; i < counts.size(); ++i) {
+        offsets_.push_back(offsets_.back() + counts[i]);
+      }
+      DXTBX_ASSERT(offsets_.back() == weights.size());
+      compute_statistics(0, num_threads);
+    }
+
+    /**
+     * @returns The number of shots
+     */
+    std::size_t size() const {
+      return offsets_.size() - 1;
+    }
+
+    /**
+     * @returns Do all shots share the same energy axis
+     */
+    bool has_shared_axis() const {
+      return shared_axis_;
+    }
+
+    /**
+     * @returns The energy axis, or the energies of all shots if there is no
+     *          shared axis (eV)
+     */
+    vecd energies() const {
+      return energies_;
+    }
+
+    /**
+     * @returns The weights of all shots
+     */
+    vecd weights() const {
+      return weights_;
+    }
+
+    /**
+     * @returns The offset of each shot in the weights, and the total size
+     */
+    scitbx::af::shared<std::size_t> offsets() const {
+      return scitbx::af::shared<std::size_t>(offsets_.begin(), offsets_.end());
+    }
+
+    /**
+     * Add the spectrum of a shot. If the table has a shared axis and the
+     * energies of the spectrum differ from it, the table is converted to
+     * have the energies of each shot.
+     * @param spectrum The spectrum
+     */
+    void append(const Spectrum &spectrum) {
+      vecd energies = spectrum.get_energies_eV();
+      vecd weights = spectrum.get_weights();
+      DXTBX_ASSERT(energies.size() == weights.size());
+      if (size() == 0 && energies_.size() == 0) {
+        energies_ = vecd(energies.begin(), energies.end());
+        shared_axis_ = true;
+      } else if (shared_axis_ && !has_axis(energies)) {
+        expand_axis();
+      }
+      if (!shared_axis_) {
+        energies_.extend(energies.begin(), energies.end());
+      }
+      weights_.extend(weights.begin(), weights.end());
+      offsets_.push_back(weights_.size());
+      compute_statistics(size() - 1, 1);
+    }
+
+    /**
+     * Get a view of the spectrum of a shot in the table storage
+     * @param index The shot index
+     * @returns The view of the spectrum
+     */
+    SpectrumView spectrum(std::size_t index) const {
+      DXTBX_ASSERT(index < size());
+      return SpectrumView(energies_,
+                          weights_,
+                          shared_axis_ ? 0 : offsets_[index],
+                          offsets_[index],
+                          offsets_[index + 1] - offsets_[index],
+                          weighted_energy_[index],
+                          weighted_energy_variance_[index],
+                          emin_[index],
+                          emax_[index]);
+    }
+
+    /**
+     * Copy the spectrum of a shot into a Spectrum with the precomputed
+     * statistics
+     * @param index The shot index
+     * @returns The spectrum
+     */
+    Spectrum to_spectrum(std::size_t index) const {
+      return spectrum(index).to_spectrum();
+    }
+
+    /**
+     * @returns The weighted energy of each shot (eV)
+     */
+    vecd weighted_energies() const {
+      return vecd(weighted_energy_.begin(), weighted_energy_.end());
+    }
+
+    /**
+     * @returns The weighted energy variance of each shot
+     */
+    vecd weighted_energy_variances() const {
+      return vecd(weighted_energy_variance_.begin(), weighted_energy_variance_.end());
+    }
+
+    /**
+     * @returns The weighted wavelength of each shot (Å)
+     */
+    vecd weighted_wavelengths() const {
+      vecd result(size());
+      for (std::size_t i = 0; i < size(); ++i) {
+        result[i] = scitbx::constants::factor_ev_angstrom / weighted_energy_[i];
+      }
+      return result;
+    }
+
+    /**
+     * @returns The lower limit of the 98% bandwidth of each shot (eV)
+     */
+    vecd emin() const {
+      return vecd(emin_.begin(), emin_.end());
+    }
+
+    /**
+     * @returns The upper limit of the 98% bandwidth of each shot (eV)
+     */
+    vecd emax() const {
+      return vecd(emax_.begin(), emax_.end());
+    }
+
+    /**
+     * @returns The shot indices in order of increasing weighted energy
+     */
+    scitbx::af::shared<std::size_t> sort_indices() const {
+      std::vector<std::size_t> index(size());
+      for (std::size_t i = 0; i < index.size(); ++i) {
+        index[i] = i;
+      }
+      std::stable_sort(index.begin(), index.end(), CompareEnergy(weighted_energy_));
+      return scitbx::af::shared<std::size_t>(index.begin(), index.end());
+    }
+
+    /**
+     * Bin the shots by weighted energy
+     * @param edges The increasing bin edges (eV)
+     * @returns The bin of each shot, or -1 if the weighted energy is outside
+     *          the bins. Each bin includes its lower edge.
+     */
+    scitbx::af::shared<int> bin_indices(
+      const scitbx::af::const_ref<double> &edges) const {
+      DXTBX_ASSERT(edges.size() >= 2);
+      for (std::size_t i = 1; i < edges.size(); ++i) {
+        DXTBX_ASSERT(edges[i - 1] < edges[i]);
+      }
+      scitbx::af::shared<int> result(size());
+      for (std::size_t i = 0; i < size(); ++i) {
+        const double *it =
+          std::upper_bound(edges.begin(), edges.end(), weighted_energy_[i]);
+        if (it == edges.begin() || it == edges.end()) {
+          result[i] = -1;
+        } else {
+          result[i] = static_cast<int>(it - edges.begin()) - 1;
+        }
+      }
+      return result;
+    }
+
+    /**
+     * Select a subset of the shots
+     * @param indices The shot indices
+     * @returns The table of the selected shots
+     */
+    SpectrumTable select(const scitbx::af::const_ref<std::size_t> &indices) const {
+      SpectrumTable result;
+      result.shared_axis_ = shared_axis_;
+      if (shared_axis_) {
+        result.energies_ = energies_;
+      }
+      for (std::size_t k = 0; k < indices.size(); ++k) {
+        std::size_t i = indices[k];
+        DXTBX_ASSERT(i < size());
+        if (!shared_axis_) {
+          result.energies_.extend(energies_.begin() + offsets_[i],
+                                  energies_.begin() + offsets_[i + 1]);
+        }
+        result.weights_.extend(weights_.begin() + offsets_[i],
+                               weights_.begin() + offsets_[i + 1]);
+        result.offsets_.push_back(result.weights_.size());
+        result.weighted_energy_.push_back(weighted_energy_[i]);
+        result.weighted_energy_variance_.push_back(weighted_energy_variance_[i]);
+        result.emin_.push_back(emin_[i]);
+        result.emax_.push_back(emax_[i]);
+      }
+      return result;
+    }
+
+  protected:
+    struct CompareEnergy {
+      const std::vector<double> &energy;
+      CompareEnergy(const std::vector<double> &energy_) : energy(energy_) {}
+      bool operator()(std::size_t a, std::size_t b) const {
+        return energy[a] < energy[b];
+      }
+    };
+
+    /**
+     * @returns Are the energies the same as the shared axis
+     */
+    bool has_axis(const vecd &energies) const {
+      return energies.size() == energies_.size()
+             && std::equal(energies.begin(), energies.end(), energies_.begin());
+    }
+
+    /**
+     * Store the energies of each shot instead of the shared axis
+     */
+    void expand_axis() {
+      vecd energies;
+      for (std::size_t i = 0; i < size(); ++i) {
+        energies.extend(energies_.begin(), energies_.end());
+      }
+      energies_ = energies;
+      shared_axis_ = false;
+    }
+
+    /**
+     * Compute the statistics of the shots from the first shot onwards
+     */
+    void compute_statistics(std::size_t first, int num_threads) {
+      DXTBX_ASSERT(num_threads > 0);
+      weighted_energy_.resize(size());
+      weighted_energy_variance_.resize(size());
+      emin_.resize(size());
+      emax_.resize(size());
+      std::vector<char> valid(size(), 1);
+      int n = static_cast<int>(size());
+#pragma omp parallel for num_threads(num_threads) schedule(dynamic) if (num_threads > 1)
+      for (int i = static_cast<int>(first); i < n; ++i) {
+        valid[i] = compute_shot_statistics(i);
+      }
+      DXTBX_ASSERT(std::find(valid.begin(), valid.end(), 0) == valid.end());
+    }
+
+    /**
+     * Compute the statistics of a shot as Spectrum does. This does not throw
+     * so it can be called from a parallel region.
+     * @returns False if the weights or energies do not have a positive sum
+     */
+    bool compute_shot_statistics(std::size_t index) {
+      std::size_t begin = offsets_[index];
+      std::size_t end = offsets_[index + 1];
+      const double *e = shared_axis_ ? energies_.begin() : energies_.begin() + begin;
+      const double *w = weights_.begin() + begin;
+      std::size_t n = end - begin;
+      weighted_energy_[index] = 0;
+      weighted_energy_variance_[index] = 0;
+      emin_[index] = 0;
+      emax_[index] = 0;
+      if (n == 0) {
+        return true;
+      }
+
+      // The weighted mean and variance
+      double weighted_sum = 0;
+      double weighted_sum_sq = 0;
+      double summed_weights = 0;
+      for (std::size_t i = 0; i < n; ++i) {
+        weighted_sum += e[i] * w[i];
+        weighted_sum_sq += e[i] * e[i] * w[i];
+        summed_weights += w[i];
+      }
+      if (!(weighted_sum > 0 && summed_weights > 0)) {
+        return false;
+      }
+      double mean = weighted_sum / summed_weights;
+      weighted_energy_[index] = mean;
+      weighted_energy_variance_[index] = weighted_sum_sq / summed_weights - mean * mean;
+
+      // The 1% and 99% points of the cumulative weights
+      double total = summed_weights;
+      double cdf = 0;
+      for (std::size_t i = 0; i < n; ++i) {
+        cdf += w[i];
+        if (cdf < 0.01 * total) emin_[index] = e[i];
+        if (cdf > 0.99 * total) {
+          emax_[index] = e[i];
+          break;
+        }
+      }
+      return true;
+    }
+
+    vecd energies_;
+    vecd weights_;
+    std::vector<std::size_t> offsets_;
+    bool shared_axis_;
+    std::vector<double> weighted_energy_;
+    std::vector<double> weighted_energy_variance_;
+    std::vector<double> emin_;
+    std::vector<double> emax_;
+  };
+
+}}  // namespace dxtbx::model
+
+#endif  // DXTBX_MODEL_SPECTRUM_TABLE_H
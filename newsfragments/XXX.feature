@@ -0,0 +1 @@
+Add ``SummedImageSequence``, a view of an ``ImageSequence`` summing blocks of consecutive images
@@ -0,0 +1,129 @@
+from __future__ import absolute_import, division, print_function
+
+import concurrent.futures
+import io
+import json
+import os
+import threading
+
+import numpy as np
+import pytest
+
+from dxtbx.format.FormatEigerStream import (
+    EigerStreamReceiver,
+    FormatEigerStream,
+    write_stream_message,
+)
+
+
+def write_stream(filename, frames):
+    configuration = {
+        "bit_depth_readout": 16,
+        "sensor_material": "Si",
+        "sensor_thickness": 0.45,
+        "detector_distance": 100.0,
+        "x_pixel_size": 0.075,
+        "y_pixel_size": 0.075,
+        "detector_orientation": [1, 0, 0, 0, -1, 0],
+        "detector_translation": [-0.15, 0.1, 0],
+        "wavelength": 1.0,
+        "nimages": len(frames),
+        "ntrigger": 1,
+    }
+    with filename.open("wb") as f:
+        write_stream_message(
+            f, [json.dumps({"htype": "dheader-1.0"}), json.dumps(configuration)]
+        )
+        for index, frame in enumerate(frames):
+            info = {
+                "htype": "dimage_d-1.0",
+                "shape": [frame.shape[1], frame.shape[0]],
+                "type": "uint16",
+                "encoding": "<",
+                "size": frame.nbytes,
+            }
+            write_stream_message(
+                f,
+                [
+                    json.dumps({"htype": "dimage-1.0", "frame": index}),
+                    json.dumps(info),
+                    frame.astype("<u2").tobytes(),
+                    json.dumps({"htype": "dconfig-1.0"}),
+                ],
+            )
+        write_stream_message(f, [json.dumps({"htype": "dseries_end-1.0"})])
+
+
+def test_stream_receiver(tmp_path):
+    frames = [np.arange(12, dtype=np.uint16).reshape(3, 4) + i for i in range(3)]
+    frames[1][0, 0] = 2 ** 16 - 1
+    filename = tmp_path / "stream.bin"
+    write_stream(filename, frames)
+
+    with EigerStreamReceiver(str(filename), capacity=4, nproc=2) as receiver:
+        assert receiver.num_images() == 3
+        imageset = FormatEigerStream.get_stream_imageset(receiver)
+        assert len(imageset) == 3
+        assert imageset.get_detector()[0].get_image_size() == (4, 3)
+        assert imageset.get_beam(2).get_wavelength() == 1.0
+        for i, frame in enumerate(frames):
+            data = imageset.get_raw_data(i)[0]
+            assert data.all() == (3, 4)
+            expected = frame.astype(np.int32)
+            expected[expected == 2 ** 16 - 1] = -1
+            assert list(data) == list(expected.ravel())
+        assert receiver.finished()
+        assert receiver.num_received() == 3
+
+    # Frames which have left the ring buffer can no longer be read
+    with EigerStreamReceiver(str(filename), capacity=2) as receiver:
+        assert receiver.read(2).all() == (3, 4)
+        with pytest.raises(IndexError):
+            receiver.read(0)
+        with pytest.raises(IndexError):
+            receiver.read(3)
+
+        # A frame dropped after it is looked up gives the same error
+        future = concurrent.futures.Future()
+        future.cancel()
+        receiver._slots[2 % 2] = (2, future)
+        with pytest.raises(IndexError):
+            receiver.read(2)
+
+
+@pytest.mark.skipif(not hasattr(os, "mkfifo"), reason="Requires named pipes")
+def test_stream_receiver_close(tmp_path):
+    frames = [np.arange(12, dtype=np.uint16).reshape(3, 4)]
+    filename = tmp_path / "stream.bin"
+    write_stream(filename, frames)
+    messages = filename.read_bytes()
+    fifo = str(tmp_path / "stream.fifo")
+    os.mkfifo(fifo)
+
+    # The writer sends all but the end of series message then stalls
+    end = io.BytesIO()
+    write_stream_message(end, [json.dumps({"htype": "dseries_end-1.0"})])
+    stalled = threading.Event()
+
+    def write():
+        with open(fifo, "wb") as f:
+            f.write(messages[: -len(end.getvalue())])
+            f.flush()
+            stalled.wait(10)
+
+    writer = threading.Thread(target=write)
+    writer.start()
+    try:
+        receiver = EigerStreamReceiver(fifo)
+        assert receiver.read(0, timeout=10).all() == (3, 4)
+        assert not receiver.finished()
+
+        # Closing interrupts the blocked read of the pipe
+        closer = threading.Thread(target=receiver.close)
+        closer.start()
+        closer.join(5)
+        assert not closer.is_alive()
+        assert receiver.finished()
+    finally:
+        stalled.set()
+        writer.join()
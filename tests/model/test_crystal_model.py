@@ -16,6 +16,7 @@ from scitbx.math import euler_angles, euler_angles_as_matrix
 from dxtbx.model import (
     Crystal,
     CrystalFactory,
+    CrystalSimilarityIndex,
     MosaicCrystalKabsch2010,
     MosaicCrystalSauter2014,
 )
@@ -439,6 +440,57 @@ def test_similarity():
     # unit_cell.is_similar_to is tested elsewhere
 
 
+def test_similarity_index():
+    random.seed(0)
+    crystals = []
+    for i in range(20):
+        R = matrix.sqr(random_rotation())
+        symbol = "P 1" if i % 4 else "P 2"
+        for j in range(3):
+            dr = matrix.col((0, 0, 1)).axis_and_angle_as_r3_rotation_matrix(
+                0.004 * j, deg=True
+            )
+            crystal = Crystal(
+                real_space_a=(10 + 0.05 * j, 0, 0),
+                real_space_b=(0, 11, 0),
+                real_space_c=(0, 0, 12),
+                space_group_symbol=symbol,
+            )
+            crystal.set_U(dr * R)
+            crystals.append(crystal)
+    # A copy in the other space group and a copy with a different cell
+    crystal = Crystal(crystals[4])
+    crystal.set_space_group(sgtbx.space_group_info("P 2").group())
+    crystals.append(crystal)
+    crystal = Crystal(crystals[4])
+    crystal.set_unit_cell(uctbx.unit_cell((10, 11, 14, 90, 90, 90)))
+    crystals.append(crystal)
+    random.shuffle(crystals)
+
+    index = CrystalSimilarityIndex(crystals)
+    assert len(index) == len(crystals)
+    for i, c1 in enumerate(crystals):
+        expected = [j for j, c2 in enumerate(crystals) if c2.is_similar_to(c1)]
+        assert list(index.find_similar(c1)) == expected
+        assert i in expected
+
+    # Compare the clusters with the connected components of the pairwise test
+    clusters = index.clusters()
+    for i, c1 in enumerate(crystals):
+        for j, c2 in enumerate(crystals):
+            if c1.is_similar_to(c2):
+                assert clusters[i] == clusters[j]
+    assert flex.max(clusters) + 1 == 22
+    assert clusters[0] == 0
+
+    # The nearest crystal of each crystal is itself
+    nearest = index.find_nearest(crystals)
+    assert list(nearest) == list(range(len(crystals)))
+    other = Crystal((10, 0, 0), (0, 11, 0), (0, 0, 12), space_group_symbol="P 4")
+    assert list(index.find_nearest([other])) == [-1]
+    assert len(index.find_similar(other)) == 0
+
+
 @pytest.mark.xfail(reason="https://github.com/cctbx/dxtbx/issues/5")
 def test_change_basis_mosaic_crystal():
     mosaic_model = MosaicCrystalSauter2014(
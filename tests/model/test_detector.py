@@ -1,5 +1,6 @@
 from __future__ import absolute_import, division, print_function
 
+import math
 import random
 from builtins import range
 
@@ -257,6 +258,78 @@ def test_panel_mask():
     assert m2[40, 40] is False
 
 
+def test_binned(detector):
+    detector[0].add_mask(10, 10, 30, 30)
+    detector[0].set_pedestal(1)
+    binned = detector.binned(4)
+    assert len(binned) == len(detector)
+    panel = binned[0]
+    assert panel.get_pixel_size() == pytest.approx((0.688, 0.688))
+    assert panel.get_image_size() == (128, 128)
+    assert panel.get_image_size_mm() == pytest.approx(detector[0].get_image_size_mm())
+    assert panel.get_trusted_range() == (0, 16000)
+    assert panel.get_pedestal() == 16
+    assert [tuple(m) for m in panel.get_mask()] == [(3, 3, 7, 7)]
+    assert panel.get_origin() == pytest.approx(detector[0].get_origin())
+    assert panel.get_pixel_lab_coord((10, 20)) == pytest.approx(
+        detector[0].get_pixel_lab_coord((40, 80))
+    )
+
+    # The original detector is unchanged
+    assert detector[0].get_image_size() == (512, 512)
+
+    # Multi-panel detectors keep the hierarchy
+    detector = create_multipanel_detector(offset=0)
+    binned = detector.binned(2)
+    assert len(binned) == len(detector)
+    assert binned.hierarchy().get_origin() == pytest.approx(
+        detector.hierarchy().get_origin()
+    )
+    for p1, p2 in zip(detector, binned):
+        assert p2.get_image_size() == (
+            p1.get_image_size()[0] // 2,
+            p1.get_image_size()[1] // 2,
+        )
+
+
+def test_correction_arrays(detector):
+    panel = detector[0]
+
+    def lab_coord(i, j):
+        return matrix.col(panel.get_pixel_lab_coord((i + 0.5, j + 0.5)))
+
+    area = 0.172 * 0.172
+    solid_angle = panel.get_solid_angle_array()
+    assert solid_angle.all() == (512, 512)
+    for j, i in ((0, 0), (100, 300), (511, 511)):
+        p = lab_coord(i, j)
+        assert solid_angle[j, i] == pytest.approx(area * 200 / p.length() ** 3)
+
+    s0 = matrix.col((0, 0, 1))
+    pn = matrix.col((0, 1, 0))
+    polarization = panel.get_polarization_array(s0, pn, 0.5)
+    for j, i in ((0, 0), (100, 300), (511, 511)):
+        cos_two_theta = s0.dot(lab_coord(i, j).normalize())
+        assert polarization[j, i] == pytest.approx(0.5 * (1 + cos_two_theta ** 2))
+    polarization = panel.get_polarization_array(s0, pn, 0.999)
+    for j, i in ((0, 0), (100, 300), (511, 511)):
+        p = lab_coord(i, j).normalize()
+        expected = (1 - 2 * 0.999) * (1 - pn.dot(p) ** 2) + 0.999 * (
+            1 + s0.dot(p) ** 2
+        )
+        assert polarization[j, i] == pytest.approx(expected)
+
+    # Without an attenuation coefficient the obliquity factor is unity
+    assert panel.get_obliquity_array().all_eq(1)
+    panel.set_mu(3.0)
+    obliquity = panel.get_obliquity_array()
+    for j, i in ((0, 0), (100, 300), (511, 511)):
+        cos_angle = 200 / lab_coord(i, j).length()
+        expected = (1 - math.exp(-0.3 / cos_angle)) / (1 - math.exp(-0.3))
+        assert obliquity[j, i] == pytest.approx(expected)
+        assert obliquity[j, i] >= 1
+
+
 def test_equality():
     detector = create_detector(offset=0)
 
@@ -1,4 +1,5 @@
 import errno
+import json
 import os
 
 import pytest
@@ -21,7 +22,11 @@ from dxtbx.model import (
     Scan,
     ScanFactory,
 )
-from dxtbx.model.experiment_list import ExperimentListDict, ExperimentListFactory
+from dxtbx.model.experiment_list import (
+    ExperimentListDict,
+    ExperimentListFactory,
+    ExperimentListJournal,
+)
 
 
 def test_experiment_list_extend():
@@ -590,6 +595,69 @@ def test_experimentlist_dumper_dump_empty_sequence(tmpdir):
     check(experiments, experiments2)
 
 
+def test_experimentlist_journal(tmpdir):
+    tmpdir.chdir()
+
+    filenames = ["filename_%01d.cbf" % (i + 1) for i in range(0, 4)]
+    imageset = Format.get_imageset(
+        filenames,
+        beam=Beam((1, 0, 0)),
+        detector=Detector(),
+        goniometer=Goniometer(),
+        scan=Scan((1, 4), (0.0, 1.0)),
+        as_sequence=True,
+    )
+    experiments = ExperimentList()
+    for i in range(4):
+        experiments.append(
+            Experiment(
+                imageset=imageset,
+                beam=imageset.get_beam(),
+                detector=imageset.get_detector(),
+                goniometer=imageset.get_goniometer(),
+                scan=imageset.get_scan(),
+                crystal=Crystal(
+                    (1, 0, 0), (0, 1, 0), (0, 0, 1 + i), space_group_symbol="P1"
+                ),
+                identifier=str(i),
+            )
+        )
+
+    filename = "journal.jsonl"
+    journal = ExperimentListJournal(filename)
+    assert journal.checkpoint(experiments[:2]) == 2
+    assert journal.checkpoint(experiments[:2]) == 0
+    size = os.path.getsize(filename)
+    assert journal.checkpoint(experiments) == 2
+    assert len(journal) == 4
+
+    # Only the new crystals and experiments should have been appended
+    with open(filename) as infile:
+        infile.seek(size)
+        ids = [json.loads(line)["__id__"] for line in infile]
+    assert ids == ["crystal", "Experiment", "crystal", "Experiment", "checkpoint"]
+
+    experiments2 = ExperimentListJournal.load(filename, check_format=False)
+    check(experiments, experiments2)
+    assert len(experiments2.imagesets()) == 1
+    assert len(experiments2.crystals()) == 4
+
+    # An interrupted checkpoint is ignored and then discarded when reopened
+    size = os.path.getsize(filename)
+    with open(filename, "a") as outfile:
+        outfile.write('{"__id__":"Experiment","identifier":"4","beam":0')
+    check(experiments, ExperimentListJournal.load(filename, check_format=False))
+    journal = ExperimentListJournal(filename, check_format=False)
+    assert len(journal) == 4
+    assert os.path.getsize(filename) == size
+    journal.experiments.append(Experiment(beam=journal.experiments[0].beam))
+    assert journal.checkpoint() == 1
+    experiments3 = ExperimentListJournal.load(filename, check_format=False)
+    assert len(experiments3) == 5
+    assert len(experiments3.beams()) == 1
+    check(experiments, experiments3[:4])
+
+
 def test_experimentlist_dumper_dump_with_lookup(dials_regression, tmpdir):
     tmpdir.chdir()
 
@@ -936,3 +1004,58 @@ def test_experimentlist_change_basis(dials_data):
 
     with pytest.raises(AssertionError):
         experiments.change_basis([cb_op, cb_op])
+
+
+def test_experimentlist_reindex_crystals():
+    crystal = Crystal((10, 0, 0), (0, 11, 0), (0, 0, 12), space_group_symbol="P 1")
+    cov_B = flex.double(flex.grid(9, 9), 0)
+    for i, variance in zip((0, 4, 8), (1e-8, 2e-8, 3e-8)):
+        cov_B[i, i] = variance
+    crystal.set_B_covariance(cov_B)
+    crystal.set_A_at_scan_points([crystal.get_A()] * 3)
+    cov_B.reshape(flex.grid(1, 9, 9))
+    cov_B_array = flex.double(flex.grid(3, 9, 9))
+    for i in range(3):
+        cov_B_array[i : (i + 1), :, :] = cov_B
+    crystal.set_B_covariance_at_scan_points(cov_B_array)
+    cell = crystal.get_unit_cell().parameters()
+    cell_sd = crystal.get_cell_parameter_sd()
+
+    beam = Beam()
+    other = Crystal(crystal)
+    experiments = ExperimentList(
+        [
+            Experiment(beam=beam, crystal=crystal),
+            Experiment(beam=beam, crystal=crystal),
+            Experiment(beam=beam, crystal=other),
+        ]
+    )
+    cb_op = sgtbx.change_of_basis_op("b,c,a")
+    reindexed = experiments.change_basis(cb_op)
+
+    # Only the crystals are copied and shared crystals remain shared
+    assert list(experiments.indices(crystal)) == [0, 1]
+    assert list(reindexed.indices(beam)) == [0, 1, 2]
+    assert list(reindexed.indices(reindexed[0].crystal)) == [0, 1]
+    assert list(reindexed.indices(reindexed[2].crystal)) == [2]
+    assert reindexed[0].crystal not in experiments
+
+    # The cell and its errors are permuted, including at scan points
+    xl = reindexed[0].crystal
+    new_cell = xl.get_unit_cell().parameters()
+    new_cell_sd = xl.get_cell_parameter_sd()
+    for k in range(3):
+        m = min(range(3), key=lambda m: abs(cell[m] - new_cell[k]))
+        assert new_cell[k] == pytest.approx(cell[m])
+        assert new_cell_sd[k] == pytest.approx(cell_sd[m])
+    assert xl.get_num_scan_points() == 3
+    for i in range(3):
+        assert xl.get_cell_parameter_sd_at_scan_point(i) == pytest.approx(new_cell_sd)
+
+    # Different operators applied to a shared crystal give different crystals
+    reindexed = experiments.change_basis(
+        [cb_op, sgtbx.change_of_basis_op(), cb_op], in_place=True
+    )
+    assert reindexed is experiments
+    assert list(experiments.indices(experiments[0].crystal)) == [0]
+    assert experiments[1].crystal.get_unit_cell().parameters() == pytest.approx(cell)
@@ -0,0 +1,153 @@
+from __future__ import absolute_import, division, print_function
+
+import math
+
+import pytest
+
+from cctbx import factor_ev_angstrom
+from scitbx import matrix
+from scitbx.array_family import flex
+
+from dxtbx.model import (
+    BeamFactory,
+    Crystal,
+    DetectorFactory,
+    Experiment,
+    GoniometerFactory,
+    RotationPredictor,
+    ScanFactory,
+    Spectrum,
+    StillsPredictor,
+)
+
+
+@pytest.fixture
+def experiment():
+    return Experiment(
+        beam=BeamFactory.simple(1.0),
+        detector=DetectorFactory.simple(
+            "PAD", 100, (50, 50), "+x", "-y", (0.1, 0.1), (1000, 1000)
+        ),
+        goniometer=GoniometerFactory.known_axis((1, 0, 0)),
+        scan=ScanFactory.make_scan((1, 20), 0.1, (0, 0.5), list(range(20))),
+        crystal=Crystal(
+            (40, 0, 0), (0, 50, 0), (0, 0, 60), space_group_symbol="P 21 21 21"
+        ),
+    )
+
+
+def test_rotation_predictor(experiment):
+    predictor = RotationPredictor(experiment)
+    assert predictor.num_images() == 20
+    predictions = predictor.predict(d_min=2.0)
+    assert len(predictions["miller_index"]) > 100
+    assert len(set(predictions["miller_index"])) == len(predictions["miller_index"])
+
+    s0 = matrix.col(experiment.beam.get_s0())
+    axis = matrix.col(experiment.goniometer.get_rotation_axis())
+    A = matrix.sqr(experiment.crystal.get_A())
+    for hkl, panel, s1, xyzpx, xyzmm in zip(
+        predictions["miller_index"],
+        predictions["panel"],
+        predictions["s1"],
+        predictions["xyzcal.px"],
+        predictions["xyzcal.mm"],
+    ):
+        h, k, l = hkl
+        assert not (k == 0 and l == 0 and h % 2)
+        assert not (h == 0 and l == 0 and k % 2)
+        assert not (h == 0 and k == 0 and l % 2)
+        assert 0 <= xyzpx[2] <= 20
+        assert xyzmm[2] == pytest.approx(math.radians(0.5 * xyzpx[2]))
+
+        # The diffraction condition holds at the predicted angle
+        R = axis.axis_and_angle_as_r3_rotation_matrix(xyzmm[2])
+        r = R * A * matrix.col(hkl)
+        assert r.length() <= 0.5
+        assert s1 == pytest.approx((s0 + r).elems, abs=1e-5)
+        assert matrix.col(s1).length() == pytest.approx(s0.length())
+        assert panel == 0
+        assert experiment.detector[0].get_ray_intersection_px(s1) == pytest.approx(
+            xyzpx[:2]
+        )
+
+    # The results do not depend on the number of threads
+    threaded = predictor.predict(d_min=2.0, num_threads=4)
+    for key in predictions:
+        assert list(threaded[key]) == list(predictions[key])
+
+    # A scan-varying crystal which does not vary gives the same predictions
+    experiment.crystal.set_A_at_scan_points([experiment.crystal.get_A()] * 21)
+    scan_varying = RotationPredictor(experiment).predict(d_min=2.0)
+    assert list(scan_varying["miller_index"]) == list(predictions["miller_index"])
+    for xyz1, xyz2 in zip(scan_varying["xyzcal.px"], predictions["xyzcal.px"]):
+        assert xyz1 == pytest.approx(xyz2)
+
+
+def test_stills_predictor(experiment):
+    detector = experiment.detector
+    energies = flex.double(range(12000, 12601, 5))
+    crystals = []
+    beams = []
+    spectra = []
+    for i in range(3):
+        crystal = Crystal(experiment.crystal)
+        crystal.rotate_around_origin((1, 1, 0), 10 * i, deg=True)
+        crystals.append(crystal)
+        beams.append(BeamFactory.simple(1.0))
+        weights = flex.exp(-0.5 * flex.pow2((energies - 12200 - 100 * i) / 50))
+        spectra.append(Spectrum(energies, weights))
+
+    predictor = StillsPredictor(detector)
+    predictions = predictor.predict(crystals, beams, spectra, d_min=4.0)
+    assert set(predictions["id"]) == {0, 1, 2}
+
+    for i in range(3):
+        emin = spectra[i].get_emin_eV()
+        emax = spectra[i].get_emax_eV()
+        A = matrix.sqr(crystals[i].get_A())
+        u = matrix.col(beams[i].get_unit_s0())
+
+        # Find the expected reflections by checking every Miller index
+        expected = set()
+        for h in range(-10, 11):
+            for k in range(-13, 14):
+                for l in range(-15, 16):
+                    r = A * matrix.col((h, k, l))
+                    if r.length() == 0 or r.length() > 0.25 or r.dot(u) >= 0:
+                        continue
+                    wavelength = -2 * r.dot(u) / r.length_sq()
+                    if not emin <= factor_ev_angstrom / wavelength <= emax:
+                        continue
+                    if (k, l) == (0, 0) and h % 2:
+                        continue
+                    if (h, l) == (0, 0) and k % 2:
+                        continue
+                    if (h, k) == (0, 0) and l % 2:
+                        continue
+                    s1 = u / wavelength + r
+                    try:
+                        panel, _ = detector.get_ray_intersection(s1)
+                    except RuntimeError:
+                        continue
+                    expected.add((h, k, l))
+
+        selection = predictions["id"] == i
+        assert set(predictions["miller_index"].select(selection)) == expected
+        for hkl, s1, wavelength, weight, xyzpx in zip(
+            predictions["miller_index"].select(selection),
+            predictions["s1"].select(selection),
+            predictions["wavelength"].select(selection),
+            predictions["spectral_weight"].select(selection),
+            predictions["xyzcal.px"].select(selection),
+        ):
+            r = A * matrix.col(hkl)
+            assert s1 == pytest.approx((u / wavelength + r).elems)
+            assert matrix.col(s1).length() == pytest.approx(1 / wavelength)
+            assert 0 < weight <= 1
+            assert detector[0].get_ray_intersection_px(s1) == pytest.approx(xyzpx[:2])
+
+    # The results do not depend on the number of threads
+    threaded = predictor.predict(crystals, beams, spectra, d_min=4.0, num_threads=3)
+    for key in predictions:
+        assert list(threaded[key]) == list(predictions[key])
@@ -3,12 +3,14 @@ from __future__ import absolute_import, division, print_function
 import math
 import random
 
+import h5py
+import numpy
 import pytest
 
 from cctbx import factor_ev_angstrom
 from scitbx.array_family import flex
 
-from dxtbx.model import Spectrum
+from dxtbx.model import Spectrum, SpectrumTable
 
 
 def test_spectrum():
@@ -57,6 +59,74 @@ def test_spectrum_weighted_mean_variance():
     assert variance == pytest.approx(w * w, abs=1e-3)
 
 
+def test_spectrum_table(tmp_path):
+    peaks = (11880.0, 11860.0, 11900.0, 11870.0)
+    energies, _ = __generate_simple(peaks[0], 1, 5.0)
+    shot_weights = [__generate_simple(p, 1000.0, 5.0)[1] for p in peaks]
+    weights = flex.double()
+    for w in shot_weights:
+        weights.extend(w)
+    weights.reshape(flex.grid(len(peaks), len(energies)))
+
+    table = SpectrumTable(energies, weights, num_threads=2)
+    assert len(table) == len(peaks)
+    assert table.has_shared_axis()
+    for i, p in enumerate(peaks):
+        spectrum = Spectrum(energies, shot_weights[i])
+        view = table.spectrum(i)
+        assert len(view) == len(energies)
+        assert [view.weight(j) for j in range(len(view))] == list(shot_weights[i])
+        assert [view.energy(j) for j in range(len(view))] == list(energies)
+        assert list(view.to_spectrum().get_weights()) == list(spectrum.get_weights())
+        assert table.weighted_energies()[i] == pytest.approx(p, abs=1e-3)
+        assert view.get_weighted_energy_eV() == spectrum.get_weighted_energy_eV()
+        assert view.get_emax_eV() == spectrum.get_emax_eV()
+        assert (
+            table.weighted_energy_variances()[i]
+            == spectrum.get_weighted_energy_variance()
+        )
+        assert table.weighted_wavelengths()[i] == spectrum.get_weighted_wavelength()
+        assert table.emin()[i] == spectrum.get_emin_eV()
+        assert table.emax()[i] == spectrum.get_emax_eV()
+
+    # Sort and bin the shots by energy
+    assert list(table.sort_indices()) == [1, 3, 0, 2]
+    ordered = table.select(table.sort_indices())
+    assert list(ordered.weighted_energies()) == sorted(table.weighted_energies())
+    edges = flex.double([11850, 11875, 11890])
+    assert list(table.bin_indices(edges)) == [1, 0, -1, 0]
+
+    # Appending a spectrum with different energies drops the shared axis
+    table.append(Spectrum(flex.double([11800, 11801]), flex.double([1, 3])))
+    assert not table.has_shared_axis()
+    assert len(table) == len(peaks) + 1
+    assert table.weighted_energies()[-1] == pytest.approx(11800.75)
+    assert list(table.offsets()) == [i * len(energies) for i in range(5)] + [
+        4 * len(energies) + 2
+    ]
+    assert list(table.to_spectrum(4).get_energies_eV()) == [11800, 11801]
+    assert [view.energy(0) for view in (table.spectrum(0), table.spectrum(4))] == [
+        energies[0],
+        11800,
+    ]
+
+    # Load the table from HDF5
+    filename = str(tmp_path / "spectra.h5")
+    with h5py.File(filename, "w") as handle:
+        handle["energies"] = energies.as_numpy_array()
+        handle["weights"] = weights.as_numpy_array()
+        handle["shot_energies"] = numpy.tile(energies.as_numpy_array(), (len(peaks), 1))
+    with h5py.File(filename, "r") as handle:
+        loaded = SpectrumTable.from_hdf5(handle["energies"], handle["weights"])
+        assert loaded.has_shared_axis()
+        assert list(loaded.weighted_energies()) == list(
+            table.weighted_energies()[: len(peaks)]
+        )
+        loaded = SpectrumTable.from_hdf5(handle["shot_energies"], handle["weights"])
+        assert not loaded.has_shared_axis()
+        assert list(loaded.emax()) == list(table.emax()[: len(peaks)])
+
+
 def __generate_spectrum():
     energies = flex.double()
     counts = flex.double()
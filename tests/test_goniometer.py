@@ -201,6 +201,71 @@ def test_multi_axis_goniometer():
     assert single_axis.get_rotation_axis() == (1, 0, 0)
 
 
+def test_batch_goniometer_settings():
+    omega = flex.double([0, 10, -35.5, 120])
+    kappa = flex.double([0, 30, -60, 170])
+    phi = flex.double([0, 20, 45, -90])
+
+    for scan_axis in ("omega", "phi"):
+        goniometer = KappaGoniometer(50.0, 0.0, 0.0, 0.0, "-y", scan_axis)
+        settings = goniometer.compute_settings(omega, kappa, phi, num_threads=2)
+        for i in range(len(omega)):
+            g = KappaGoniometer(50.0, omega[i], kappa[i], phi[i], "-y", scan_axis)
+            _compare_tuples(settings["rotation_axis"][i], g.get_rotation_axis())
+            _compare_tuples(settings["fixed_rotation"][i], g.get_fixed_rotation())
+            _compare_tuples(settings["setting_rotation"][i], g.get_setting_rotation())
+
+    axes = flex.vec3_double(((1, 0, 0), (0.643, 0, -0.766), (1, 0, 0)))
+    names = flex.std_string(("phi", "kappa", "omega"))
+    goniometer = GoniometerFactory.multi_axis(axes, flex.double(3, 0), names, 1)
+    angles = flex.double()
+    for o, k, p in zip(omega, kappa, phi):
+        angles.extend(flex.double((p, k, o)))
+    angles.reshape(flex.grid(len(omega), 3))
+    settings = goniometer.compute_settings(angles, num_threads=2)
+    for i in range(len(omega)):
+        goniometer.set_angles(flex.double((phi[i], kappa[i], omega[i])))
+        _compare_tuples(settings["rotation_axis"][i], goniometer.get_rotation_axis())
+        _compare_tuples(settings["fixed_rotation"][i], goniometer.get_fixed_rotation())
+        _compare_tuples(
+            settings["setting_rotation"][i], goniometer.get_setting_rotation()
+        )
+
+    # Kappa settings and the equivalent Eulerian settings give the same rotation
+    goniometer = KappaGoniometer(50.0, 0.0, 0.0, 0.0, "-y", "omega")
+    omega_axis = matrix.col(goniometer.get_omega_axis())
+    kappa_axis = matrix.col(goniometer.get_kappa_axis())
+    phi_axis = matrix.col(goniometer.get_phi_axis())
+    chi_axis = matrix.col(goniometer.get_chi_axis())
+    euler_omega, chi, euler_phi = goniometer.euler_angles(omega, kappa, phi)
+    for i in range(len(omega)):
+        R_kappa = (
+            omega_axis.axis_and_angle_as_r3_rotation_matrix(omega[i], deg=True)
+            * kappa_axis.axis_and_angle_as_r3_rotation_matrix(kappa[i], deg=True)
+            * phi_axis.axis_and_angle_as_r3_rotation_matrix(phi[i], deg=True)
+        )
+        R_euler = (
+            omega_axis.axis_and_angle_as_r3_rotation_matrix(euler_omega[i], deg=True)
+            * chi_axis.axis_and_angle_as_r3_rotation_matrix(chi[i], deg=True)
+            * phi_axis.axis_and_angle_as_r3_rotation_matrix(euler_phi[i], deg=True)
+        )
+        _compare_tuples(R_kappa.elems, R_euler.elems)
+
+    new_omega, new_kappa, new_phi, valid = goniometer.kappa_angles(
+        euler_omega, chi, euler_phi, num_threads=2
+    )
+    assert valid.all_eq(True)
+    _compare_tuples(new_omega, omega)
+    _compare_tuples(new_kappa, kappa)
+    _compare_tuples(new_phi, phi)
+
+    # A kappa arm at 50 degrees cannot reach chi = 120 degrees
+    valid = goniometer.kappa_angles(
+        flex.double([0]), flex.double([120]), flex.double([0])
+    )[3]
+    assert list(valid) == [False]
+
+
 def test_single_axis_goniometer_from_phil():
     params = goniometer_phil_scope.fetch(
         parse(
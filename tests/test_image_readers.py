@@ -1,10 +1,15 @@
 from __future__ import absolute_import, division, print_function
 
 import os
+from unittest import mock
 
 import pycbf
 
-from dxtbx.format.image import cbf_read_buffer
+from scitbx.array_family import flex
+
+from dxtbx.format.FormatCBFMultiTile import cbf_wrapper
+from dxtbx.format.FormatCBFMultiTileHierarchy import FormatCBFMultiTileHierarchy
+from dxtbx.format.image import cbf_read_arrays, cbf_read_buffer
 from dxtbx.model.detector import DetectorFactory
 
 
@@ -19,3 +24,128 @@ def test_cbf_buffer(dials_regression):
     cbf_read_buffer(handle, contents, pycbf.MSG_DIGEST)
     det = DetectorFactory.imgCIF_H(handle, "unknown")
     assert det
+
+
+def test_cbf_read_arrays():
+    ints = flex.int(range(12))
+    ints.reshape(flex.grid(3, 4))
+    reals = flex.double([0.5 * i for i in range(6)])
+    reals.reshape(flex.grid(2, 3))
+
+    cbf = cbf_wrapper()
+    cbf.new_datablock(b"test")
+    cbf.add_category(
+        "array_structure", ["id", "encoding_type", "compression_type", "byte_order"]
+    )
+    cbf.add_row(["A1", "signed 32-bit integer", "packed", "little_endian"])
+    cbf.add_row(["A2", "signed 64-bit real IEEE", "packed", "little_endian"])
+    cbf.add_category("array_data", ["array_id", "binary_id", "data"])
+    cbf.add_row(["A1", "1"])
+    cbf.set_integerarray_wdims_fs(
+        pycbf.CBF_PACKED,
+        1,
+        ints.copy_to_byte_str(),
+        4,
+        1,
+        12,
+        "little_endian",
+        4,
+        3,
+        1,
+        0,
+    )
+    cbf.add_row(["A2", "2"])
+    cbf.set_realarray_wdims_fs(
+        pycbf.CBF_PACKED,
+        2,
+        reals.copy_to_byte_str(),
+        8,
+        6,
+        b"little_endian",
+        3,
+        2,
+        1,
+        0,
+    )
+
+    arrays = cbf_read_arrays(cbf)
+    assert len(arrays) == 2
+    assert isinstance(arrays[0], flex.int)
+    assert isinstance(arrays[1], flex.double)
+    assert arrays[0].all() == (3, 4)
+    assert arrays[1].all() == (2, 3)
+    assert list(arrays[0]) == list(ints)
+    assert list(arrays[1]) == list(reals)
+
+    # Split the integer array into a 1x4 and a 2x2 section
+    cbf.add_category(
+        "array_structure_list_section", ["id", "array_id", "index", "start", "end"]
+    )
+    for row in [
+        ("S1", "A1", "1", "1", "4"),
+        ("S1", "A1", "2", "1", "1"),
+        ("S1", "A1", "3", "1", "1"),
+        ("S2", "A1", "1", "3", "4"),
+        ("S2", "A1", "2", "2", "3"),
+        ("S2", "A1", "3", "1", "1"),
+    ]:
+        cbf.add_row(row)
+
+    sections = cbf_read_arrays(cbf)
+    assert len(sections) == 2
+    assert sections[0].all() == (1, 4)
+    assert sections[1].all() == (2, 2)
+    assert list(sections[0]) == [0, 1, 2, 3]
+    assert list(sections[1]) == [6, 7, 10, 11]
+
+
+def test_hierarchy_raw_data_for_panels():
+    ints = flex.int(range(12))
+    ints.reshape(flex.grid(3, 4))
+
+    # One integer array split into a 1x4 and a 2x2 panel
+    cbf = cbf_wrapper()
+    cbf.new_datablock(b"test")
+    cbf.add_category(
+        "array_structure", ["id", "encoding_type", "compression_type", "byte_order"]
+    )
+    cbf.add_row(["A1", "signed 32-bit integer", "packed", "little_endian"])
+    cbf.add_category("array_data", ["array_id", "binary_id", "data"])
+    cbf.add_row(["A1", "1"])
+    cbf.set_integerarray_wdims_fs(
+        pycbf.CBF_PACKED,
+        1,
+        ints.copy_to_byte_str(),
+        4,
+        1,
+        12,
+        "little_endian",
+        4,
+        3,
+        1,
+        0,
+    )
+    cbf.add_category(
+        "array_structure_list_section", ["id", "array_id", "index", "start", "end"]
+    )
+    for row in [
+        ("S1", "A1", "1", "1", "4"),
+        ("S1", "A1", "2", "1", "1"),
+        ("S1", "A1", "3", "1", "1"),
+        ("S2", "A1", "1", "3", "4"),
+        ("S2", "A1", "2", "2", "3"),
+        ("S2", "A1", "3", "1", "1"),
+    ]:
+        cbf.add_row(row)
+
+    fmt = FormatCBFMultiTileHierarchy.__new__(FormatCBFMultiTileHierarchy)
+    fmt._raw_data = None
+    with mock.patch.object(fmt, "_get_cbf_handle", return_value=cbf):
+        with mock.patch.object(fmt, "get_detector", return_value=[None, None]):
+            panels = fmt.get_raw_data_for_panels([1, 0])
+    assert len(panels) == 2
+    assert all(isinstance(panel, flex.int) for panel in panels)
+    assert panels[0].all() == (2, 2)
+    assert panels[1].all() == (1, 4)
+    assert list(panels[0]) == [6, 7, 10, 11]
+    assert list(panels[1]) == [0, 1, 2, 3]
@@ -1,17 +1,36 @@
+import concurrent.futures
+import multiprocessing
 import os
+import struct
+import threading
 from unittest import mock
 
+import numpy as np
 import pytest
 import six.moves.cPickle as pickle
 
+from scitbx import matrix
 from scitbx.array_family import flex
 
+import dxtbx.ext
+import dxtbx.format.Format
 import dxtbx.format.FormatHDF5SaclaMPCCD
 import dxtbx.format.image
 import dxtbx.format.Registry
 import dxtbx.tests.imagelist
 from dxtbx.format.FormatCBFMiniPilatus import FormatCBFMiniPilatus as FormatClass
-from dxtbx.imageset import ExternalLookup, ImageSequence, ImageSetData, ImageSetFactory
+from dxtbx.imageset import (
+    ExternalLookup,
+    ImageAssembler,
+    ImageSequence,
+    ImageSet,
+    ImageSetData,
+    ImageSetFactory,
+    MemReader,
+    PyramidCache,
+    SummedImageSequence,
+)
+from dxtbx.masking import apply_bad_pixel_mask, find_bad_pixels
 from dxtbx.model import Beam, Detector, Panel
 from dxtbx.model.beam import BeamFactory
 from dxtbx.model.experiment_list import ExperimentListFactory
@@ -97,6 +116,177 @@ def test_image():
         assert tile.name() == "TileName%d" % i
 
 
+def test_image_views():
+    values = list(range(4 * 6))
+    frame = flex.int(values)
+    frame.reshape(flex.grid(4, 6))
+
+    # Two modules stacked along the slow axis and two side by side
+    stacked = dxtbx.format.image.ImageInt(frame, [(0, 6, 2, 6), (12, 6, 2, 6)])
+    strided = dxtbx.format.image.ImageInt(frame, [(0, 6, 4, 3), (3, 6, 4, 3)])
+
+    assert stacked.n_tiles() == 2
+    assert strided.n_tiles() == 2
+    for i in range(2):
+        assert stacked.tile(i).is_view()
+        assert stacked.tile(i).is_contiguous()
+        assert not strided.tile(i).is_contiguous()
+        assert stacked.tile(i).data().all() == (2, 6)
+        assert strided.tile(i).data().all() == (4, 3)
+        assert list(stacked.tile(i).data()) == values[i * 12 : (i + 1) * 12]
+    assert list(strided.tile(1).data()) == [
+        x for j in range(4) for x in values[j * 6 + 3 : j * 6 + 6]
+    ]
+
+    # Conversions read the views without materialising them first
+    as_double = dxtbx.format.image.ImageBuffer(strided).as_double()
+    assert list(as_double.tile(0).data()) == list(strided.tile(0).data())
+
+    with pytest.raises(RuntimeError):
+        dxtbx.format.image.ImageInt(frame, [(12, 6, 3, 6)])
+
+
+def test_image_view_reader_copy():
+    pytest.importorskip("h5py")
+    from dxtbx.format.FormatHDF5SaclaMPCCD import ImageReader
+
+    # Copies of a reader keep returning views of the frame
+    reader = ImageReader(None, ["a.h5"], 1)
+    assert isinstance(reader.copy(["b.h5"], 1), ImageReader)
+
+
+def test_frame_stack_reader(tmp_path):
+    # Five big endian 2x3 frames after a 7 byte header
+    frames = [[i * 100 + j for j in range(6)] for i in range(5)]
+    filename = tmp_path / "frames.bin"
+    with filename.open("wb") as f:
+        f.write(b"HEADER!")
+        for frame in frames:
+            f.write(struct.pack(">6H", *frame))
+    offsets = flex.size_t([7 + i * 12 for i in range(5)])
+
+    reader = dxtbx.format.image.FrameStackReader(
+        str(filename), offsets, "uint16", (2, 3), big_endian=True
+    )
+    assert len(reader) == 5
+    assert reader.frame_bytes() == 12
+    assert not reader.is_float()
+
+    frame = reader.read(3)
+    assert isinstance(frame, flex.int)
+    assert frame.all() == (2, 3)
+    assert list(frame) == frames[3]
+
+    stack = reader.read_range(1, 5, step=2)
+    assert stack.all() == (2, 2, 3)
+    assert list(stack) == frames[1] + frames[3]
+
+    stack = reader.read_frames(flex.size_t([4, 0]))
+    assert list(stack) == frames[4] + frames[0]
+    stack = reader.read_frames(flex.size_t([4, 0, 2]), num_threads=2)
+    assert list(stack) == frames[4] + frames[0] + frames[2]
+
+    with pytest.raises(RuntimeError):
+        reader.read(5)
+    with pytest.raises(RuntimeError):
+        dxtbx.format.image.FrameStackReader(
+            str(filename), flex.size_t([7 + 5 * 12]), "uint16", (2, 3)
+        )
+
+    filename = tmp_path / "floats.bin"
+    filename.write_bytes(struct.pack("<3f", 0.5, -1.25, 3.0))
+    reader = dxtbx.format.image.FrameStackReader(
+        str(filename), flex.size_t([0]), "float32", (1, 3)
+    )
+    frame = reader.read(0)
+    assert reader.is_float() and not reader.is_double()
+    assert isinstance(frame, flex.float)
+    assert list(frame) == [0.5, -1.25, 3.0]
+
+    filename = tmp_path / "doubles.bin"
+    filename.write_bytes(struct.pack("<3d", 0.5, -1.25, 3.0))
+    reader = dxtbx.format.image.FrameStackReader(
+        str(filename), flex.size_t([0]), "float64", (1, 3)
+    )
+    assert reader.is_double()
+    assert isinstance(reader.read(0), flex.double)
+    assert isinstance(reader.read_range(0, 1), flex.double)
+
+    # Unsigned 32 bit values above INT_MAX wrap when read as int
+    filename = tmp_path / "uint32.bin"
+    filename.write_bytes(struct.pack("<3I", 7, 0x80000000, 0xFFFFFFFF))
+    reader = dxtbx.format.image.FrameStackReader(
+        str(filename), flex.size_t([0]), "uint32", (1, 3)
+    )
+    assert list(reader.read(0)) == [7, -(2 ** 31), -1]
+
+
+def test_sparse_images():
+    frame = flex.int(flex.grid(4, 3), 0)
+    frame[1] = 5
+    frame[7] = 2000
+    frame[11] = -3
+
+    # Sparse tiles keep only the non-zero pixels
+    tile = dxtbx.format.image.SparseImageTileInt(frame)
+    assert list(tile.indices()) == [1, 7, 11]
+    assert list(tile.values()) == [5, 2000, -3]
+    assert list(tile.data()) == list(frame)
+    other = dxtbx.format.image.SparseImageTileInt(
+        flex.size_t([1, 7, 11]), flex.int([5, 2000, -3]), (4, 3), "module"
+    )
+    assert other.name() == "module"
+    assert list(other.data()) == list(frame)
+    with pytest.raises(RuntimeError):
+        dxtbx.format.image.SparseImageTileInt(
+            flex.size_t([7, 1]), flex.int([1, 1]), (4, 3)
+        )
+
+    image = dxtbx.format.image.SparseImageInt(tile)
+    assert image.num_pixels() == 3
+    assert list(image.dense().tile(0).data()) == list(frame)
+    image = pickle.loads(pickle.dumps(image))
+    assert list(image.tile(0).indices()) == [1, 7, 11]
+
+    # Conversions between sparse and dense buffers
+    buffer = dxtbx.format.image.ImageBuffer(image)
+    assert buffer.is_sparse()
+    assert not buffer.is_int()
+    assert not buffer.dense().is_sparse()
+    assert list(buffer.as_double().tile(0).data()) == list(frame.as_double())
+    assert list(buffer.as_sparse_double().tile(0).values()) == [5, 2000, -3]
+    dense = dxtbx.format.image.ImageBuffer(dxtbx.format.image.ImageInt(frame))
+    assert list(dense.as_sparse_int().tile(0).indices()) == [1, 7, 11]
+
+    # Decode the non-zero pixels of a compressed frame directly
+    indices, values = dxtbx.ext.uncompress_sparse(dxtbx.ext.compress(frame), 4, 3)
+    assert list(indices) == [1, 7, 11]
+    assert list(values) == [5, 2000, -3]
+
+    # Read sparse frames through an imageset
+    class Frame(object):
+        def get_raw_data(self):
+            return image
+
+    detector = Detector()
+    panel = detector.add_panel()
+    panel.set_image_size((3, 4))
+    panel.set_trusted_range((-10, 1000))
+    imageset = ImageSet(ImageSetData(MemReader([Frame()]), None))
+    imageset.set_detector(detector)
+    assert list(imageset.get_raw_data(0)[0]) == list(frame)
+    assert imageset.get_raw_sparse_data(0).num_pixels() == 3
+    mask = imageset.get_mask(0)[0]
+    assert mask.count(False) == 1
+    assert not mask[7]
+
+    panel.set_gain(2)
+    corrected = imageset.get_corrected_sparse_data(0).tile(0)
+    assert list(corrected.indices()) == [1, 7, 11]
+    assert list(corrected.values()) == [2.5, 1000, -1.5]
+    assert list(image.tile(0).values()) == [5, 2000, -3]
+
+
 def test_image_buffer():
     data = flex.int(flex.grid(10, 10))
     name = "TileName0"
@@ -566,6 +756,60 @@ def test_pickle_imageset(centroid_files):
     sequence4[0]
 
 
+class _ModelProvider(object):
+    def __init__(self):
+        self.calls = []
+
+    def read_models(self, first, last):
+        self.calls.append((first, last))
+        return [
+            (Beam((0, 0, 1), 1.0 + i // 3), Detector(), None, None)
+            for i in range(first, last)
+        ]
+
+
+def test_model_provider():
+    provider = _ModelProvider()
+    data = ImageSetData(MemReader([None] * 10), None)
+    data.set_model_provider(provider, batch_size=4)
+    imageset = ImageSet(data)
+    assert provider.calls == []
+
+    # Setting a model reads the others first so the provider never replaces it
+    imageset.set_beam(Beam((0, 0, 1), 5.0), 7)
+    imageset.set_detector(None, 8)
+    assert provider.calls == [(7, 10)]
+    assert imageset.get_beam(7).get_wavelength() == 5.0
+    assert imageset.get_detector(8) is None
+    assert imageset.get_detector(7) is not None
+
+    # The models are read for a batch of images on first access only
+    assert imageset.get_beam(1).get_wavelength() == 1.0
+    assert imageset.get_beam(4).get_wavelength() == 2.0
+    assert imageset.get_detector(3) is not None
+    assert imageset.get_goniometer(2) is None
+    assert provider.calls == [(7, 10), (1, 5)]
+    assert imageset.get_scan(5) is None
+    assert imageset.get_beam(6).get_wavelength() == 3.0
+    assert provider.calls == [(7, 10), (1, 5), (5, 9)]
+
+    # Identical models of consecutive images are shared, so changing one in
+    # place changes the others, but setting one replaces it for one image
+    imageset.get_beam(1).set_wavelength(0.5)
+    assert imageset.get_beam(2).get_wavelength() == 0.5
+    assert imageset.get_beam(3).get_wavelength() == 2.0
+    imageset.set_beam(Beam((0, 0, 1), 0.7), 2)
+    assert imageset.get_beam(1).get_wavelength() == 0.5
+
+    # The provider and the images it has read survive pickling
+    imageset2 = pickle.loads(pickle.dumps(imageset))
+    provider2 = imageset2.data().model_provider()
+    assert provider2.calls == provider.calls
+    assert imageset2.get_detector(8) is None
+    assert imageset2.get_beam(0).get_wavelength() == 1.0
+    assert provider2.calls == provider.calls + [(0, 4)]
+
+
 def test_get_corrected_data(centroid_files):
     sequence = ImageSetFactory.new(centroid_files)[0]
 
@@ -586,6 +830,226 @@ def test_get_corrected_data(centroid_files):
     assert flex.mean(data3) == pytest.approx(flex.mean(data2) - 1.0 / 2.0)
 
 
+class _OverlappingReader(object):
+    """A reader whose first reads wait until that many are in progress at once"""
+
+    def __init__(self, reader, parties):
+        self._reader = reader
+        self._parties = parties
+        self._count = 0
+        self._lock = threading.Lock()
+        self._barrier = threading.Barrier(parties, timeout=60)
+
+    def read(self, index):
+        with self._lock:
+            self._count += 1
+            wait = self._count <= self._parties
+        if wait:
+            self._barrier.wait()
+        return self._reader.read(index)
+
+    def __len__(self):
+        return len(self._reader)
+
+    def __getattr__(self, name):
+        return getattr(self._reader, name)
+
+
+def test_concurrent_reads(centroid_files):
+    sequence = ImageSetFactory.new(centroid_files)[0]
+    sequence.get_detector()[0].set_gain(2)
+    expected = [sequence.get_corrected_data(i)[0] for i in range(len(sequence))]
+    masks = [sequence.get_mask(i)[0] for i in range(len(sequence))]
+
+    # With more than one thread the reads release the GIL. The first four
+    # reads are held until all four are in progress, so they run at once, and
+    # more threads read than keep caches, so idle caches are dropped meanwhile
+    imageset = ImageSet(ImageSetData(_OverlappingReader(sequence.reader(), 4), None))
+    imageset.set_num_threads(2)
+    for i in range(len(imageset)):
+        imageset.set_beam(sequence.get_beam(), i)
+        imageset.set_detector(sequence.get_detector(), i)
+
+    def read(i):
+        index = i % len(imageset)
+        data = imageset.get_corrected_data(index)[0]
+        mask = imageset.get_mask(index)[0]
+        return data.all_eq(expected[index]) and mask.all_eq(masks[index])
+
+    with concurrent.futures.ThreadPoolExecutor(max_workers=12) as pool:
+        assert all(pool.map(read, range(4 * len(imageset))))
+
+
+def test_format_instances_of_finished_threads(centroid_files):
+    thread = threading.Thread(target=FormatClass.get_instance, args=centroid_files[:1])
+    thread.start()
+    thread.join()
+    assert (thread.ident, FormatClass) in dxtbx.format.Format._instances
+
+    # The instance of the finished thread is dropped with the next new instance
+    FormatClass.get_instance(centroid_files[1])
+    FormatClass.get_instance(centroid_files[2])
+    assert (thread.ident, FormatClass) not in dxtbx.format.Format._instances
+
+
+def _read_shared_frame(name, key):
+    cache = dxtbx.format.image.SharedFrameCache(name, 1)
+    return cache.get(key).as_int()[0].data()
+
+
+def test_shared_cache(centroid_files):
+    name = "dxtbx_test_%d" % os.getpid()
+    cache = dxtbx.format.image.SharedFrameCache(name, 2 * 2527 * 2463 * 4 + 100)
+    try:
+        sequence = ImageSetFactory.new(centroid_files)[0]
+        expected = [sequence.get_raw_data(i)[0] for i in range(3)]
+
+        sequence.set_shared_cache(cache)
+        sequence.clear_cache()
+        for i in range(3):
+            assert sequence.get_raw_data(i)[0].all_eq(expected[i])
+        # Only the two most recent frames fit in the byte budget
+        assert len(cache) == 2
+        key = cache.frame_key(centroid_files[2], 2)
+        assert key in cache
+        assert cache.frame_key(centroid_files[0], 0) not in cache
+
+        # Another process sees the decoded frame
+        with multiprocessing.Pool(1) as pool:
+            data = pool.apply(_read_shared_frame, (name, key))
+        assert data.all_eq(expected[2])
+
+        # Another imageset reads the frame from the cache
+        other = ImageSetFactory.new(centroid_files)[0]
+        other.set_shared_cache(cache)
+        assert other.get_raw_data(2)[0].all_eq(expected[2])
+        assert other.get_raw_data_for_panels(2, flex.size_t([0]))[0].all_eq(expected[2])
+
+        cache.clear()
+        assert len(cache) == 0
+        assert cache.num_bytes() == 0
+    finally:
+        dxtbx.format.image.SharedFrameCache.remove(name)
+
+
+class _SingleFileReader(MemReader):
+    """An in-memory reader standing in for one multi-image file"""
+
+    def __init__(self, images, path):
+        super().__init__(images)
+        self._path = path
+
+    def paths(self):
+        return [self._path]
+
+    def is_single_file_reader(self):
+        return True
+
+    def master_path(self):
+        return self._path
+
+
+def test_shared_cache_keys(centroid_files):
+    name = "dxtbx_test_keys_%d" % os.getpid()
+    cache = dxtbx.format.image.SharedFrameCache(name, 3 * 2527 * 2463 * 4 + 100)
+    try:
+        images = [FormatClass(path) for path in centroid_files[:3]]
+
+        # The images of a single file reader are keyed on the master file
+        imageset = ImageSet(ImageSetData(_SingleFileReader(images, "master.h5"), None))
+        imageset.set_shared_cache(cache)
+        for i in range(3):
+            assert imageset.get_raw_data(i)[0].all_eq(images[i].get_raw_data())
+        assert all(cache.frame_key("master.h5", i) in cache for i in range(3))
+
+        # Images without a path can not be shared
+        imageset = ImageSet(ImageSetData(MemReader(images), None))
+        with pytest.raises(RuntimeError):
+            imageset.set_shared_cache(cache)
+        assert imageset.shared_cache() is None
+    finally:
+        dxtbx.format.image.SharedFrameCache.remove(name)
+
+
+def test_summed_image_sequence(centroid_files):
+    sequence = ImageSetFactory.new(centroid_files)[0]
+    summed = SummedImageSequence(sequence, 3)
+    assert len(summed) == 3
+
+    # Check the merged scan
+    scan = sequence.get_scan()
+    summed_scan = summed.get_scan()
+    assert summed_scan.get_num_images() == 3
+    assert summed_scan.get_image_range() == (1, 3)
+    assert summed_scan.get_oscillation()[1] == pytest.approx(
+        3 * scan.get_oscillation()[1]
+    )
+    assert summed_scan.get_oscillation_range() == pytest.approx(
+        scan.get_oscillation_range()
+    )
+    assert list(summed_scan.get_exposure_times()) == pytest.approx(
+        [sum(scan.get_exposure_times()[i : i + 3]) for i in (0, 3, 6)]
+    )
+    assert list(summed_scan.get_epochs()) == pytest.approx(
+        [scan.get_epochs()[i] for i in (0, 3, 6)]
+    )
+    assert summed.get_scan(1).get_image_range() == (2, 2)
+
+    # Check the data is the sum of the raw images
+    data = summed.get_raw_data(1)[0]
+    expected = sequence.get_raw_data(3)[0].deep_copy()
+    for i in (4, 5):
+        expected += sequence.get_raw_data(i)[0]
+    assert data.all_eq(expected)
+
+    # Check the mask is the intersection of the raw masks
+    mask = summed.get_mask(1)[0]
+    expected = (
+        sequence.get_mask(3)[0] & sequence.get_mask(4)[0] & sequence.get_mask(5)[0]
+    )
+    assert mask.all_eq(expected)
+
+    # Check slicing and pickling
+    partial = summed[1:3]
+    assert isinstance(partial, SummedImageSequence)
+    assert len(partial) == 2
+    assert partial.get_raw_data(0)[0].all_eq(data)
+    summed2 = pickle.loads(pickle.dumps(summed))
+    assert summed2.get_block_size() == 3
+    assert summed2.get_scan() == summed.get_scan()
+    assert summed2.get_raw_data(1)[0].all_eq(data)
+
+    with pytest.raises(RuntimeError):
+        SummedImageSequence(sequence, 2)
+
+
+def test_binned_raw_data(centroid_files):
+    sequence = ImageSetFactory.new(centroid_files)[0]
+    detector = sequence.get_detector().binned(2)
+    data = sequence.get_raw_data(0)[0]
+    mask = sequence.get_mask(0)[0]
+    binned = sequence.get_binned_raw_data(0, 2)[0]
+    binned_mask = sequence.get_binned_mask(0, 2)[0]
+    assert binned.all() == tuple(reversed(detector[0].get_image_size()))
+    assert binned_mask.all() == binned.all()
+
+    # Check a block against the raw data
+    for j, i in ((0, 0), (100, 200), (200, 100)):
+        values = [
+            data[2 * j + dj, 2 * i + di]
+            for dj in (0, 1)
+            for di in (0, 1)
+            if mask[2 * j + dj, 2 * i + di]
+        ]
+        assert binned_mask[j, i] == bool(values)
+        if values:
+            assert binned[j, i] == round(sum(values) * 4 / len(values))
+
+    # Blocks without any valid pixels are outside the trusted range
+    invalid = binned.as_1d().select((~binned_mask).as_1d())
+    assert invalid.all_le(int(detector[0].get_trusted_range()[0]))
+
+
 def test_multi_panel_gain_map(dials_data):
     pytest.importorskip("h5py")
     filename = os.path.join(
@@ -605,6 +1069,309 @@ def test_multi_panel_gain_map(dials_data):
     iset.reader().nullify_format_instance()
 
 
+def test_image_assembler(centroid_files):
+    # Two 10x5 pixel panels side by side with a gap of two pixels
+    detector = Detector()
+    for x in (0, 1.2):
+        panel = detector.add_panel()
+        panel.set_frame((1, 0, 0), (0, -1, 0), (x, 0, -100))
+        panel.set_image_size((10, 5))
+        panel.set_pixel_size((0.1, 0.1))
+    data = (flex.double(range(50)), flex.double(range(100, 150)))
+    mask = (flex.bool(50, True), flex.bool(50, True))
+    for d, m in zip(data, mask):
+        d.reshape(flex.grid(5, 10))
+        m.reshape(flex.grid(5, 10))
+    mask[1][2, 3] = False
+
+    assembler = ImageAssembler(detector)
+    assert assembler.get_image_size() == (22, 5)
+    assert assembler.get_pixel_size() == pytest.approx(0.1)
+    assert assembler.num_covered() == 100
+    assert assembler.panel_to_image(1, (0, 0)) == pytest.approx((12, 0))
+    assert list(assembler.coverage())[:22] == [0] * 10 + [-1, -1] + [1] * 10
+
+    image = assembler.assemble(data, mask, gap_value=-1)
+    assert image.all() == (5, 22)
+    assert image[0:5, 0:10].all_eq(data[0])
+    assert image[0:5, 10:12].all_eq(-1)
+    assert image[2, 15] == -1
+    assert image[3, 15] == data[1][3, 3]
+    assert assembler.assemble(data, mask, gap_value=-1, num_threads=2).all_eq(image)
+    assert list(assembler.assemble_mask(mask)) == list(image != -1)
+
+    # Bilinear interpolation of a constant image
+    assembler = ImageAssembler(detector, pixel_size=0.05, interpolation="bilinear")
+    assert assembler.get_image_size() == (44, 10)
+    image = assembler.assemble(tuple(d * 0 + 7 for d in data), gap_value=0)
+    assert image.count(0) == 4 * 10
+    assert image.as_1d().select(image.as_1d() != 0).all_eq(7)
+
+    # A single panel detector assembles to the raw image
+    sequence = ImageSetFactory.new(centroid_files)[0]
+    assembler = ImageAssembler(sequence.get_detector())
+    raw = sequence.get_raw_data(0)[0].as_double()
+    valid = sequence.get_mask(0)[0].as_1d()
+    image = sequence.get_assembled_data(0, assembler, gap_value=-1)
+    assert image.all() == raw.all()
+    assert image.as_1d().select(valid).all_eq(raw.as_1d().select(valid))
+    assert image.as_1d().select(~valid).all_eq(-1)
+
+
+def test_image_pyramid(centroid_files, tmp_path):
+    sequence = ImageSetFactory.new(centroid_files)[0]
+    data = sequence.get_raw_data(0)[0]
+    mask = sequence.get_mask(0)[0]
+    ysize, xsize = data.all()
+
+    pyramid = sequence.get_pyramid(0, num_levels=3, pooling="max")
+    assert len(pyramid) == 3
+    level = pyramid.level(0)[0]
+    assert level.all() == ((ysize + 1) // 2, (xsize + 1) // 2)
+    block = data[100:102, 200:202]
+    block_mask = mask[100:102, 200:202]
+    assert level[50, 100] == flex.max(block.select(block_mask.as_1d()))
+    assert pyramid.level(2)[0].all() == ((ysize + 7) // 8, (xsize + 7) // 8)
+
+    # Mean pooling gives the mean of the valid full resolution pixels
+    pyramid = sequence.get_pyramid(0, num_levels=2, pooling="mean")
+    valid = data.as_double().select(mask.as_1d())
+    total = flex.sum(pyramid.level(1)[0] * pyramid.count(1)[0])
+    assert total == pytest.approx(flex.sum(valid))
+    assert pyramid.mask(1)[0].count(True) > 0
+    with pytest.raises(Exception):
+        sequence.get_pyramid(0, pooling="median")
+
+    # The coarse levels are cached on disk
+    cache = PyramidCache(str(tmp_path), sequence, num_levels=3, first_level=1)
+    assert cache.levels() == [1, 2]
+    assert 1 not in cache
+    level = cache.get(1, 2)[0]
+    assert 1 in cache and len(cache) == 1
+    expected = sequence.get_pyramid(1, num_levels=3).level(2)[0].as_numpy_array()
+    valid = ~np.isnan(level)
+    assert valid.any()
+    assert np.array_equal(level[valid], expected[valid])
+    with pytest.raises(IndexError):
+        cache.get(1, 0)
+    cache = PyramidCache(str(tmp_path), sequence, num_levels=3, first_level=1)
+    assert 1 in cache
+    cache = PyramidCache(str(tmp_path), sequence, num_levels=3, pooling="mean")
+    assert 1 not in cache
+
+
+def test_pixel_histogram(centroid_files):
+    sequence = ImageSetFactory.new(centroid_files)[0]
+    histogram = dxtbx.format.image.PixelHistogram(20, 0, 20)
+    sequence.accumulate_histogram(histogram, 0, 3, num_threads=2)
+    assert histogram.num_images() == 3
+    assert histogram.num_panels() == 1
+    assert list(histogram.edges()) == list(range(21))
+
+    data = np.concatenate(
+        [
+            sequence.get_raw_data(i)[0].as_numpy_array()[
+                sequence.get_mask(i)[0].as_numpy_array()
+            ]
+            for i in range(3)
+        ]
+    )
+    in_range = data[(data >= 0) & (data < 20)]
+    assert list(histogram.counts(0)) == list(np.bincount(in_range, minlength=20))
+    assert histogram.underflow(0) == (data < 0).sum()
+    assert histogram.overflow(0) == (data >= 20).sum()
+    assert histogram.num_valid(0) == data.size
+    assert histogram.num_valid(0) + histogram.num_masked(0) == 3 * len(
+        sequence.get_raw_data(0)[0]
+    )
+    assert histogram.mean(0) == pytest.approx(data.mean())
+    assert histogram.minimum(0) == data.min()
+    assert histogram.maximum(0) == data.max()
+    assert abs(histogram.quantile(0, 0.5) - np.median(data)) <= 1
+
+    # Histograms of parts of the sequence can be merged
+    merged = dxtbx.format.image.PixelHistogram(20, 0, 20)
+    sequence.accumulate_histogram(merged, 0, 2)
+    rest = dxtbx.format.image.PixelHistogram(20, 0, 20)
+    sequence.accumulate_histogram(rest, 2, 3)
+    merged.merge(rest)
+    assert merged.num_images() == 3
+    assert list(merged.counts(0)) == list(histogram.counts(0))
+    assert merged.mean(0) == pytest.approx(histogram.mean(0))
+
+    # Logarithmic bins counted per pixel
+    image = flex.double(range(100)) + 0.5
+    image.reshape(flex.grid(10, 10))
+    mask = flex.bool(100, True)
+    mask[0] = False
+    mask.reshape(flex.grid(10, 10))
+    histogram = dxtbx.format.image.PixelHistogram(
+        2, 1, 100, logarithmic=True, per_pixel=True
+    )
+    histogram.add_image(
+        dxtbx.format.image.ImageDouble(image), dxtbx.format.image.ImageBool(mask)
+    )
+    assert list(histogram.edges()) == pytest.approx([1, 10, 100])
+    assert list(histogram.counts(0)) == [9, 90]
+    assert histogram.underflow(0) == 0
+    assert histogram.num_masked(0) == 1
+    pixel_counts = histogram.pixel_counts(0)
+    assert pixel_counts.all() == (100, 2)
+    assert list(pixel_counts[0:2, :]) == [0, 0, 1, 0]
+    assert list(pixel_counts[9:11, :]) == [1, 0, 0, 1]
+    assert histogram.quantile(0, 0.05) == pytest.approx(10 ** (4.95 / 9))
+
+
+def test_geometric_correction(centroid_files):
+    sequence = ImageSetFactory.new(centroid_files)[0]
+    detector = sequence.get_detector()
+    beam = sequence.get_beam()
+    panel = detector[0]
+
+    correction = sequence.get_geometric_correction(0)[0]
+    solid_angle = panel.get_solid_angle_array()
+    solid_angle /= flex.max(solid_angle)
+    polarization = panel.get_polarization_array(
+        beam.get_s0(),
+        beam.get_polarization_normal(),
+        beam.get_polarization_fraction(),
+    )
+    obliquity = panel.get_obliquity_array()
+    expected = solid_angle * polarization * obliquity
+    assert correction.all() == expected.all()
+    assert flex.max(flex.abs(correction - expected)) < 1e-3
+
+    # Applied in the same pass as gain and pedestal
+    data = sequence.get_corrected_data(0)[0]
+    corrected = sequence.get_corrected_data(
+        0, solid_angle=True, polarization=True, obliquity=True
+    )[0]
+    assert flex.max(flex.abs(corrected - data / correction)) < 1e-6
+    corrected = sequence.get_corrected_data(0, polarization=True)[0]
+    polarization = sequence.get_geometric_correction(
+        0, solid_angle=False, polarization=True, obliquity=False
+    )[0]
+    assert flex.max(flex.abs(corrected - data / polarization)) < 1e-6
+
+    # The cached correction follows changes to the geometry. Compare with the
+    # closed form for a beam polarized with a fraction f of the electric field
+    # in the polarization plane: f (1 - (p.e)^2) + (1 - f) (1 - (p.n)^2)
+    for fraction in (0.5, 0.9):
+        beam.set_polarization_fraction(fraction)
+        sequence.set_beam(beam)
+        polarization = sequence.get_geometric_correction(
+            0, solid_angle=False, polarization=True, obliquity=False
+        )[0]
+        s0 = matrix.col(beam.get_s0()).normalize()
+        n = matrix.col(beam.get_polarization_normal()).normalize()
+        e = n.cross(s0).normalize()
+        for j, i in ((0, 0), (1000, 300), (2500, 2400), (1263, 1231)):
+            p = matrix.col(panel.get_pixel_lab_coord((i + 0.5, j + 0.5))).normalize()
+            expected = fraction * (1 - p.dot(e) ** 2) + (1 - fraction) * (
+                1 - p.dot(n) ** 2
+            )
+            assert polarization[j, i] == pytest.approx(expected)
+
+
+def test_find_bad_pixels(centroid_files):
+    sequence = ImageSetFactory.new(centroid_files)[0]
+    finder = find_bad_pixels(sequence, min_images=5)
+    assert finder.num_images() == len(sequence)
+    bad_pixel_mask = finder.mask()
+    assert len(bad_pixel_mask) == len(sequence.get_detector())
+
+    # Pixels in the static mask are never observed, but the trusted range is
+    # not applied so untrusted pixels still are
+    static_mask = sequence.get_static_mask()[0]
+    num_observed = finder.num_observed()[0]
+    assert num_observed.select((~static_mask).as_1d()).all_eq(0)
+    mask = sequence.get_mask(0)[0]
+    assert num_observed.select((static_mask & ~mask).as_1d()).count(0) == 0
+
+    # The bad pixels are added to the imageset mask
+    bad = flex.bool(mask.accessor(), True)
+    bad[10, 20] = False
+    apply_bad_pixel_mask(sequence, (bad_pixel_mask[0] & bad,))
+    new_mask = sequence.get_mask(0)[0]
+    assert not new_mask[10, 20]
+    assert (new_mask & ~mask).count(True) == 0
+
+
+def test_raw_data_for_panels(dials_data):
+    pytest.importorskip("h5py")
+    filename = os.path.join(
+        dials_data("image_examples"),
+        "SACLA-MPCCD-run266702-0-subset.h5",
+    )
+
+    format_class = dxtbx.format.Registry.get_format_class_for_file(filename)
+    iset = format_class.get_imageset([filename])
+    panels = flex.size_t([3, 1])
+
+    # Read before the full image is cached and after
+    subset = iset.get_raw_data_for_panels(0, panels)
+    data = iset.get_raw_data(0)
+    assert len(subset) == 2
+    for panel, tile in zip(panels, subset):
+        assert tile.all() == data[panel].all()
+        assert tile.all_eq(data[panel])
+    cached = iset.get_raw_data_for_panels(0, panels)
+    for tile1, tile2 in zip(subset, cached):
+        assert tile1.all_eq(tile2)
+
+    with pytest.raises(Exception):
+        iset.get_raw_data_for_panels(1, flex.size_t([len(data)]))
+
+    iset.reader().nullify_format_instance()
+
+
+def test_mem_reader_panels():
+    class Frame(object):
+        def get_raw_data(self):
+            return (flex.int(flex.grid(2, 3), 1), flex.int(flex.grid(2, 3), 2))
+
+    reader = MemReader([Frame()])
+    subset = reader.read_panels(0, [1])
+    assert len(subset) == 1
+    assert subset[0].all_eq(2)
+    iset = ImageSet(ImageSetData(reader, None))
+    assert iset.get_raw_data_for_panels(0, flex.size_t([1, 0]))[1].all_eq(1)
+
+
+def test_parallel_panels(dials_data):
+    pytest.importorskip("h5py")
+    filename = os.path.join(
+        dials_data("image_examples"),
+        "SACLA-MPCCD-run266702-0-subset.h5",
+    )
+
+    format_class = dxtbx.format.Registry.get_format_class_for_file(filename)
+    iset = format_class.get_imageset([filename])
+    assert iset.num_threads() == 1
+    data = iset.get_corrected_data(0, solid_angle=True)
+    mask = iset.get_mask(0)
+
+    iset.set_num_threads(4)
+    iset.clear_cache()
+    assert iset.num_threads() == 4
+    for tile1, tile2 in zip(data, iset.get_corrected_data(0, solid_angle=True)):
+        assert tile1.all_eq(tile2)
+    for tile1, tile2 in zip(mask, iset.get_mask(0)):
+        assert tile1.all_eq(tile2)
+
+    # Errors in a worker thread are raised in the caller
+    gain = tuple(flex.double(tile.accessor(), 1) for tile in data)
+    gain[-1][0] = 0
+    iset.external_lookup.gain.data = dxtbx.format.image.ImageDouble(gain)
+    with pytest.raises(RuntimeError):
+        iset.get_corrected_data(0)
+
+    with pytest.raises(Exception):
+        iset.set_num_threads(0)
+
+    iset.reader().nullify_format_instance()
+
+
 @pytest.mark.parametrize(
     "multi_panel,expected_panel_count",
     (